@@ -0,0 +1,1071 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  A low-level low-latency thread-safe software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the software fifo template class itself, together with the status codes returned
+//  by its functions.
+//
+//  The status codes are a one byte enum class, FifoStatus, with the original FIFO_STATUS_... names kept as
+//  constants of that type. fifoStatusName() gives the name of one for logging. The functions that return a
+//  status are marked FIFO_NODISCARD, so that a status dropped by mistake is a compiler warning, and the tests
+//  on their hot paths are marked FIFO_LIKELY() or FIFO_UNLIKELY() so that success is the straight-line path.
+//
+//  push_try() takes the item by rvalue reference - it is moved into the FIFO if there is room, and left with
+//  the caller (moved back, if need be) if not, so a caller retrying a push doesn't have to copy or rebuild it.
+//  push_retry() does the retrying itself, backing off between attempts, for as long as the FIFO is only busy
+//  and within a budget of attempts or time (see "Retrying a push" in FifoLock.h).
+//
+//  It is shared by the Windows Console Apps in this project, notably;
+//
+//  Software_Fifo_Exercise_Win.cpp - the (very) basic single-threaded test rig
+//  Fifo_Benchmark_Win.cpp         - the multi-threaded load generator and benchmark harness
+//
+//  See Software_Fifo_Exercise_Win.cpp for the design brief, the design considerations and a description
+//  of how the fifo works.
+//
+//  Optional instrumentation (see FifoStats.h) is compiled in by defining the relevant FIFO_INSTRUMENT_...
+//  macro as 1. When none are defined the fifo compiles to exactly the plain class.
+//
+//  Static tracepoints (see FifoTrace.h) are compiled in unless FIFO_TRACING is defined as 0. They cost next
+//  to nothing unless a trace session is listening.
+//
+//  How the reader thread sleeps in pop() while the FIFO is empty, and is woken by push(), is the third
+//  template parameter (see FifoWait.h). The default is the Windows Event.
+//
+//  How the items are held is the fourth template parameter (see FifoStorage.h). By default small trivially
+//  copyable types are held in an ordinary array, and bigger ones in a slab alongside a ring of slab slot
+//  numbers, so that they are copied in and out without holding the mutex.
+//
+//  The mutex that protects the ring is the fifth template parameter (see FifoLock.h). The default is the
+//  Windows Critical Section, which a writer thread gives up on at once if it is held (push() returns
+//  FIFO_STATUS_LOCKED). With one of the spinlocks writer threads wait their turn instead.
+//
+//  The reader thread can be told to prefetch items a given distance ahead of the one it is popping (see
+//  setPrefetchDistance() below, and "Prefetching" in FifoStorage.h). By default it doesn't.
+//
+//  The reader thread can also be told to hand the ring positions it has popped back to the writer threads a
+//  few at a time (see setReleaseInterval() below, and "Handing positions back"). By default it hands each
+//  one back as it pops it.
+//
+//  push_batch(), pop_try_batch() and pop_batch() move a run of items in or out with a single acquisition of
+//  the mutex, copying them in bulk (see FifoCopy.h). They need the items to be held inline.
+//
+//  A writer thread that pushes a lot can do so through a producer handle (see FifoProducer.h), which is
+//  promised room for a chunk of items at a time and publishes each chunk with a single acquisition of the
+//  mutex.
+//
+//  A Fifo constructed with a name is listed in the process-wide registry of fifos (see FifoMetrics.h), from
+//  which its metrics can be exported in Prometheus text format (see FifoMetricsExporter.h).
+//
+//  The settings - the template parameters and the FIFO_... macros - are checked at compile time (see FifoConfig
+//  below, and the static_asserts following each group of macros), so that a combination that can't work, or
+//  would only work slowly, fails to compile rather than being found out in production.
+//
+//  When FIFO_MODEL_CHECK is defined as 1 the fifo's calls to Windows synchronisation functions are redirected
+//  to the schedule exploration stand-ins in FifoModel.h, and each FIFO_SCHEDULE_POINT() below marks a place
+//  where the model checker may switch threads. Otherwise FIFO_SCHEDULE_POINT() compiles to nothing.
+//
+//
+//  The reader and the mutex
+//  ========================
+//
+//  Only writer threads take the mutex - it keeps them from pushing into the same ring position. The reader
+//  thread never does; the insertion index belongs to the writers and the extraction index to the reader, and
+//  the population is the only thing they share;
+//
+//  - a writer stores its item, then adds one to the population (an interlocked add - a release). The reader
+//    only takes the item after reading a non-zero population and an acquire fence, so it sees the item as
+//    the writer left it.
+//  - the reader reads the item out, then subtracts one from the population (again an interlocked add). A
+//    writer only stores into that position after reading a population below the capacity and an acquire
+//    fence, so the reader is done with it by then.
+//
+//  Writers only ever add to the population and the reader only ever subtracts from it, so a writer that
+//  finds room still has it, and the reader that finds an item still has that. The reader therefore never
+//  stalls behind a writer holding the mutex - or behind one pre-empted while holding it.
+//
+//
+//  Handing positions back
+//  ======================
+//
+//  Each interlocked subtract by the reader takes the cache line holding the population away from the writer
+//  threads, which need it for their next push. setReleaseInterval() lets the reader pop several items and
+//  then hand all their positions back with one subtract. Until then the popped items are still counted in
+//  the population, so the reader keeps its own count of them ("unreleased") and only takes the items beyond
+//  it. The positions are handed back at once, whatever the interval;
+//
+//  - when the reader has taken every item it can see - so an empty FIFO always has a population of 0, which
+//    is what the wait strategies and the writers' wake-ups depend on
+//  - when the population (with the room promised to producer handles) is at or above the fullness
+//    threshold - so that writers filling the FIFO get the room back as soon as they could run short of it
+//
+//  So at most interval - 1 popped positions are ever held back, and a writer can only be told
+//  FIFO_STATUS_FULL (or PREEMPTED) while that many are in fact free until the reader's next pop.
+//
+//
+
+
+#pragma once
+
+
+#include <windows.h>		// For InterlockedExchangeAdd()
+#include <string>		// For the string class
+
+
+
+constexpr unsigned FIFO_EXAMPLE_MAX_CAPACITY = 5;
+
+// What push(), pop_try() and the batch functions return. A type of its own, so that it can't be mixed up with
+// a count or an index, and one byte, so that it comes back in a register with room to spare.
+enum class FifoStatus : unsigned char {
+	Success,
+	Full,
+	Empty,
+	Locked,
+	Preempted
+};
+
+constexpr unsigned FIFO_STATUS_COUNT = 5;	// Number of status codes above
+
+// The original names of the status codes
+constexpr FifoStatus FIFO_STATUS_SUCCESS = FifoStatus::Success;
+constexpr FifoStatus FIFO_STATUS_FULL = FifoStatus::Full;
+constexpr FifoStatus FIFO_STATUS_EMPTY = FifoStatus::Empty;
+constexpr FifoStatus FIFO_STATUS_LOCKED = FifoStatus::Locked;
+constexpr FifoStatus FIFO_STATUS_PREEMPTED = FifoStatus::Preempted;
+
+
+// The name of a status code (e.g. "FIFO_STATUS_FULL") for logging - straight from a table of constant strings,
+// with nothing constructed or copied
+inline const char* fifoStatusName(FifoStatus status) {
+
+	static const char* const names[FIFO_STATUS_COUNT] = {
+		"FIFO_STATUS_SUCCESS",
+		"FIFO_STATUS_FULL",
+		"FIFO_STATUS_EMPTY",
+		"FIFO_STATUS_LOCKED",
+		"FIFO_STATUS_PREEMPTED"
+	};
+	return (unsigned) status < FIFO_STATUS_COUNT ? names[(unsigned) status] : "FIFO_STATUS_UNKNOWN";
+}
+
+
+// [[nodiscard]] where the compiler has it (C++17), otherwise the nearest equivalent
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define FIFO_NODISCARD			[[nodiscard]]
+#elif defined(_MSC_VER)
+#define FIFO_NODISCARD			_Check_return_
+#elif defined(__GNUC__)
+#define FIFO_NODISCARD			__attribute__((warn_unused_result))
+#else
+#define FIFO_NODISCARD
+#endif
+
+// Which way a test usually goes, so that the compiler lays out the usual way as the straight-line path. C++20's
+// [[likely]] and [[unlikely]] mark statements rather than conditions, and Visual Studio has no counterpart of
+// __builtin_expect(), so there these leave the condition as it is.
+#if defined(__GNUC__)
+#define FIFO_LIKELY(condition)		__builtin_expect(!!(condition), 1)
+#define FIFO_UNLIKELY(condition)	__builtin_expect(!!(condition), 0)
+#else
+#define FIFO_LIKELY(condition)		(condition)
+#define FIFO_UNLIKELY(condition)	(condition)
+#endif
+
+#ifndef FIFO_PREFETCH_DISTANCE
+#define FIFO_PREFETCH_DISTANCE		((unsigned) 0)	// Ring positions ahead that pop() prefetches (0 - none)
+#endif
+
+#ifndef FIFO_RELEASE_INTERVAL
+#define FIFO_RELEASE_INTERVAL		((unsigned) 1)	// Pops whose ring positions are handed back together (1 - each at once)
+#endif
+
+#ifndef FIFO_RELEASE_FULL_PERCENT
+#define FIFO_RELEASE_FULL_PERCENT	((unsigned) 75)	// Population, as a percentage of the capacity, at which each pop hands its position back at once
+#endif
+
+static_assert(FIFO_RELEASE_INTERVAL >= 1, "FIFO_RELEASE_INTERVAL must be at least 1 - 1 hands each position back as it is popped");
+static_assert(FIFO_RELEASE_FULL_PERCENT <= 100, "FIFO_RELEASE_FULL_PERCENT is a percentage of the capacity");
+
+
+#ifndef FIFO_MODEL_CHECK
+#define FIFO_MODEL_CHECK	0
+#endif
+
+#if FIFO_MODEL_CHECK
+#include "FifoModel.h"		// Schedule exploration stand-ins for the Windows synchronisation calls
+#else
+#define FIFO_SCHEDULE_POINT(label)
+#endif
+
+#include "FifoStats.h"		// Optional instrumentation (uses the status codes above)
+#include "FifoTrace.h"		// Static tracepoints
+#include "FifoMetrics.h"		// Registry of named fifos and their metrics
+#include "FifoWait.h"		// Reader thread wait strategies
+#include "FifoStorage.h"		// Inline and slab item storage
+#include "FifoLock.h"		// Mutex policies (after FifoModel.h, for the Critical Section stand-ins)
+
+#include <atomic>		// For handing out Fifo ids
+#include <climits>		// For UINT_MAX and USHRT_MAX
+#include <type_traits>		// For std::is_same and std::conditional
+#include <utility>		// For std::move and std::forward
+
+
+
+
+// Hands out the ids that identify fifos in tracepoints. Not a member of Fifo - a static there would be one per
+// specialisation, so a Fifo<int, 5> and a Fifo<Work, 64> would both be fifo 0. An inline function's static is
+// one for the whole process.
+inline unsigned fifoNextId(void) {
+
+	static std::atomic<unsigned> nextId(0);
+	return nextId.fetch_add(1);
+}
+
+
+
+
+// What follows from a Fifo's item type and capacity, worked out (and checked) at compile time
+template <class T, unsigned capacity>
+struct FifoConfig {
+
+	static_assert(capacity >= 1, "A Fifo needs a capacity of at least 1");
+
+	// Otherwise pop() would never find that many items ahead of it, and would never prefetch
+	static_assert(FIFO_PREFETCH_DISTANCE < capacity, "FIFO_PREFETCH_DISTANCE must be less than the capacity");
+
+	static constexpr unsigned positions = capacity;
+	// A power of two capacity lets advance() wrap with a mask rather than a compare (BaselineVyukovQueue insists on one)
+	static constexpr bool powerOfTwo = (capacity & (capacity - 1)) == 0;
+
+	// What the insertion and extraction indices are kept in - the narrowest type that holds every ring position.
+	// 16 bits for a capacity of up to 65536, otherwise 32.
+	typedef typename std::conditional<(capacity - 1 <= USHRT_MAX), unsigned short, unsigned>::type Position;
+
+	// Wide enough to count ring positions up to twice the capacity - so that an index plus a number of positions
+	// can't overflow while advance() works it out. Only a capacity of more than 2^31 needs more than 32 bits.
+	typedef typename std::conditional<(2ULL * capacity - 1 <= UINT_MAX), unsigned, unsigned long long>::type Index;
+
+	// The ring position 'count' (no more than the capacity) on from 'index'. A compare and subtract - no division,
+	// whatever the capacity - or, for a power of two capacity, just a mask. 'next' is under twice the capacity, so
+	// masking off the capacity bit is the same subtract without the branch.
+	static Position advance(unsigned index, unsigned count) {
+		Index next = (Index) index + count;
+		if (powerOfTwo) return (Position) (next & (capacity - 1));
+		return (Position) (next >= capacity ? next - capacity : next);
+	}
+};
+
+
+
+
+template <class FifoType, unsigned chunkSize> class FifoProducer;	// See FifoProducer.h
+
+
+
+
+template <class T, unsigned capacity = FIFO_EXAMPLE_MAX_CAPACITY, class WaitPolicy = FifoEventWait,
+	class Storage = typename FifoStorageFor<T, capacity>::type, class LockPolicy = FifoCriticalSectionLock>
+class Fifo {
+
+	template <class FifoType, unsigned chunkSize> friend class FifoProducer;
+
+	typedef FifoConfig<T, capacity> Config;
+	typedef T Item;
+	typedef Storage ItemStorage;
+
+	// A storage given explicitly must be for the same item type and capacity - otherwise the ring indices would run
+	// off the end of it
+	static_assert(std::is_same<typename Storage::Item, T>::value, "Fifo storage must hold items of type T");
+	static_assert(Storage::positions == Config::positions, "Fifo storage must have the same capacity as the Fifo");
+
+	WaitPolicy waiter;	    // Puts the reader thread to sleep while the FIFO is empty, and wakes it up again
+	LockPolicy mutex;	    // The "mutex" protects the insertion side of the ring from simultaneous writer thread assault (see FifoLock.h)
+
+private:
+
+	Storage storage;	    // The FIFO is implemented as a ring of capacity positions - held inline or in a slab (see FifoStorage.h)
+
+	typename Config::Position InsertionIndex, ExtractionIndex;  // Ring insertion and extraction indices
+
+	volatile unsigned population;  // Current population of the ring
+
+	volatile unsigned reserved;	// Ring positions promised to producer handles (see FifoProducer.h) - changed under the mutex
+
+	unsigned prefetchDistance;	// Ring positions ahead of the extraction index that pop() prefetches (0 - none)
+
+	unsigned unreleased;		// Items popped whose ring positions are still counted in the population - reader thread only
+	unsigned releaseInterval;	// Most pops before their positions are handed back (see "Handing positions back" above)
+	unsigned releaseFull;		// Population at or above which each pop hands its position back at once
+	unsigned long long releases;	// Times the reader thread has handed positions back
+
+	unsigned id;			// Identifies this Fifo in tracepoints - unique within the process
+	bool registered;		// Listed in the FifoRegistry - only if constructed with a name
+
+#if FIFO_INSTRUMENT_LATENCY
+	unsigned long long pushTicks[capacity];  // Time-stamp counter at push() of the item at the same ring position
+	FifoHistogram latency;			 // Time spent in the FIFO by each popped item
+#endif
+
+#if FIFO_INSTRUMENT_COUNTERS
+	FifoOutcomeCounters outcomes;		 // Number of push(), pop() and pop_try() calls by result
+#endif
+
+#if FIFO_INSTRUMENT_OCCUPANCY
+	FifoOccupancy occupancy;		 // Population as seen by the reader thread each time it pops
+#endif
+
+#if FIFO_INSTRUMENT_LOCKS
+	FifoLockProfile lockProfile;		 // Waits for and holds of the mutex by writer threads
+	unsigned long long lockedTicks;		 // Time-stamp counter when the mutex was last acquired
+#endif
+
+
+public:
+
+	Fifo() : InsertionIndex(0), ExtractionIndex(0), population(0), reserved(0), prefetchDistance(FIFO_PREFETCH_DISTANCE),
+		unreleased(0), releaseInterval(FIFO_RELEASE_INTERVAL), releaseFull(fullPositions(FIFO_RELEASE_FULL_PERCENT)), releases(0),
+		registered(false)
+#if FIFO_INSTRUMENT_LOCKS
+		, lockedTicks(0)
+#endif
+	{
+
+		id = fifoNextId();
+		FIFO_TRACE_REGISTER();
+	}
+
+
+	// A Fifo with a name is added to the FifoRegistry (see FifoMetrics.h) once it is fully constructed, so that
+	// its metrics can be exported under that name. This costs push() and pop() nothing.
+	explicit Fifo(const std::string& name) : Fifo() {
+
+		FifoRegistry::instance().add(name, this, &Fifo::collectMetrics);
+		registered = true;
+	}
+
+
+	~Fifo() {
+
+		// Leave the registry first - no metrics can be being collected from this Fifo once this returns
+		if (registered) FifoRegistry::instance().remove(this);
+	}
+
+
+	FIFO_NODISCARD FifoStatus push(const T& item) {
+
+		//	- push
+		//	A "writer thread" calls this function to push an item into the queue.
+		//	If there is no room in the queue for the item, this function should return immediately indicating
+		//	to the calling thread that the item was not pushed to the queue.
+		//
+		//	This function may be called from multiple threads ("writer threads")
+		//
+
+		return pushItem(item, nullptr);
+	}
+
+
+	FIFO_NODISCARD FifoStatus push_try(T&& item) {
+
+		//	- push_try
+		//	A "writer thread" calls this function to push an item into the queue, moving it in rather than
+		//	copying it. Returns the same as push(). If the item isn't pushed it is left with the caller -
+		//	untouched, or moved back again - ready for the next attempt, e.g.
+		//
+		//		while (fifo.push_try(std::move(work)) != FIFO_STATUS_SUCCESS) YieldProcessor();
+		//
+		//	This function may be called from multiple threads ("writer threads")
+		//
+
+		return pushItem(std::move(item), &item);
+	}
+
+
+	FIFO_NODISCARD FifoStatus push_retry(const T& item, const FifoRetryBudget& budget) {
+
+		//	- push_retry
+		//	A "writer thread" calls this function to push an item into the queue, trying again - after a
+		//	randomised, growing pause - for as long as the FIFO is only busy (FIFO_STATUS_LOCKED - the mutex
+		//	was held, or with a slab no slot was free) and the budget allows, e.g. up to 64 attempts within 100
+		//	microseconds;
+		//
+		//		status = fifo.push_retry(work, FifoRetryBudget{64, 100});
+		//
+		//	Returns FIFO_STATUS_FULL or FIFO_STATUS_PREEMPTED at once if the FIFO is truly full (PREEMPTED is
+		//	found full with the mutex held, so a pause would only end in FULL), otherwise the result of the last
+		//	attempt - FIFO_STATUS_LOCKED if the budget ran out first.
+		//
+		//	This function may be called from multiple threads ("writer threads")
+		//
+
+		FifoStatus status = pushItem(item, nullptr);
+		if (FIFO_LIKELY(status != FIFO_STATUS_LOCKED)) return status;
+
+		FifoRetryBackoff backoff(budget);
+		while (backoff.pause()) {
+			status = pushItem(item, nullptr);
+			if (FIFO_LIKELY(status != FIFO_STATUS_LOCKED)) return status;
+		}
+		return status;
+	}
+
+
+	FIFO_NODISCARD FifoStatus pop_try(T* itemPtr) {
+
+		//	- pop_try
+		//	The "reader thread" calls this function to fetch the next available item.
+		//	If no items are available the function should return immediately indicating this condition to the
+		//	calling thread.
+		//
+		//	This function is only ever called from a single thread (the "reader thread")
+		//
+
+		// If no items in the FIFO return appropriate status code immediately
+		FIFO_SCHEDULE_POINT("pop_try: empty test");
+		if (FIFO_UNLIKELY(population == 0)) return popOutcome(FIFO_STATUS_EMPTY);
+
+		// Data items are available in the FIFO...
+		// No mutex is needed to take one (see "The reader and the mutex" above) - but the item must be read as
+		// the writer left it, after the population that counted it in
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// Obtain the item at the current extraction position (with a slab, just its slot number - the item is
+		// copied out once the ring position has been handed back)
+		unsigned taken = storage.take(ExtractionIndex, itemPtr);
+		prefetchAhead();
+		recordLatency(ExtractionIndex);
+		recordOccupancy(1);
+		// Bump extraction position
+		ExtractionIndex = Config::advance(ExtractionIndex, 1);
+
+		// Hand the ring position back to the writer threads - now, or with those of the next few pops
+		unreleased++;
+		if (releaseDue()) {
+			FIFO_SCHEDULE_POINT("pop_try: population release");
+			releaseTaken();
+		}
+
+		storage.finish(taken, itemPtr);
+
+		// Return success
+		return popOutcome(FIFO_STATUS_SUCCESS);
+	}
+
+
+	void pop(T* itemPtr) {
+
+		//	- pop
+		//	The "reader thread" calls this function to fetch the next available item.
+		//	If no items are available this thread is put to sleep until an item becomes available.
+		//
+		//	This function is only ever called from a single thread (the "reader thread")
+		//
+
+		// If no items are available put this (single reader) thread to sleep until item is available,
+		// i.e, until it is woken by a writer thread calling Fifo<T>::push(). The wait strategy may return before
+		// an item is available (see FifoWait.h) so test again each time.
+		FIFO_SCHEDULE_POINT("pop: empty test");
+		while (FIFO_UNLIKELY(population == 0)) {
+
+			FIFO_TRACE_READER_PARK(id, population);
+			waiter.park(&population);
+			FIFO_TRACE_READER_UNPARK(id, population);
+			FIFO_SCHEDULE_POINT("pop: empty test");
+		}
+
+		// If we're here this thread either hasn't waited or alternatively "the sleeper has awakened".
+		// Back to reality, we know that data items are now available in the FIFO...
+		// No mutex is needed to take one, as in pop_try()
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// Obtain the item at the current extraction position (with a slab, just its slot number - the item is
+		// copied out once the ring position has been handed back)
+		unsigned taken = storage.take(ExtractionIndex, itemPtr);
+		prefetchAhead();
+		recordLatency(ExtractionIndex);
+		recordOccupancy(1);
+		// Bump extraction position
+		ExtractionIndex = Config::advance(ExtractionIndex, 1);
+
+		// Hand the ring position back to the writer threads, as in pop_try()
+		unreleased++;
+		if (releaseDue()) {
+			FIFO_SCHEDULE_POINT("pop: population release");
+			releaseTaken();
+		}
+
+		storage.finish(taken, itemPtr);
+
+		popOutcome(FIFO_STATUS_SUCCESS);
+	}
+
+
+	FIFO_NODISCARD FifoStatus push_batch(const T* itemsPtr, unsigned count, unsigned* pushedPtr) {
+
+		//	- push_batch
+		//	A "writer thread" calls this function to push up to 'count' items into the queue at once.
+		//	As many as there is room for are pushed, in order, and *pushedPtr is set to how many that was.
+		//	Returns FIFO_STATUS_SUCCESS if at least one was pushed, otherwise the same as push() would.
+		//
+		//	This function may be called from multiple threads ("writer threads")
+		//
+
+		static_assert(Storage::batched, "push_batch() needs the items to be held inline (FifoInlineStorage)");
+
+		*pushedPtr = 0;
+		if (count == 0) return FIFO_STATUS_SUCCESS;
+
+		// The same tests as push() - no room, the mutex is busy, or no room after all
+		FIFO_SCHEDULE_POINT("push_batch: full test");
+		if (FIFO_UNLIKELY(population + reserved >= capacity)) return pushOutcome(FIFO_STATUS_FULL);
+
+		if (FIFO_UNLIKELY(!writerLock())) return pushOutcome(FIFO_STATUS_LOCKED);
+
+		if (FIFO_UNLIKELY(population + reserved >= capacity)) {
+			writerUnlock();
+			return pushOutcome(FIFO_STATUS_PREEMPTED);
+		}
+		// The positions about to be written were handed back by the reader - after it had read them
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// Copy in as many items as there is room for, in bulk. The reader may pop meanwhile, which only makes
+		// more room.
+		unsigned room = capacity - population - reserved;
+		unsigned pushed = (count < room) ? count : room;
+		storage.putRun(InsertionIndex, itemsPtr, pushed);
+		for (unsigned i = 0; i < pushed; i++) stampItem(Config::advance(InsertionIndex, i));
+		// Bump insertion position and FIFO population - the population last, publishing the items to the reader
+		InsertionIndex = Config::advance(InsertionIndex, pushed);
+		FIFO_SCHEDULE_POINT("push_batch: population publish");
+		addToPopulation((int) pushed);
+
+		writerUnlock();
+
+		FIFO_TRACE_WRITER_WAKE(id, population);
+		waiter.wake(&population);
+
+		// Counted (and traced) as that many successful pushes
+		*pushedPtr = pushed;
+		for (unsigned i = 0; i < pushed; i++) pushOutcome(FIFO_STATUS_SUCCESS);
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	FIFO_NODISCARD FifoStatus pop_try_batch(T* itemsPtr, unsigned maxCount, unsigned* poppedPtr) {
+
+		//	- pop_try_batch
+		//	The "reader thread" calls this function to fetch up to 'maxCount' of the available items at once.
+		//	*poppedPtr is set to how many were fetched. If no items are available the function returns
+		//	FIFO_STATUS_EMPTY immediately.
+		//
+		//	This function is only ever called from a single thread (the "reader thread")
+		//
+
+		static_assert(Storage::batched, "pop_try_batch() needs the items to be held inline (FifoInlineStorage)");
+
+		*poppedPtr = 0;
+
+		FIFO_SCHEDULE_POINT("pop_try_batch: empty test");
+		if (FIFO_UNLIKELY(population == 0)) return popOutcome(FIFO_STATUS_EMPTY);
+
+		*poppedPtr = takeBatch(itemsPtr, maxCount);
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	void pop_batch(T* itemsPtr, unsigned maxCount, unsigned* poppedPtr) {
+
+		//	- pop_batch
+		//	The "reader thread" calls this function to fetch up to 'maxCount' of the available items at once.
+		//	If no items are available this thread is put to sleep until at least one becomes available.
+		//
+		//	This function is only ever called from a single thread (the "reader thread")
+		//
+
+		static_assert(Storage::batched, "pop_batch() needs the items to be held inline (FifoInlineStorage)");
+
+		// Sleep as pop() does
+		FIFO_SCHEDULE_POINT("pop_batch: empty test");
+		while (FIFO_UNLIKELY(population == 0)) {
+
+			FIFO_TRACE_READER_PARK(id, population);
+			waiter.park(&population);
+			FIFO_TRACE_READER_UNPARK(id, population);
+			FIFO_SCHEDULE_POINT("pop_batch: empty test");
+		}
+
+		*poppedPtr = takeBatch(itemsPtr, maxCount);
+	}
+
+
+	// Sets how many ring positions ahead of the item being popped pop() and pop_try() prefetch (0 - none).
+	// Call from the reader thread, or before it starts.
+	void setPrefetchDistance(unsigned distance) {
+		prefetchDistance = distance;
+	}
+
+
+	// Sets how many pops the reader thread makes before handing their ring positions back to the writer threads
+	// together (1 - each as it is popped), and the population, as a percentage of the capacity, at or above which
+	// each pop hands its position back at once (see "Handing positions back" above). Call from the reader
+	// thread, or before it starts.
+	void setReleaseInterval(unsigned interval, unsigned fullPercent = FIFO_RELEASE_FULL_PERCENT) {
+		releaseInterval = (interval != 0) ? interval : 1;
+		releaseFull = fullPositions((fullPercent < 100) ? fullPercent : 100);
+	}
+
+
+	// The number of times the reader thread has handed popped positions back to the writer threads - one
+	// interlocked subtract on the population each. Call from the reader thread, or once it has finished.
+	unsigned long long getReleaseCount(void) {
+		return releases;
+	}
+
+
+	// Identifies this Fifo in tracepoints (see FifoTrace.h). Fifos are numbered from 0 in order of construction.
+	unsigned getId(void) {
+		return id;
+	}
+
+
+	// This function is used for testing by main() in the Console Apps - it gives an instantaneous (and
+	// therefore immediately stale) value of the FIFO population. With a release interval above 1 (see
+	// setReleaseInterval()) that includes popped items whose positions haven't yet been handed back.
+	unsigned getPopulation(void) {
+		return population;
+	}
+
+
+	// Time spent in the FIFO by items popped since the previous reset, optionally resetting as it reads.
+	// May be called from any thread. Always returns zeroes unless FIFO_INSTRUMENT_LATENCY is 1.
+	FifoHistogramSnapshot getLatencySnapshot(bool reset) {
+#if FIFO_INSTRUMENT_LATENCY
+		return latency.snapshot(reset);
+#else
+		(void) reset;
+		FifoHistogramSnapshot none = {};
+		return none;
+#endif
+	}
+
+
+	// Number of push(), pop() and pop_try() calls by result since the previous reset, optionally resetting as
+	// it reads. May be called from any thread. Always returns zeroes unless FIFO_INSTRUMENT_COUNTERS is 1.
+	FifoOutcomeSnapshot getOutcomeSnapshot(bool reset) {
+#if FIFO_INSTRUMENT_COUNTERS
+		return outcomes.snapshot(reset);
+#else
+		(void) reset;
+		FifoOutcomeSnapshot none = {};
+		return none;
+#endif
+	}
+
+
+	// High-water mark, time-weighted average population and recent population samples since the previous
+	// reset, optionally resetting as it reads. May be called from any thread. Always returns zeroes unless
+	// FIFO_INSTRUMENT_OCCUPANCY is 1.
+	FifoOccupancySnapshot getOccupancySnapshot(bool reset) {
+#if FIFO_INSTRUMENT_OCCUPANCY
+		return occupancy.snapshot(reset);
+#else
+		(void) reset;
+		FifoOccupancySnapshot none = {};
+		return none;
+#endif
+	}
+
+
+	// How often, and for how long, writer threads waited for and held the mutex since the previous
+	// reset, optionally resetting as it reads. May be called from any thread. Always returns zeroes unless
+	// FIFO_INSTRUMENT_LOCKS is 1.
+	FifoLockSnapshot getLockSnapshot(bool reset) {
+#if FIFO_INSTRUMENT_LOCKS
+		return lockProfile.snapshot(reset);
+#else
+		(void) reset;
+		FifoLockSnapshot none = {};
+		return none;
+#endif
+	}
+
+
+private:
+
+	// Called by the FifoRegistry, on the thread collecting metrics, for each Fifo constructed with a name.
+	// Reads without resetting - exported counters only ever count up.
+	static void collectMetrics(void* self, FifoMetricsWriter& out) {
+
+		Fifo* fifo = (Fifo*) self;
+
+		out.gauge("fifo_capacity", "Maximum number of items the FIFO holds.", (double) capacity);
+		out.gauge("fifo_population", "Number of items in the FIFO.", (double) fifo->population);
+#if FIFO_INSTRUMENT_COUNTERS
+		out.outcomes(fifo->getOutcomeSnapshot(false));
+#endif
+#if FIFO_INSTRUMENT_LATENCY
+		out.latency(fifo->getLatencySnapshot(false));
+#endif
+#if FIFO_INSTRUMENT_OCCUPANCY
+		out.occupancy(fifo->getOccupancySnapshot(false));
+#endif
+#if FIFO_INSTRUMENT_LOCKS
+		out.locks(fifo->getLockSnapshot(false));
+#endif
+	}
+
+
+	// The body of push() and push_try(). 'item' is a const T& for push() and a T&& for push_try(), which also
+	// gives the item's address as 'giveBack' - if the item isn't pushed after all, a storage that moved it out
+	// moves it back there.
+	template <class Source>
+	FifoStatus pushItem(Source&& item, T* giveBack) {
+
+		// If there's no space in the FIFO then return appropriate status code immediately
+		// (Positions promised to producer handles count as taken - see FifoProducer.h)
+		FIFO_SCHEDULE_POINT("push: full test");
+		if (FIFO_UNLIKELY(population + reserved >= capacity)) return pushOutcome(FIFO_STATUS_FULL);
+
+		// Get the item ready to go in - with a slab this copies (or for push_try(), moves) it into a free slab
+		// slot now, so that the copy isn't made with the mutex held. If the slab has no free slot (other writers
+		// are part-way through pushing a lot of items) the FIFO is busy.
+		typename Storage::Ticket ticket;
+		if (FIFO_UNLIKELY(!storage.stage(std::forward<Source>(item), &ticket))) return pushOutcome(FIFO_STATUS_LOCKED);
+
+		// One thread at a time now...
+		// Attempt to acquire the mutex (this thread will continue if it's acquired) or alternatively return
+		// appropriate status code if another thread has it
+		if (FIFO_UNLIKELY(!writerLock())) {
+			storage.unstage(ticket, giveBack);
+			return pushOutcome(FIFO_STATUS_LOCKED);
+		}
+
+		// NOTE - Depending on how the OS does its thread scheduling this will likely be a rare occurrence, but...
+		//
+		// The mutex has been acquired - test again - if another writer thread previously here bumped the poulation to
+		// maximum and thereafter released the mutex so that this thread could then acquire it, did that
+		// writer thread bump the population to maximum AFTER this thread passed the not-full-capacity test above
+		// but BEFORE it could test and acquire the mutex?
+		if (FIFO_UNLIKELY(population + reserved >= capacity)) {
+
+			// Yes it did - the FIFO is in fact full - release the mutex (and the slab slot, if any)
+			writerUnlock();
+			storage.unstage(ticket, giveBack);
+
+			// No space in the FIFO so return appropriate status code immediately
+			return pushOutcome(FIFO_STATUS_PREEMPTED);
+		}
+		// The position about to be written was handed back by the reader - after it had read it
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// There's space in the FIFO...
+		// Store the item in the FIFO at the current insertion position (with a slab, just its slot number)
+		storage.put(InsertionIndex, ticket);
+		stampItem(InsertionIndex);
+		// Bump insertion position and FIFO population - the population last, publishing the item to the reader
+		InsertionIndex = Config::advance(InsertionIndex, 1);
+		FIFO_SCHEDULE_POINT("push: population publish");
+		addToPopulation(1);
+
+		// Release the mutex
+		writerUnlock();
+
+		// Wake the reader thread if it is sleeping in pop() - with the default FifoEventWait this sets the
+		// 'Data Available' Event
+		FIFO_TRACE_WRITER_WAKE(id, population);
+		waiter.wake(&population);
+
+		// Return success
+		return pushOutcome(FIFO_STATUS_SUCCESS);
+	}
+
+
+	// Called by pop() and pop_try() as they take an item. Prefetch instructions don't wait for the data, so this
+	// adds little to the time the pop takes. Only a position that holds an item is prefetched (see
+	// "Prefetching" in FifoStorage.h) - and, since only this thread pops, that item stays put until it is popped.
+	void prefetchAhead(void) {
+		if (prefetchDistance != 0 && prefetchDistance < population - unreleased) {
+			storage.prefetch(Config::advance(ExtractionIndex, prefetchDistance));
+		}
+	}
+
+
+	// Called by pop_try_batch() and pop_batch() once they know the FIFO isn't empty - fetches up to 'maxCount'
+	// items in bulk and returns how many
+	unsigned takeBatch(T* itemsPtr, unsigned maxCount) {
+
+		// The population can only have gone up since the caller's test - only this thread pops. As in pop_try(),
+		// no mutex is needed. The items this thread has popped but not yet handed back aren't available.
+		unsigned available = population - unreleased;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned popped = (maxCount < available) ? maxCount : available;
+		storage.takeRun(ExtractionIndex, itemsPtr, popped);
+		for (unsigned i = 0; i < popped; i++) recordLatency(Config::advance(ExtractionIndex, i));
+		recordOccupancy(popped);
+		// Bump extraction position and hand the ring positions back, as in pop_try()
+		ExtractionIndex = Config::advance(ExtractionIndex, popped);
+		unreleased += popped;
+		if (releaseDue()) {
+			FIFO_SCHEDULE_POINT("pop_batch: population release");
+			releaseTaken();
+		}
+
+		// Counted (and traced) as that many successful pops
+		for (unsigned i = 0; i < popped; i++) popOutcome(FIFO_STATUS_SUCCESS);
+		return popped;
+	}
+
+
+	// Producer handles (see FifoProducer.h)
+
+
+	// Promises a producer handle up to 'wanted' ring positions, setting *promisedPtr to how many. The positions
+	// aren't chosen yet - just kept free - so that the handle's later publishReserved() can't find the FIFO full.
+	// Returns what push() would if none could be promised.
+	FifoStatus reserveRoom(unsigned wanted, unsigned* promisedPtr) {
+
+		*promisedPtr = 0;
+
+		FIFO_SCHEDULE_POINT("reserve: full test");
+		if (FIFO_UNLIKELY(population + reserved >= capacity)) return pushOutcome(FIFO_STATUS_FULL);
+
+		if (FIFO_UNLIKELY(!writerLock())) return pushOutcome(FIFO_STATUS_LOCKED);
+
+		unsigned used = population + reserved;
+		if (FIFO_UNLIKELY(used >= capacity)) {
+			writerUnlock();
+			return pushOutcome(FIFO_STATUS_PREEMPTED);
+		}
+		// The positions will be written by publishReserved() - the reader had finished with them before the
+		// population read above
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		unsigned room = capacity - used;
+		*promisedPtr = (wanted < room) ? wanted : room;
+		reserved += *promisedPtr;
+
+		writerUnlock();
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	// Stores a producer handle's items, in order, in the next ring positions and publishes them to the reader,
+	// giving back all 'promised' positions (those not used go back to everyone). The room was promised, so
+	// this waits for the mutex, whatever the lock. Each item is counted as a successful push. acceptTicksPtr
+	// holds the time-stamp counter at which the handle accepted each item - the latency histogram counts an
+	// item's time in the FIFO from then, not from when its chunk happened to be published.
+	void publishReserved(const T* itemsPtr, const unsigned long long* acceptTicksPtr, unsigned count, unsigned promised) {
+
+		writerLockWaiting();
+
+		storage.putRun(InsertionIndex, itemsPtr, count);
+		for (unsigned i = 0; i < count; i++) stampItem(Config::advance(InsertionIndex, i), acceptTicksPtr[i]);
+		InsertionIndex = Config::advance(InsertionIndex, count);
+		reserved -= promised;
+		FIFO_SCHEDULE_POINT("publish: population publish");
+		addToPopulation((int) count);
+
+		writerUnlock();
+
+		if (count != 0) {
+			FIFO_TRACE_WRITER_WAKE(id, population);
+			waiter.wake(&population);
+		}
+		for (unsigned i = 0; i < count; i++) pushOutcome(FIFO_STATUS_SUCCESS);
+	}
+
+
+	// Called by the pops once they have counted what they popped in 'unreleased'. Whether to hand the positions
+	// back now (see "Handing positions back" above) - after releaseInterval pops, when this thread has taken
+	// every item it can see, or when the FIFO is getting full. With an interval of 1 the population isn't read.
+	bool releaseDue(void) {
+
+		if (FIFO_LIKELY(unreleased >= releaseInterval)) return true;
+
+		FIFO_SCHEDULE_POINT("release: population test");
+		unsigned seen = population;
+		return seen == unreleased || seen + reserved >= releaseFull;
+	}
+
+
+	// Decrements the FIFO population by the items popped since the last release, handing their ring positions
+	// back to the writer threads. If that has rendered the FIFO empty, tells the wait strategy (FifoEventWait
+	// resets the Event flag).
+	void releaseTaken(void) {
+
+		unsigned count = unreleased;
+		unreleased = 0;
+		releases++;
+		if (addToPopulation(-(int) count) == 0) waiter.drained();
+	}
+
+
+	// The number of ring positions that is 'percent' of the capacity
+	static unsigned fullPositions(unsigned percent) {
+		return (unsigned) ((unsigned long long) capacity * percent / 100);
+	}
+
+
+	// The population is changed by the writer threads (one at a time, holding the mutex) and by the reader
+	// thread (without it), so each change is one interlocked add - which is also the release that publishes an
+	// item to the reader, or hands a ring position back to the writers. Returns the new population.
+	unsigned addToPopulation(int count) {
+		return (unsigned) (InterlockedExchangeAdd((volatile LONG*) &population, (LONG) count) + count);
+	}
+
+
+	// Mutex acquisition and release, by writer threads only. Without FIFO_INSTRUMENT_LOCKS these are just the
+	// LockPolicy calls.
+
+
+	// With the Critical Section a writer thread never waits for the mutex - returns false at once if another thread
+	// has it. With a lock that writers wait for (LockPolicy::writersWait), waits its turn and always returns true.
+	bool writerLock(void) {
+#if FIFO_INSTRUMENT_LOCKS
+		if (!mutex.tryLock()) {
+			if (!LockPolicy::writersWait) {
+				lockProfile.writerContended();
+				return false;
+			}
+			unsigned long long waitStart = FifoTsc::now();
+			mutex.lock();
+			lockedTicks = FifoTsc::now();
+			lockProfile.writerWaited(lockedTicks - waitStart);
+			return true;
+		}
+		lockedTicks = FifoTsc::now();
+		return true;
+#else
+		if (LockPolicy::writersWait) {
+			mutex.lock();
+			return true;
+		}
+		return mutex.tryLock();
+#endif
+	}
+
+
+	// For a writer that has been promised room (publishReserved()) - waits for the mutex whatever the lock
+	void writerLockWaiting(void) {
+#if FIFO_INSTRUMENT_LOCKS
+		if (!mutex.tryLock()) {
+			unsigned long long waitStart = FifoTsc::now();
+			mutex.lock();
+			lockedTicks = FifoTsc::now();
+			lockProfile.writerWaited(lockedTicks - waitStart);
+			return;
+		}
+		lockedTicks = FifoTsc::now();
+#else
+		mutex.lock();
+#endif
+	}
+
+
+	void writerUnlock(void) {
+#if FIFO_INSTRUMENT_LOCKS
+		lockProfile.writerHeld(FifoTsc::now() - lockedTicks);
+#endif
+		mutex.unlock();
+	}
+
+
+	// Instrumentation hooks - each compiles to nothing unless its instrumentation is switched on
+
+
+	// Called by push() with the mutex held, having just stored an item at ring position index
+	void stampItem(unsigned index) {
+#if FIFO_INSTRUMENT_LATENCY
+		pushTicks[index] = FifoTsc::now();
+#else
+		(void) index;
+#endif
+	}
+
+
+	// Called by publishReserved() with the mutex held, having just stored an item at ring position index that
+	// was pushed (to a producer handle) at 'ticks'
+	void stampItem(unsigned index, unsigned long long ticks) {
+#if FIFO_INSTRUMENT_LATENCY
+		pushTicks[index] = ticks;
+#else
+		(void) index;
+		(void) ticks;
+#endif
+	}
+
+
+	// Called by pop() and pop_try() having just obtained the item at ring position index
+	void recordLatency(unsigned index) {
+#if FIFO_INSTRUMENT_LATENCY
+		latency.record(FifoTsc::now() - pushTicks[index]);
+#else
+		(void) index;
+#endif
+	}
+
+
+	// Called by the pops just before they count what they have taken as unreleased - records the items they could
+	// see, and that 'count' of them (one, or a batch) are being taken
+	void recordOccupancy(unsigned count) {
+#if FIFO_INSTRUMENT_OCCUPANCY
+		occupancy.record(population - unreleased, count, FifoTsc::now());
+#else
+		(void) count;
+#endif
+	}
+
+
+	// Called by push() with the status it is about to return - passes the status straight back
+	FifoStatus pushOutcome(FifoStatus status) {
+#if FIFO_INSTRUMENT_COUNTERS
+		outcomes.countPush(status);
+#endif
+		if (FIFO_LIKELY(status == FIFO_STATUS_SUCCESS)) FIFO_TRACE_PUSH_ACCEPTED(id, population);
+		else FIFO_TRACE_PUSH_REJECTED(id, population, (unsigned) status);
+		return status;
+	}
+
+
+	// Called by pop() and pop_try() with the status they are about to return - passes the status straight back
+	FifoStatus popOutcome(FifoStatus status) {
+#if FIFO_INSTRUMENT_COUNTERS
+		outcomes.countPop(status);
+#endif
+		if (FIFO_LIKELY(status == FIFO_STATUS_SUCCESS)) FIFO_TRACE_POP(id, population);
+		return status;
+	}
+
+};
@@ -0,0 +1,248 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Baseline queues for comparison with the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the alternatives to the software fifo that the benchmark harness
+//  (Fifo_Benchmark_Win.cpp, "mode=compare") measures it against;
+//
+//  BaselineStdQueue     - std::queue (on its default std::deque) protected by a std::mutex. The alternative
+//                         considered, and set aside, in "Design considerations" in Software_Fifo_Exercise_Win.cpp.
+//  BaselineCondVarQueue - the same, with a std::condition_variable for the reader to sleep on when empty - the
+//                         textbook C++11 blocking queue
+//  BaselineVyukovQueue  - Dmitry Vyukov's well-known bounded multi-producer multi-consumer lock-free queue, an
+//                         array of cells each with its own sequence number. Written out here from the published
+//                         algorithm rather than taken from a library, so the harness still has no dependencies.
+//
+//  They are only for benchmarking. Each has the same push(), pop_try() and pop() as Fifo, returning the
+//  same FIFO_STATUS_... codes, so one benchmark template can drive them all. Each holds at most "capacity"
+//  items - push() returns FIFO_STATUS_FULL rather than letting a std::queue grow - so that they are compared
+//  like for like.
+//
+//
+
+
+#pragma once
+
+
+#include "Fifo.h"		// For the FIFO_STATUS_... codes
+
+#include <atomic>		// For BaselineVyukovQueue
+#include <condition_variable>	// For BaselineCondVarQueue
+#include <mutex>
+#include <queue>		// For std::queue
+
+
+
+
+template <class T, unsigned capacity>
+class BaselineStdQueue {
+
+	std::mutex mutex;
+	std::queue<T> items;
+
+public:
+
+	FifoStatus push(const T& item) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.size() >= capacity) return FIFO_STATUS_FULL;
+		items.push(item);
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	FifoStatus pop_try(T* itemPtr) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.empty()) return FIFO_STATUS_EMPTY;
+		*itemPtr = items.front();
+		items.pop();
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	// There is nothing to sleep on - spins until an item is available
+	void pop(T* itemPtr) {
+		while (pop_try(itemPtr) != FIFO_STATUS_SUCCESS) YieldProcessor();
+	}
+
+
+	static const char* name(void) {
+		return "std_queue_mutex";
+	}
+};
+
+
+
+
+template <class T, unsigned capacity>
+class BaselineCondVarQueue {
+
+	std::mutex mutex;
+	std::condition_variable dataAvailable;
+	std::queue<T> items;
+
+public:
+
+	FifoStatus push(const T& item) {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (items.size() >= capacity) return FIFO_STATUS_FULL;
+			items.push(item);
+		}
+		dataAvailable.notify_one();
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	FifoStatus pop_try(T* itemPtr) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.empty()) return FIFO_STATUS_EMPTY;
+		*itemPtr = items.front();
+		items.pop();
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	void pop(T* itemPtr) {
+
+		std::unique_lock<std::mutex> lock(mutex);
+		dataAvailable.wait(lock, [this] { return !items.empty(); });
+		*itemPtr = items.front();
+		items.pop();
+	}
+
+
+	static const char* name(void) {
+		return "condvar_queue";
+	}
+};
+
+
+
+
+// The capacity must be a power of two
+template <class T, unsigned capacity>
+class BaselineVyukovQueue {
+
+	static_assert(capacity >= 2 && FifoConfig<T, capacity>::powerOfTwo, "BaselineVyukovQueue capacity must be a power of two");
+	static_assert(ATOMIC_POINTER_LOCK_FREE == 2, "BaselineVyukovQueue needs lock-free std::atomic<size_t>");
+
+	struct Cell {
+		std::atomic<size_t> sequence;	// == position: free for the push at that position
+		T data;				// == position + 1: holds the item pushed there, ready for the pop
+	};
+
+	// The two positions are kept on separate cache lines from each other and from the cells. Padded rather
+	// than aligned, as in FifoStats.h, since the queue may be allocated with new.
+	std::atomic<size_t> enqueuePosition;
+	char paddingAfterEnqueue[2 * FIFO_CACHE_LINE_SIZE];
+	std::atomic<size_t> dequeuePosition;
+	char paddingAfterDequeue[2 * FIFO_CACHE_LINE_SIZE];
+	Cell cells[capacity];
+
+public:
+
+	BaselineVyukovQueue() : enqueuePosition(0), dequeuePosition(0) {
+		for (size_t i = 0; i < capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+
+	FifoStatus push(const T& item) {
+
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+
+		for (;;) {
+			Cell& cell = cells[position & (capacity - 1)];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+			if (difference == 0) {
+				// The cell is free - claim this position, or try again at the position another writer left
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.data = item;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return FIFO_STATUS_SUCCESS;
+				}
+			}
+			else if (difference < 0) {
+				// The cell still holds the item from one lap ago
+				return FIFO_STATUS_FULL;
+			}
+			else {
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+
+	FifoStatus pop_try(T* itemPtr) {
+
+		size_t position = dequeuePosition.load(std::memory_order_relaxed);
+
+		for (;;) {
+			Cell& cell = cells[position & (capacity - 1)];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+
+			if (difference == 0) {
+				if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					*itemPtr = cell.data;
+					// Free the cell for the push one lap from now
+					cell.sequence.store(position + capacity, std::memory_order_release);
+					return FIFO_STATUS_SUCCESS;
+				}
+			}
+			else if (difference < 0) {
+				return FIFO_STATUS_EMPTY;
+			}
+			else {
+				position = dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+
+	// Lock-free - there is nothing to sleep on, so spins until an item is available
+	void pop(T* itemPtr) {
+		while (pop_try(itemPtr) != FIFO_STATUS_SUCCESS) YieldProcessor();
+	}
+
+
+	static const char* name(void) {
+		return "vyukov_mpmc";
+	}
+};
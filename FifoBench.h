@@ -0,0 +1,1572 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Building blocks for the software fifo benchmark harness (Fifo_Benchmark_Win.cpp).
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the pieces of the benchmark harness that are not specific to any one benchmark,
+//  notably;
+//
+//  BenchClock    - a cheap high-resolution clock (the processor's time-stamp counter)
+//  BenchLfsr     - a Shift-register pseudo-random bit generator
+//  BenchRandom   - a seeded pseudo-random number source using either a Mersenne Twister or BenchLfsr
+//  BenchArrivals - inter-arrival timing for writer threads (fixed rate with frequency modulation,
+//                  Poisson, or bursty)
+//  BenchOptions  - "name=value" command line option parsing
+//  BenchSamples  - latency samples, their percentiles and their distribution
+//  BenchReport   - results output as a text table, CSV or JSON
+//  BenchTopology - which logical processors share a physical core, an L3 cache, a socket or a NUMA
+//                  node, for pinning threads and for recording what a benchmark ran on
+//  BenchCounters - processor cycles, and where the hardware allows it instructions retired, used by a
+//                  thread, for reporting the cost of each item
+//  BenchPmcSession - with administrator rights, an ETW session that counts cache misses, cross-core dirty
+//                  hits and branch misses for BenchCounters
+//
+//
+//  Reproducibility
+//  ===============
+//
+//  Everything that the harness itself decides (request timing, burst lengths, modulation phases) is derived
+//  from a single seed, so that two runs with the same seed and options drive the fifo with the same schedule.
+//  The outcomes of those requests will still vary a little from run to run because of vacillations in the OS.
+//
+//  The C++11 <random> distribution classes are deliberately NOT used - their algorithms are left to the
+//  library implementer, so the same seed could give different numbers with different compilers. The
+//  generators themselves (std::mt19937 and the LFSR below) are fully specified, and the conversion of their
+//  output to the required distributions is done here.
+//
+//
+
+
+#pragma once
+
+
+#include "Fifo.h"		// The software fifo template class (and FifoStats.h)
+
+#include <algorithm>		// For std::sort
+#include <cmath>		// For log() and sin()
+#include <cstdio>		// For snprintf()
+#include <cstdlib>		// For strtoul() and strtod()
+#include <evntrace.h>		// For the PMC session
+#include <evntcons.h>
+#include <intrin.h>		// For __readpmc()
+#include <istream>		// For reading a report back
+#include <map>			// For the option table and the PMC session's slices
+#include <mutex>		// For the PMC session
+#include <ostream>		// For report output
+#include <random>		// For std::mt19937 (the C++11 Mersenne Twister)
+#include <string>		// For the string class
+#include <thread>		// For the PMC session's consumer
+#include <utility>		// For std::pair
+#include <vector>		// For sample and report storage
+
+#pragma comment(lib, "Advapi32.lib")	// For the PMC session
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchClock
+//
+//  The Windows performance counter typically ticks at only 10MHz, which is too coarse to time a single push
+//  or pop, so all timing here uses the processor's time-stamp counter (see FifoTsc in FifoStats.h).
+//
+//--------------------------------------------------------------------------------
+
+class BenchClock {
+
+public:
+
+	// Current time in TSC ticks
+	static unsigned long long now(void) {
+		return FifoTsc::now();
+	}
+
+
+	// Number of TSC ticks per nanosecond - measured once, on first use
+	static double ticksPerNanosecond(void) {
+		return FifoTsc::ticksPerNanosecond();
+	}
+
+
+	static double toNanoseconds(unsigned long long ticks) {
+		return FifoTsc::toNanoseconds(ticks);
+	}
+
+
+	static unsigned long long fromNanoseconds(double nanoseconds) {
+		return (unsigned long long) (nanoseconds * ticksPerNanosecond());
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchLfsr
+//
+//  A 32-bit Galois Shift-register pseudo-random bit generator using the maximal-length polynomial
+//  x^32 + x^22 + x^2 + x + 1. Each call to next() clocks the register 32 times to produce a 32-bit word.
+//
+//--------------------------------------------------------------------------------
+
+class BenchLfsr {
+
+	unsigned state;		// Shift register contents - must never be zero
+
+public:
+
+	explicit BenchLfsr(unsigned seed) : state(seed != 0 ? seed : 0xACE1u) {}
+
+
+	unsigned next(void) {
+
+		unsigned word = 0;
+
+		for (unsigned bit = 0; bit < 32; bit++) {
+
+			unsigned outputBit = state & 1u;
+			state >>= 1;
+			if (outputBit) state ^= 0x80200003u;	// Feedback taps 32, 22, 2, 1
+			word = (word << 1) | outputBit;
+		}
+
+		return word;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchRandom
+//
+//  A seeded source of pseudo-random numbers, using either the C++11 Mersenne Twister or BenchLfsr.
+//
+//--------------------------------------------------------------------------------
+
+enum BenchGenerator {
+	BENCH_GENERATOR_MT,	// std::mt19937
+	BENCH_GENERATOR_LFSR	// BenchLfsr
+};
+
+
+class BenchRandom {
+
+	BenchGenerator generator;
+	std::mt19937 twister;
+	BenchLfsr lfsr;
+
+public:
+
+	BenchRandom(BenchGenerator generator, unsigned seed) : generator(generator), twister(seed), lfsr(seed) {}
+
+
+	// Next raw 32-bit pseudo-random word
+	unsigned next(void) {
+		return (generator == BENCH_GENERATOR_MT) ? (unsigned) twister() : lfsr.next();
+	}
+
+
+	// Uniformly distributed in [0, 1)
+	double uniform(void) {
+		return (double) next() / 4294967296.0;
+	}
+
+
+	// Exponentially distributed with the given mean
+	double exponential(double mean) {
+		return -log(1.0 - uniform()) * mean;
+	}
+};
+
+
+// Derive a per-thread seed from the run seed so that every thread has its own reproducible sequence
+inline unsigned benchThreadSeed(unsigned seed, unsigned threadIndex) {
+
+	// Golden-ratio increment followed by a 32-bit avalanche mix - consecutive thread indexes give unrelated seeds
+	unsigned x = seed + 0x9E3779B9u * (threadIndex + 1);
+	x ^= x >> 16; x *= 0x85EBCA6Bu;
+	x ^= x >> 13; x *= 0xC2B2AE35u;
+	x ^= x >> 16;
+	return x;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchArrivals
+//
+//  Generates the gaps between successive requests made by one writer thread;
+//
+//  BENCH_ARRIVAL_FIXED   - a fixed average rate with sinusoidal frequency modulation. Each writer starts at a
+//                          pseudo-random modulation phase, so writers drift in and out of step with each other,
+//                          giving deliberate occasional concurrency.
+//  BENCH_ARRIVAL_POISSON - exponentially distributed gaps (a Poisson process) with the given average rate.
+//  BENCH_ARRIVAL_BURSTY  - bursts of back-to-back requests separated by exponentially distributed idle gaps,
+//                          with the given average rate overall.
+//
+//--------------------------------------------------------------------------------
+
+enum BenchArrivalPattern {
+	BENCH_ARRIVAL_FIXED,
+	BENCH_ARRIVAL_POISSON,
+	BENCH_ARRIVAL_BURSTY
+};
+
+
+struct BenchArrivalConfig {
+	BenchArrivalPattern pattern;
+	double ratePerSecond;		// Average requests per second (per writer)
+	double modulationDepth;		// BENCH_ARRIVAL_FIXED - period swings by +/- this fraction (0 to <1)
+	unsigned modulationPeriod;	// BENCH_ARRIVAL_FIXED - number of requests per modulation cycle
+	unsigned burstLength;		// BENCH_ARRIVAL_BURSTY - requests per burst
+};
+
+
+class BenchArrivals {
+
+	BenchArrivalConfig config;
+	BenchRandom random;
+	double meanGapNs;		// Average gap between requests
+	double phase;			// BENCH_ARRIVAL_FIXED - modulation starting phase (radians)
+	unsigned long long count;	// Number of gaps generated so far
+
+public:
+
+	BenchArrivals(const BenchArrivalConfig& config, BenchRandom random)
+		: config(config), random(random), meanGapNs(1.0e9 / config.ratePerSecond), phase(0.0), count(0) {
+
+		phase = this->random.uniform() * 2.0 * 3.14159265358979323846;
+	}
+
+
+	// Nanoseconds from the previous request to the next one
+	double nextGapNs(void) {
+
+		double gap = 0.0;
+
+		switch (config.pattern) {
+
+		case BENCH_ARRIVAL_FIXED: {
+			double angle = phase + 2.0 * 3.14159265358979323846 * (double) count / (double) config.modulationPeriod;
+			gap = meanGapNs * (1.0 + config.modulationDepth * sin(angle));
+			break;
+		}
+
+		case BENCH_ARRIVAL_POISSON:
+			gap = random.exponential(meanGapNs);
+			break;
+
+		case BENCH_ARRIVAL_BURSTY:
+			// Back-to-back within a burst, then an idle gap long enough to keep the average rate
+			if ((count % config.burstLength) != 0) gap = 0.0;
+			else gap = random.exponential(meanGapNs * config.burstLength);
+			break;
+		}
+
+		count++;
+		return gap;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchOptions
+//
+//  Command line options are given as "name=value" (leading dashes are ignored, so "--writers=4" and
+//  "writers=4" are the same). An option given without a value is taken to be "1".
+//
+//--------------------------------------------------------------------------------
+
+class BenchOptions {
+
+	std::map<std::string, std::string> values;
+
+public:
+
+	BenchOptions(int argc, char* argv[]) {
+
+		for (int i = 1; i < argc; i++) {
+
+			std::string argument(argv[i]);
+			size_t start = argument.find_first_not_of('-');
+			if (start == std::string::npos) continue;
+			argument = argument.substr(start);
+
+			size_t equals = argument.find('=');
+			if (equals == std::string::npos) values[argument] = "1";
+			else values[argument.substr(0, equals)] = argument.substr(equals + 1);
+		}
+	}
+
+
+	bool has(const std::string& name) const {
+		return values.count(name) != 0;
+	}
+
+
+	std::string getString(const std::string& name, const std::string& defaultValue) const {
+
+		std::map<std::string, std::string>::const_iterator found = values.find(name);
+		return (found == values.end()) ? defaultValue : found->second;
+	}
+
+
+	unsigned getUnsigned(const std::string& name, unsigned defaultValue) const {
+
+		std::map<std::string, std::string>::const_iterator found = values.find(name);
+		return (found == values.end()) ? defaultValue : (unsigned) strtoul(found->second.c_str(), NULL, 0);
+	}
+
+
+	double getDouble(const std::string& name, double defaultValue) const {
+
+		std::map<std::string, std::string>::const_iterator found = values.find(name);
+		return (found == values.end()) ? defaultValue : strtod(found->second.c_str(), NULL);
+	}
+
+
+	// A comma-separated list of numbers, e.g. "writers=1,4,16"
+	std::vector<unsigned> getUnsignedList(const std::string& name, const std::string& defaultValue) const {
+
+		std::vector<std::string> text = getStringList(name, defaultValue);
+		std::vector<unsigned> list;
+		for (size_t i = 0; i < text.size(); i++) list.push_back((unsigned) strtoul(text[i].c_str(), NULL, 0));
+		return list;
+	}
+
+
+	// A comma-separated list of words, e.g. "policy=event,address"
+	std::vector<std::string> getStringList(const std::string& name, const std::string& defaultValue) const {
+
+		std::string text = getString(name, defaultValue);
+		std::vector<std::string> list;
+
+		size_t start = 0;
+		while (start < text.size()) {
+			size_t comma = text.find(',', start);
+			if (comma == std::string::npos) comma = text.size();
+			if (comma > start) list.push_back(text.substr(start, comma - start));
+			start = comma + 1;
+		}
+		return list;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchSamples
+//
+//  A collection of latency samples (in TSC ticks) from which percentiles are obtained. Storage is reserved
+//  up-front so that recording a sample during a run never re-allocates.
+//
+//--------------------------------------------------------------------------------
+
+struct BenchPercentiles {
+	unsigned long long count;
+	double meanNs, p50Ns, p90Ns, p99Ns, p999Ns, maxNs;
+};
+
+
+// One bucket of a distribution - the number of samples greater than the previous bucket's upper bound and
+// no greater than this one's
+struct BenchBucket {
+	double upperNs;
+	unsigned long long count;
+};
+
+
+#define BENCH_BUCKET_RATIO	1.189207115	// Fourth root of 2
+
+
+class BenchSamples {
+
+	std::vector<unsigned long long> ticks;
+
+public:
+
+	void reserve(size_t count) {
+		ticks.reserve(count);
+	}
+
+
+	void record(unsigned long long sampleTicks) {
+		ticks.push_back(sampleTicks);
+	}
+
+
+	// Merge another collection into this one (e.g. per-thread samples into a total)
+	void append(const BenchSamples& other) {
+		ticks.insert(ticks.end(), other.ticks.begin(), other.ticks.end());
+	}
+
+
+	size_t size(void) const {
+		return ticks.size();
+	}
+
+
+	// Sorts the samples in place
+	BenchPercentiles percentiles(void) {
+
+		BenchPercentiles result = {};
+		result.count = ticks.size();
+		if (ticks.empty()) return result;
+
+		std::sort(ticks.begin(), ticks.end());
+
+		double sum = 0.0;
+		for (size_t i = 0; i < ticks.size(); i++) sum += (double) ticks[i];
+
+		result.meanNs = BenchClock::toNanoseconds((unsigned long long) (sum / (double) ticks.size()));
+		result.p50Ns = BenchClock::toNanoseconds(atFraction(0.50));
+		result.p90Ns = BenchClock::toNanoseconds(atFraction(0.90));
+		result.p99Ns = BenchClock::toNanoseconds(atFraction(0.99));
+		result.p999Ns = BenchClock::toNanoseconds(atFraction(0.999));
+		result.maxNs = BenchClock::toNanoseconds(ticks.back());
+		return result;
+	}
+
+
+	// The samples counted into buckets a quarter of a power of two of nanoseconds wide (so each bucket's upper
+	// bound is about 19% above the previous one's), from the lowest to the highest non-empty bucket. Sorts the
+	// samples in place.
+	std::vector<BenchBucket> distribution(void) {
+
+		std::vector<BenchBucket> buckets;
+		if (ticks.empty()) return buckets;
+
+		std::sort(ticks.begin(), ticks.end());
+
+		double upperNs = 1.0;
+		while (upperNs < BenchClock::toNanoseconds(ticks.front())) upperNs *= BENCH_BUCKET_RATIO;
+
+		size_t i = 0;
+		while (i < ticks.size()) {
+			BenchBucket bucket = { upperNs, 0 };
+			while (i < ticks.size() && BenchClock::toNanoseconds(ticks[i]) <= upperNs) {
+				bucket.count++;
+				i++;
+			}
+			buckets.push_back(bucket);
+			upperNs *= BENCH_BUCKET_RATIO;
+		}
+		return buckets;
+	}
+
+
+private:
+
+	// Nearest-rank percentile of the (sorted) samples
+	unsigned long long atFraction(double fraction) const {
+
+		size_t rank = (size_t) ceil(fraction * (double) ticks.size());
+		if (rank < 1) rank = 1;
+		return ticks[rank - 1];
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchReport
+//
+//  Benchmark results as a list of records, each record being an ordered list of named fields. Every record
+//  of a report is expected to have the same fields in the same order. The report can be printed as;
+//
+//  BENCH_FORMAT_TEXT - one "name = value" line per field (single record) or an aligned table (several records)
+//  BENCH_FORMAT_CSV  - a header line of field names followed by one line per record
+//  BENCH_FORMAT_JSON - a JSON object (single record) or an array of objects (several records)
+//
+//  A report written as CSV can be read back with benchReadCsv(), e.g. to compare a run with a baseline.
+//
+//--------------------------------------------------------------------------------
+
+enum BenchFormat {
+	BENCH_FORMAT_TEXT,
+	BENCH_FORMAT_CSV,
+	BENCH_FORMAT_JSON
+};
+
+
+inline BenchFormat benchParseFormat(const std::string& name) {
+
+	if (name == "csv") return BENCH_FORMAT_CSV;
+	if (name == "json") return BENCH_FORMAT_JSON;
+	return BENCH_FORMAT_TEXT;
+}
+
+
+class BenchRecord {
+
+	struct Field {
+		std::string name;
+		std::string value;
+		bool isText;		// Text values are quoted in JSON, numbers are not
+	};
+
+	std::vector<Field> fields;
+
+	friend class BenchReport;
+
+public:
+
+	BenchRecord& add(const std::string& name, const std::string& value) {
+		Field field = { name, value, true };
+		fields.push_back(field);
+		return *this;
+	}
+
+
+	BenchRecord& add(const std::string& name, const char* value) {
+		return add(name, std::string(value));
+	}
+
+
+	BenchRecord& add(const std::string& name, unsigned long long value) {
+		Field field = { name, std::to_string(value), false };
+		fields.push_back(field);
+		return *this;
+	}
+
+
+	BenchRecord& add(const std::string& name, unsigned value) {
+		return add(name, (unsigned long long) value);
+	}
+
+
+	BenchRecord& add(const std::string& name, double value) {
+		char text[32];
+		snprintf(text, sizeof(text), "%.6g", value);
+		Field field = { name, text, false };
+		fields.push_back(field);
+		return *this;
+	}
+
+
+	// Add the usual set of percentile fields, each name being prefixed by the given prefix
+	BenchRecord& add(const std::string& prefix, const BenchPercentiles& percentiles) {
+		add(prefix + "_count", percentiles.count);
+		add(prefix + "_mean_ns", percentiles.meanNs);
+		add(prefix + "_p50_ns", percentiles.p50Ns);
+		add(prefix + "_p90_ns", percentiles.p90Ns);
+		add(prefix + "_p99_ns", percentiles.p99Ns);
+		add(prefix + "_p99.9_ns", percentiles.p999Ns);
+		add(prefix + "_max_ns", percentiles.maxNs);
+		return *this;
+	}
+
+
+	// The same for a snapshot of a FifoHistogram (which has no p90)
+	BenchRecord& add(const std::string& prefix, const FifoHistogramSnapshot& snapshot) {
+		add(prefix + "_count", snapshot.count);
+		add(prefix + "_mean_ns", FifoTsc::toNanoseconds(snapshot.meanTicks));
+		add(prefix + "_p50_ns", FifoTsc::toNanoseconds(snapshot.p50Ticks));
+		add(prefix + "_p99_ns", FifoTsc::toNanoseconds(snapshot.p99Ticks));
+		add(prefix + "_p99.9_ns", FifoTsc::toNanoseconds(snapshot.p999Ticks));
+		add(prefix + "_max_ns", FifoTsc::toNanoseconds(snapshot.maxTicks));
+		return *this;
+	}
+};
+
+
+class BenchReport {
+
+	std::vector<BenchRecord> records;
+
+public:
+
+	// Start a new record and return it for its fields to be added
+	BenchRecord& newRecord(void) {
+		records.push_back(BenchRecord());
+		return records.back();
+	}
+
+
+	size_t size(void) const {
+		return records.size();
+	}
+
+
+	// Adds the same fields to the end of every record so far - e.g. a description of the machine
+	void addToEach(const BenchRecord& common) {
+
+		for (size_t r = 0; r < records.size(); r++) {
+			records[r].fields.insert(records[r].fields.end(), common.fields.begin(), common.fields.end());
+		}
+	}
+
+
+	void print(std::ostream& out, BenchFormat format) const {
+
+		if (records.empty()) return;
+
+		switch (format) {
+		case BENCH_FORMAT_TEXT: printText(out); break;
+		case BENCH_FORMAT_CSV: printCsv(out); break;
+		case BENCH_FORMAT_JSON: printJson(out); break;
+		}
+	}
+
+
+private:
+
+	void printText(std::ostream& out) const {
+
+		const std::vector<BenchRecord::Field>& first = records[0].fields;
+
+		if (records.size() == 1) {
+
+			size_t width = 0;
+			for (size_t f = 0; f < first.size(); f++) width = std::max(width, first[f].name.size());
+
+			for (size_t f = 0; f < first.size(); f++) {
+				out << first[f].name << std::string(width - first[f].name.size(), ' ') << " = " << first[f].value << "\n";
+			}
+			return;
+		}
+
+		// Several records - a table with one column per field
+		std::vector<size_t> widths(first.size());
+		for (size_t f = 0; f < first.size(); f++) {
+			widths[f] = first[f].name.size();
+			for (size_t r = 0; r < records.size(); r++) widths[f] = std::max(widths[f], records[r].fields[f].value.size());
+		}
+
+		for (size_t f = 0; f < first.size(); f++) out << padded(first[f].name, widths[f]);
+		out << "\n";
+		for (size_t r = 0; r < records.size(); r++) {
+			for (size_t f = 0; f < first.size(); f++) out << padded(records[r].fields[f].value, widths[f]);
+			out << "\n";
+		}
+	}
+
+
+	void printCsv(std::ostream& out) const {
+
+		const std::vector<BenchRecord::Field>& first = records[0].fields;
+
+		for (size_t f = 0; f < first.size(); f++) out << (f ? "," : "") << first[f].name;
+		out << "\n";
+		for (size_t r = 0; r < records.size(); r++) {
+			for (size_t f = 0; f < records[r].fields.size(); f++) out << (f ? "," : "") << csvValue(records[r].fields[f].value);
+			out << "\n";
+		}
+	}
+
+
+	// A value containing a comma (e.g. a list of processors) or a quote is quoted, with its quotes doubled
+	static std::string csvValue(const std::string& value) {
+
+		if (value.find_first_of(",\"") == std::string::npos) return value;
+
+		std::string quoted = "\"";
+		for (size_t i = 0; i < value.size(); i++) {
+			if (value[i] == '"') quoted += '"';
+			quoted += value[i];
+		}
+		return quoted + "\"";
+	}
+
+
+	void printJson(std::ostream& out) const {
+
+		if (records.size() > 1) out << "[\n";
+
+		for (size_t r = 0; r < records.size(); r++) {
+
+			out << "{";
+			for (size_t f = 0; f < records[r].fields.size(); f++) {
+				const BenchRecord::Field& field = records[r].fields[f];
+				out << (f ? ", " : "") << "\"" << field.name << "\": ";
+				if (field.isText) out << "\"" << field.value << "\"";
+				else out << field.value;
+			}
+			out << "}" << ((r + 1 < records.size()) ? ",\n" : "\n");
+		}
+
+		if (records.size() > 1) out << "]\n";
+	}
+
+
+	static std::string padded(const std::string& text, size_t width) {
+		return text + std::string(width - text.size() + 2, ' ');
+	}
+};
+
+
+// One line of CSV split into its values, undoing the quoting done by BenchReport
+inline std::vector<std::string> benchSplitCsv(const std::string& line) {
+
+	std::vector<std::string> values(1);
+	bool quoted = false;
+
+	for (size_t i = 0; i < line.size(); i++) {
+
+		char c = line[i];
+
+		if (quoted) {
+			if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') { values.back() += '"'; i++; }
+			else if (c == '"') quoted = false;
+			else values.back() += c;
+		}
+		else if (c == '"') quoted = true;
+		else if (c == ',') values.push_back(std::string());
+		else values.back() += c;
+	}
+	return values;
+}
+
+
+// Reads a report written as CSV - a header line of field names then one line per record - giving each
+// record as a map from field name to value
+inline std::vector<std::map<std::string, std::string> > benchReadCsv(std::istream& in) {
+
+	std::vector<std::map<std::string, std::string> > records;
+	std::vector<std::string> names;
+	std::string line;
+
+	while (std::getline(in, line)) {
+
+		if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+		if (line.empty()) continue;
+
+		std::vector<std::string> values = benchSplitCsv(line);
+		if (names.empty()) {
+			names = values;
+			continue;
+		}
+
+		std::map<std::string, std::string> record;
+		for (size_t i = 0; i < values.size() && i < names.size(); i++) record[names[i]] = values[i];
+		records.push_back(record);
+	}
+	return records;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchTopology
+//
+//  Which logical processors share a physical core (SMT siblings, e.g. Hyper-Threading), an L3 cache, a
+//  socket (processor package) and a NUMA node, as reported by GetLogicalProcessorInformationEx() - the
+//  Windows counterpart of /sys/devices/system/cpu. Used to pin threads to processors a known "distance"
+//  apart;
+//
+//  BENCH_PLACEMENT_NONE   - not pinned, the OS decides
+//  BENCH_PLACEMENT_SMT    - logical processors of one physical core
+//  BENCH_PLACEMENT_L3     - different physical cores sharing an L3 cache
+//  BENCH_PLACEMENT_CORE   - different physical cores of the same socket
+//  BENCH_PLACEMENT_SOCKET - different sockets
+//
+//  On most single-socket Intel processors every core shares the one L3, so "l3" and "core" are the same;
+//  on processors with several L3 caches per socket (e.g. AMD's core complexes) they differ.
+//
+//  Only processor group 0 (the first 64 logical processors) is used.
+//
+//--------------------------------------------------------------------------------
+
+enum BenchPlacement {
+	BENCH_PLACEMENT_NONE,
+	BENCH_PLACEMENT_SMT,
+	BENCH_PLACEMENT_L3,
+	BENCH_PLACEMENT_CORE,
+	BENCH_PLACEMENT_SOCKET,
+	BENCH_PLACEMENT_COUNT
+};
+
+
+inline const char* benchPlacementName(unsigned placement) {
+
+	static const char* names[BENCH_PLACEMENT_COUNT] = { "none", "smt", "l3", "core", "socket" };
+	return placement < BENCH_PLACEMENT_COUNT ? names[placement] : "?";
+}
+
+
+// BENCH_PLACEMENT_COUNT if the name isn't one of the above
+inline unsigned benchParsePlacement(const std::string& name) {
+
+	for (unsigned p = 0; p < BENCH_PLACEMENT_COUNT; p++) if (name == benchPlacementName(p)) return p;
+	return BENCH_PLACEMENT_COUNT;
+}
+
+
+// The processor for thread 'index' from a list of processors to pin threads to, used round-robin, or ~0u
+// (not pinned) if the list is empty
+inline unsigned benchProcessorFor(const std::vector<unsigned>& processors, unsigned index) {
+	return processors.empty() ? ~0u : processors[index % processors.size()];
+}
+
+
+// A list of processors as text, "-" for none
+inline std::string benchProcessorList(const std::vector<unsigned>& processors) {
+
+	std::string text;
+	for (size_t i = 0; i < processors.size(); i++) {
+		if (i != 0) text += ",";
+		text += (processors[i] == ~0u) ? std::string("-") : std::to_string(processors[i]);
+	}
+	return text.empty() ? std::string("-") : text;
+}
+
+
+class BenchTopology {
+
+	unsigned long long processorMask;		// Every logical processor
+	std::vector<unsigned long long> coreMasks;	// Logical processors of each physical core
+	std::vector<unsigned long long> l3Masks;	// Logical processors sharing each L3 cache
+	std::vector<unsigned long long> packageMasks;	// Logical processors of each socket
+	std::vector<unsigned long long> numaMasks;	// Logical processors of each NUMA node
+
+public:
+
+	BenchTopology() : processorMask(0) {
+
+		DWORD length = 0;
+		GetLogicalProcessorInformationEx(RelationAll, NULL, &length);
+		if (length == 0) return;
+
+		std::vector<char> buffer(length);
+		PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) &buffer[0];
+		if (!GetLogicalProcessorInformationEx(RelationAll, info, &length)) return;
+
+		// The records are of different sizes, each giving its own
+		for (DWORD offset = 0; offset < length; offset += info->Size) {
+
+			info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) &buffer[offset];
+
+			if (info->Relationship == RelationProcessorCore || info->Relationship == RelationProcessorPackage) {
+				unsigned long long mask = 0;
+				for (WORD g = 0; g < info->Processor.GroupCount; g++) {
+					if (info->Processor.GroupMask[g].Group == 0) mask |= info->Processor.GroupMask[g].Mask;
+				}
+				if (mask == 0) continue;
+				if (info->Relationship == RelationProcessorCore) {
+					coreMasks.push_back(mask);
+					processorMask |= mask;
+				}
+				else packageMasks.push_back(mask);
+			}
+			else if (info->Relationship == RelationCache) {
+				if (info->Cache.Level == 3 && info->Cache.GroupMask.Group == 0 && info->Cache.GroupMask.Mask != 0) {
+					l3Masks.push_back(info->Cache.GroupMask.Mask);
+				}
+			}
+			else if (info->Relationship == RelationNumaNode) {
+				if (info->NumaNode.GroupMask.Group == 0 && info->NumaNode.GroupMask.Mask != 0) {
+					numaMasks.push_back(info->NumaNode.GroupMask.Mask);
+				}
+			}
+		}
+	}
+
+
+	unsigned processors(void) const {
+		return bitCount(processorMask);
+	}
+
+
+	unsigned cores(void) const {
+		return (unsigned) coreMasks.size();
+	}
+
+
+	unsigned l3Caches(void) const {
+		return (unsigned) l3Masks.size();
+	}
+
+
+	unsigned packages(void) const {
+		return (unsigned) packageMasks.size();
+	}
+
+
+	unsigned numaNodes(void) const {
+		return (unsigned) numaMasks.size();
+	}
+
+
+	// Adds the shape of the machine to a report record, so that results can be compared like for like
+	void describe(BenchRecord& record) const {
+
+		record.add("logical_processors", processors());
+		record.add("cores", cores());
+		record.add("l3_caches", l3Caches());
+		record.add("sockets", packages());
+		record.add("numa_nodes", numaNodes());
+	}
+
+
+	// Chooses 1 + count logical processors - an "anchor" (processors[0]) and 'count' more, each with the given
+	// placement relative to the anchor. When there are fewer suitable processors than 'count' they are used
+	// round-robin. Returns false if this machine has none (e.g. BENCH_PLACEMENT_SOCKET on a single socket
+	// machine). For BENCH_PLACEMENT_NONE all are returned as ~0u.
+	bool pickGroup(unsigned placement, unsigned count, std::vector<unsigned>* processors) const {
+
+		processors->assign(count + 1, ~0u);
+
+		unsigned anchor = ~0u;
+		std::vector<unsigned> others;
+
+		switch (placement) {
+
+		case BENCH_PLACEMENT_NONE:
+			return true;
+
+		case BENCH_PLACEMENT_SMT:
+			// The other logical processors of the anchor's own core
+			for (size_t c = 0; c < coreMasks.size() && others.empty(); c++) {
+				if (bitCount(coreMasks[c]) < 2) continue;
+				anchor = lowestBit(coreMasks[c]);
+				for (unsigned bit = anchor + 1; bit < 64; bit++) if (coreMasks[c] & (1ULL << bit)) others.push_back(bit);
+			}
+			break;
+
+		case BENCH_PLACEMENT_L3:
+			coresWithin(l3Masks, &anchor, &others);
+			break;
+
+		case BENCH_PLACEMENT_CORE:
+			coresWithin(packageMasks, &anchor, &others);
+			break;
+
+		case BENCH_PLACEMENT_SOCKET:
+			// The cores of the second socket
+			if (packageMasks.size() < 2) return false;
+			anchor = lowestBit(packageMasks[0]);
+			for (size_t c = 0; c < coreMasks.size(); c++) {
+				if (coreMasks[c] & packageMasks[1]) others.push_back(lowestBit(coreMasks[c] & packageMasks[1]));
+			}
+			break;
+		}
+
+		if (others.empty()) return false;
+
+		(*processors)[0] = anchor;
+		for (unsigned i = 1; i <= count; i++) (*processors)[i] = others[(i - 1) % others.size()];
+		return true;
+	}
+
+
+	// Chooses two logical processors with the given placement. Returns false if this machine has none. For
+	// BENCH_PLACEMENT_NONE both are returned as ~0u.
+	bool pickPair(unsigned placement, unsigned* first, unsigned* second) const {
+
+		std::vector<unsigned> pair;
+		bool found = pickGroup(placement, 1, &pair);
+		*first = found ? pair[0] : ~0u;
+		*second = found ? pair[1] : ~0u;
+		return found;
+	}
+
+
+	// Pins the calling thread to one logical processor. Does nothing for ~0u.
+	static bool pin(unsigned processor) {
+
+		if (processor == ~0u) return true;
+		return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << processor) != 0;
+	}
+
+
+	// Raises the priority class of the whole process - "normal", "high" or "realtime" - so that other work
+	// on the machine is less likely to interrupt the benchmark threads. Windows has no equivalent of Linux's
+	// "isolcpus"; keeping other processes off the pinned processors is up to the machine's setup. "realtime"
+	// needs administrator rights (without them Windows quietly gives "high"), and a spinning thread at
+	// realtime priority can starve the rest of the system. Returns false for an unknown name.
+	static bool setPriority(const std::string& priority) {
+
+		DWORD priorityClass;
+		if (priority == "normal") priorityClass = NORMAL_PRIORITY_CLASS;
+		else if (priority == "high") priorityClass = HIGH_PRIORITY_CLASS;
+		else if (priority == "realtime") priorityClass = REALTIME_PRIORITY_CLASS;
+		else return false;
+		return SetPriorityClass(GetCurrentProcess(), priorityClass) != 0;
+	}
+
+
+private:
+
+	// The first of 'scopes' (L3 caches or sockets) with at least two cores - its first core is the anchor
+	// and one processor of each of its other cores goes in 'others'
+	void coresWithin(const std::vector<unsigned long long>& scopes, unsigned* anchor, std::vector<unsigned>* others) const {
+
+		for (size_t s = 0; s < scopes.size() && others->empty(); s++) {
+			*anchor = ~0u;
+			for (size_t c = 0; c < coreMasks.size(); c++) {
+				if ((coreMasks[c] & scopes[s]) == 0) continue;
+				unsigned processor = lowestBit(coreMasks[c] & scopes[s]);
+				if (*anchor == ~0u) *anchor = processor;
+				else others->push_back(processor);
+			}
+		}
+	}
+
+
+	static unsigned bitCount(unsigned long long mask) {
+		unsigned count = 0;
+		for (; mask != 0; mask &= mask - 1) count++;
+		return count;
+	}
+
+
+	static unsigned lowestBit(unsigned long long mask) {
+		unsigned bit = 0;
+		while (bit < 63 && (mask & (1ULL << bit)) == 0) bit++;
+		return bit;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  BenchCounters
+//
+//  What the threads of a benchmark cost the processor, as well as how long they took. On Linux these would
+//  come from perf_event_open(); Windows has no counterpart that an ordinary process can use, so by default
+//  the counters are those that can be read without a driver or administrator rights;
+//
+//  cycles       - QueryThreadCycleTime(), the processor cycles charged to the thread (in user and kernel
+//                 mode, not counting time asleep). Always available.
+//  instructions - the processor's fixed-function "instructions retired" counter, read with rdpmc. Only
+//                 available where the OS lets user mode use rdpmc and something (e.g. a profiler) has
+//                 enabled the counter; otherwise rdpmc faults, which is caught, or reads a counter that
+//                 never moves, which is spotted. The counter belongs to the logical processor rather than
+//                 the thread, so it's only used for a thread that finished on the processor it started on
+//                 - pin the threads (see BenchTopology) to be sure of that.
+//
+//  Cache misses, cross-core dirty hits (HITM) and branch misses need programmable counters, which Windows
+//  only hands out to an ETW session run by an administrator. With "pmc=on" the harness starts one (see
+//  BenchPmcSession below); otherwise, or if that fails, they are reported as "n/a" - in their own columns,
+//  so that the records of every machine have the same fields.
+//
+//  Each thread takes a BenchCounterSnapshot at the start and the end of the part being measured. Once the
+//  threads have finished the differences are added up in a BenchCounterTotals.
+//
+//
+//  The PMC session
+//  ===============
+//
+//  BenchPmcSession runs the NT Kernel Logger with context switch events, and has Windows attach the values
+//  of up to three programmable counters ("profile sources") to each of them. The counts between two context
+//  switches on a logical processor are what the thread switched out used, so a consumer thread adds them up
+//  as runs ("slices") of each thread that has taken a snapshot. A thread's counts between its two snapshots
+//  are then those of its slices within that time - a slice only partly within it shared out by time.
+//
+//  The profile sources are looked up by name, as "wpr -pmcsources" lists them;
+//
+//  pmc_cache=LLCMisses  - last level cache misses (CacheMisses on processors without it)
+//  pmc_branch=BranchMispredictions
+//  pmc_hitm=            - Windows has no built-in source for cross-core dirty hits, so this names one
+//                         defined for the processor, if any (e.g. as a custom profile source)
+//
+//  A source that isn't there is reported as "n/a", as are all three if the session can't start - without
+//  administrator rights, or while another tool has the NT Kernel Logger. The session is stopped when the
+//  process exits normally; after a crash "logman stop "NT Kernel Logger" -ets" stops it.
+//
+//--------------------------------------------------------------------------------
+
+enum BenchPmcCounter {
+	BENCH_PMC_CACHE_MISSES,
+	BENCH_PMC_HITM,
+	BENCH_PMC_BRANCH_MISSES,
+	BENCH_PMC_COUNTERS		// Number of counters above
+};
+
+
+struct BenchCounterSnapshot {
+	unsigned long long cycles;		// QueryThreadCycleTime()
+	unsigned long long instructions;	// Instructions retired on this logical processor, if readable
+	bool instructionsValid;
+	unsigned processor;			// Logical processor the thread was on at the time
+	unsigned long threadId;			// For finding the thread's slices in the PMC session
+	unsigned long long ticks;		// QueryPerformanceCounter(), to compare with the PMC session's events
+};
+
+
+// The profile source names for each BenchPmcCounter - empty for none
+struct BenchPmcSources {
+	std::string names[BENCH_PMC_COUNTERS];
+};
+
+
+// The counts of BenchPmcSession's counters, each only if it could be read
+struct BenchPmcCounts {
+	double counts[BENCH_PMC_COUNTERS];
+	bool valid[BENCH_PMC_COUNTERS];
+};
+
+
+class BenchPmcSession {
+
+	// One thread's run on a logical processor, from being switched in to being switched out
+	struct Slice {
+		unsigned long long startTicks, endTicks;	// QueryPerformanceCounter() values
+		unsigned long long counts[BENCH_PMC_COUNTERS];
+	};
+
+	// The counters' values at the last context switch on a logical processor
+	struct Processor {
+		bool seen;
+		unsigned long long ticks;
+		unsigned long long values[BENCH_PMC_COUNTERS];
+	};
+
+	TRACEHANDLE session;
+	TRACEHANDLE consumer;
+	std::vector<char> properties;			// EVENT_TRACE_PROPERTIES and the logger name
+	std::thread consumerThread;
+	int slotOf[BENCH_PMC_COUNTERS];			// Position of each counter's value in an event (-1 - not collected)
+	unsigned slotCount;
+
+	std::mutex mutex;				// Protects what follows - shared with the consumer thread
+	std::map<unsigned long, std::vector<Slice> > slices;	// By thread id - only for threads that have taken a snapshot
+	std::vector<Processor> processors;		// By logical processor index
+	std::atomic<unsigned long long> latestTicks;	// Time stamp of the latest event consumed
+
+	BenchPmcSession() : session(0), consumer(INVALID_PROCESSTRACE_HANDLE), slotCount(0), latestTicks(0) {
+		for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) slotOf[c] = -1;
+	}
+
+public:
+
+	// The one session of the process - the NT Kernel Logger can only be run once at a time
+	static BenchPmcSession& instance(void) {
+		static BenchPmcSession only;
+		return only;
+	}
+
+
+	~BenchPmcSession() {
+		stop();
+	}
+
+
+	bool running(void) const {
+		return session != 0;
+	}
+
+
+	// Starts the session with those of the named profile sources the processor has. Returns false, with the
+	// reason in *problem, if it can't - in which case the counters are all "n/a".
+	bool start(const BenchPmcSources& sources, std::string* problem) {
+
+		if (running()) return true;
+
+		// Which profile sources are there, and their numbers
+		std::vector<ULONG> sourceIds;
+		if (!findSources(sources, &sourceIds, problem)) return false;
+
+		// The NT Kernel Logger, delivering context switch events in real time, time stamped with
+		// QueryPerformanceCounter() (ClientContext 1) so that they compare with the snapshots
+		properties.assign(sizeof(EVENT_TRACE_PROPERTIES) + sizeof(KERNEL_LOGGER_NAMEW), 0);
+		EVENT_TRACE_PROPERTIES* props = (EVENT_TRACE_PROPERTIES*) &properties[0];
+		props->Wnode.BufferSize = (ULONG) properties.size();
+		props->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+		props->Wnode.ClientContext = 1;
+		props->Wnode.Guid = systemTraceGuid();
+		props->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+		props->EnableFlags = EVENT_TRACE_FLAG_CSWITCH;
+		props->BufferSize = 1024;		// KB
+		props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+
+		TRACEHANDLE handle = 0;
+		ULONG status = StartTraceW(&handle, KERNEL_LOGGER_NAMEW, props);
+		if (status != ERROR_SUCCESS) {
+			*problem = (status == ERROR_ALREADY_EXISTS) ? "the NT Kernel Logger is already in use" :
+				(status == ERROR_ACCESS_DENIED) ? "administrator rights are needed" : "StartTrace() failed with " + std::to_string(status);
+			return false;
+		}
+		session = handle;
+
+		// The counters, then the events they are attached to - context switches (thread events, type 36)
+		CLASSIC_EVENT_ID contextSwitch = {};
+		contextSwitch.EventGuid = threadGuid();
+		contextSwitch.Type = 36;
+		status = TraceSetInformation(session, TracePmcCounterListInfo, &sourceIds[0], (ULONG) (sourceIds.size() * sizeof(ULONG)));
+		if (status == ERROR_SUCCESS) status = TraceSetInformation(session, TracePmcEventListInfo, &contextSwitch, sizeof(contextSwitch));
+		if (status != ERROR_SUCCESS) {
+			*problem = "the counters couldn't be attached to context switches (" + std::to_string(status) + ")";
+			stop();
+			return false;
+		}
+
+		// The consumer, on a thread of its own - ProcessTrace() only returns once the session stops
+		EVENT_TRACE_LOGFILEW logFile = {};
+		logFile.LoggerName = (LPWSTR) KERNEL_LOGGER_NAMEW;
+		logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD | PROCESS_TRACE_MODE_RAW_TIMESTAMP;
+		logFile.EventRecordCallback = onEvent;
+		logFile.Context = this;
+		consumer = OpenTraceW(&logFile);
+		if (consumer == INVALID_PROCESSTRACE_HANDLE) {
+			*problem = "OpenTrace() failed";
+			stop();
+			return false;
+		}
+		consumerThread = std::thread(consume, this);
+		return true;
+	}
+
+
+	void stop(void) {
+
+		if (session != 0) {
+			ControlTraceW(session, NULL, (EVENT_TRACE_PROPERTIES*) &properties[0], EVENT_TRACE_CONTROL_STOP);
+			session = 0;
+		}
+		if (consumer != INVALID_PROCESSTRACE_HANDLE) {
+			CloseTrace(consumer);
+			consumer = INVALID_PROCESSTRACE_HANDLE;
+		}
+		if (consumerThread.joinable()) consumerThread.join();
+	}
+
+
+	// Whether the counter is being collected
+	bool collecting(BenchPmcCounter counter) const {
+		return running() && slotOf[counter] >= 0;
+	}
+
+
+	// Called by BenchCounters::snapshot() - from now on the calling thread's slices are kept
+	void watch(unsigned long threadId) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		slices[threadId];
+	}
+
+
+	// Adds up the counts of the threads between their snapshots. Waits (briefly) for the events up to now to
+	// be consumed first. Returns false if they weren't.
+	bool sum(const std::vector<BenchCounterSnapshot>& starts, const std::vector<BenchCounterSnapshot>& ends,
+		BenchPmcCounts* totals) {
+
+		for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) {
+			totals->counts[c] = 0.0;
+			totals->valid[c] = collecting((BenchPmcCounter) c);
+		}
+		if (!running() || !settle()) {
+			for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) totals->valid[c] = false;
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (size_t t = 0; t < starts.size(); t++) {
+
+			std::map<unsigned long, std::vector<Slice> >::const_iterator found = slices.find(starts[t].threadId);
+			if (found == slices.end()) continue;
+
+			unsigned long long from = starts[t].ticks, to = ends[t].ticks;
+			const std::vector<Slice>& runs = found->second;
+
+			for (size_t s = 0; s < runs.size(); s++) {
+				unsigned long long start = std::max(runs[s].startTicks, from), end = std::min(runs[s].endTicks, to);
+				if (start > end) continue;
+				unsigned long long length = runs[s].endTicks - runs[s].startTicks;
+				double share = (length == 0) ? 1.0 : (double) (end - start) / (double) length;
+				for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) totals->counts[c] += share * (double) runs[s].counts[c];
+			}
+		}
+		return true;
+	}
+
+
+private:
+
+	// SystemTraceControlGuid and ThreadGuid, given here so as not to need INITGUID and their libraries
+	static GUID systemTraceGuid(void) {
+		GUID guid = { 0x9e814aad, 0x3204, 0x11d2, { 0x9a, 0x82, 0x00, 0x60, 0x08, 0xa8, 0x69, 0x39 } };
+		return guid;
+	}
+
+
+	static GUID threadGuid(void) {
+		GUID guid = { 0x3d6fa8d1, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } };
+		return guid;
+	}
+
+
+	// Looks up the named profile sources, setting slotOf[] and the list of source numbers for the session
+	bool findSources(const BenchPmcSources& sources, std::vector<ULONG>* sourceIds, std::string* problem) {
+
+		ULONG length = 0;
+		TraceQueryInformation(0, TraceProfileSourceListInfo, NULL, 0, &length);
+		if (length == 0) {
+			*problem = "the profile sources couldn't be listed";
+			return false;
+		}
+		std::vector<char> buffer(length);
+		if (TraceQueryInformation(0, TraceProfileSourceListInfo, &buffer[0], length, &length) != ERROR_SUCCESS) {
+			*problem = "the profile sources couldn't be listed";
+			return false;
+		}
+
+		for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) {
+
+			if (sources.names[c].empty()) continue;
+			std::wstring wanted(sources.names[c].begin(), sources.names[c].end());
+
+			for (ULONG offset = 0; offset < length; ) {
+				const PROFILE_SOURCE_INFO* info = (const PROFILE_SOURCE_INFO*) &buffer[offset];
+				if (wanted == info->Description) {
+					slotOf[c] = (int) sourceIds->size();
+					sourceIds->push_back(info->Source);
+					break;
+				}
+				if (info->NextEntryOffset == 0) break;
+				offset += info->NextEntryOffset;
+			}
+		}
+		slotCount = (unsigned) sourceIds->size();
+
+		if (slotCount == 0) {
+			*problem = "none of the profile sources was found";
+			return false;
+		}
+		return true;
+	}
+
+
+	static void consume(BenchPmcSession* self) {
+		TRACEHANDLE handle = self->consumer;
+		ProcessTrace(&handle, 1, NULL, NULL);
+	}
+
+
+	// Waits until the events up to now have been consumed - up to two seconds. Context switches never stop,
+	// so the latest time stamp soon passes any moment.
+	bool settle(void) {
+
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		ControlTraceW(session, NULL, (EVENT_TRACE_PROPERTIES*) &properties[0], EVENT_TRACE_CONTROL_FLUSH);
+
+		for (unsigned waited = 0; waited < 2000; waited += 10) {
+			if (latestTicks.load(std::memory_order_acquire) >= (unsigned long long) now.QuadPart) return true;
+			Sleep(10);
+		}
+		return false;
+	}
+
+
+	static VOID WINAPI onEvent(PEVENT_RECORD event) {
+		((BenchPmcSession*) event->UserContext)->contextSwitch(event);
+	}
+
+
+	// A context switch - what the processor's counters have counted since the last one was used by the
+	// thread being switched out
+	void contextSwitch(const EVENT_RECORD* event) {
+
+		unsigned long long ticks = (unsigned long long) event->EventHeader.TimeStamp.QuadPart;
+
+		if (IsEqualGUID(event->EventHeader.ProviderId, threadGuid()) && event->EventHeader.EventDescriptor.Opcode == 36 &&
+			event->UserDataLength >= 2 * sizeof(ULONG)) {
+
+			const ULONG64* values = NULL;
+			for (USHORT e = 0; e < event->ExtendedDataCount; e++) {
+				const EVENT_HEADER_EXTENDED_DATA_ITEM& item = event->ExtendedData[e];
+				if (item.ExtType == EVENT_HEADER_EXT_TYPE_PMC_COUNTERS && item.DataSize >= slotCount * sizeof(ULONG64)) {
+					values = (const ULONG64*) (ULONG_PTR) item.DataPtr;
+				}
+			}
+
+			if (values != NULL) {
+				const ULONG* threadIds = (const ULONG*) event->UserData;	// NewThreadId, then OldThreadId
+				unsigned index = event->BufferContext.ProcessorIndex;
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (index >= processors.size()) processors.resize(index + 1, Processor());
+				Processor& processor = processors[index];
+
+				unsigned long long now[BENCH_PMC_COUNTERS] = {};
+				for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) if (slotOf[c] >= 0) now[c] = values[slotOf[c]];
+
+				std::map<unsigned long, std::vector<Slice> >::iterator watched = slices.find(threadIds[1]);
+				if (processor.seen && watched != slices.end()) {
+					Slice slice;
+					slice.startTicks = processor.ticks;
+					slice.endTicks = ticks;
+					for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) slice.counts[c] = now[c] - processor.values[c];
+					watched->second.push_back(slice);
+				}
+				processor.seen = true;
+				processor.ticks = ticks;
+				for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) processor.values[c] = now[c];
+			}
+		}
+
+		if (ticks > latestTicks.load(std::memory_order_relaxed)) latestTicks.store(ticks, std::memory_order_release);
+	}
+};
+
+
+class BenchCounters {
+
+public:
+
+	static BenchCounterSnapshot snapshot(void) {
+
+		BenchCounterSnapshot snapshot;
+		ULONG64 cycles = 0;
+		QueryThreadCycleTime(GetCurrentThread(), &cycles);
+		snapshot.cycles = cycles;
+		snapshot.processor = GetCurrentProcessorNumber();
+		snapshot.instructionsValid = instructionsAvailable() && readInstructions(&snapshot.instructions);
+		if (!snapshot.instructionsValid) snapshot.instructions = 0;
+
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		snapshot.ticks = (unsigned long long) now.QuadPart;
+		snapshot.threadId = GetCurrentThreadId();
+		if (BenchPmcSession::instance().running()) BenchPmcSession::instance().watch(snapshot.threadId);
+		return snapshot;
+	}
+
+
+	// Whether the instructions retired counter can be read here - found out once, on first use
+	static bool instructionsAvailable(void) {
+
+		static const bool available = probeInstructions();
+		return available;
+	}
+
+
+private:
+
+	// Fixed-function counter 0 (rdpmc with bit 30 of the counter number set) is instructions retired on
+	// Intel processors. Elsewhere - or where user mode may not use rdpmc - the instruction faults, and the
+	// fault is caught. Structured exception handling is Microsoft-specific, so other compilers don't try.
+	static bool readInstructions(unsigned long long* count) {
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		__try {
+			*count = __readpmc(0x40000000);
+			return true;
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER) {
+			return false;
+		}
+#else
+		(void) count;
+		return false;
+#endif
+	}
+
+
+	// Readable and actually counting - a counter that nothing has enabled reads the same every time
+	static bool probeInstructions(void) {
+
+		unsigned long long before, after;
+		if (!readInstructions(&before)) return false;
+
+		volatile unsigned work = 0;
+		for (unsigned i = 0; i < 1000; i++) work += i;
+
+		return readInstructions(&after) && after != before;
+	}
+};
+
+
+class BenchCounterTotals {
+
+	unsigned long long cycles;
+	unsigned long long instructions;
+	bool instructionsValid;			// Every thread added gave a usable instruction count
+	std::vector<BenchCounterSnapshot> starts, ends;	// Each thread's snapshots, for the PMC session
+
+public:
+
+	BenchCounterTotals() : cycles(0), instructions(0), instructionsValid(true) {}
+
+
+	// Adds what one thread used between the two snapshots
+	void add(const BenchCounterSnapshot& start, const BenchCounterSnapshot& end) {
+
+		cycles += end.cycles - start.cycles;
+		if (start.instructionsValid && end.instructionsValid && start.processor == end.processor) {
+			instructions += end.instructions - start.instructions;
+		}
+		else instructionsValid = false;
+
+		if (BenchPmcSession::instance().running()) {
+			starts.push_back(start);
+			ends.push_back(end);
+		}
+	}
+
+
+	// Adds the counts per item to a report record, with "n/a" for those that couldn't be measured
+	void describe(BenchRecord& record, unsigned long long items) const {
+
+		double perItem = items ? 1.0 / (double) items : 0.0;
+
+		record.add("cycles_per_item", (double) cycles * perItem);
+		if (instructionsValid) {
+			record.add("instructions_per_item", (double) instructions * perItem);
+			record.add("ipc", cycles ? (double) instructions / (double) cycles : 0.0);
+		}
+		else {
+			record.add("instructions_per_item", "n/a");
+			record.add("ipc", "n/a");
+		}
+
+		// From the PMC session, if there is one - in BenchPmcCounter order
+		static const char* const names[BENCH_PMC_COUNTERS] = { "cache_misses_per_item", "hitm_per_item", "branch_misses_per_item" };
+		BenchPmcCounts pmc = {};
+		if (!starts.empty()) BenchPmcSession::instance().sum(starts, ends, &pmc);
+		for (unsigned c = 0; c < BENCH_PMC_COUNTERS; c++) {
+			if (pmc.valid[c]) record.add(names[c], pmc.counts[c] * perItem);
+			else record.add(names[c], "n/a");
+		}
+	}
+};
@@ -0,0 +1,53 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  The cache line size assumed by the software fifo template class and its companions.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains FIFO_CACHE_LINE_SIZE, by which the counters of FifoStats.h, the spinlocks of FifoLock.h
+//  and the baseline queues of FifoBaselines.h are padded, and by which FifoStorage.h walks an item when it
+//  prefetches it. It is a header of its own so that each of those can include it without needing the others.
+//
+//  64 bytes is right for current x86 and x64 processors. For anything else, define FIFO_CACHE_LINE_SIZE
+//  before including Fifo.h.
+//
+//
+
+
+#pragma once
+
+
+#ifndef FIFO_CACHE_LINE_SIZE
+#define FIFO_CACHE_LINE_SIZE		64
+#endif
+
+static_assert((FIFO_CACHE_LINE_SIZE & (FIFO_CACHE_LINE_SIZE - 1)) == 0, "FIFO_CACHE_LINE_SIZE must be a power of two");
@@ -0,0 +1,269 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Bulk copying of runs of items for the batch functions of the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the copy used by Fifo's batch functions - push_batch(), pop_try_batch() and
+//  pop_batch() - to move a contiguous run of items in or out of the ring in one go, rather than item by item.
+//
+//  For a trivially copyable T the run is copied as bytes. Which instructions are used is decided once, at
+//  run time, from what the processor (and the OS) supports;
+//
+//  FIFO_COPY_AVX512 - 64 byte AVX-512 loads and stores
+//  FIFO_COPY_AVX2   - 32 byte AVX2 loads and stores
+//  FIFO_COPY_SCALAR - memcpy(), the fallback
+//
+//  Runs shorter than FIFO_SIMD_MIN_BYTES are always left to memcpy(), which is already quick for a few
+//  bytes and has nothing to decide. The batch functions need a trivially copyable T - for anything else they
+//  fail to compile, rather than quietly falling back to assigning the items one by one.
+//
+//  Runs pushed in of at least FIFO_STREAM_MIN_BYTES are written with non-temporal ("streaming") stores,
+//  which go to memory without displacing the writer's cache. A run that long won't all still be in cache
+//  by the time the reader gets to it anyway, and the writer has no further use for it. The streaming stores
+//  are weakly ordered, so they are followed by a store fence before the mutex is released. Runs popped out
+//  use ordinary stores - the reader is about to use them.
+//
+//  Compiled with Visual Studio the AVX2 and AVX-512 instructions need no special compiler options; with GCC
+//  or Clang each copy function is marked as targeting its instruction set. Defining FIFO_SIMD as 0 leaves
+//  every copy to memcpy(). The benchmark harness ("mode=batch" in Fifo_Benchmark_Win.cpp) measures the
+//  bytes per second moved through a fifo by each kind of copy.
+//
+//
+
+
+#pragma once
+
+
+#include <intrin.h>		// For __cpuid(), __cpuidex() and _xgetbv()
+#include <immintrin.h>		// For the AVX2 and AVX-512 intrinsics
+
+#include <atomic>		// For the chosen copy
+#include <cstdint>		// For uintptr_t
+#include <cstring>		// For memcpy()
+#include <type_traits>		// For std::is_trivially_copyable
+
+
+
+#ifndef FIFO_SIMD
+#define FIFO_SIMD		1	// 0 - every copy is left to memcpy()
+#endif
+
+#ifndef FIFO_SIMD_MIN_BYTES
+#define FIFO_SIMD_MIN_BYTES	((size_t) 256)		// Shorter runs are left to memcpy()
+#endif
+
+#ifndef FIFO_STREAM_MIN_BYTES
+#define FIFO_STREAM_MIN_BYTES	((size_t) 256 * 1024)	// Runs pushed of at least this are written with streaming stores
+#endif
+
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FIFO_TARGET(isa)	__attribute__((target(isa)))
+#else
+#define FIFO_TARGET(isa)
+#endif
+
+
+#define FIFO_COPY_SCALAR	((unsigned) 0)
+#define FIFO_COPY_AVX2		((unsigned) 1)
+#define FIFO_COPY_AVX512	((unsigned) 2)
+
+#define FIFO_COPY_COUNT		((unsigned) 3)	// Number of kinds of copy above
+
+
+
+
+class FifoCopy {
+
+public:
+
+	// The kind of copy in use - the best this processor supports, unless use() has chosen another
+	static unsigned kind(void) {
+		return current().load(std::memory_order_relaxed);
+	}
+
+
+	// The best kind of copy this processor (and OS) supports
+	static unsigned best(void) {
+
+		static const unsigned detected = detect();
+		return detected;
+	}
+
+
+	// Uses the given kind of copy from now on - for benchmarking one against another. Returns false (and
+	// changes nothing) if this processor doesn't support it. Best called before any fifo is in use.
+	static bool use(unsigned copyKind) {
+
+		if (copyKind > best()) return false;
+		current().store(copyKind, std::memory_order_relaxed);
+		return true;
+	}
+
+
+	static const char* name(unsigned copyKind) {
+
+		static const char* names[FIFO_COPY_COUNT] = { "scalar", "avx2", "avx512" };
+		return copyKind < FIFO_COPY_COUNT ? names[copyKind] : "?";
+	}
+
+
+	// Copies 'bytes' bytes - with streaming stores if 'streaming' and the run is long enough
+	static void bytes(void* dest, const void* source, size_t bytes, bool streaming) {
+
+		if (bytes < FIFO_SIMD_MIN_BYTES) {
+			memcpy(dest, source, bytes);
+			return;
+		}
+
+		streaming = streaming && bytes >= FIFO_STREAM_MIN_BYTES;
+
+#if FIFO_SIMD
+		switch (kind()) {
+		case FIFO_COPY_AVX512: copyAvx512((char*) dest, (const char*) source, bytes, streaming); return;
+		case FIFO_COPY_AVX2: copyAvx2((char*) dest, (const char*) source, bytes, streaming); return;
+		}
+#endif
+		memcpy(dest, source, bytes);
+	}
+
+
+private:
+
+	static std::atomic<unsigned>& current(void) {
+
+		static std::atomic<unsigned> inUse(best());
+		return inUse;
+	}
+
+
+	static unsigned detect(void) {
+
+#if FIFO_SIMD
+		int info[4];
+
+		__cpuid(info, 0);
+		if (info[0] < 7) return FIFO_COPY_SCALAR;
+
+		// The OS must save the AVX registers (XCR0 bits 1 and 2) - and for AVX-512 the opmask and upper
+		// ZMM registers too (bits 5, 6 and 7) - when it switches threads
+		__cpuid(info, 1);
+		bool osSavesRegisters = (info[2] & (1 << 27)) != 0;
+		if (!osSavesRegisters) return FIFO_COPY_SCALAR;
+		unsigned long long xcr0 = _xgetbv(0);
+
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		bool avx512 = (info[1] & (1 << 16)) != 0;
+
+		if (avx512 && (xcr0 & 0xE6) == 0xE6) return FIFO_COPY_AVX512;
+		if (avx2 && (xcr0 & 0x06) == 0x06) return FIFO_COPY_AVX2;
+#endif
+		return FIFO_COPY_SCALAR;
+	}
+
+
+#if FIFO_SIMD
+
+	// Streaming stores must be aligned, so the start of the run up to the first aligned address is copied
+	// with memcpy() - a streaming run is long enough for that to be a small part of it
+	static void alignHead(char** dest, const char** source, size_t* bytes, size_t alignment) {
+
+		size_t head = (alignment - ((uintptr_t) *dest & (alignment - 1))) & (alignment - 1);
+		memcpy(*dest, *source, head);
+		*dest += head;
+		*source += head;
+		*bytes -= head;
+	}
+
+
+	FIFO_TARGET("avx2")
+	static void copyAvx2(char* dest, const char* source, size_t bytes, bool streaming) {
+
+		if (streaming) {
+			alignHead(&dest, &source, &bytes, 32);
+			for (; bytes >= 32; bytes -= 32, dest += 32, source += 32) {
+				_mm256_stream_si256((__m256i*) dest, _mm256_loadu_si256((const __m256i*) source));
+			}
+			_mm_sfence();
+		}
+		else {
+			// Two at a time, so that the loads of one pair can overlap the stores of the previous one
+			for (; bytes >= 64; bytes -= 64, dest += 64, source += 64) {
+				__m256i first = _mm256_loadu_si256((const __m256i*) source);
+				__m256i second = _mm256_loadu_si256((const __m256i*) (source + 32));
+				_mm256_storeu_si256((__m256i*) dest, first);
+				_mm256_storeu_si256((__m256i*) (dest + 32), second);
+			}
+		}
+		memcpy(dest, source, bytes);
+	}
+
+
+	FIFO_TARGET("avx512f")
+	static void copyAvx512(char* dest, const char* source, size_t bytes, bool streaming) {
+
+		if (streaming) {
+			alignHead(&dest, &source, &bytes, 64);
+			for (; bytes >= 64; bytes -= 64, dest += 64, source += 64) {
+				_mm512_stream_si512((__m512i*) dest, _mm512_loadu_si512((const void*) source));
+			}
+			_mm_sfence();
+		}
+		else {
+			for (; bytes >= 128; bytes -= 128, dest += 128, source += 128) {
+				__m512i first = _mm512_loadu_si512((const void*) source);
+				__m512i second = _mm512_loadu_si512((const void*) (source + 64));
+				_mm512_storeu_si512((void*) dest, first);
+				_mm512_storeu_si512((void*) (dest + 64), second);
+			}
+		}
+		memcpy(dest, source, bytes);
+	}
+
+#endif
+};
+
+
+
+
+// Copies 'count' items in bulk - T must be trivially copyable, which is checked here at compile time
+template <class T>
+inline void fifoCopyItems(T* dest, const T* source, unsigned count, bool streaming) {
+
+	static_assert(std::is_trivially_copyable<T>::value, "Batches can only be copied in bulk for a trivially copyable T");
+
+	if (count == 0) return;
+
+	FifoCopy::bytes(dest, source, (size_t) count * sizeof(T), streaming);
+}
@@ -0,0 +1,371 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Mutex policies for the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the locks that keep writer threads from pushing into the same ring position. The reader
+//  thread never takes one - it takes items once it has seen them counted in the population, after an acquire
+//  fence (see "The reader and the mutex" in Fifo.h). The lock is the fifth template parameter of Fifo, for
+//  example "Fifo<Work, 64, FifoEventWait, FifoStorageFor<Work, 64>::type, FifoTicketLock>"; the default is
+//  FifoCriticalSectionLock, the original CRITICAL_SECTION.
+//
+//  FifoCriticalSectionLock - a Windows CRITICAL_SECTION. A writer thread that finds it held gives up at once,
+//                            and push() returns FIFO_STATUS_LOCKED. Only a producer handle's publish waits.
+//  FifoTtasLock            - a test-and-test-and-set spinlock on a flag of its own cache line. Waiting threads
+//                            read the flag (which stays in their caches while it is held) and only try to set
+//                            it when they see it clear, backing off between reads.
+//  FifoTicketLock          - a ticket lock. Each thread takes the next ticket and waits until the ticket being
+//                            served is its own, so the threads get the lock in the order they asked for it.
+//
+//  With FifoTtasLock and FifoTicketLock writer threads wait their turn too ("writersWait"), rather than
+//  returning FIFO_STATUS_LOCKED and leaving the caller to try again. The ring is only held for as long as it
+//  takes to move one item (or, with a slab, one slot number) in or out - a few nanoseconds - which is far
+//  less than a CRITICAL_SECTION costs to take when there is any contention, and less than the caller's own
+//  retry loop would take to come round again.
+//
+//  It is included by Fifo.h (it uses FifoTsc from FifoStats.h) - include Fifo.h rather than this file.
+//
+//  Each lock provides;
+//
+//  tryLock()   - takes the lock if it is free, returning false if not
+//  lock()      - waits for the lock and takes it
+//  unlock()    - releases it
+//  writersWait - whether push() waits for the lock (lock()) or gives up if it is held (tryLock())
+//  name()      - a short name for the lock, for benchmark reports
+//
+//
+//  Backing off
+//  ===========
+//
+//  A thread waiting for a spinlock pauses between looks at it (YieldProcessor(), the "pause" instruction)
+//  for FIFO_LOCK_BACKOFF_MIN iterations at first, doubling each time up to FIFO_LOCK_BACKOFF_MAX, so that a
+//  crowd of waiting threads doesn't keep the lock's cache line bouncing between them. Once at the maximum,
+//  each further wait also calls SwitchToThread(). With more threads than processors ("oversubscribed") the
+//  thread holding the lock, or next in line for it, may not be running at all - spinning would only keep it
+//  off the processor for longer. This matters most for FifoTicketLock, where nobody else can take the lock
+//  out of turn.
+//
+//  The design brief (see Software_Fifo_Exercise_Win.cpp) allows any thread to pre-empt any other. A thread
+//  spinning at a higher priority than the one holding the lock may keep that thread off the processor until
+//  the spinner gets as far as SwitchToThread() - which only gives way to threads ready to run on the same
+//  processor. That is why the Critical Section, which puts its waiters to sleep, remains the default.
+//
+//  The model checker (Fifo_ModelCheck_Win.cpp) explores all three locks. It stands in for the Critical
+//  Section's Windows calls; the spinlocks are explored as they are, with a FIFO_SCHEDULE_POINT() before each
+//  access to their flag or tickets. With FIFO_MODEL_CHECK a waiting thread's backoff is a single
+//  YieldProcessor() - what matters there is what the other threads do meanwhile, not how long it waits.
+//
+//
+//  Retrying a push
+//  ===============
+//
+//  Fifo<>::push_retry() does a writer's retrying for it, within a FifoRetryBudget - a number of attempts, a
+//  time, or both. FIFO_STATUS_LOCKED means the FIFO was only busy - another writer had the mutex, or (with a
+//  slab) every slab slot was taken - and is retried, after a pause (FifoRetryBackoff) of a random length
+//  between half and all of a limit that doubles from FIFO_LOCK_BACKOFF_MIN to FIFO_LOCK_BACKOFF_MAX
+//  iterations as above. The randomness ("jitter") keeps writers that were turned away together from all
+//  coming back together. FIFO_STATUS_FULL and FIFO_STATUS_PREEMPTED mean the FIFO is truly full (PREEMPTED
+//  is found full with the mutex held, after another writer took the last position) - nothing but the reader
+//  can change that, so they are returned at once, for the caller to decide what to do.
+//
+//  Compared with a writer retrying at once in a tight loop, this costs a little latency for the item being
+//  retried, and saves the processor time spent on - and the contention caused by - attempts that had no
+//  chance. The benchmark harness's "mode=backoff" measures both with many writers.
+//
+//
+
+
+#pragma once
+
+
+#include "FifoCacheLine.h"	// For padding the spinlocks
+
+#include <windows.h>		// For the Critical Section, YieldProcessor() and SwitchToThread()
+#include <atomic>		// For the spinlock flag and tickets
+#include <cstdint>		// For uintptr_t
+
+
+
+#ifndef FIFO_LOCK_BACKOFF_MIN
+#define FIFO_LOCK_BACKOFF_MIN	((unsigned) 4)		// YieldProcessor() iterations after the first failed look
+#endif
+
+#ifndef FIFO_LOCK_BACKOFF_MAX
+#define FIFO_LOCK_BACKOFF_MAX	((unsigned) 1024)	// Most iterations between looks - then SwitchToThread() as well
+#endif
+
+static_assert(FIFO_LOCK_BACKOFF_MIN >= 1 && FIFO_LOCK_BACKOFF_MIN <= FIFO_LOCK_BACKOFF_MAX,
+	"FIFO_LOCK_BACKOFF_MIN must be at least 1 and no more than FIFO_LOCK_BACKOFF_MAX");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "The spinlocks need a lock-free std::atomic<unsigned>");
+
+
+
+
+// Exponential backoff for a thread waiting for a spinlock - see "Backing off" above
+class FifoBackoff {
+
+	unsigned limit;
+
+public:
+
+	FifoBackoff() : limit(FIFO_LOCK_BACKOFF_MIN) {}
+
+
+	void pause(void) {
+
+#if FIFO_MODEL_CHECK
+		YieldProcessor();
+#else
+		for (unsigned i = 0; i < limit; i++) YieldProcessor();
+
+		if (limit < FIFO_LOCK_BACKOFF_MAX) limit *= 2;
+		else SwitchToThread();
+#endif
+	}
+};
+
+
+
+
+class FifoCriticalSectionLock {
+
+	CRITICAL_SECTION section;
+
+public:
+
+	static const bool writersWait = false;
+
+
+	FifoCriticalSectionLock() {
+		InitializeCriticalSection(&section);
+	}
+
+
+	~FifoCriticalSectionLock() {
+		DeleteCriticalSection(&section);
+	}
+
+
+	bool tryLock(void) {
+		return TryEnterCriticalSection(&section) != 0;
+	}
+
+
+	void lock(void) {
+		EnterCriticalSection(&section);
+	}
+
+
+	void unlock(void) {
+		LeaveCriticalSection(&section);
+	}
+
+
+	static const char* name(void) {
+		return "critical_section";
+	}
+};
+
+
+
+
+// The flag is kept on a cache line of its own, so that waiting threads reading it don't slow down the thread
+// holding the lock as it works on the ring. Padded rather than aligned, as in FifoStats.h, since a Fifo may
+// be allocated with new.
+class FifoTtasLock {
+
+	char paddingBefore[FIFO_CACHE_LINE_SIZE];
+	std::atomic<unsigned> locked;
+	char paddingAfter[FIFO_CACHE_LINE_SIZE];
+
+public:
+
+	static const bool writersWait = true;
+
+
+	FifoTtasLock() : locked(0) {}
+
+
+	// Test before setting, so that a held lock costs a read rather than a write to its cache line
+	bool tryLock(void) {
+
+		FIFO_SCHEDULE_POINT("ttas: lock test");
+		if (locked.load(std::memory_order_relaxed) != 0) return false;
+		FIFO_SCHEDULE_POINT("ttas: lock exchange");
+		return locked.exchange(1, std::memory_order_acquire) == 0;
+	}
+
+
+	void lock(void) {
+
+		if (tryLock()) return;
+
+		FifoBackoff backoff;
+		do {
+			backoff.pause();
+		} while (!tryLock());
+	}
+
+
+	void unlock(void) {
+
+		FIFO_SCHEDULE_POINT("ttas: unlock");
+		locked.store(0, std::memory_order_release);
+	}
+
+
+	static const char* name(void) {
+		return "ttas";
+	}
+};
+
+
+
+
+// The ticket dispenser and the ticket being served are on cache lines of their own - a thread taking a
+// ticket doesn't disturb the threads watching for theirs to come up
+class FifoTicketLock {
+
+	char paddingBefore[FIFO_CACHE_LINE_SIZE];
+	std::atomic<unsigned> nextTicket;
+	char paddingBetween[FIFO_CACHE_LINE_SIZE];
+	std::atomic<unsigned> nowServing;
+	char paddingAfter[FIFO_CACHE_LINE_SIZE];
+
+public:
+
+	static const bool writersWait = true;
+
+
+	FifoTicketLock() : nextTicket(0), nowServing(0) {}
+
+
+	// Only takes a ticket if it would be served at once - i.e. nobody holds the lock or is waiting for it
+	bool tryLock(void) {
+
+		FIFO_SCHEDULE_POINT("ticket: serving test");
+		unsigned serving = nowServing.load(std::memory_order_acquire);
+		FIFO_SCHEDULE_POINT("ticket: take if served");
+		return nextTicket.compare_exchange_strong(serving, serving + 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+
+	void lock(void) {
+
+		FIFO_SCHEDULE_POINT("ticket: take ticket");
+		unsigned ticket = nextTicket.fetch_add(1, std::memory_order_relaxed);
+		FIFO_SCHEDULE_POINT("ticket: serving test");
+		if (nowServing.load(std::memory_order_acquire) == ticket) return;
+
+		FifoBackoff backoff;
+		do {
+			backoff.pause();
+		} while (nowServing.load(std::memory_order_acquire) != ticket);
+	}
+
+
+	// Only the holder changes nowServing, so a plain load and store will do
+	void unlock(void) {
+
+		FIFO_SCHEDULE_POINT("ticket: unlock");
+		nowServing.store(nowServing.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+
+	static const char* name(void) {
+		return "ticket";
+	}
+};
+
+
+
+
+// How long Fifo<>::push_retry() keeps trying - at most 'attempts' pushes (0 - no limit on the number) and for
+// at most 'microseconds' (0 - no limit on the time). With neither limit there is just the one attempt.
+struct FifoRetryBudget {
+	unsigned attempts;
+	unsigned microseconds;
+};
+
+
+
+
+// Exponential backoff with jitter between the attempts of Fifo<>::push_retry() - see "Retrying a push" above
+class FifoRetryBackoff {
+
+	unsigned limit;
+	unsigned attemptsLeft;		// 0 - attempts not limited
+	long long deadline;		// Performance counter time to give up at (0 - time not limited)
+	unsigned jitter;		// Xorshift generator state - never 0
+
+public:
+
+	explicit FifoRetryBackoff(const FifoRetryBudget& budget) : limit(FIFO_LOCK_BACKOFF_MIN), attemptsLeft(budget.attempts),
+		deadline(0) {
+
+		if (budget.attempts == 0 && budget.microseconds == 0) attemptsLeft = 1;
+
+		// The performance counter is only read when there is a time limit, and then only between attempts
+		if (budget.microseconds != 0) {
+			LARGE_INTEGER frequency, now;
+			QueryPerformanceFrequency(&frequency);
+			QueryPerformanceCounter(&now);
+			deadline = now.QuadPart + (long long) budget.microseconds * frequency.QuadPart / 1000000;
+		}
+
+		// Seeded differently by each push_retry() call that needs it - from the time-stamp counter and the stack address
+		jitter = ((unsigned) FifoTsc::now() ^ (unsigned) (uintptr_t) this) | 1;
+	}
+
+
+	// Called after each failed attempt. Returns false, without pausing, if the budget has been spent.
+	bool pause(void) {
+
+		if (attemptsLeft != 0 && --attemptsLeft == 0) return false;
+		if (deadline != 0) {
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			if (now.QuadPart >= deadline) return false;
+		}
+
+		jitter ^= jitter << 13;
+		jitter ^= jitter >> 17;
+		jitter ^= jitter << 5;
+		unsigned spins = limit / 2 + jitter % (limit - limit / 2 + 1);
+		for (unsigned i = 0; i < spins; i++) YieldProcessor();
+
+		if (limit < FIFO_LOCK_BACKOFF_MAX) limit *= 2;
+		else SwitchToThread();
+		return true;
+	}
+};
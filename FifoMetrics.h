@@ -0,0 +1,292 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  A process-wide registry of named fifos, and their metrics in Prometheus text format.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains;
+//
+//  FifoRegistry      - the list of all named fifos in the process. A Fifo constructed with a name
+//                      ("Fifo<int> workQueue("work")") adds itself to the registry, and removes itself again
+//                      when it is destroyed. A Fifo constructed without a name is not registered.
+//  FifoMetricsWriter - builds the Prometheus text exposition of the metrics of every registered fifo.
+//
+//  It is included by Fifo.h (it uses the status codes and FifoStats.h), so include Fifo.h rather than this
+//  file. See FifoMetricsExporter.h for a thread that regularly writes the metrics to a file or serves them
+//  on a local socket.
+//
+//  Registering costs push() and pop() nothing at all - the registry is only touched when a named Fifo is
+//  constructed or destroyed, and when metrics are collected. Collection runs on whichever thread asks for
+//  it (normally the exporter's), reading each fifo's instrumentation snapshots (see FifoStats.h) without
+//  resetting them, so counters keep counting up as Prometheus expects. Which metrics a fifo has depends on
+//  which instrumentation is compiled in - the capacity and population are always there.
+//
+//
+
+
+#pragma once
+
+
+#include <cstdio>		// For snprintf()
+#include <map>			// For grouping samples into metric families
+#include <mutex>		// For the registry lock
+#include <string>		// For the string class
+#include <vector>
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoMetricsWriter
+//
+//  Collects metric samples and renders them in the Prometheus text exposition format. Prometheus wants all
+//  the samples of one metric ("family") together under a single HELP and TYPE line, but they are collected
+//  fifo by fifo, so they are grouped by family here and only rendered at the end.
+//
+//--------------------------------------------------------------------------------
+
+class FifoMetricsWriter {
+
+	struct Family {
+		std::string help;
+		std::string type;			// "gauge", "counter" or "summary"
+		std::vector<std::string> samples;	// Complete sample lines
+	};
+
+	std::map<std::string, Family> families;	// By family name - so output is in name order
+	std::string fifoLabel;			// 'fifo="name"' of the fifo being collected
+
+public:
+
+	// Subsequent samples are for the fifo with this name
+	void beginFifo(const std::string& name) {
+		fifoLabel = "fifo=\"" + escape(name) + "\"";
+	}
+
+
+	void gauge(const std::string& name, const std::string& help, double value, const std::string& extraLabels = "") {
+		sample(name, name, help, "gauge", value, extraLabels);
+	}
+
+
+	void counter(const std::string& name, const std::string& help, double value, const std::string& extraLabels = "") {
+		sample(name, name, help, "counter", value, extraLabels);
+	}
+
+
+	// A summary - quantiles, sum and count of a set of observations, here from a FifoHistogram snapshot
+	void summary(const std::string& name, const std::string& help, const FifoHistogramSnapshot& snapshot, double secondsPerTick) {
+
+		sample(name, name, help, "summary", (double) snapshot.p50Ticks * secondsPerTick, "quantile=\"0.5\"");
+		sample(name, name, help, "summary", (double) snapshot.p99Ticks * secondsPerTick, "quantile=\"0.99\"");
+		sample(name, name, help, "summary", (double) snapshot.p999Ticks * secondsPerTick, "quantile=\"0.999\"");
+		// The exact sum, not the mean times the count - the mean is rounded down by a different amount each
+		// time, so the product could go down between scrapes, which a Prometheus sum must never do
+		sample(name, name + "_sum", help, "summary", (double) snapshot.sumTicks * secondsPerTick, "");
+		sample(name, name + "_count", help, "summary", (double) snapshot.count, "");
+	}
+
+
+	// The metrics of each kind of instrumentation (see FifoStats.h), from snapshots taken without resetting
+
+	void outcomes(const FifoOutcomeSnapshot& snapshot) {
+
+		static const char* statusLabels[FIFO_STATUS_COUNT] = { "success", "full", "empty", "locked", "preempted" };
+
+		for (unsigned status = 0; status < FIFO_STATUS_COUNT; status++) {
+			if (status == (unsigned) FIFO_STATUS_EMPTY) continue;	// push() never returns it
+			counter("fifo_push_total", "push() calls by returned status.", (double) snapshot.push[status],
+				std::string("status=\"") + statusLabels[status] + "\"");
+		}
+		counter("fifo_popped_total", "Items obtained by pop() or pop_try().", (double) snapshot.popped);
+		counter("fifo_pop_empty_total", "pop_try() calls that found the FIFO empty.", (double) snapshot.popEmpty);
+	}
+
+
+	void latency(const FifoHistogramSnapshot& snapshot) {
+
+		summary("fifo_latency_seconds", "Time spent in the FIFO by popped items.", snapshot, secondsPerTick());
+		gauge("fifo_latency_max_seconds", "Longest time spent in the FIFO by a popped item.", (double) snapshot.maxTicks * secondsPerTick());
+	}
+
+
+	void occupancy(const FifoOccupancySnapshot& snapshot) {
+
+		gauge("fifo_occupancy_high_water_mark", "Highest population seen by the reader thread.", (double) snapshot.highWaterMark);
+		gauge("fifo_occupancy_average", "Time-weighted average population seen by the reader thread.", snapshot.averagePopulation);
+	}
+
+
+	// Only writer threads take the mutex (see "The reader and the mutex" in Fifo.h), so these are all theirs
+	void locks(const FifoLockSnapshot& snapshot) {
+
+		const FifoLockSideSnapshot& writer = snapshot.writer;
+
+		counter("fifo_lock_acquisitions_total", "Mutex acquisitions by writer threads.", (double) writer.acquisitions);
+		counter("fifo_lock_contended_total", "Writer attempts that found another thread holding the mutex.", (double) writer.contended);
+		counter("fifo_lock_wait_seconds_total", "Time writer threads spent waiting for the mutex.", (double) writer.waitTicksTotal * secondsPerTick());
+		counter("fifo_lock_hold_seconds_total", "Time writer threads held the mutex.", (double) writer.holdTicksTotal * secondsPerTick());
+		gauge("fifo_lock_hold_max_seconds", "Longest time a writer thread held the mutex.", (double) writer.holdTicksMax * secondsPerTick());
+	}
+
+
+	// The complete exposition
+	std::string render(void) const {
+
+		std::string text;
+
+		for (std::map<std::string, Family>::const_iterator f = families.begin(); f != families.end(); ++f) {
+			text += "# HELP " + f->first + " " + f->second.help + "\n";
+			text += "# TYPE " + f->first + " " + f->second.type + "\n";
+			for (size_t s = 0; s < f->second.samples.size(); s++) text += f->second.samples[s] + "\n";
+		}
+		return text;
+	}
+
+
+private:
+
+	static double secondsPerTick(void) {
+		return 1e-9 / FifoTsc::ticksPerNanosecond();
+	}
+
+
+	void sample(const std::string& family, const std::string& name, const std::string& help, const std::string& type, double value, const std::string& extraLabels) {
+
+		Family& entry = families[family];
+		entry.help = help;
+		entry.type = type;
+
+		char number[32];
+		snprintf(number, sizeof(number), "%.17g", value);
+		entry.samples.push_back(name + "{" + fifoLabel + (extraLabels.empty() ? "" : "," + extraLabels) + "} " + number);
+	}
+
+
+	// Label values escape backslash, double quote and newline
+	static std::string escape(const std::string& text) {
+
+		std::string escaped;
+		for (size_t i = 0; i < text.size(); i++) {
+			if (text[i] == '\\') escaped += "\\\\";
+			else if (text[i] == '"') escaped += "\\\"";
+			else if (text[i] == '\n') escaped += "\\n";
+			else escaped += text[i];
+		}
+		return escaped;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoRegistry
+//
+//  Every registered fifo is held as its name, its address and a function that knows how to collect its
+//  metrics (Fifo<>::collectMetrics() for the fifo's own template arguments), so fifos of any type and
+//  capacity can share the one registry.
+//
+//  The registry's mutex is held while metrics are collected, and a Fifo's destructor removes it from the
+//  registry (taking the same mutex) before anything else, so a fifo can never be destroyed part way through
+//  having its metrics collected.
+//
+//--------------------------------------------------------------------------------
+
+typedef void (*FifoCollectFunction)(void* fifo, FifoMetricsWriter& out);
+
+
+class FifoRegistry {
+
+	struct Entry {
+		std::string name;
+		void* fifo;
+		FifoCollectFunction collect;
+	};
+
+	std::mutex mutex;
+	std::vector<Entry> entries;
+
+	FifoRegistry() {}
+
+public:
+
+	// The one registry of this process
+	static FifoRegistry& instance(void) {
+		static FifoRegistry registry;
+		return registry;
+	}
+
+
+	void add(const std::string& name, void* fifo, FifoCollectFunction collect) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry entry = { name, fifo, collect };
+		entries.push_back(entry);
+	}
+
+
+	void remove(void* fifo) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].fifo == fifo) {
+				entries.erase(entries.begin() + i);
+				return;
+			}
+		}
+	}
+
+
+	size_t size(void) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+
+	// The metrics of every registered fifo, in Prometheus text format
+	std::string collectPrometheus(void) {
+
+		FifoMetricsWriter out;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < entries.size(); i++) {
+				out.beginFifo(entries[i].name);
+				entries[i].collect(entries[i].fifo, out);
+			}
+		}
+		return out.render();
+	}
+};
@@ -0,0 +1,263 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  A background exporter of the metrics of every named fifo, in Prometheus text format.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains FifoMetricsExporter, which runs a thread of its own that collects the metrics of the
+//  fifos in the FifoRegistry (see FifoMetrics.h) and makes them available in one of two ways;
+//
+//  startFile()   - every so often the metrics are written to a file, for example for the node_exporter
+//                  "textfile" collector. The file is written under a temporary name and then moved over the
+//                  previous one, so a reader never sees a half written file.
+//  startSocket() - the metrics are served on a local (AF_UNIX) socket. Each connection gets the metrics as
+//                  they are at that moment, as a minimal HTTP/1.0 response, so for example
+//                  "curl --unix-socket fifo.sock http://localhost/metrics" works. AF_UNIX sockets need
+//                  Windows 10 version 1803 or later.
+//
+//  All of the collecting and formatting is done on the exporter's thread - push() and pop() are not
+//  affected at all.
+//
+//  This file includes <winsock2.h>, which must be included before <windows.h>, so include this file before
+//  Fifo.h (and before anything else that includes <windows.h>). Links with Ws2_32.lib.
+//
+//
+
+
+#pragma once
+
+
+#include <winsock2.h>		// For the local socket - must come before <windows.h>
+#include <afunix.h>		// For AF_UNIX sockets
+#include <windows.h>		// For MoveFileEx()
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#include "Fifo.h"		// For the FifoRegistry
+
+#include <chrono>		// For the interval between exports
+#include <condition_variable>	// For waking the exporter thread when it's stopped
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+
+
+class FifoMetricsExporter {
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable stopSignal;
+	bool stopRequested;			// Protected by mutex
+
+	std::string path;			// File, or socket, path
+	unsigned intervalMilliseconds;		// startFile() - time between writes
+	SOCKET listener;			// startSocket() - INVALID_SOCKET otherwise
+
+public:
+
+	FifoMetricsExporter() : stopRequested(false), intervalMilliseconds(0), listener(INVALID_SOCKET) {}
+
+
+	~FifoMetricsExporter() {
+		stop();
+	}
+
+
+	// Writes the metrics to filePath now and then every intervalMs milliseconds until stop(), which writes
+	// them one last time. Returns false if the exporter is already running or the first write fails.
+	bool startFile(const std::string& filePath, unsigned intervalMs) {
+
+		if (worker.joinable()) return false;
+		if (!writeFile(filePath)) return false;
+
+		path = filePath;
+		intervalMilliseconds = intervalMs < 10 ? 10 : intervalMs;
+		stopRequested = false;
+		worker = std::thread(&FifoMetricsExporter::fileLoop, this);
+		return true;
+	}
+
+
+	// Serves the metrics on an AF_UNIX socket at socketPath until stop(). Any file already at socketPath (a
+	// socket left behind by an earlier run) is deleted first. Returns false if the exporter is already
+	// running or the socket can't be set up.
+	bool startSocket(const std::string& socketPath) {
+
+		if (worker.joinable()) return false;
+
+		sockaddr_un address;
+		if (socketPath.size() >= sizeof(address.sun_path)) return false;
+
+		WSADATA wsaData;
+		if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return false;
+
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener == INVALID_SOCKET) {
+			WSACleanup();
+			return false;
+		}
+
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strcpy(address.sun_path, socketPath.c_str());
+		DeleteFileA(socketPath.c_str());
+
+		if (bind(listener, (sockaddr*) &address, sizeof(address)) == SOCKET_ERROR || listen(listener, 4) == SOCKET_ERROR) {
+			closesocket(listener);
+			listener = INVALID_SOCKET;
+			WSACleanup();
+			return false;
+		}
+
+		path = socketPath;
+		stopRequested = false;
+		worker = std::thread(&FifoMetricsExporter::socketLoop, this);
+		return true;
+	}
+
+
+	// Stops the exporter thread, if running. Call before destroying the fifos whose final figures should be
+	// exported - they leave the registry when they are destroyed.
+	void stop(void) {
+
+		if (!worker.joinable()) return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopRequested = true;
+		}
+		stopSignal.notify_all();
+		worker.join();
+
+		if (listener != INVALID_SOCKET) {
+			closesocket(listener);
+			listener = INVALID_SOCKET;
+			DeleteFileA(path.c_str());
+			WSACleanup();
+		}
+		else {
+			writeFile(path);
+		}
+	}
+
+
+	// Writes the metrics of every named fifo to filePath once, replacing the file as a whole
+	static bool writeFile(const std::string& filePath) {
+
+		std::string text = FifoRegistry::instance().collectPrometheus();
+		std::string temporaryPath = filePath + ".tmp";
+
+		{
+			std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+			if (!file) return false;
+			file << text;
+			if (!file.flush()) return false;
+		}
+
+		return MoveFileExA(temporaryPath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+	}
+
+
+private:
+
+	void fileLoop(void) {
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (!stopSignal.wait_for(lock, std::chrono::milliseconds(intervalMilliseconds), [this] { return stopRequested; })) {
+
+			lock.unlock();
+			writeFile(path);
+			lock.lock();
+		}
+	}
+
+
+	void socketLoop(void) {
+
+		while (!stopping()) {
+
+			// Wait up to 100ms for a connection, so that stop() is noticed promptly
+			fd_set readable;
+			FD_ZERO(&readable);
+			FD_SET(listener, &readable);
+			timeval timeout = { 0, 100000 };
+
+			if (select((int) listener + 1, &readable, NULL, NULL, &timeout) <= 0) continue;
+
+			SOCKET client = accept(listener, NULL, NULL);
+			if (client == INVALID_SOCKET) continue;
+
+			serve(client);
+			closesocket(client);
+		}
+	}
+
+
+	bool stopping(void) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		return stopRequested;
+	}
+
+
+	// Reads (and ignores) the request, if the client sends one, then sends the metrics
+	static void serve(SOCKET client) {
+
+		DWORD receiveTimeoutMs = 200;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*) &receiveTimeoutMs, sizeof(receiveTimeoutMs));
+
+		char request[1024];
+		std::string received;
+		while (received.find("\r\n\r\n") == std::string::npos && received.size() < 8192) {
+			int length = recv(client, request, sizeof(request), 0);
+			if (length <= 0) break;
+			received.append(request, length);
+		}
+
+		std::string body = FifoRegistry::instance().collectPrometheus();
+		std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+			std::to_string(body.size()) + "\r\n\r\n" + body;
+
+		size_t sent = 0;
+		while (sent < response.size()) {
+			int length = send(client, response.c_str() + sent, (int) (response.size() - sent), 0);
+			if (length <= 0) break;
+			sent += length;
+		}
+		shutdown(client, SD_SEND);
+	}
+};
@@ -0,0 +1,757 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//
+//  Schedule exploration (model checking) for the software fifo template class and its wait strategies.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file is only used when FIFO_MODEL_CHECK is defined as 1, as it is by the model checking Console App
+//  (Fifo_ModelCheck_Win.cpp). Fifo.h then includes it, and from there on the Windows synchronisation calls
+//  made by Fifo.h, FifoWait.h and FifoLock.h - the Critical Section, the Event, WaitOnAddress(), the slim
+//  reader/writer lock and condition variable, and YieldProcessor() - are redirected to stand-ins here. Nothing
+//  else in the fifo changes.
+//
+//  The stand-ins let FifoModelScheduler decide which thread runs when. Only one thread ever runs at a time,
+//  and it runs until its next "schedule point" - any of the redirected calls, or a FIFO_SCHEDULE_POINT() in
+//  Fifo.h, FifoWait.h, FifoStorage.h or FifoLock.h, placed before each access to shared state that isn't
+//  protected by the mutex (the population tests, the "sleeping" flags, the slab slot flags, the spinlocks). There the scheduler either lets it carry on or switches to
+//  another thread. Each run of a test (an "execution") is therefore fully determined by the choices made at
+//  its schedule points, and the choices can be recorded, replayed, and systematically varied;
+//
+//  - search=dfs    - every execution there is, by depth-first search over the choices - CHESS-style
+//  - search=random - pseudo-random choices, for when depth-first search would take too long
+//
+//  The number of interleavings grows very quickly, so as in CHESS the number of preemptions - switches away
+//  from a thread that could have carried on - is bounded. Switches when a thread blocks, spins or finishes are
+//  free. Most concurrency bugs need only one or two preemptions to show, and with the fifo's small
+//  capacities and thread counts depth-first search to a bound of two or three completes in seconds.
+//
+//  An execution fails if;
+//
+//  - deadlock   - no thread can run, yet not all have finished - for example the reader asleep in pop() with
+//                 an item in the FIFO, having missed its wake-up (a "lost wake-up")
+//  - livelock   - FIFO_MODEL_STEP_LIMIT schedule points pass without the execution finishing, or every thread
+//                 left is spinning in YieldProcessor() and none can make progress
+//
+//  or if the test finds the results wrong (Fifo_ModelCheck_Win.cpp checks them with the StressChecker in
+//  FifoStress.h, using the scheduler's step count as the clock). Each failure comes with the schedule that
+//  led to it, as a string of choices to replay it with, and a trace of every step each thread took.
+//
+//  Limitations - threads run one at a time, so every execution is sequentially consistent. The checker
+//  explores interleavings, not the reorderings allowed by the processor's memory model, so the memory fences
+//  in FifoWait.h are taken on trust. Timeouts are treated as INFINITE, and the stand-ins never wake up
+//  spuriously.
+//
+//
+//  Yielding
+//  ========
+//
+//  A thread that spins (calls YieldProcessor()) can't make progress until another thread does something, so
+//  a spinning thread isn't run again until every other thread that could run has taken a step. This keeps
+//  spin loops from being explored one iteration at a time for ever, and makes sure that a thread that is
+//  being spun on does get to run. If every thread left is spinning, nothing can ever change, which is
+//  reported as a livelock.
+//
+//
+//  Testing a new wait strategy
+//  ===========================
+//
+//  A wait strategy that only uses the redirected calls is explored as it stands. Put a FIFO_SCHEDULE_POINT()
+//  before each of its accesses to memory shared between threads (flags, counters, the population) and add it
+//  to the list of policies in Fifo_ModelCheck_Win.cpp.
+//
+//
+
+
+#pragma once
+
+
+#include <windows.h>		// For the types of the calls that are redirected
+#include <condition_variable>	// For handing the baton from thread to thread
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>		// For search=random
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+#define FIFO_MODEL_NO_THREAD		(~0u)
+#define FIFO_MODEL_MAX_THREADS		((unsigned) 32)
+#define FIFO_MODEL_STEP_LIMIT		((unsigned long long) 2000)	// Schedule points in one execution before it's a livelock
+
+#define FIFO_MODEL_SEARCH_DFS		((unsigned) 0)
+#define FIFO_MODEL_SEARCH_RANDOM	((unsigned) 1)
+
+
+
+
+// One step of an execution - a thread reaching a schedule point
+struct FifoModelStep {
+	unsigned thread;
+	const char* label;
+};
+
+
+// Thrown through each thread of an execution that has failed, to end it
+struct FifoModelAbort {};
+
+
+// The stand-in for a Windows Event. The HANDLE returned by the stand-in CreateEvent() points to one of these.
+struct FifoModelEvent {
+	bool manualReset;
+	bool signaled;
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoModelScheduler
+//
+//--------------------------------------------------------------------------------
+
+class FifoModelScheduler {
+
+	struct Thread {
+		bool finished;
+		unsigned awaiting;		// Called YieldProcessor() - not run again until each of these threads (a bit
+						// mask) has taken a step
+		std::function<bool()> ready;	// Blocked until this returns true - empty if not blocked
+		const void* waitingOn;		// Address (or condition variable) waited on, until woken - NULL if none
+		const char* label;		// The thread's latest schedule point
+	};
+
+	struct Decision {
+		unsigned options;		// Threads that could have been chosen
+		unsigned chosen;
+	};
+
+	// The baton - only the thread named by 'running' runs
+	std::mutex batonMutex;
+	std::condition_variable batonSignal;
+	unsigned running;
+	bool aborting;
+
+	// The current execution
+	std::vector<Thread> threads;
+	unsigned long long steps;
+	unsigned preemptions;
+	std::vector<FifoModelStep> trace;
+	std::vector<Decision> decisions;
+	std::string failure;
+
+	// The search
+	unsigned search;
+	unsigned preemptionBound;
+	std::mt19937 random;
+	std::vector<unsigned> prefix;		// Choices to make at the start of the next execution
+
+	// Owner thread of each Critical Section and slim reader/writer lock, by address
+	std::map<const void*, unsigned> owners;
+
+	FifoModelScheduler() : running(FIFO_MODEL_NO_THREAD), aborting(false), steps(0), preemptions(0),
+		search(FIFO_MODEL_SEARCH_DFS), preemptionBound(2) {}
+
+public:
+
+	// The one scheduler of this process
+	static FifoModelScheduler& instance(void) {
+		static FifoModelScheduler scheduler;
+		return scheduler;
+	}
+
+
+	// Starts a new search. The first execution begins with the choices in 'replay' (from schedule() of an
+	// earlier execution), if any.
+	void startSearch(unsigned searchKind, unsigned bound, unsigned seed, const std::vector<unsigned>& replay) {
+
+		search = searchKind;
+		preemptionBound = bound;
+		random.seed(seed);
+		prefix = replay;
+	}
+
+
+	// Runs one execution - body(thread) on each of threadCount (up to FIFO_MODEL_MAX_THREADS) threads,
+	// interleaved as the search chooses. Returns false if the execution deadlocked or livelocked (see
+	// getFailure()).
+	bool execute(unsigned threadCount, const std::function<void(unsigned)>& body) {
+
+		if (threadCount > FIFO_MODEL_MAX_THREADS) {
+			failure = "too many threads";
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(batonMutex);
+
+			Thread fresh = { false, 0, std::function<bool()>(), NULL, "start" };
+			threads.assign(threadCount, fresh);
+			steps = 0;
+			preemptions = 0;
+			trace.clear();
+			decisions.clear();
+			failure.clear();
+			aborting = false;
+			running = FIFO_MODEL_NO_THREAD;
+		}
+
+		std::vector<std::thread> workers;
+		for (unsigned t = 0; t < threadCount; t++) workers.push_back(std::thread(&FifoModelScheduler::threadMain, this, t, &body));
+
+		// Choose the first thread to run
+		{
+			std::lock_guard<std::mutex> lock(batonMutex);
+			running = choose(FIFO_MODEL_NO_THREAD);
+			if (!failure.empty()) aborting = true;
+		}
+		batonSignal.notify_all();
+
+		for (unsigned t = 0; t < threadCount; t++) workers[t].join();
+		return failure.empty();
+	}
+
+
+	// Prepares the next execution. Returns false if depth-first search has tried every schedule.
+	bool nextExecution(void) {
+
+		prefix.clear();
+		if (search == FIFO_MODEL_SEARCH_RANDOM) return true;
+
+		// Back up to the latest choice that has an alternative not yet tried, and try it
+		while (!decisions.empty() && decisions.back().chosen + 1 >= decisions.back().options) decisions.pop_back();
+		if (decisions.empty()) return false;
+
+		decisions.back().chosen++;
+		for (size_t d = 0; d < decisions.size(); d++) prefix.push_back(decisions[d].chosen);
+		return true;
+	}
+
+
+	// The choices made in the latest execution - pass to startSearch() to replay it
+	std::vector<unsigned> schedule(void) const {
+
+		std::vector<unsigned> choices;
+		for (size_t d = 0; d < decisions.size(); d++) choices.push_back(decisions[d].chosen);
+		return choices;
+	}
+
+
+	const std::string& getFailure(void) const {
+		return failure;
+	}
+
+
+	const std::vector<FifoModelStep>& getTrace(void) const {
+		return trace;
+	}
+
+
+	unsigned getPreemptions(void) const {
+		return preemptions;
+	}
+
+
+	// The logical clock - the number of steps taken so far in this execution
+	unsigned long long now(void) const {
+		return steps;
+	}
+
+
+	// Which thread of the execution is calling, or FIFO_MODEL_NO_THREAD if it isn't one (the main thread,
+	// constructing or destroying the fifo)
+	static unsigned& self(void) {
+		static thread_local unsigned thread = FIFO_MODEL_NO_THREAD;
+		return thread;
+	}
+
+
+	//  Schedule points
+
+
+	// The calling thread may be switched away from here
+	void point(const char* label) {
+
+		unsigned me = self();
+		if (me == FIFO_MODEL_NO_THREAD) return;
+
+		std::unique_lock<std::mutex> lock(batonMutex);
+		step(lock, me, label);
+	}
+
+
+	// The calling thread is spinning - run the others until each of them has taken a step
+	void yield(const char* label) {
+
+		unsigned me = self();
+		if (me == FIFO_MODEL_NO_THREAD) return;
+
+		std::unique_lock<std::mutex> lock(batonMutex);
+
+		unsigned others = 0;
+		for (unsigned t = 0; t < threads.size(); t++) {
+			if (t != me && !threads[t].finished && (!threads[t].ready || threads[t].ready())) others |= 1u << t;
+		}
+		threads[me].awaiting = others;
+		step(lock, me, label);
+	}
+
+
+	//  The synchronisation objects - each called after a point() naming the call
+
+
+	void initializeLock(const void* object) {
+
+		std::lock_guard<std::mutex> lock(batonMutex);
+		owners[object] = FIFO_MODEL_NO_THREAD;
+	}
+
+
+	void deleteLock(const void* object) {
+
+		std::lock_guard<std::mutex> lock(batonMutex);
+		owners.erase(object);
+	}
+
+
+	bool tryAcquire(const void* object) {
+
+		std::lock_guard<std::mutex> lock(batonMutex);
+		if (owners[object] != FIFO_MODEL_NO_THREAD) return false;
+		owners[object] = self();
+		return true;
+	}
+
+
+	void acquire(const void* object, const char* label) {
+
+		unsigned me = self();
+		std::unique_lock<std::mutex> lock(batonMutex);
+		waitUntil(lock, me, label, [this, object] { return owners[object] == FIFO_MODEL_NO_THREAD; });
+		owners[object] = me;
+	}
+
+
+	void release(const void* object) {
+
+		std::lock_guard<std::mutex> lock(batonMutex);
+		owners[object] = FIFO_MODEL_NO_THREAD;
+	}
+
+
+	void waitEvent(FifoModelEvent* event, const char* label) {
+
+		std::unique_lock<std::mutex> lock(batonMutex);
+		waitUntil(lock, self(), label, [event] { return event->signaled; });
+		if (!event->manualReset) event->signaled = false;
+	}
+
+
+	// Sleeps until wakeAddress(address) if the 'size' bytes at 'address' equal those at 'compare'
+	void waitOnAddress(const volatile void* address, const void* compare, size_t size, const char* label) {
+
+		unsigned me = self();
+		std::unique_lock<std::mutex> lock(batonMutex);
+		if (memcmp((const void*) address, compare, size) != 0) return;
+
+		if (me != FIFO_MODEL_NO_THREAD) threads[me].waitingOn = (const void*) address;
+		waitUntil(lock, me, label, [this, me] { return threads[me].waitingOn == NULL; });
+	}
+
+
+	void wakeAddress(const void* address, bool all) {
+
+		std::lock_guard<std::mutex> lock(batonMutex);
+		for (size_t t = 0; t < threads.size(); t++) {
+			if (threads[t].waitingOn == address) {
+				threads[t].waitingOn = NULL;
+				if (!all) return;
+			}
+		}
+	}
+
+
+	// Releases the lock, sleeps until wakeAddress(condition), then acquires the lock again
+	void sleepCondition(const void* condition, const void* object, const char* label) {
+
+		unsigned me = self();
+		std::unique_lock<std::mutex> lock(batonMutex);
+		owners[object] = FIFO_MODEL_NO_THREAD;
+
+		if (me != FIFO_MODEL_NO_THREAD) threads[me].waitingOn = condition;
+		waitUntil(lock, me, label, [this, me, object] { return threads[me].waitingOn == NULL && owners[object] == FIFO_MODEL_NO_THREAD; });
+		owners[object] = me;
+	}
+
+
+private:
+
+	void threadMain(unsigned me, const std::function<void(unsigned)>* body) {
+
+		self() = me;
+
+		{
+			std::unique_lock<std::mutex> lock(batonMutex);
+			batonSignal.wait(lock, [this, me] { return running == me || aborting; });
+			if (aborting) {
+				self() = FIFO_MODEL_NO_THREAD;
+				return;
+			}
+		}
+
+		try {
+			(*body)(me);
+		}
+		catch (FifoModelAbort&) {
+			self() = FIFO_MODEL_NO_THREAD;
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(batonMutex);
+			threads[me].finished = true;
+			threads[me].label = "finished";
+			for (size_t t = 0; t < threads.size(); t++) threads[t].awaiting &= ~(1u << me);
+			if (!aborting) {
+				running = choose(me);
+				if (!failure.empty()) aborting = true;
+			}
+		}
+		batonSignal.notify_all();
+		self() = FIFO_MODEL_NO_THREAD;
+	}
+
+
+	// Records a step by thread 'me' and then runs whichever thread the search chooses
+	void step(std::unique_lock<std::mutex>& lock, unsigned me, const char* label) {
+
+		FifoModelStep record = { me, label };
+		trace.push_back(record);
+		threads[me].label = label;
+		steps++;
+
+		for (size_t t = 0; t < threads.size(); t++) if (t != me) threads[t].awaiting &= ~(1u << me);
+
+		if (steps > FIFO_MODEL_STEP_LIMIT) fail("livelock - " + std::to_string(FIFO_MODEL_STEP_LIMIT) + " steps without finishing; " + describeThreads());
+
+		switchTo(lock, me, failure.empty() ? choose(me) : FIFO_MODEL_NO_THREAD);
+	}
+
+
+	// Blocks thread 'me' until ready() is true. Outside an execution, just carries on.
+	void waitUntil(std::unique_lock<std::mutex>& lock, unsigned me, const char* label, const std::function<bool()>& ready) {
+
+		if (me == FIFO_MODEL_NO_THREAD || ready()) return;
+
+		threads[me].ready = ready;
+		step(lock, me, label);
+		threads[me].ready = std::function<bool()>();
+	}
+
+
+	// Hands the baton to 'next' and waits for it to come back - or ends the execution if it has failed
+	void switchTo(std::unique_lock<std::mutex>& lock, unsigned me, unsigned next) {
+
+		if (!failure.empty()) {
+			aborting = true;
+			batonSignal.notify_all();
+			throw FifoModelAbort();
+		}
+
+		if (next != me) {
+			running = next;
+			batonSignal.notify_all();
+			batonSignal.wait(lock, [this, me] { return running == me || aborting; });
+			if (aborting) throw FifoModelAbort();
+		}
+	}
+
+
+	bool runnable(unsigned t) {
+		return !threads[t].finished && threads[t].awaiting == 0 && (!threads[t].ready || threads[t].ready());
+	}
+
+
+	// Chooses the next thread to run - 'me' (if it can run) is option 0, the other threads that can run the
+	// rest, unless the preemption bound has been reached. Returns FIFO_MODEL_NO_THREAD when every thread has
+	// finished; fails the execution when none can run but not all have finished.
+	unsigned choose(unsigned me) {
+
+		std::vector<unsigned> options;
+		bool meRunnable = (me != FIFO_MODEL_NO_THREAD) && runnable(me);
+		if (meRunnable) options.push_back(me);
+
+		if (!meRunnable || preemptions < preemptionBound) {
+			for (unsigned t = 0; t < threads.size(); t++) if (t != me && runnable(t)) options.push_back(t);
+		}
+
+		if (options.empty()) {
+			bool allFinished = true, allSpinning = true;
+			for (size_t t = 0; t < threads.size(); t++) {
+				if (threads[t].finished) continue;
+				allFinished = false;
+				if (threads[t].awaiting == 0) allSpinning = false;
+			}
+			if (!allFinished) fail(std::string(allSpinning ? "livelock" : "deadlock") + " - no thread can make progress; " + describeThreads());
+			return FIFO_MODEL_NO_THREAD;
+		}
+
+		unsigned chosen = decide((unsigned) options.size());
+		if (meRunnable && chosen != 0) preemptions++;
+		return options[chosen];
+	}
+
+
+	unsigned decide(unsigned optionCount) {
+
+		if (optionCount == 1) return 0;
+
+		size_t index = decisions.size();
+		unsigned chosen = 0;
+		if (index < prefix.size()) chosen = (prefix[index] < optionCount) ? prefix[index] : 0;
+		else if (search == FIFO_MODEL_SEARCH_RANDOM) chosen = random() % optionCount;
+
+		Decision decision = { optionCount, chosen };
+		decisions.push_back(decision);
+		return chosen;
+	}
+
+
+	void fail(const std::string& description) {
+		if (failure.empty()) failure = description;
+	}
+
+
+	std::string describeThreads(void) {
+
+		std::string text;
+		for (size_t t = 0; t < threads.size(); t++) {
+			if (t != 0) text += ", ";
+			text += "thread " + std::to_string(t) + " ";
+			if (threads[t].finished) text += "finished";
+			else if (threads[t].awaiting != 0) text += std::string("spinning at ") + threads[t].label;
+			else if (threads[t].ready) text += std::string("blocked in ") + threads[t].label;
+			else text += std::string("at ") + threads[t].label;
+		}
+		return text;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The stand-ins for the Windows calls
+//
+//--------------------------------------------------------------------------------
+
+inline void fifoModelInitializeCriticalSection(LPCRITICAL_SECTION section) {
+	FifoModelScheduler::instance().initializeLock(section);
+}
+
+
+inline void fifoModelDeleteCriticalSection(LPCRITICAL_SECTION section) {
+	FifoModelScheduler::instance().deleteLock(section);
+}
+
+
+inline BOOL fifoModelTryEnterCriticalSection(LPCRITICAL_SECTION section) {
+
+	FifoModelScheduler::instance().point("TryEnterCriticalSection");
+	return FifoModelScheduler::instance().tryAcquire(section) ? TRUE : FALSE;
+}
+
+
+inline void fifoModelEnterCriticalSection(LPCRITICAL_SECTION section) {
+
+	FifoModelScheduler::instance().point("EnterCriticalSection");
+	FifoModelScheduler::instance().acquire(section, "EnterCriticalSection (waiting)");
+}
+
+
+inline void fifoModelLeaveCriticalSection(LPCRITICAL_SECTION section) {
+
+	FifoModelScheduler::instance().point("LeaveCriticalSection");
+	FifoModelScheduler::instance().release(section);
+}
+
+
+inline HANDLE fifoModelCreateEvent(LPSECURITY_ATTRIBUTES attributes, BOOL manualReset, BOOL initialState, const void* name) {
+
+	(void) attributes;
+	(void) name;
+	FifoModelEvent* event = new FifoModelEvent;
+	event->manualReset = (manualReset != FALSE);
+	event->signaled = (initialState != FALSE);
+	return (HANDLE) event;
+}
+
+
+inline BOOL fifoModelCloseHandle(HANDLE handle) {
+
+	delete (FifoModelEvent*) handle;
+	return TRUE;
+}
+
+
+inline BOOL fifoModelSetEvent(HANDLE handle) {
+
+	FifoModelScheduler::instance().point("SetEvent");
+	((FifoModelEvent*) handle)->signaled = true;
+	return TRUE;
+}
+
+
+inline BOOL fifoModelResetEvent(HANDLE handle) {
+
+	FifoModelScheduler::instance().point("ResetEvent");
+	((FifoModelEvent*) handle)->signaled = false;
+	return TRUE;
+}
+
+
+inline DWORD fifoModelWaitForSingleObject(HANDLE handle, DWORD milliseconds) {
+
+	(void) milliseconds;
+	FifoModelScheduler::instance().point("WaitForSingleObject");
+	FifoModelScheduler::instance().waitEvent((FifoModelEvent*) handle, "WaitForSingleObject (waiting)");
+	return WAIT_OBJECT_0;
+}
+
+
+inline BOOL fifoModelWaitOnAddress(volatile VOID* address, PVOID compare, SIZE_T size, DWORD milliseconds) {
+
+	(void) milliseconds;
+	FifoModelScheduler::instance().point("WaitOnAddress");
+	FifoModelScheduler::instance().waitOnAddress(address, compare, size, "WaitOnAddress (waiting)");
+	return TRUE;
+}
+
+
+inline void fifoModelWakeByAddressSingle(PVOID address) {
+
+	FifoModelScheduler::instance().point("WakeByAddressSingle");
+	FifoModelScheduler::instance().wakeAddress(address, false);
+}
+
+
+inline void fifoModelWakeByAddressAll(PVOID address) {
+
+	FifoModelScheduler::instance().point("WakeByAddressAll");
+	FifoModelScheduler::instance().wakeAddress(address, true);
+}
+
+
+inline void fifoModelInitializeSRWLock(PSRWLOCK srwLock) {
+	FifoModelScheduler::instance().initializeLock(srwLock);
+}
+
+
+inline void fifoModelAcquireSRWLockExclusive(PSRWLOCK srwLock) {
+
+	FifoModelScheduler::instance().point("AcquireSRWLockExclusive");
+	FifoModelScheduler::instance().acquire(srwLock, "AcquireSRWLockExclusive (waiting)");
+}
+
+
+inline void fifoModelReleaseSRWLockExclusive(PSRWLOCK srwLock) {
+
+	FifoModelScheduler::instance().point("ReleaseSRWLockExclusive");
+	FifoModelScheduler::instance().release(srwLock);
+}
+
+
+inline void fifoModelInitializeConditionVariable(PCONDITION_VARIABLE condition) {
+	(void) condition;
+}
+
+
+inline BOOL fifoModelSleepConditionVariableSRW(PCONDITION_VARIABLE condition, PSRWLOCK srwLock, DWORD milliseconds, ULONG flags) {
+
+	(void) milliseconds;
+	(void) flags;
+	FifoModelScheduler::instance().point("SleepConditionVariableSRW");
+	FifoModelScheduler::instance().sleepCondition(condition, srwLock, "SleepConditionVariableSRW (waiting)");
+	return TRUE;
+}
+
+
+inline void fifoModelWakeConditionVariable(PCONDITION_VARIABLE condition) {
+
+	FifoModelScheduler::instance().point("WakeConditionVariable");
+	FifoModelScheduler::instance().wakeAddress(condition, false);
+}
+
+
+inline void fifoModelWakeAllConditionVariable(PCONDITION_VARIABLE condition) {
+
+	FifoModelScheduler::instance().point("WakeAllConditionVariable");
+	FifoModelScheduler::instance().wakeAddress(condition, true);
+}
+
+
+
+
+// From here on the Windows calls are the stand-ins above
+
+#undef CreateEvent
+#undef YieldProcessor
+
+#define InitializeCriticalSection	fifoModelInitializeCriticalSection
+#define DeleteCriticalSection		fifoModelDeleteCriticalSection
+#define TryEnterCriticalSection		fifoModelTryEnterCriticalSection
+#define EnterCriticalSection		fifoModelEnterCriticalSection
+#define LeaveCriticalSection		fifoModelLeaveCriticalSection
+#define CreateEvent			fifoModelCreateEvent
+#define CloseHandle			fifoModelCloseHandle
+#define SetEvent			fifoModelSetEvent
+#define ResetEvent			fifoModelResetEvent
+#define WaitForSingleObject		fifoModelWaitForSingleObject
+#define WaitOnAddress			fifoModelWaitOnAddress
+#define WakeByAddressSingle		fifoModelWakeByAddressSingle
+#define WakeByAddressAll		fifoModelWakeByAddressAll
+#define InitializeSRWLock		fifoModelInitializeSRWLock
+#define AcquireSRWLockExclusive		fifoModelAcquireSRWLockExclusive
+#define ReleaseSRWLockExclusive		fifoModelReleaseSRWLockExclusive
+#define InitializeConditionVariable	fifoModelInitializeConditionVariable
+#define SleepConditionVariableSRW	fifoModelSleepConditionVariableSRW
+#define WakeConditionVariable		fifoModelWakeConditionVariable
+#define WakeAllConditionVariable	fifoModelWakeAllConditionVariable
+#define YieldProcessor()		FifoModelScheduler::instance().yield("YieldProcessor")
+
+#define FIFO_SCHEDULE_POINT(label)	FifoModelScheduler::instance().point(label)
@@ -0,0 +1,196 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Producer handles for the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains FifoProducer, a handle through which one writer thread pushes into a Fifo a chunk at a
+//  time. Each writer thread has a handle of its own;
+//
+//		FifoProducer<Fifo<Sample, 1024> > producer(samples);
+//		...
+//		if (producer.push(sample) != FIFO_STATUS_SUCCESS) ...	// as Fifo<>::push()
+//		...
+//		producer.flush();					// when there's nothing more to push for a while
+//
+//  The handle is promised room for up to "chunkSize" items (FIFO_PRODUCER_CHUNK, 16, by default) in one
+//  acquisition of the mutex, collects the items pushed to it in a chunk of its own, and then stores and
+//  publishes the whole chunk, in order, in one more. So a writer touches the mutex and the population twice per
+//  chunk rather than once per item. push() returns FIFO_STATUS_FULL (or LOCKED or PREEMPTED) only when room
+//  for the next chunk can't be promised - an item the handle has accepted always goes in.
+//
+//  The promise is of room, not of particular ring positions - the positions are only chosen when the chunk is
+//  published. Were they chosen at the start, a handle part-way through its chunk would leave a hole in the
+//  ring that the reader (which doesn't take the mutex - see "The reader and the mutex" in Fifo.h) would have
+//  to wait at, so one slow writer would hold up every item pushed after it. Room promised but not yet used
+//  counts as taken for every other writer.
+//
+//  Items wait in the handle until its chunk is full. So that they don't wait for long, a chunk is published
+//  once its first item is more than "flushMicroseconds" (FIFO_PRODUCER_FLUSH_US, 50, by default) old. The
+//  handle has no thread of its own, so that is only tested when push() or flushIfDue() is called - a writer
+//  that stops pushing should call flush() (or flushIfDue() from time to time). The destructor flushes, and
+//  gives back any room still promised. The handle notes when it accepted each item, and with
+//  FIFO_INSTRUMENT_LATENCY the Fifo's latency histogram counts from then - the wait in the chunk included.
+//
+//  The items are copied into the ring in bulk, so the Fifo must hold them inline (FifoInlineStorage), as for
+//  push_batch(). Its clock is the time-stamp counter - the first handle made in the process calibrates it, a
+//  one-off 50ms (see FifoTsc in FifoStats.h).
+//
+//
+
+
+#pragma once
+
+
+#include "Fifo.h"		// The software fifo template class
+
+
+
+#ifndef FIFO_PRODUCER_CHUNK
+#define FIFO_PRODUCER_CHUNK	((unsigned) 16)		// Items a producer handle asks room for at a time
+#endif
+
+#ifndef FIFO_PRODUCER_FLUSH_US
+#define FIFO_PRODUCER_FLUSH_US	((unsigned) 50)		// Oldest an item may be before its chunk is published
+#endif
+
+static_assert(FIFO_PRODUCER_CHUNK >= 1, "FIFO_PRODUCER_CHUNK must be at least 1");
+
+
+
+
+template <class FifoType, unsigned chunkSize = FIFO_PRODUCER_CHUNK>
+class FifoProducer {
+
+	typedef typename FifoType::Item T;
+
+	static_assert(chunkSize >= 1, "A FifoProducer chunk must hold at least one item");
+	static_assert(chunkSize <= FifoType::Config::positions, "A FifoProducer chunk can't be bigger than the Fifo");
+	static_assert(FifoType::ItemStorage::batched, "FifoProducer needs the items to be held inline (FifoInlineStorage)");
+
+	FifoType& fifo;
+	unsigned promised;		// Ring positions promised to this handle for its chunk
+	unsigned filled;		// Items in the chunk so far
+	unsigned long long flushTicks;	// Oldest an item may be, in time-stamp counter ticks
+	unsigned long long publishes;	// Chunks published so far
+	T chunk[chunkSize];
+	unsigned long long acceptTicks[chunkSize];	// Time-stamp counter when each item in the chunk was pushed
+
+public:
+
+	explicit FifoProducer(FifoType& fifoRef, unsigned flushMicroseconds = FIFO_PRODUCER_FLUSH_US) : fifo(fifoRef),
+		promised(0), filled(0), publishes(0) {
+
+		flushTicks = (unsigned long long) (flushMicroseconds * 1000.0 * FifoTsc::ticksPerNanosecond());
+	}
+
+
+	~FifoProducer() {
+		flush();
+	}
+
+
+	FifoProducer(const FifoProducer&) = delete;
+	FifoProducer& operator=(const FifoProducer&) = delete;
+
+
+	FIFO_NODISCARD FifoStatus push(const T& item) {
+
+		//	- push
+		//	The writer thread that owns this handle calls this function to push an item into the queue. Returns
+		//	the same as Fifo<>::push() - but only fails when no room can be promised for a new chunk. The item
+		//	reaches the reader when the chunk is published - when it is full, its first item is too old, or on
+		//	flush().
+		//
+
+		// Nothing promised (or all used) - ask for room for a new chunk
+		if (FIFO_UNLIKELY(filled == promised)) {
+			publish();
+			FifoStatus status = fifo.reserveRoom(chunkSize, &promised);
+			if (FIFO_UNLIKELY(status != FIFO_STATUS_SUCCESS)) return status;
+		}
+
+		// Note when the item was accepted - for the flush test, and for the Fifo's latency histogram, which
+		// counts the time the item then waits in the chunk as time spent in the FIFO
+		unsigned long long now = FifoTsc::now();
+		acceptTicks[filled] = now;
+		chunk[filled++] = item;
+
+		// Publish a chunk that is full, or whose first item has waited long enough
+		if (filled == promised || now - acceptTicks[0] >= flushTicks) publish();
+		return FIFO_STATUS_SUCCESS;
+	}
+
+
+	// Publishes the items pushed so far, and gives back the rest of the room promised for them
+	void flush(void) {
+		if (promised != 0) publish();
+	}
+
+
+	// Publishes the items pushed so far if the first of them has waited long enough - for a writer thread to
+	// call while it has nothing to push
+	void flushIfDue(void) {
+		if (filled != 0 && FifoTsc::now() - acceptTicks[0] >= flushTicks) publish();
+	}
+
+
+	// Items pushed to this handle that the reader can't see yet
+	unsigned pending(void) const {
+		return filled;
+	}
+
+
+	// Ring positions promised to this handle and not yet given back - taken, for every other writer
+	unsigned promisedRoom(void) const {
+		return promised;
+	}
+
+
+	// Chunks published so far - for benchmarking
+	unsigned long long getPublishCount(void) const {
+		return publishes;
+	}
+
+
+private:
+
+	void publish(void) {
+
+		if (promised == 0) return;
+
+		fifo.publishReserved(chunk, acceptTicks, filled, promised);
+		publishes++;
+		promised = 0;
+		filled = 0;
+	}
+};
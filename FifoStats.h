@@ -0,0 +1,706 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Optional instrumentation for the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the building blocks used by Fifo.h when instrumentation is compiled in, notably;
+//
+//  FifoTsc             - the processor's time-stamp counter, and its rate
+//  FifoHistogram       - a log-linear ("HDR-style") histogram of tick counts
+//  FifoOutcomeCounters - counts of push() and pop results, sharded by writer thread
+//  FifoOccupancy       - high-water mark, average and sampled history of the FIFO population
+//  FifoLockProfile     - contention for, waits for and hold times of the FIFO's mutex
+//
+//  It is included by Fifo.h (it uses the FIFO_STATUS_... codes defined there) - include Fifo.h rather than
+//  this file.
+//
+//  Each kind of instrumentation is switched on by defining the relevant macro as 1, either in the project's
+//  preprocessor definitions or before Fifo.h is included. They all default to 0, in which case Fifo.h
+//  compiles to exactly what it would be without them;
+//
+//  FIFO_INSTRUMENT_LATENCY - each item is stamped with the time-stamp counter when it is pushed, and the
+//                            time it spent in the fifo is recorded in a FifoHistogram when it is popped.
+//                            See Fifo<>::getLatencySnapshot().
+//
+//  FIFO_INSTRUMENT_COUNTERS - the result of every push(), pop() and pop_try() call is counted in a
+//                             FifoOutcomeCounters. See Fifo<>::getOutcomeSnapshot().
+//
+//  FIFO_INSTRUMENT_OCCUPANCY - the reader thread notes the population each time it pops, keeping a
+//                              high-water mark, a time-weighted average and a sampled history in a
+//                              FifoOccupancy. See Fifo<>::getOccupancySnapshot().
+//
+//  FIFO_INSTRUMENT_LOCKS - every acquisition of the FIFO's mutex by a writer thread is timed, from starting
+//                          to wait for it to releasing it, and contended acquisitions are counted, in a
+//                          FifoLockProfile. The reader thread never takes the mutex.
+//                          See Fifo<>::getLockSnapshot().
+//
+//
+
+
+#pragma once
+
+
+#include "FifoCacheLine.h"	// For padding the counters
+
+#include <windows.h>		// For QueryPerformanceCounter()
+#include <intrin.h>		// For __rdtsc() and _BitScanReverse64()
+
+#include <atomic>		// For the histogram and outcome counters
+#include <cmath>		// For ceil()
+#include <mutex>		// For the occupancy snapshot baseline
+
+
+
+#ifndef FIFO_INSTRUMENT_LATENCY
+#define FIFO_INSTRUMENT_LATENCY		0
+#endif
+
+#ifndef FIFO_INSTRUMENT_COUNTERS
+#define FIFO_INSTRUMENT_COUNTERS	0
+#endif
+
+#ifndef FIFO_INSTRUMENT_OCCUPANCY
+#define FIFO_INSTRUMENT_OCCUPANCY	0
+#endif
+
+#ifndef FIFO_INSTRUMENT_LOCKS
+#define FIFO_INSTRUMENT_LOCKS		0
+#endif
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoTsc
+//
+//  The processor's time-stamp counter (TSC). This ticks at (around) the nominal core frequency and on any
+//  processor of the last decade runs at a constant rate on all cores ("invariant TSC"), which makes it the
+//  cheapest way to time things that take nanoseconds. Its rate is calibrated against the Windows performance
+//  counter the first time it is needed.
+//
+//--------------------------------------------------------------------------------
+
+class FifoTsc {
+
+public:
+
+	static unsigned long long now(void) {
+		return __rdtsc();
+	}
+
+
+	// Number of TSC ticks per nanosecond - measured once, on first use
+	static double ticksPerNanosecond(void) {
+
+		static const double ticksPerNs = calibrate();
+		return ticksPerNs;
+	}
+
+
+	static double toNanoseconds(unsigned long long ticks) {
+		return (double) ticks / ticksPerNanosecond();
+	}
+
+
+private:
+
+	static double calibrate(void) {
+
+		LARGE_INTEGER frequency, qpcStart, qpcNow;
+		QueryPerformanceFrequency(&frequency);
+
+		// Busy-wait for 50ms of performance counter time, noting how many TSC ticks elapse meanwhile
+		QueryPerformanceCounter(&qpcStart);
+		unsigned long long tscStart = __rdtsc();
+		do {
+			QueryPerformanceCounter(&qpcNow);
+		} while ((qpcNow.QuadPart - qpcStart.QuadPart) < frequency.QuadPart / 20);
+		unsigned long long tscTicks = __rdtsc() - tscStart;
+
+		double nanoseconds = (double) (qpcNow.QuadPart - qpcStart.QuadPart) * 1.0e9 / (double) frequency.QuadPart;
+		return (double) tscTicks / nanoseconds;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoHistogram
+//
+//  A log-linear histogram of tick counts, in the style of Gil Tene's HdrHistogram. Values below 16 each have
+//  their own bucket. Above that every power of two ("octave") is split into 16 equal-width buckets, so any
+//  value is recorded to within 1/16th (about 6%) of itself, right up to 2^64 - 1, using fewer than 1000 buckets.
+//
+//  Values are recorded by ONE thread (the fifo's reader thread) but a snapshot may be taken by any thread
+//  at any time. The counters are therefore atomic - recording a value is a handful of instructions and an
+//  uncontended locked add, and nothing is ever allocated.
+//
+//  A snapshot can reset the histogram as it reads it ("reset-on-read"), so that each snapshot describes
+//  just the interval since the previous one. Each bucket is read and zeroed in one atomic exchange, so no
+//  recorded value is lost or counted twice, although a value recorded while the snapshot is being taken may
+//  land in either this snapshot or the next.
+//
+//--------------------------------------------------------------------------------
+
+#define FIFO_HISTOGRAM_SUB_BUCKET_BITS	4
+#define FIFO_HISTOGRAM_SUB_BUCKETS	(1u << FIFO_HISTOGRAM_SUB_BUCKET_BITS)
+#define FIFO_HISTOGRAM_BUCKETS		((64 - FIFO_HISTOGRAM_SUB_BUCKET_BITS + 1) * FIFO_HISTOGRAM_SUB_BUCKETS)
+
+
+// Percentiles and other figures taken from a FifoHistogram. Tick values are the highest value that falls
+// into the relevant bucket, except for maxTicks and sumTicks which are exact.
+struct FifoHistogramSnapshot {
+	unsigned long long count;
+	unsigned long long sumTicks;		// Of every value recorded - meanTicks is this over count, rounded down
+	unsigned long long meanTicks;
+	unsigned long long p50Ticks, p99Ticks, p999Ticks;
+	unsigned long long maxTicks;
+};
+
+
+class FifoHistogram {
+
+	std::atomic<unsigned long long> buckets[FIFO_HISTOGRAM_BUCKETS];
+	std::atomic<unsigned long long> sumTicks;	// For the mean
+	std::atomic<unsigned long long> maxTicks;
+
+public:
+
+	FifoHistogram() {
+		reset();
+	}
+
+
+	// Record one value. Only ever called from one thread.
+	void record(unsigned long long ticks) {
+
+		buckets[bucketIndex(ticks)].fetch_add(1, std::memory_order_relaxed);
+		sumTicks.fetch_add(ticks, std::memory_order_relaxed);
+
+		// Only the recording thread raises the maximum, so no compare-and-swap loop is needed. A reset that
+		// sneaks in between the load and the store just means this value is reported in the next snapshot.
+		if (ticks > maxTicks.load(std::memory_order_relaxed)) maxTicks.store(ticks, std::memory_order_relaxed);
+	}
+
+
+	FifoHistogramSnapshot snapshot(bool resetAfterReading) {
+
+		// Take a copy of the counters first (zeroing them if asked to) so the percentiles are all
+		// worked out from the same set of numbers
+		unsigned long long counts[FIFO_HISTOGRAM_BUCKETS];
+		unsigned long long total = 0;
+
+		for (unsigned i = 0; i < FIFO_HISTOGRAM_BUCKETS; i++) {
+			counts[i] = resetAfterReading ? buckets[i].exchange(0, std::memory_order_relaxed) : buckets[i].load(std::memory_order_relaxed);
+			total += counts[i];
+		}
+
+		FifoHistogramSnapshot result = {};
+		result.count = total;
+		result.sumTicks = resetAfterReading ? sumTicks.exchange(0, std::memory_order_relaxed) : sumTicks.load(std::memory_order_relaxed);
+		result.maxTicks = resetAfterReading ? maxTicks.exchange(0, std::memory_order_relaxed) : maxTicks.load(std::memory_order_relaxed);
+		if (total == 0) return result;
+
+		result.meanTicks = result.sumTicks / total;
+		result.p50Ticks = valueAtFraction(counts, total, 0.50);
+		result.p99Ticks = valueAtFraction(counts, total, 0.99);
+		result.p999Ticks = valueAtFraction(counts, total, 0.999);
+
+		// The bucket's highest value can exceed the actual maximum - never report a percentile above it
+		if (result.p50Ticks > result.maxTicks) result.p50Ticks = result.maxTicks;
+		if (result.p99Ticks > result.maxTicks) result.p99Ticks = result.maxTicks;
+		if (result.p999Ticks > result.maxTicks) result.p999Ticks = result.maxTicks;
+		return result;
+	}
+
+
+	void reset(void) {
+
+		for (unsigned i = 0; i < FIFO_HISTOGRAM_BUCKETS; i++) buckets[i].store(0, std::memory_order_relaxed);
+		sumTicks.store(0, std::memory_order_relaxed);
+		maxTicks.store(0, std::memory_order_relaxed);
+	}
+
+
+	// Which bucket a value goes in
+	static unsigned bucketIndex(unsigned long long ticks) {
+
+		if (ticks < FIFO_HISTOGRAM_SUB_BUCKETS) return (unsigned) ticks;
+
+		// Position of the most significant set bit (at least FIFO_HISTOGRAM_SUB_BUCKET_BITS here)
+		unsigned long msb;
+		_BitScanReverse64(&msb, ticks);
+
+		// The octave picks the group of 16 buckets, the next 4 bits below the most significant bit pick
+		// the bucket within the group
+		unsigned shift = msb - FIFO_HISTOGRAM_SUB_BUCKET_BITS;
+		unsigned octave = shift + 1;
+		unsigned subBucket = (unsigned) (ticks >> shift) & (FIFO_HISTOGRAM_SUB_BUCKETS - 1);
+		return octave * FIFO_HISTOGRAM_SUB_BUCKETS + subBucket;
+	}
+
+
+	// The highest value that goes in a bucket
+	static unsigned long long bucketHighestValue(unsigned index) {
+
+		if (index < FIFO_HISTOGRAM_SUB_BUCKETS) return index;
+
+		unsigned octave = index / FIFO_HISTOGRAM_SUB_BUCKETS;
+		unsigned subBucket = index % FIFO_HISTOGRAM_SUB_BUCKETS;
+		unsigned shift = octave - 1;
+		unsigned long long lowest = (unsigned long long) (FIFO_HISTOGRAM_SUB_BUCKETS + subBucket) << shift;
+		return lowest + ((1ULL << shift) - 1);
+	}
+
+
+private:
+
+	static unsigned long long valueAtFraction(const unsigned long long* counts, unsigned long long total, double fraction) {
+
+		// Nearest rank - the smallest value with at least this fraction of all values at or below it
+		unsigned long long rank = (unsigned long long) ceil(fraction * (double) total);
+		if (rank < 1) rank = 1;
+
+		unsigned long long seen = 0;
+		for (unsigned i = 0; i < FIFO_HISTOGRAM_BUCKETS; i++) {
+			seen += counts[i];
+			if (seen >= rank) return bucketHighestValue(i);
+		}
+		return bucketHighestValue(FIFO_HISTOGRAM_BUCKETS - 1);
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoOutcomeCounters
+//
+//  Counts of the results returned by push() (one counter per FIFO_STATUS_... code) and by pop()/pop_try().
+//
+//  Many writer threads push at once, so a single shared counter per status would have every writer
+//  bouncing the same cache line back and forth - exactly the contention the counts are meant to detect.
+//  Instead the push counters are split into FIFO_COUNTER_SHARDS shards. Each writer thread is given a shard
+//  the first time it counts anything (threads take shards in turn) and only ever updates that one, so up
+//  to FIFO_COUNTER_SHARDS writers never share a cache line. With more writers than that, shards are shared
+//  and the counters are still correct, just not contention-free.
+//
+//  The shards are only added up when a snapshot is taken.
+//
+//  Pops are only ever done by the reader thread, so they need just one (unshared) set of counters.
+//
+//  Each shard is padded to two cache lines. Without alignment guarantees (a Fifo may be allocated with new,
+//  which before C++17 ignores over-alignment) this is what it takes to be sure that no two shards' counters
+//  can fall in the same cache line.
+//
+//--------------------------------------------------------------------------------
+
+#define FIFO_COUNTER_SHARDS		16
+
+
+// Counts taken from a FifoOutcomeCounters
+struct FifoOutcomeSnapshot {
+	unsigned long long push[FIFO_STATUS_COUNT];	// push() calls returning each FIFO_STATUS_... code
+	unsigned long long popped;			// Items obtained by pop() or pop_try()
+	unsigned long long popEmpty;			// pop_try() calls that found the FIFO empty
+};
+
+
+class FifoOutcomeCounters {
+
+	struct Shard {
+		std::atomic<unsigned long long> push[FIFO_STATUS_COUNT];
+		char padding[2 * FIFO_CACHE_LINE_SIZE - FIFO_STATUS_COUNT * sizeof(std::atomic<unsigned long long>)];
+	};
+
+	Shard shards[FIFO_COUNTER_SHARDS];
+
+	char paddingBeforeReader[FIFO_CACHE_LINE_SIZE];
+	std::atomic<unsigned long long> popped;
+	std::atomic<unsigned long long> popEmpty;
+	char paddingAfterReader[FIFO_CACHE_LINE_SIZE];
+
+public:
+
+	FifoOutcomeCounters() {
+
+		for (unsigned s = 0; s < FIFO_COUNTER_SHARDS; s++) {
+			for (unsigned c = 0; c < FIFO_STATUS_COUNT; c++) shards[s].push[c].store(0, std::memory_order_relaxed);
+		}
+		popped.store(0, std::memory_order_relaxed);
+		popEmpty.store(0, std::memory_order_relaxed);
+	}
+
+
+	// Count one push() result. Called from any writer thread.
+	void countPush(FifoStatus status) {
+		shards[threadShard()].push[(unsigned) status].fetch_add(1, std::memory_order_relaxed);
+	}
+
+
+	// Count one pop() or pop_try() result. Only ever called from the reader thread.
+	void countPop(FifoStatus status) {
+
+		if (status == FIFO_STATUS_SUCCESS) popped.fetch_add(1, std::memory_order_relaxed);
+		else popEmpty.fetch_add(1, std::memory_order_relaxed);
+	}
+
+
+	// Add up the shards, optionally resetting them as they are read. Each counter is read and zeroed in one
+	// atomic exchange, so nothing is lost or counted twice.
+	FifoOutcomeSnapshot snapshot(bool resetAfterReading) {
+
+		FifoOutcomeSnapshot result = {};
+
+		for (unsigned s = 0; s < FIFO_COUNTER_SHARDS; s++) {
+			for (unsigned c = 0; c < FIFO_STATUS_COUNT; c++) result.push[c] += readCounter(shards[s].push[c], resetAfterReading);
+		}
+		result.popped = readCounter(popped, resetAfterReading);
+		result.popEmpty = readCounter(popEmpty, resetAfterReading);
+		return result;
+	}
+
+
+private:
+
+	static unsigned long long readCounter(std::atomic<unsigned long long>& counter, bool resetAfterReading) {
+		return resetAfterReading ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed);
+	}
+
+
+	// This thread's shard - handed out in turn to threads as they first ask for one. The same shard number
+	// is used by a thread for every Fifo it pushes to.
+	static unsigned threadShard(void) {
+
+		static std::atomic<unsigned> nextShard(0);
+		static thread_local unsigned shard = FIFO_COUNTER_SHARDS;	// Not yet assigned
+
+		if (shard == FIFO_COUNTER_SHARDS) shard = nextShard.fetch_add(1, std::memory_order_relaxed) % FIFO_COUNTER_SHARDS;
+		return shard;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoOccupancy
+//
+//  The FIFO population as seen by the reader thread each time it pops an item, kept cheaply by the reader
+//  thread itself (a time-stamp counter read and a few loads and stores per pop);
+//
+//  High-water mark - the highest population seen. Between one pop and the next the population can only
+//  rise (only the reader removes items), so its peak over that time is exactly the population seen at the
+//  next pop. The high-water mark is therefore exact, except for any peak after the most recent pop.
+//
+//  Time-weighted average - the population integrated over time, divided by the time. The reader knows the
+//  population just after one pop and just before the next, but not exactly when in between the new items
+//  arrived, so each interval is taken as a straight-line rise between the two (the trapezium rule). The
+//  average is accurate when pops are frequent; over long idle spells it can be up to half an item high.
+//
+//  Sampled history - every FIFO_OCCUPANCY_SAMPLE_NS (or, if the reader pops less often, at every pop) the
+//  population is written into a ring of the most recent FIFO_OCCUPANCY_SAMPLES samples.
+//
+//  Snapshots may be taken from any thread. Resetting the high-water mark races harmlessly with the reader
+//  raising it (the value may then appear in either snapshot). The average is never reset as such - the
+//  running totals only ever increase (wrapping harmlessly) and a reset just moves the baseline from which
+//  the next snapshot measures them.
+//
+//--------------------------------------------------------------------------------
+
+#define FIFO_OCCUPANCY_SAMPLES		256
+#define FIFO_OCCUPANCY_SAMPLE_NS	1000000.0	// 1ms
+
+
+struct FifoOccupancySample {
+	unsigned long long ticks;	// Time-stamp counter at the time of the sample
+	unsigned population;
+};
+
+
+// Figures taken from a FifoOccupancy
+struct FifoOccupancySnapshot {
+	unsigned highWaterMark;
+	double averagePopulation;		// Time-weighted, over the interval coveredTicks
+	unsigned long long coveredTicks;	// Time from the previous reset (or the first pop) to the most recent pop
+	unsigned sampleCount;			// Number of entries in samples[]
+	FifoOccupancySample samples[FIFO_OCCUPANCY_SAMPLES];	// Most recent samples, oldest first
+};
+
+
+class FifoOccupancy {
+
+	// Reader thread only
+	unsigned long long previousTicks;	// Time of the previous pop (zero before the first one)
+	unsigned previousPopulation;		// Population just after the previous pop
+	unsigned long long nextSampleTicks;	// When the next sample is due
+	unsigned long long sampleIntervalTicks;
+
+	// Written by the reader thread, read by snapshots
+	std::atomic<unsigned> highWaterMark;
+	std::atomic<unsigned long long> areaTotal;	// Sum of (population before + after) * ticks, i.e. twice the area
+	std::atomic<unsigned long long> ticksTotal;	// Time covered by areaTotal
+	std::atomic<unsigned long long> sampleTicks[FIFO_OCCUPANCY_SAMPLES];
+	std::atomic<unsigned> samplePopulation[FIFO_OCCUPANCY_SAMPLES];
+	std::atomic<unsigned long long> samplesWritten;	// Total ever written - the next goes in [samplesWritten % FIFO_OCCUPANCY_SAMPLES]
+
+	// Snapshot side
+	std::mutex baselineMutex;
+	unsigned long long areaBaseline, ticksBaseline;
+
+public:
+
+	FifoOccupancy() : previousTicks(0), previousPopulation(0), nextSampleTicks(0), areaBaseline(0), ticksBaseline(0) {
+
+		sampleIntervalTicks = (unsigned long long) (FIFO_OCCUPANCY_SAMPLE_NS * FifoTsc::ticksPerNanosecond());
+
+		highWaterMark.store(0, std::memory_order_relaxed);
+		areaTotal.store(0, std::memory_order_relaxed);
+		ticksTotal.store(0, std::memory_order_relaxed);
+		samplesWritten.store(0, std::memory_order_relaxed);
+		for (unsigned i = 0; i < FIFO_OCCUPANCY_SAMPLES; i++) {
+			sampleTicks[i].store(0, std::memory_order_relaxed);
+			samplePopulation[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+
+	// Note the population just before a pop that takes 'count' items (one, or a batch). Only ever called from
+	// the reader thread.
+	void record(unsigned population, unsigned count, unsigned long long now) {
+
+		if (population > highWaterMark.load(std::memory_order_relaxed)) highWaterMark.store(population, std::memory_order_relaxed);
+
+		// Only the reader writes the totals, so a plain load and store is enough (no locked add)
+		if (previousTicks != 0) {
+			unsigned long long ticks = now - previousTicks;
+			areaTotal.store(areaTotal.load(std::memory_order_relaxed) + (unsigned long long) (previousPopulation + population) * ticks, std::memory_order_relaxed);
+			ticksTotal.store(ticksTotal.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+		}
+		previousTicks = now;
+		previousPopulation = population - count;
+
+		if (now >= nextSampleTicks) {
+
+			unsigned long long written = samplesWritten.load(std::memory_order_relaxed);
+			unsigned slot = (unsigned) (written % FIFO_OCCUPANCY_SAMPLES);
+			sampleTicks[slot].store(now, std::memory_order_relaxed);
+			samplePopulation[slot].store(population, std::memory_order_relaxed);
+			samplesWritten.store(written + 1, std::memory_order_release);
+
+			nextSampleTicks = now + sampleIntervalTicks;
+		}
+	}
+
+
+	FifoOccupancySnapshot snapshot(bool resetAfterReading) {
+
+		FifoOccupancySnapshot result;
+		result.highWaterMark = resetAfterReading ? highWaterMark.exchange(0, std::memory_order_relaxed) : highWaterMark.load(std::memory_order_relaxed);
+
+		{
+			std::lock_guard<std::mutex> lock(baselineMutex);
+
+			unsigned long long area = areaTotal.load(std::memory_order_relaxed);
+			unsigned long long ticks = ticksTotal.load(std::memory_order_relaxed);
+
+			// Unsigned subtraction gives the right answer even if a total has wrapped since the baseline
+			result.coveredTicks = ticks - ticksBaseline;
+			result.averagePopulation = (result.coveredTicks != 0) ? (double) (area - areaBaseline) / 2.0 / (double) result.coveredTicks : 0.0;
+
+			if (resetAfterReading) {
+				areaBaseline = area;
+				ticksBaseline = ticks;
+			}
+		}
+
+		// Copy out the sample ring, oldest first. The reader may be overwriting the oldest entries while they
+		// are copied, so afterwards any entry that might have been overwritten meanwhile is dropped.
+		unsigned long long writtenBefore = samplesWritten.load(std::memory_order_acquire);
+		unsigned long long first = (writtenBefore > FIFO_OCCUPANCY_SAMPLES) ? writtenBefore - FIFO_OCCUPANCY_SAMPLES : 0;
+
+		FifoOccupancySample copied[FIFO_OCCUPANCY_SAMPLES];
+		for (unsigned long long n = first; n < writtenBefore; n++) {
+			unsigned slot = (unsigned) (n % FIFO_OCCUPANCY_SAMPLES);
+			copied[n - first].ticks = sampleTicks[slot].load(std::memory_order_relaxed);
+			copied[n - first].population = samplePopulation[slot].load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned long long writtenAfter = samplesWritten.load(std::memory_order_relaxed);
+		unsigned long long firstIntact = (writtenAfter > FIFO_OCCUPANCY_SAMPLES) ? writtenAfter - FIFO_OCCUPANCY_SAMPLES + 1 : 0;
+		if (firstIntact < first) firstIntact = first;
+
+		result.sampleCount = 0;
+		for (unsigned long long n = firstIntact; n < writtenBefore; n++) result.samples[result.sampleCount++] = copied[n - first];
+
+		return result;
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  FifoLockProfile
+//
+//  How the FIFO's mutex is used by the writer threads. Only they take it - the reader thread takes items
+//  through the population alone (see "The reader and the mutex" in Fifo.h), so there is nothing to profile
+//  on its side;
+//
+//  acquisitions - number of times the mutex was acquired
+//  contended    - number of times it was found to be held by another thread. A writer thread then gives
+//                 up (push() returns FIFO_STATUS_LOCKED), unless the lock is one that writers wait for
+//                 (see FifoLock.h).
+//  wait         - time spent waiting for the mutex when it was contended. Writer threads only wait with a
+//                 lock that writers wait for (or to publish a producer handle's items) - otherwise this is
+//                 always zero.
+//  hold         - time from acquiring the mutex to releasing it
+//
+//  Hold and wait times are recorded while the mutex is held, so only one thread at a time records them and
+//  the counters are uncontended. Failed writer attempts are counted outside the mutex - those counters are
+//  shared by the writers, but they are only touched on a path where the writer has already lost out.
+//
+//--------------------------------------------------------------------------------
+
+struct FifoLockSideSnapshot {
+	unsigned long long acquisitions;
+	unsigned long long contended;
+	unsigned long long waitTicksTotal, waitTicksMax;
+	unsigned long long holdTicksTotal, holdTicksMax;
+};
+
+
+struct FifoLockSnapshot {
+	FifoLockSideSnapshot writer;
+};
+
+
+class FifoLockProfile {
+
+	struct Side {
+		std::atomic<unsigned long long> acquisitions;
+		std::atomic<unsigned long long> contended;
+		std::atomic<unsigned long long> waitTicksTotal, waitTicksMax;
+		std::atomic<unsigned long long> holdTicksTotal, holdTicksMax;
+	};
+
+	Side writer;
+
+public:
+
+	FifoLockProfile() {
+		clear(writer);
+	}
+
+
+	// A writer thread found the mutex held by another thread
+	void writerContended(void) {
+		writer.contended.fetch_add(1, std::memory_order_relaxed);
+	}
+
+
+	// A writer thread is about to release the mutex, having held it for this long
+	void writerHeld(unsigned long long ticks) {
+		held(writer, ticks);
+	}
+
+
+	// A writer thread found the mutex held and waited this long for it (only with a lock that writers wait for).
+	// Recorded once the writer holds the mutex, like its hold time.
+	void writerWaited(unsigned long long ticks) {
+
+		writer.contended.fetch_add(1, std::memory_order_relaxed);
+		writer.waitTicksTotal.fetch_add(ticks, std::memory_order_relaxed);
+		raiseMax(writer.waitTicksMax, ticks);
+	}
+
+
+	FifoLockSnapshot snapshot(bool resetAfterReading) {
+
+		FifoLockSnapshot result;
+		result.writer = read(writer, resetAfterReading);
+		return result;
+	}
+
+
+private:
+
+	static void held(Side& side, unsigned long long ticks) {
+
+		side.acquisitions.fetch_add(1, std::memory_order_relaxed);
+		side.holdTicksTotal.fetch_add(ticks, std::memory_order_relaxed);
+		raiseMax(side.holdTicksMax, ticks);
+	}
+
+
+	// Only the thread holding the mutex raises a maximum, so no compare-and-swap loop is needed
+	static void raiseMax(std::atomic<unsigned long long>& maximum, unsigned long long ticks) {
+		if (ticks > maximum.load(std::memory_order_relaxed)) maximum.store(ticks, std::memory_order_relaxed);
+	}
+
+
+	static void clear(Side& side) {
+
+		side.acquisitions.store(0, std::memory_order_relaxed);
+		side.contended.store(0, std::memory_order_relaxed);
+		side.waitTicksTotal.store(0, std::memory_order_relaxed);
+		side.waitTicksMax.store(0, std::memory_order_relaxed);
+		side.holdTicksTotal.store(0, std::memory_order_relaxed);
+		side.holdTicksMax.store(0, std::memory_order_relaxed);
+	}
+
+
+	static unsigned long long readCounter(std::atomic<unsigned long long>& counter, bool resetAfterReading) {
+		return resetAfterReading ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed);
+	}
+
+
+	static FifoLockSideSnapshot read(Side& side, bool resetAfterReading) {
+
+		FifoLockSideSnapshot result;
+		result.acquisitions = readCounter(side.acquisitions, resetAfterReading);
+		result.contended = readCounter(side.contended, resetAfterReading);
+		result.waitTicksTotal = readCounter(side.waitTicksTotal, resetAfterReading);
+		result.waitTicksMax = readCounter(side.waitTicksMax, resetAfterReading);
+		result.holdTicksTotal = readCounter(side.holdTicksTotal, resetAfterReading);
+		result.holdTicksMax = readCounter(side.holdTicksMax, resetAfterReading);
+		return result;
+	}
+};
@@ -0,0 +1,383 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Item storage for the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the two ways in which Fifo can hold the items in it. Which one a Fifo uses is chosen at
+//  compile time from the item type T: a trivially copyable T of no more than FIFO_INLINE_MAX_BYTES bytes is
+//  held inline, and anything else (a big struct, or a type with its own copy constructor) in a slab. The
+//  choice can also be made explicitly with the fourth template parameter of Fifo, for example
+//  "Fifo<Work, 64, FifoEventWait, FifoSlabStorage<Work, 64> >".
+//
+//  FifoInlineStorage - the original ordinary array of T. push() copies the item into the array with the
+//                      mutex held, and pop() copies it out again before handing its ring position back.
+//  FifoSlabStorage   - a preallocated array ("slab") of T, with the ring itself an array of slab slot
+//                      numbers. push() claims a free slab slot and copies the item into it BEFORE taking the
+//                      mutex, and with the mutex held only writes the slot number into the ring. pop() reads
+//                      the slot number, and copies the item out AFTER handing the ring position back to the
+//                      writers. However big T is, the mutex is only held for as long as it takes to move one
+//                      number into the ring, and the ring position is only kept from the writers for as long
+//                      as it takes to read one out; the ring stays a dense array of 2 byte numbers (4 byte
+//                      with more than 65536 slots).
+//
+//  So big items can be pushed by value with no second code path; pushing pointers to them (as suggested in
+//  "Fifo item data types" in Software_Fifo_Exercise_Win.cpp) still works, but is no longer needed to keep
+//  the time spent holding the mutex short. The benchmark harness ("mode=storage" in Fifo_Benchmark_Win.cpp)
+//  measures both storages over a range of item sizes, for choosing FIFO_INLINE_MAX_BYTES.
+//
+//  Each storage provides;
+//
+//  Item, positions         - the item type and capacity it was made for, which Fifo checks match its own
+//  Ticket                  - what push() carries from stage() to put()
+//  stage(item, &ticket)    - called by push() before taking the mutex. Returns false if there is nowhere to
+//                            put the item just now (FifoSlabStorage only - see below). An overload taking
+//                            T&& is called by push_try(), and may move the item rather than copy it.
+//  unstage(ticket, giveBack) - called by push() if it then doesn't store the item after all. For push_try()
+//                            giveBack is the caller's item, to move the item back to if stage() moved it.
+//  put(index, ticket)      - called by push() with the mutex held - stores the item at ring position index
+//  take(index, itemPtr)    - called by pop() and pop_try() once they have seen the item counted in the
+//                            population (and after an acquire fence - see "The reader and the mutex" in Fifo.h)
+//                            - takes the item at ring position index, returning a number for finish()
+//  finish(taken, itemPtr)  - called by pop() and pop_try() with what take() returned, after the ring position has
+//                            been counted as popped (and perhaps already handed back to the writers)
+//  prefetch(index)         - called by pop() and pop_try() after take() - starts fetching the item at ring
+//                            position index, which the reader will pop soon, into its cache (see below)
+//  name()                  - a short name for the storage, for benchmark reports
+//
+//  FifoInlineStorage also provides putRun() and takeRun(), which copy a run of items in or out in bulk (see
+//  FifoCopy.h) for Fifo's batch functions; "batched" says whether a storage has them. With a slab the items
+//  of a run would each be in a slot of their own, and so couldn't be copied in bulk, and the point of the
+//  slab - copying outside the mutex, and outside the time the ring position is kept from the writers - would
+//  be lost.
+//
+//
+//  Slab slots
+//  ==========
+//
+//  A slab slot is in use from the moment a writer claims it in stage() until the reader has copied the item
+//  out of it in finish() - not just while its number is in the ring. Writers that have staged an item but
+//  are still waiting for the mutex therefore hold slots too, so the slab has FIFO_SLAB_SPARE_SLOTS more slots
+//  than the ring has positions. If there are even more writers than that part-way through push() at once,
+//  stage() can find no free slot; push() then returns FIFO_STATUS_LOCKED (the FIFO is busy - try again), not
+//  FIFO_STATUS_FULL, since the ring itself may well have room.
+//
+//  Each slot has a "busy" flag. A writer claims a slot by setting its flag with an atomic exchange, starting
+//  at a position handed out round-robin so that writers don't all fight over the same slot; the reader
+//  clears the flag once it has copied the item out. The population handoff orders the writer's copy into the
+//  slot before the reader's copy out of it - the writer's interlocked add to the population comes after the
+//  copy, and the reader's acquire fence after reading that population - and the flag's release/acquire orders
+//  the reader's copy out before the next writer's copy in. The ring position can go back to the writers
+//  before finish(), since the slot stays busy until then.
+//
+//  Each access to a busy flag is preceded by a FIFO_SCHEDULE_POINT(), so that the model checker
+//  (Fifo_ModelCheck_Win.cpp, see FifoModel.h) can switch threads there.
+//
+//
+//  Prefetching
+//  ===========
+//
+//  When the reader is popping big items, or pointers to big objects, much of its time can go on waiting for
+//  them to arrive in its cache from the writer's. Given a prefetch distance (see Fifo::setPrefetchDistance()),
+//  pop() starts fetching the item that many positions further on each time it pops one, so that by the time
+//  the reader gets to it, it is already on its way. With a slab that is the item in its slab slot.
+//
+//  What a pointer points to can be fetched as well, by specialising FifoPrefetch for the pointer type, for
+//  example;
+//
+//      template <> struct FifoPrefetch<Work*> {
+//          static void pointee(Work* const& item) { fifoPrefetchBytes(item, sizeof(Work)); }
+//      };
+//
+//  By default FifoPrefetch does nothing more. Only items already in the FIFO are prefetched - a position the
+//  writers haven't filled yet would just bring its cache line over to the reader for a writer to take back.
+//
+//
+
+
+#pragma once
+
+
+#include "FifoCopy.h"		// For copying runs of items in bulk
+#include "FifoCacheLine.h"	// For FIFO_CACHE_LINE_SIZE
+
+#include <windows.h>		// For PreFetchCacheLine()
+#include <atomic>		// For the slab slot flags
+#include <climits>		// For UINT_MAX and USHRT_MAX
+#include <cstdint>		// For uintptr_t
+#include <type_traits>		// For std::is_trivially_copyable and std::conditional
+#include <utility>		// For std::move
+
+
+
+#ifndef FIFO_INLINE_MAX_BYTES
+#define FIFO_INLINE_MAX_BYTES	((unsigned) 64)	// Biggest trivially copyable T held inline rather than in a slab
+#endif
+
+#ifndef FIFO_SLAB_SPARE_SLOTS
+#define FIFO_SLAB_SPARE_SLOTS	((unsigned) 8)	// Slab slots beyond the capacity, for items staged by writers
+#endif
+
+static_assert(FIFO_INLINE_MAX_BYTES >= 1, "FIFO_INLINE_MAX_BYTES must be at least 1");
+// With none, a writer could find every slot taken by the reader and the other writers while the ring has room
+static_assert(FIFO_SLAB_SPARE_SLOTS >= 1, "FIFO_SLAB_SPARE_SLOTS must be at least 1");
+// Writers claim slots with an exchange on a flag - if that took a lock, stage() would be no better than the mutex
+static_assert(ATOMIC_BOOL_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "FifoSlabStorage needs lock-free atomic flags");
+
+
+
+
+// Starts fetching 'bytes' bytes from 'address' on into this thread's cache, a cache line at a time. Prefetching
+// never faults, so a stale or null address does no harm.
+inline void fifoPrefetchBytes(const void* address, size_t bytes) {
+
+	const char* line = (const char*) ((uintptr_t) address & ~(uintptr_t) (FIFO_CACHE_LINE_SIZE - 1));
+	const char* end = (const char*) address + bytes;
+	for (; line < end; line += FIFO_CACHE_LINE_SIZE) PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, line);
+}
+
+
+// What to prefetch for an item beyond the item itself - nothing, unless specialised (see "Prefetching" above)
+template <class T>
+struct FifoPrefetch {
+	static void pointee(const T& item) {
+		(void) item;
+	}
+};
+
+
+
+
+template <class T, unsigned capacity>
+class FifoInlineStorage {
+
+	T items[capacity];	// The FIFO is implemented as a basic array of T - this basic array is called "items"
+
+public:
+
+	typedef T Item;
+	static const unsigned positions = capacity;
+
+	typedef const T* Ticket;	// The item being pushed, which is only copied into items[] by put()
+
+	static const bool batched = true;
+
+
+	bool stage(const T& item, Ticket* ticket) {
+		*ticket = &item;
+		return true;
+	}
+
+
+	// push_try() - put() copies the item all the same, since a T held inline is normally trivially copyable
+	bool stage(T&& item, Ticket* ticket) {
+		*ticket = &item;
+		return true;
+	}
+
+
+	// The item never left the caller, so there is nothing to give back
+	void unstage(Ticket ticket, T* giveBack) {
+		(void) ticket;
+		(void) giveBack;
+	}
+
+
+	void put(unsigned index, Ticket ticket) {
+		items[index] = *ticket;
+	}
+
+
+	unsigned take(unsigned index, T* itemPtr) {
+		*itemPtr = items[index];
+		return index;
+	}
+
+
+	void finish(unsigned taken, T* itemPtr) {
+		(void) taken;
+		(void) itemPtr;
+	}
+
+
+	// Copies 'count' items in from ring position index on. A run that reaches the end of items[] carries on
+	// at the start, so it is copied in at most two pieces.
+	void putRun(unsigned index, const T* source, unsigned count) {
+
+		unsigned first = (count < capacity - index) ? count : capacity - index;
+		fifoCopyItems(&items[index], source, first, true);
+		fifoCopyItems(&items[0], source + first, count - first, true);
+	}
+
+
+	void takeRun(unsigned index, T* dest, unsigned count) {
+
+		unsigned first = (count < capacity - index) ? count : capacity - index;
+		fifoCopyItems(dest, &items[index], first, false);
+		fifoCopyItems(dest + first, &items[0], count - first, false);
+	}
+
+
+	void prefetch(unsigned index) {
+		fifoPrefetchBytes(&items[index], sizeof(T));
+		FifoPrefetch<T>::pointee(items[index]);
+	}
+
+
+	static const char* name(void) {
+		return "inline";
+	}
+};
+
+
+
+
+template <class T, unsigned capacity>
+class FifoSlabStorage {
+
+	static_assert(capacity <= UINT_MAX - FIFO_SLAB_SPARE_SLOTS, "FifoSlabStorage capacity leaves no room for the spare slots");
+
+	static const unsigned slots = capacity + FIFO_SLAB_SPARE_SLOTS;
+
+	// Slab slot numbers are kept as narrow as the number of slots allows - 16 bits for up to 65536 slots - so
+	// that the ring stays dense
+	typedef typename std::conditional<(slots - 1 <= USHRT_MAX), unsigned short, unsigned>::type Slot;
+
+	Slot ring[capacity];			// Slab slot number of the item at each ring position
+	std::atomic<unsigned> nextSlot;		// Where the next writer starts looking for a free slot
+	std::atomic<bool> busy[slots];		// Slot claimed by a writer and not yet emptied by the reader
+	T slab[slots];
+
+public:
+
+	typedef T Item;
+	static const unsigned positions = capacity;
+
+	typedef unsigned Ticket;		// The slab slot number
+
+	static const bool batched = false;
+
+
+	FifoSlabStorage() : nextSlot(0) {
+		for (unsigned s = 0; s < slots; s++) busy[s].store(false, std::memory_order_relaxed);
+	}
+
+
+	// Claims a free slot and copies the item into it. Returns false if every slot is in use.
+	bool stage(const T& item, Ticket* ticket) {
+
+		if (!claim(ticket)) return false;
+		slab[*ticket] = item;
+		return true;
+	}
+
+
+	// push_try() - moves the item into the slot instead
+	bool stage(T&& item, Ticket* ticket) {
+
+		if (!claim(ticket)) return false;
+		slab[*ticket] = std::move(item);
+		return true;
+	}
+
+
+	// Frees the slot - first moving the item back to the caller of push_try(), if it was moved into the slot
+	void unstage(Ticket ticket, T* giveBack) {
+		if (giveBack != nullptr) *giveBack = std::move(slab[ticket]);
+		FIFO_SCHEDULE_POINT("slab: free slot");
+		busy[ticket].store(false, std::memory_order_release);
+	}
+
+
+	void put(unsigned index, Ticket ticket) {
+		ring[index] = (Slot) ticket;
+	}
+
+
+	// Returns the slot - the item is copied out of it by finish(), which may be after the ring position has
+	// been handed back
+	unsigned take(unsigned index, T* itemPtr) {
+		(void) itemPtr;
+		return ring[index];
+	}
+
+
+	// Moves rather than copies - the slot's copy of the item is finished with
+	void finish(unsigned slot, T* itemPtr) {
+		*itemPtr = std::move(slab[slot]);
+		FIFO_SCHEDULE_POINT("slab: free slot");
+		busy[slot].store(false, std::memory_order_release);
+	}
+
+
+	// The ring position is only a slot number - it's the slab slot that's worth fetching
+	void prefetch(unsigned index) {
+		fifoPrefetchBytes(&slab[ring[index]], sizeof(T));
+		FifoPrefetch<T>::pointee(slab[ring[index]]);
+	}
+
+
+	static const char* name(void) {
+		return "slab";
+	}
+
+
+private:
+
+	bool claim(Ticket* ticket) {
+
+		unsigned start = nextSlot.fetch_add(1, std::memory_order_relaxed);
+
+		for (unsigned i = 0; i < slots; i++) {
+			unsigned slot = (start + i) % slots;
+			// Test before exchanging, so that a busy slot costs a read rather than a write to its cache line
+			FIFO_SCHEDULE_POINT("slab: slot test");
+			if (!busy[slot].load(std::memory_order_relaxed) && !busy[slot].exchange(true, std::memory_order_acquire)) {
+				*ticket = slot;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+
+
+
+// The storage a Fifo of T uses unless told otherwise - see "About this file" above
+template <class T, unsigned capacity>
+struct FifoStorageFor {
+
+	static const bool isInline = std::is_trivially_copyable<T>::value && sizeof(T) <= FIFO_INLINE_MAX_BYTES;
+
+	typedef typename std::conditional<isInline, FifoInlineStorage<T, capacity>, FifoSlabStorage<T, capacity> >::type type;
+};
@@ -0,0 +1,602 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  A stress test and history checker for the software fifo template class and its variants.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the pieces of the stress test (Fifo_Benchmark_Win.cpp, "mode=stress");
+//
+//  StressEvent   - one push(), pop_try() or pop() call as seen by the thread that made it; what it was, what
+//                  it returned, which item it pushed or popped, and BenchClock times taken just before the
+//                  call and just after it returned
+//  stressHandlePush(), stressHandleFlush() - make a call on a producer handle (FifoProducer.h), recording it
+//                  in a StressEvent
+//  StressChecker - checks the histories of all the threads of a run against what a correct fifo may do
+//  runStressRound<>() - runs writer threads and one reader thread against a fifo (or anything with the same
+//                  push(), pop_try() and pop()) for a number of operations each, and checks the result
+//
+//  Each writer pushes items numbered 0, 1, 2... (moving on to the next number only when a push succeeds),
+//  with a pseudo-random pause before each push. Some of the writers ("handleWriters") may push through a
+//  producer handle of their own, flushing it when they have finished. The reader pauses pseudo-randomly too,
+//  and pops with a pseudo-random mix of pop_try() and pop(). Every call is recorded in the calling thread's
+//  own history, so recording never makes the threads wait for each other. When the writers have finished,
+//  the reader empties the fifo and the histories are checked;
+//
+//  - FIFO order per writer - the items of each writer are popped in the order they were pushed
+//  - No duplication - no item is popped twice
+//  - No loss - every item that was successfully pushed is popped
+//  - No invention - nothing is popped that was never successfully pushed, or before it was pushed
+//  - FULL is honest - a push() returning FIFO_STATUS_FULL or FIFO_STATUS_PREEMPTED could have seen the fifo
+//    full at some moment during the call. A reader with a release interval (see "Handing positions back" in
+//    Fifo.h) may hold back up to that less one popped positions, so the checker can be told to allow that -
+//    a round with a release interval (a Fifo only) sets it on the fifo and allows for it.
+//  - EMPTY is honest - a pop_try() returning FIFO_STATUS_EMPTY could have seen the fifo empty at some moment
+//    during the call
+//
+//  For the last two the exact moment each call took effect isn't known - only that it was some time between
+//  its two time stamps - so the checker works out the most (or least) items the fifo could possibly have held
+//  during the call, given every other call's time stamps, and only complains when even that doesn't allow
+//  the result. FIFO_STATUS_LOCKED may be returned at any time and isn't checked.
+//
+//  An item pushed to a producer handle only enters the fifo when the handle publishes its chunk - in that
+//  push(), or a later one, or the flush - so the checker times the item by the call that published it. And
+//  a writer is told FULL when the room promised to the handles counts too, so the most the fifo could have
+//  held during a FULL call includes, for each handle, the most room it could have been promised at the
+//  time - what it held after its last call before then, or during any call of its that overlapped.
+//
+//  The time stamps of different threads are compared with each other, which relies on the processor's
+//  time-stamp counter being synchronised across processors (an "invariant TSC", as on all recent x86).
+//
+//
+//  Sanitizers
+//  ==========
+//
+//  The harness itself is free of data races - each history belongs to one thread and is only read once
+//  that thread has been joined - so a ThreadSanitizer build reports only races in the fifo under test.
+//  MSVC has no ThreadSanitizer; build with clang (e.g. clang-cl with -fsanitize=thread where the platform
+//  supports it) to use one, or with /fsanitize=address to catch memory errors. Note that the fifo's
+//  'volatile' population is, to ThreadSanitizer, a race in its own right.
+//
+//
+
+
+#pragma once
+
+
+#include "FifoBench.h"		// For BenchClock and BenchRandom
+#include "FifoProducer.h"	// Producer handles
+
+#include <algorithm>		// For std::sort and the binary searches
+#include <atomic>
+#include <memory>		// For std::unique_ptr
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+#define STRESS_OP_PUSH		((unsigned) 0)
+#define STRESS_OP_POP_TRY	((unsigned) 1)
+#define STRESS_OP_POP		((unsigned) 2)
+#define STRESS_OP_FLUSH		((unsigned) 3)	// A producer handle's flush() - it pushes nothing of its own
+
+#define STRESS_MAX_ERRORS	((size_t) 10)	// Errors described in full - the rest are only counted
+
+#define STRESS_HANDLE_CHUNK	((unsigned) 4)	// Chunk size of the writers' producer handles - small, so that they publish often
+
+
+
+
+// The item passed through the fifo
+struct StressItem {
+	unsigned writer;
+	unsigned sequence;
+};
+
+
+struct StressEvent {
+	unsigned long long startTicks;	// BenchClock time just before the call
+	unsigned long long endTicks;	// BenchClock time just after it returned
+	unsigned op;			// STRESS_OP_...
+	FifoStatus status;		// FIFO_STATUS_... returned (pop() always succeeds)
+	StressItem item;		// Pushed, or popped if the status is FIFO_STATUS_SUCCESS
+	unsigned published;		// Items the call made visible to the reader - a push()'s own, or a handle's chunk
+	unsigned roomMost;		// Producer handle - most ring positions it was promised at any moment during the call
+	unsigned roomAfter;		// ...and when the call returned
+};
+
+
+typedef std::vector<StressEvent> StressHistory;
+
+
+struct StressConfig {
+	unsigned writers;
+	unsigned handleWriters;		// Of those, how many push through a producer handle (FifoProducer.h) of their own
+	unsigned opsPerWriter;		// push() calls made by each writer
+	unsigned maxPause;		// Longest pause before each call, in YieldProcessor() iterations
+	unsigned popPercent;		// Reader's calls that are pop() rather than pop_try(), as a percentage
+	unsigned releaseInterval;	// A Fifo's reader hands back popped positions this many at a time (1 - each at once)
+	unsigned releaseFullPercent;	// ...and at once whenever the Fifo is at least this full
+	unsigned seed;
+	BenchGenerator generator;
+};
+
+
+struct StressResult {
+	unsigned long long pushes, pops;	// Successful calls
+	unsigned long long full, empty;		// FIFO_STATUS_FULL or _PREEMPTED and FIFO_STATUS_EMPTY results checked
+	unsigned long long errorCount;
+	std::vector<std::string> errors;	// The first STRESS_MAX_ERRORS errors
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  StressChecker
+//
+//  Checks the histories of one run. writerHistories[w] is the history of writer w; readerHistory is the
+//  history of the (single) reader.
+//
+//--------------------------------------------------------------------------------
+
+class StressChecker {
+
+	unsigned capacity;
+	unsigned heldBack;	// Popped positions the reader may not yet have handed back
+	StressResult result;
+
+	// Successful pushes and pops by start and by end time, sorted, for counting how many took place before
+	// (or could have taken place before) a given time - a push by the call that published its item
+	std::vector<unsigned long long> pushStarts, pushEnds, popStarts, popEnds;
+
+	std::vector<const StressHistory*> handleHistories;	// Those of writers with producer handles
+
+public:
+
+	explicit StressChecker(unsigned fifoCapacity, unsigned fifoHeldBack = 0) : capacity(fifoCapacity), heldBack(fifoHeldBack), result() {}
+
+
+	StressResult check(const std::vector<StressHistory>& writerHistories, const StressHistory& readerHistory) {
+
+		// Each writer's successful pushes, indexed by sequence number, so a popped item can be matched up - each
+		// with the call that published it (the push() itself, or a later call on the writer's producer handle),
+		// which is when it entered the fifo
+		std::vector<std::vector<const StressEvent*> > pushed(writerHistories.size());
+
+		for (size_t w = 0; w < writerHistories.size(); w++) {
+
+			size_t published = 0;
+
+			for (size_t e = 0; e < writerHistories[w].size(); e++) {
+				const StressEvent& event = writerHistories[w][e];
+				if (event.status != FIFO_STATUS_SUCCESS) continue;
+
+				if (event.op == STRESS_OP_PUSH) {
+					if (event.item.writer != w || event.item.sequence != pushed[w].size()) {
+						error("writer " + std::to_string(w) + " pushed item " + describe(event.item) + " out of turn - harness fault");
+					}
+					pushed[w].push_back(NULL);
+				}
+				if (event.roomMost > 0) handleHistories.push_back(&writerHistories[w]);
+
+				// A handle publishes every item waiting in its chunk
+				if (event.published != 0 && published + event.published != pushed[w].size()) {
+					error("writer " + std::to_string(w) + " published " + std::to_string(event.published) + " item(s) with " +
+						std::to_string(pushed[w].size() - published) + " waiting - harness fault");
+				}
+				for (unsigned i = 0; i < event.published && published < pushed[w].size(); i++) {
+					pushed[w][published++] = &event;
+					pushStarts.push_back(event.startTicks);
+					pushEnds.push_back(event.endTicks);
+				}
+			}
+			if (published < pushed[w].size()) {
+				error("writer " + std::to_string(w) + " never published its last " + std::to_string(pushed[w].size() - published) + " item(s)");
+			}
+		}
+		handleHistories.erase(std::unique(handleHistories.begin(), handleHistories.end()), handleHistories.end());
+
+		// The reader's pops in the order it made them - the order the fifo gave the items out
+		std::vector<unsigned> nextSequence(writerHistories.size(), 0);
+
+		for (size_t e = 0; e < readerHistory.size(); e++) {
+
+			const StressEvent& event = readerHistory[e];
+			if (event.status != FIFO_STATUS_SUCCESS) continue;
+
+			popStarts.push_back(event.startTicks);
+			popEnds.push_back(event.endTicks);
+
+			unsigned w = event.item.writer;
+			unsigned sequence = event.item.sequence;
+
+			if (w >= pushed.size() || sequence >= pushed[w].size() || pushed[w][sequence] == NULL) {
+				error("popped item " + describe(event.item) + " which was never successfully pushed (or published)");
+				continue;
+			}
+			if (pushed[w][sequence]->startTicks > event.endTicks) {
+				error("popped item " + describe(event.item) + " before it was pushed");
+			}
+			if (sequence < nextSequence[w]) {
+				error("popped item " + describe(event.item) + " again, or out of order - expected " + std::to_string(nextSequence[w]));
+			}
+			else if (sequence > nextSequence[w]) {
+				error("popped item " + describe(event.item) + " out of order, or lost " + std::to_string(sequence - nextSequence[w]) +
+					" item(s) from " + std::to_string(nextSequence[w]));
+			}
+			if (sequence >= nextSequence[w]) nextSequence[w] = sequence + 1;
+		}
+
+		for (size_t w = 0; w < pushed.size(); w++) {
+			if (nextSequence[w] < pushed[w].size()) {
+				error("lost the last " + std::to_string(pushed[w].size() - nextSequence[w]) + " item(s) of writer " + std::to_string(w));
+			}
+		}
+
+		result.pushes = pushStarts.size();
+		result.pops = popStarts.size();
+
+		std::sort(pushStarts.begin(), pushStarts.end());
+		std::sort(pushEnds.begin(), pushEnds.end());
+		std::sort(popStarts.begin(), popStarts.end());
+		std::sort(popEnds.begin(), popEnds.end());
+
+		// FULL - the most the fifo could have held during the call is every push that had started by the time
+		// it returned, less every pop that had finished before it started, plus the most room the producer
+		// handles could have been promised meanwhile
+		for (size_t w = 0; w < writerHistories.size(); w++) {
+			for (size_t e = 0; e < writerHistories[w].size(); e++) {
+				const StressEvent& event = writerHistories[w][e];
+				if (event.status != FIFO_STATUS_FULL && event.status != FIFO_STATUS_PREEMPTED) continue;
+
+				result.full++;
+				long long most = (long long) countAtOrBefore(pushStarts, event.endTicks) - (long long) countBefore(popEnds, event.startTicks);
+				for (size_t h = 0; h < handleHistories.size(); h++) {
+					most += mostPromised(*handleHistories[h], event.startTicks, event.endTicks);
+				}
+				if (most + heldBack < (long long) capacity) {
+					error("writer " + std::to_string(w) + " was told " + fifoStatusName(event.status) + " but the fifo held at most " +
+						std::to_string(most) + " of " + std::to_string(capacity));
+				}
+			}
+		}
+
+		// EMPTY - the least the fifo could have held during the call is every push that had finished before it
+		// started, less every pop that had started by the time it returned
+		for (size_t e = 0; e < readerHistory.size(); e++) {
+			const StressEvent& event = readerHistory[e];
+			if (event.status != FIFO_STATUS_EMPTY) continue;
+
+			result.empty++;
+			long long least = (long long) countBefore(pushEnds, event.startTicks) - (long long) countAtOrBefore(popStarts, event.endTicks);
+			if (least > 0) {
+				error("reader was told FIFO_STATUS_EMPTY but the fifo held at least " + std::to_string(least));
+			}
+		}
+
+		return result;
+	}
+
+
+private:
+
+	void error(const std::string& description) {
+		if (result.errors.size() < STRESS_MAX_ERRORS) result.errors.push_back(description);
+		result.errorCount++;
+	}
+
+
+	static std::string describe(const StressItem& item) {
+		return std::to_string(item.writer) + ":" + std::to_string(item.sequence);
+	}
+
+
+	// The most room a producer handle can have been promised at any moment from 'start' to 'end' - what it held
+	// after its last call that returned before then, or the most during any of its calls that overlap. A
+	// writer's calls follow each other, so its history is in order of both time stamps.
+	static unsigned mostPromised(const StressHistory& history, unsigned long long start, unsigned long long end) {
+
+		size_t e = std::lower_bound(history.begin(), history.end(), start,
+			[](const StressEvent& event, unsigned long long ticks) { return event.endTicks < ticks; }) - history.begin();
+
+		unsigned most = (e > 0) ? history[e - 1].roomAfter : 0;
+		for (; e < history.size() && history[e].startTicks <= end; e++) {
+			if (history[e].roomMost > most) most = history[e].roomMost;
+		}
+		return most;
+	}
+
+
+	static size_t countBefore(const std::vector<unsigned long long>& sorted, unsigned long long ticks) {
+		return std::lower_bound(sorted.begin(), sorted.end(), ticks) - sorted.begin();
+	}
+
+
+	static size_t countAtOrBefore(const std::vector<unsigned long long>& sorted, unsigned long long ticks) {
+		return std::upper_bound(sorted.begin(), sorted.end(), ticks) - sorted.begin();
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The stress threads
+//
+//--------------------------------------------------------------------------------
+
+inline void stressPause(BenchRandom& random, unsigned maxPause) {
+
+	unsigned pause = maxPause ? random.next() % (maxPause + 1) : 0;
+	for (unsigned i = 0; i < pause; i++) YieldProcessor();
+}
+
+
+// A push() on a producer handle, recorded in 'event' (whose op, item and time stamps the caller fills in) with
+// the items the call published and the room the handle was promised during it and after it. A handle only
+// asks for room when it has none (see FifoProducer.h), so room asked for and published in the same call is
+// known only to be at most a chunk.
+template <class FifoType, unsigned chunkSize>
+void stressHandlePush(FifoProducer<FifoType, chunkSize>& producer, StressEvent* event) {
+
+	unsigned roomBefore = producer.promisedRoom();
+	unsigned waiting = producer.pending();
+
+	event->status = producer.push(event->item);
+
+	bool succeeded = (event->status == FIFO_STATUS_SUCCESS);
+	event->roomAfter = producer.promisedRoom();
+	event->published = (succeeded && producer.pending() == 0) ? waiting + 1 : 0;
+	event->roomMost = (roomBefore != 0) ? roomBefore : !succeeded ? 0 : (event->roomAfter != 0) ? event->roomAfter : chunkSize;
+}
+
+
+// A flush() of a producer handle, recorded the same way
+template <class FifoType, unsigned chunkSize>
+void stressHandleFlush(FifoProducer<FifoType, chunkSize>& producer, StressEvent* event) {
+
+	event->roomMost = producer.promisedRoom();
+	event->published = producer.pending();
+
+	producer.flush();
+
+	event->status = FIFO_STATUS_SUCCESS;
+	event->roomAfter = producer.promisedRoom();
+}
+
+
+// Whether a writer can push into a Queue through a producer handle with chunks of chunkSize items - only into
+// a Fifo that holds its items inline and has room for a whole chunk (see FifoProducer.h)
+template <class Queue, unsigned chunkSize>
+struct StressHandlesFor {
+	static const bool supported = false;
+};
+
+
+template <class T, unsigned capacity, class WaitPolicy, class Storage, class LockPolicy, unsigned chunkSize>
+struct StressHandlesFor<Fifo<T, capacity, WaitPolicy, Storage, LockPolicy>, chunkSize> {
+	static const bool supported = Storage::batched && chunkSize <= capacity;
+};
+
+
+template <class Queue>
+void stressWriter(Queue* queue, unsigned writer, const StressConfig* config, const std::atomic<bool>* go, StressHistory* history) {
+
+	BenchRandom random(config->generator, benchThreadSeed(config->seed, writer));
+	history->reserve(config->opsPerWriter);
+
+	while (!go->load(std::memory_order_acquire)) YieldProcessor();
+
+	StressItem item = { writer, 0 };
+
+	for (unsigned op = 0; op < config->opsPerWriter; op++) {
+
+		stressPause(random, config->maxPause);
+
+		StressEvent event;
+		event.op = STRESS_OP_PUSH;
+		event.item = item;
+		event.startTicks = BenchClock::now();
+		event.status = queue->push(item);
+		event.endTicks = BenchClock::now();
+		event.published = (event.status == FIFO_STATUS_SUCCESS) ? 1 : 0;
+		event.roomMost = event.roomAfter = 0;
+		history->push_back(event);
+
+		if (event.status == FIFO_STATUS_SUCCESS) item.sequence++;
+	}
+}
+
+
+// A writer that pushes through a producer handle of its own (with chunks of STRESS_HANDLE_CHUNK items), as
+// stressWriter() does straight into the queue, and flushes it at the end. Only a queue that can have one is
+// given such writers (see runStressRound() below) - for any other this does nothing.
+template <class Queue, bool supported = StressHandlesFor<Queue, STRESS_HANDLE_CHUNK>::supported>
+struct StressHandleWriter {
+	static void run(Queue*, unsigned, const StressConfig*, const std::atomic<bool>*, StressHistory*) {}
+};
+
+
+template <class Queue>
+struct StressHandleWriter<Queue, true> {
+
+	static void run(Queue* queue, unsigned writer, const StressConfig* config, const std::atomic<bool>* go, StressHistory* history) {
+
+		BenchRandom random(config->generator, benchThreadSeed(config->seed, writer));
+		history->reserve(config->opsPerWriter + 1);
+		FifoProducer<Queue, STRESS_HANDLE_CHUNK> producer(*queue);
+
+		while (!go->load(std::memory_order_acquire)) YieldProcessor();
+
+		StressItem item = { writer, 0 };
+
+		for (unsigned op = 0; op < config->opsPerWriter; op++) {
+
+			stressPause(random, config->maxPause);
+
+			StressEvent event;
+			event.op = STRESS_OP_PUSH;
+			event.item = item;
+			event.startTicks = BenchClock::now();
+			stressHandlePush(producer, &event);
+			event.endTicks = BenchClock::now();
+			history->push_back(event);
+
+			if (event.status == FIFO_STATUS_SUCCESS) item.sequence++;
+		}
+
+		StressEvent event;
+		event.op = STRESS_OP_FLUSH;
+		event.item = item;
+		event.startTicks = BenchClock::now();
+		stressHandleFlush(producer, &event);
+		event.endTicks = BenchClock::now();
+		history->push_back(event);
+	}
+};
+
+
+// The reader mixes pop_try() and pop() until the writers have finished (pop() can't be used after that - it
+// might never return) and then empties the fifo with pop_try(), up to and including the wake-up item (see
+// runStressRound() below). Should the fifo lose the wake-up item, the reader stops at the first EMPTY after
+// it was pushed.
+template <class Queue>
+void stressReader(Queue* queue, const StressConfig* config, const std::atomic<bool>* go, const std::atomic<bool>* writersDone,
+	const std::atomic<bool>* wakePushed, StressHistory* history) {
+
+	BenchRandom random(config->generator, benchThreadSeed(config->seed, config->writers));
+	history->reserve((size_t) config->opsPerWriter * (config->writers + 1));
+
+	while (!go->load(std::memory_order_acquire)) YieldProcessor();
+
+	for (;;) {
+
+		bool draining = writersDone->load(std::memory_order_acquire);
+		bool finished = wakePushed->load(std::memory_order_acquire);
+		if (!draining) stressPause(random, config->maxPause);
+
+		StressEvent event;
+		event.item.writer = event.item.sequence = ~0u;
+		event.published = event.roomMost = event.roomAfter = 0;
+
+		if (!draining && random.next() % 100 < config->popPercent) {
+			event.op = STRESS_OP_POP;
+			event.startTicks = BenchClock::now();
+			queue->pop(&event.item);
+			event.status = FIFO_STATUS_SUCCESS;
+		}
+		else {
+			event.op = STRESS_OP_POP_TRY;
+			event.startTicks = BenchClock::now();
+			event.status = queue->pop_try(&event.item);
+		}
+		event.endTicks = BenchClock::now();
+		history->push_back(event);
+
+		if (event.status == FIFO_STATUS_SUCCESS && event.item.writer == config->writers) break;
+		if (finished && event.status == FIFO_STATUS_EMPTY) break;
+	}
+}
+
+
+// Sets a queue up for a round - nothing to do unless it's a Fifo. Returns how many popped positions its reader
+// may hold back, for the checker.
+template <class Queue>
+unsigned stressSetUp(Queue* queue, const StressConfig& config) {
+
+	(void) queue;
+	(void) config;
+	return 0;
+}
+
+
+template <class T, unsigned capacity, class WaitPolicy, class Storage, class LockPolicy>
+unsigned stressSetUp(Fifo<T, capacity, WaitPolicy, Storage, LockPolicy>* fifo, const StressConfig& config) {
+
+	fifo->setReleaseInterval(config.releaseInterval, config.releaseFullPercent);
+	return (config.releaseInterval > 1) ? config.releaseInterval - 1 : 0;
+}
+
+
+// One run of the stress test. The writers are threads 0 to config.writers - 1, the first config.handleWriters
+// of them with producer handles - the caller sees that the queue can have them (StressHandlesFor). Once they
+// have finished one more item is pushed (as "writer" config.writers), to release the reader if it is asleep
+// in pop().
+template <class Queue>
+StressResult runStressRound(const StressConfig& config, unsigned capacity) {
+
+	// Allocated on the heap - the fifo may be too big for the stack
+	std::unique_ptr<Queue> queue(new Queue);
+	unsigned heldBack = stressSetUp(queue.get(), config);
+
+	std::vector<StressHistory> writerHistories(config.writers + 1);
+	StressHistory readerHistory;
+
+	std::atomic<bool> go(false), writersDone(false), wakePushed(false);
+
+	std::thread reader(stressReader<Queue>, queue.get(), &config, &go, &writersDone, &wakePushed, &readerHistory);
+	std::vector<std::thread> writers;
+	for (unsigned w = 0; w < config.writers; w++) {
+		if (w < config.handleWriters) {
+			writers.push_back(std::thread(StressHandleWriter<Queue>::run, queue.get(), w, &config, &go, &writerHistories[w]));
+		}
+		else writers.push_back(std::thread(stressWriter<Queue>, queue.get(), w, &config, &go, &writerHistories[w]));
+	}
+
+	go.store(true, std::memory_order_release);
+	for (unsigned w = 0; w < config.writers; w++) writers[w].join();
+
+	// The wake-up item. It is recorded like any other push, so the checker accounts for it.
+	writersDone.store(true, std::memory_order_release);
+	StressItem wakeItem = { config.writers, 0 };
+	for (;;) {
+		StressEvent event;
+		event.op = STRESS_OP_PUSH;
+		event.item = wakeItem;
+		event.startTicks = BenchClock::now();
+		event.status = queue->push(wakeItem);
+		event.endTicks = BenchClock::now();
+		event.published = (event.status == FIFO_STATUS_SUCCESS) ? 1 : 0;
+		event.roomMost = event.roomAfter = 0;
+		writerHistories[config.writers].push_back(event);
+		if (event.status == FIFO_STATUS_SUCCESS) break;
+		YieldProcessor();
+	}
+	wakePushed.store(true, std::memory_order_release);
+
+	reader.join();
+
+	return StressChecker(capacity, heldBack).check(writerHistories, readerHistory);
+}
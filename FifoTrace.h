@@ -0,0 +1,169 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Static tracepoints for the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the tracepoints placed in Fifo.h, so that what the fifo is doing can be watched in a
+//  running process without rebuilding it.
+//
+//  The tracepoints are Event Tracing for Windows (ETW) TraceLogging events - the Windows counterpart of
+//  static user-level (SDT/USDT) probes. While no trace session is listening to the provider, each tracepoint
+//  costs one test of an "enabled" flag and a (correctly predicted) branch around it - the event's fields,
+//  including the FIFO population, are only read when the event is actually being recorded.
+//
+//  The tracepoints are compiled in by default. Define FIFO_TRACING as 0 to compile them out altogether.
+//
+//
+//  The provider and its events
+//  ===========================
+//
+//  Provider "FlyweightFifo", GUID {39478A0A-9FC0-4483-A708-A5C82B40A94F}.
+//
+//  Every event carries "FifoId", the Fifo<>::getId() of the fifo concerned, and "Population", the FIFO
+//  population at the time of the event;
+//
+//  PushAccepted  - push() stored an item
+//  PushRejected  - push() did not store an item. Also carries "Status", the FIFO_STATUS_... code returned.
+//  WriterWake    - push() is about to set the 'Data Available' Event, which may wake the reader thread
+//  Pop           - pop() or pop_try() obtained an item (Population is after the pop)
+//  ReaderPark    - pop() found the FIFO empty and is putting the reader thread to sleep
+//  ReaderUnpark  - the reader thread has woken up in pop()
+//
+//  For example, using the Windows Performance Recorder;
+//
+//  wpr -start FlyweightFifo.wprp        (a recording profile naming the provider above)
+//  ...run the application...
+//  wpr -stop fifo.etl
+//
+//  or "tracelog -start fifo -guid #39478A0A-9FC0-4483-A708-A5C82B40A94F -f fifo.etl" / "tracelog -stop fifo",
+//  and view the result with Windows Performance Analyzer or "tracerpt fifo.etl".
+//
+//
+//  Projects with more than one .cpp file
+//  =====================================
+//
+//  The provider itself must be defined in exactly one .cpp file of a program. The Console Apps in this
+//  project have only one, so this file defines it. In a program where more than one .cpp file includes
+//  Fifo.h, define FIFO_TRACE_PROVIDER_DEFINED_ELSEWHERE in all but one of them.
+//
+//
+
+
+#pragma once
+
+
+#ifndef FIFO_TRACING
+#define FIFO_TRACING		1
+#endif
+
+
+#if FIFO_TRACING
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>	// For the TraceLogging macros (links with advapi32.lib)
+
+
+#ifdef FIFO_TRACE_PROVIDER_DEFINED_ELSEWHERE
+TRACELOGGING_DECLARE_PROVIDER(FifoTraceProvider);
+#else
+TRACELOGGING_DEFINE_PROVIDER(
+	FifoTraceProvider,
+	"FlyweightFifo",
+	// {39478A0A-9FC0-4483-A708-A5C82B40A94F}
+	(0x39478a0a, 0x9fc0, 0x4483, 0xa7, 0x08, 0xa5, 0xc8, 0x2b, 0x40, 0xa9, 0x4f));
+#endif
+
+
+// Registers the provider with ETW the first time a Fifo is constructed, and unregisters it when the
+// program exits
+class FifoTraceRegistration {
+
+	FifoTraceRegistration() {
+		TraceLoggingRegister(FifoTraceProvider);
+	}
+
+	~FifoTraceRegistration() {
+		TraceLoggingUnregister(FifoTraceProvider);
+	}
+
+public:
+
+	static void ensureRegistered(void) {
+		static FifoTraceRegistration registration;
+	}
+};
+
+
+// The tracepoints. TraceLoggingWrite() only evaluates its field arguments if the event is enabled.
+
+#define FIFO_TRACE_PUSH_ACCEPTED(fifoId, population) \
+	TraceLoggingWrite(FifoTraceProvider, "PushAccepted", \
+		TraceLoggingUInt32((fifoId), "FifoId"), TraceLoggingUInt32((population), "Population"))
+
+#define FIFO_TRACE_PUSH_REJECTED(fifoId, population, status) \
+	TraceLoggingWrite(FifoTraceProvider, "PushRejected", \
+		TraceLoggingUInt32((fifoId), "FifoId"), TraceLoggingUInt32((population), "Population"), \
+		TraceLoggingUInt32((status), "Status"))
+
+#define FIFO_TRACE_WRITER_WAKE(fifoId, population) \
+	TraceLoggingWrite(FifoTraceProvider, "WriterWake", \
+		TraceLoggingUInt32((fifoId), "FifoId"), TraceLoggingUInt32((population), "Population"))
+
+#define FIFO_TRACE_POP(fifoId, population) \
+	TraceLoggingWrite(FifoTraceProvider, "Pop", \
+		TraceLoggingUInt32((fifoId), "FifoId"), TraceLoggingUInt32((population), "Population"))
+
+#define FIFO_TRACE_READER_PARK(fifoId, population) \
+	TraceLoggingWrite(FifoTraceProvider, "ReaderPark", \
+		TraceLoggingUInt32((fifoId), "FifoId"), TraceLoggingUInt32((population), "Population"))
+
+#define FIFO_TRACE_READER_UNPARK(fifoId, population) \
+	TraceLoggingWrite(FifoTraceProvider, "ReaderUnpark", \
+		TraceLoggingUInt32((fifoId), "FifoId"), TraceLoggingUInt32((population), "Population"))
+
+#define FIFO_TRACE_REGISTER()	FifoTraceRegistration::ensureRegistered()
+
+
+#else	// !FIFO_TRACING
+
+
+#define FIFO_TRACE_PUSH_ACCEPTED(fifoId, population)		((void) 0)
+#define FIFO_TRACE_PUSH_REJECTED(fifoId, population, status)	((void) 0)
+#define FIFO_TRACE_WRITER_WAKE(fifoId, population)		((void) 0)
+#define FIFO_TRACE_POP(fifoId, population)			((void) 0)
+#define FIFO_TRACE_READER_PARK(fifoId, population)		((void) 0)
+#define FIFO_TRACE_READER_UNPARK(fifoId, population)		((void) 0)
+#define FIFO_TRACE_REGISTER()					((void) 0)
+
+
+#endif	// FIFO_TRACING
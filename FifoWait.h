@@ -0,0 +1,308 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  Wait strategies for the reader thread of the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains the ways in which pop() can put the reader thread to sleep while the FIFO is empty,
+//  and the ways in which push() then wakes it up again. The strategy is the third template parameter of
+//  Fifo, for example "Fifo<Work, 64, FifoSpinThenParkWait>"; the default is FifoEventWait, the original
+//  Windows Event.
+//
+//  FifoEventWait        - a manual-reset Windows Event, set by every push() and reset when the FIFO empties
+//  FifoAddressWait      - WaitOnAddress() on the FIFO population (the Windows counterpart of a Linux futex).
+//                         push() only calls WakeByAddressSingle() when the reader is actually asleep.
+//  FifoCondVarWait      - a condition variable with a slim reader/writer lock, again only signalled when
+//                         the reader is actually asleep
+//  FifoSpinWait         - the reader never sleeps - it spins until the population is non-zero. Quickest to
+//                         respond but burns a processor the whole time the FIFO is empty.
+//  FifoSpinThenParkWait - spins for up to FIFO_SPIN_LIMIT iterations, then falls back to FifoAddressWait
+//
+//  Each strategy provides;
+//
+//  park(population) - called by pop() while the FIFO is empty. Returns when the population MAY have become
+//                     non-zero - pop() tests again and calls park() again if not.
+//  wake(population) - called by push() after it has bumped the population and released the mutex
+//  drained()        - called by pop() and pop_try() when they have emptied the FIFO. The reader doesn't hold
+//                     the mutex (see "The reader and the mutex" in Fifo.h), so a writer may already have
+//                     pushed again - pop() tests the population again before it parks.
+//  name()           - a short name for the strategy, for benchmark reports
+//
+//
+//  Lost wake-ups
+//  =============
+//
+//  The strategies that only wake a reader that is asleep rely on a "sleeping" flag. The reader sets the flag
+//  then tests the population; a writer bumps the population then tests the flag. Both put a full memory
+//  fence between their write and their read, so at least one of them sees the other's write - either the
+//  reader sees the item and doesn't sleep, or the writer sees the flag and wakes the reader.
+//
+//  The model checker (FifoModel.h, Fifo_ModelCheck_Win.cpp) explores the interleavings of these steps for
+//  small numbers of threads and items, and reports any in which the reader sleeps through a push. Each
+//  access to the flag or the population is preceded by a FIFO_SCHEDULE_POINT() for it to switch threads at.
+//
+//
+
+
+#pragma once
+
+
+#include <windows.h>		// For the Windows Event, WaitOnAddress() and the condition variable
+#include <atomic>		// For the sleeping flag and memory fences
+
+#pragma comment(lib, "Synchronization.lib")	// For WaitOnAddress()
+
+
+
+#ifndef FIFO_SPIN_LIMIT
+#define FIFO_SPIN_LIMIT		((unsigned) 2000)	// FifoSpinThenParkWait - spin iterations before sleeping
+#endif
+
+static_assert(FIFO_SPIN_LIMIT >= 1, "FIFO_SPIN_LIMIT must be at least 1 - use FifoAddressWait for no spinning");
+// The sleeping flags rely on fences between plain atomic accesses - an atomic that took a lock would add a
+// lock to every push()
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "The wait strategies need a lock-free std::atomic<unsigned>");
+
+
+
+
+class FifoEventWait {
+
+	HANDLE DataAvailableEvent;	// At least one array slot in items[] contains data
+
+public:
+
+	FifoEventWait() {
+
+		// CreateEvent(Security attributes (Null=default), Is a manual-reset event?, Initial state is Signaled?, Name)
+		// The Event is deliberately unnamed - a named Event is shared by every object that opens that name, so
+		// two Fifo instances in the same process would otherwise wake each other's reader threads
+		DataAvailableEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+
+
+	~FifoEventWait() {
+		CloseHandle(DataAvailableEvent);
+	}
+
+
+	void park(volatile unsigned* population) {
+
+		WaitForSingleObject(DataAvailableEvent, INFINITE); // indefinite wait
+		FIFO_SCHEDULE_POINT("event park: population test");
+
+		// NOTE - A writer thread sets the Event AFTER it has released the mutex, so the reader thread may already
+		// have popped that writer's item (and reset the Event) by the time the Event is set. The Event can
+		// therefore be found set while the FIFO is in fact empty. If that's what woke us, reset the Event and
+		// go back to sleep. Any writer that bumps the population after the test below sets the Event again
+		// afterwards, so that wake-up can't be lost.
+		if (*population == 0) ResetEvent(DataAvailableEvent);
+	}
+
+
+	// Set the 'Data Available' Event. This action might release the reader thread if that thread is waiting on it
+	void wake(volatile unsigned* population) {
+		(void) population;
+		SetEvent(DataAvailableEvent);
+	}
+
+
+	// Item is no longer available so reset the Event flag
+	void drained(void) {
+		ResetEvent(DataAvailableEvent);
+	}
+
+
+	static const char* name(void) {
+		return "event";
+	}
+};
+
+
+
+
+class FifoAddressWait {
+
+	std::atomic<unsigned> sleeping;	// Non-zero while the reader is (about to be) asleep
+
+public:
+
+	FifoAddressWait() : sleeping(0) {}
+
+
+	void park(volatile unsigned* population) {
+
+		FIFO_SCHEDULE_POINT("address park: set sleeping");
+		sleeping.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		// WaitOnAddress() only sleeps if the population is still 0 - and it is woken by any WakeByAddress...()
+		// after a writer has changed it
+		unsigned empty = 0;
+		FIFO_SCHEDULE_POINT("address park: population test");
+		if (*population == 0) WaitOnAddress(population, &empty, sizeof(empty), INFINITE);
+
+		FIFO_SCHEDULE_POINT("address park: clear sleeping");
+		sleeping.store(0, std::memory_order_relaxed);
+	}
+
+
+	void wake(volatile unsigned* population) {
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		FIFO_SCHEDULE_POINT("address wake: sleeping test");
+		if (sleeping.load(std::memory_order_relaxed)) WakeByAddressSingle((PVOID) population);
+	}
+
+
+	void drained(void) {}
+
+
+	static const char* name(void) {
+		return "address";
+	}
+};
+
+
+
+
+class FifoCondVarWait {
+
+	SRWLOCK lock;
+	CONDITION_VARIABLE dataAvailable;
+	std::atomic<unsigned> sleeping;	// Non-zero while the reader is (about to be) asleep
+
+public:
+
+	FifoCondVarWait() : sleeping(0) {
+		InitializeSRWLock(&lock);
+		InitializeConditionVariable(&dataAvailable);
+	}
+
+
+	void park(volatile unsigned* population) {
+
+		AcquireSRWLockExclusive(&lock);
+
+		FIFO_SCHEDULE_POINT("condvar park: set sleeping");
+		sleeping.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		// The population is tested with the lock held, and the lock is only released once the reader is
+		// asleep, so a writer that takes the lock to signal can't slip in between the test and the sleep
+		FIFO_SCHEDULE_POINT("condvar park: population test");
+		if (*population == 0) SleepConditionVariableSRW(&dataAvailable, &lock, INFINITE, 0);
+
+		FIFO_SCHEDULE_POINT("condvar park: clear sleeping");
+		sleeping.store(0, std::memory_order_relaxed);
+		ReleaseSRWLockExclusive(&lock);
+	}
+
+
+	void wake(volatile unsigned* population) {
+
+		(void) population;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		FIFO_SCHEDULE_POINT("condvar wake: sleeping test");
+		if (sleeping.load(std::memory_order_relaxed)) {
+			AcquireSRWLockExclusive(&lock);
+			ReleaseSRWLockExclusive(&lock);
+			WakeConditionVariable(&dataAvailable);
+		}
+	}
+
+
+	void drained(void) {}
+
+
+	static const char* name(void) {
+		return "condvar";
+	}
+};
+
+
+
+
+class FifoSpinWait {
+
+public:
+
+	void park(volatile unsigned* population) {
+		while (*population == 0) YieldProcessor();
+	}
+
+
+	void wake(volatile unsigned* population) {
+		(void) population;
+	}
+
+
+	void drained(void) {}
+
+
+	static const char* name(void) {
+		return "spin";
+	}
+};
+
+
+
+
+class FifoSpinThenParkWait {
+
+	FifoAddressWait sleeper;
+
+public:
+
+	void park(volatile unsigned* population) {
+
+		for (unsigned spin = 0; spin < FIFO_SPIN_LIMIT; spin++) {
+			if (*population != 0) return;
+			YieldProcessor();
+		}
+		sleeper.park(population);
+	}
+
+
+	void wake(volatile unsigned* population) {
+		sleeper.wake(population);
+	}
+
+
+	void drained(void) {}
+
+
+	static const char* name(void) {
+		return "spinpark";
+	}
+};
@@ -0,0 +1,3234 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//  A multi-threaded load generator and benchmark harness for the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains a main() function which has been developed for the purpose of implementing a Windows
+//  Console App that hits instantiations of the software fifo template class (Fifo.h) with requests from
+//  several writer threads and reader threads at once, in a pseudo-random but reproducible way, as described
+//  in "Suggestions for more comprehensive multi-threaded testing" in Software_Fifo_Exercise_Win.cpp.
+//
+//
+//  How the load benchmark works
+//  ============================
+//
+//  The fifo is designed for a single reader thread, so each reader thread is given its own fifo. The writer
+//  threads are shared out between the fifos (writer w pushes to fifo w % readers).
+//
+//  Each writer thread makes a fixed number of push requests. The time at which each request is made is
+//  decided in advance by that writer's BenchArrivals schedule (see FifoBench.h), which is seeded from the
+//  run seed and the writer's index. The writer busy-waits until each request is due, so writers occupy
+//  a processor each for the duration of the run (they only give it up while the next request is more than
+//  50us away).
+//
+//  A push that doesn't succeed is not retried - the item is dropped and the status is counted. This shows
+//  directly how often writers see FIFO_STATUS_FULL, FIFO_STATUS_LOCKED and FIFO_STATUS_PREEMPTED.
+//
+//  With "loop=open" the writers instead keep trying until each item is in, and latency is measured from the
+//  time the schedule said the item should be pushed - not from when the writer finally got round to it. A
+//  writer held up by a full fifo falls behind its schedule, and the requests it should have made meanwhile
+//  are charged the wait, just as real requests arriving on their own schedule would be. (Measuring from
+//  the actual push, as a closed loop does, quietly leaves those waits out - "coordinated omission" - and
+//  makes the tail look far better than it is.) Two extra sets of percentiles are reported; "send_delay",
+//  from the scheduled time to the successful push, and "response", from the scheduled time to the pop.
+//
+//  Each item carries the time at which it was pushed, so the reader can measure how long it spent in the
+//  fifo. The time each push() call takes is also measured by the writer. When the harness is built with
+//  FIFO_INSTRUMENT_LATENCY defined as 1 the fifo's own histogram of the time items spend in it is reported
+//  as well ("fifo_histogram_..." - the worst figure across the fifos when there are several readers).
+//  Similarly FIFO_INSTRUMENT_COUNTERS adds the fifo's own count of push and pop results ("fifo_push_..."
+//  and "fifo_pop..." - these include the sentinel items of a blocking reader), and FIFO_INSTRUMENT_OCCUPANCY
+//  adds the fifo population high-water mark and time-weighted average ("fifo_occupancy_...", the highest
+//  across the fifos). The sampled population history can also be written to a CSV file ("series=").
+//
+//  Building with FIFO_INSTRUMENT_LOCKS defined as 1 adds a contention report for the fifo's mutex
+//  ("lock_writer_..."); how often the writers found the mutex held by another thread, how long they waited
+//  for it (they never wait - they return FIFO_STATUS_LOCKED - unless the fifo has one of the spinlocks of
+//  FifoLock.h) and how long they held it. The reader never takes the mutex (see "The reader and the mutex"
+//  in Fifo.h).
+//
+//  Each fifo is named ("load0", "load1", ...) so that, while the benchmark runs, the metrics of all of them
+//  can be exported in Prometheus text format to a file ("metrics=") or on a local socket ("metrics_socket=")
+//  - see FifoMetricsExporter.h. Which metrics there are depends on the FIFO_INSTRUMENT_... macros.
+//
+//  The reader either polls with pop_try() ("reader=poll") or sleeps in pop() ("reader=block"). A blocking
+//  reader is told that the run is over by a sentinel item pushed once all writers have finished.
+//
+//
+//  How the wake-up latency benchmark works
+//  =======================================
+//
+//  "mode=wake" measures how quickly a reader thread asleep in pop() gets going again after push(), for each
+//  of the wait strategies of FifoWait.h. Two threads play ping-pong through a pair of fifos; each in turn
+//  busy-waits for a while ("gap=", long enough for the other thread to have gone to sleep), pushes an item
+//  stamped with the time, and then sleeps in pop() until the reply arrives. The time from just before push()
+//  to the other thread's pop() returning is the wake-up latency.
+//
+//  The two threads are pinned to a pair of logical processors chosen from the machine's topology; both
+//  halves of one physical core ("smt"), two cores sharing an L3 cache ("l3"), two cores of one socket
+//  ("core"), two sockets ("socket"), or left to the OS ("none"). Placements the machine doesn't have are skipped. Percentiles are reported for each
+//  strategy and placement, and the whole distribution can be written to a CSV file ("dist=") - the number
+//  of samples in buckets of about 19% width, with the cumulative fraction.
+//
+//  Note that "spin" keeps a processor busy all the time - with placement=none on a machine with few
+//  processors it may be very slow indeed.
+//
+//
+//  How the comparative benchmark works
+//  ===================================
+//
+//  "mode=compare" runs the same workload through the fifo and through each of the baseline queues of
+//  FifoBaselines.h (std::queue with a std::mutex, a condition variable blocking queue and a lock-free
+//  bounded queue), all with the same capacity. A number of producer threads ("producers=", by default 1, 4
+//  and then 16) push their share of the items as fast as they can, retrying each push until it succeeds, and
+//  a single consumer thread pops them all. Each case is run with a small (16 byte) and a large (256 byte)
+//  item type. Throughput, the number of push retries and the time from each item's first push attempt to its
+//  pop are reported - "format=csv" or "format=json" give one record per case, for keeping track of
+//  regressions from run to run.
+//
+//  So are the processor cycles the producers and the consumer used per item, and the instructions per item
+//  where the processor's instructions retired counter can be read (see BenchCounters in FifoBench.h) - for
+//  seeing what a change to the fifo's layout does to the work done, not just to the time taken. These
+//  include the cycles spent retrying a push to a full queue and polling an empty one. Other counters (cache
+//  misses, cross-core dirty hits, branch misses) can't be read by an ordinary Windows process - they are
+//  counted with "pmc=on", run as administrator, and otherwise reported as "n/a".
+//
+//  The fifo is run with each of its locks (see FifoLock.h) - "fifo" with the Critical Section, which a
+//  producer gives up on when it is held (push() returns FIFO_STATUS_LOCKED, and the producer retries), and
+//  "fifo_ttas" and "fifo_ticket" with the spinlocks, which producers wait their turn for. Each record gives
+//  the lock, and whether the case is "oversubscribed" - more producer and consumer threads than the machine
+//  has logical processors - where a spinning thread may be keeping the lock holder (or, with the ticket lock,
+//  the next in line) off the processor. Running with and without placement= shows what pinning does to each.
+//
+//
+//  The throughput sweep
+//  ====================
+//
+//  "mode=sweep" runs one command's worth of throughput cases, meant to be run regularly (e.g. nightly) to
+//  catch throughput regressions; every combination of the fifo's wait strategies ("policy="), capacities
+//  (8 to 1048576), item sizes (4 bytes to 4KB) and numbers of writer threads (1 to 64). The writers push
+//  their share of the items as fast as they can, retrying each push until it succeeds, and the reader pops
+//  them with pop(), so that the wait strategy matters. Each case can be run several times ("runs="), keeping
+//  the best throughput - the run least disturbed by the rest of the machine. Fifos bigger than 64MB (e.g. a
+//  million 4KB items) are skipped.
+//
+//  The result is a summary table with one row for each wait strategy, capacity and item size, and a column
+//  of millions of items per second for each number of writers. Every case is also written, as one record,
+//  to a CSV file ("csv=") - with the processor cycles per item and the machine it ran on.
+//
+//  Given the CSV file of an earlier sweep ("baseline="), each case is compared with the same case there.
+//  A case whose throughput has fallen by more than "tolerance=" percent is a regression; each one is listed
+//  on stderr and in the "regressed" column of the summary table (the writer counts concerned), and the exit
+//  code is 1. Throughput varies from run to run, so a baseline is best made, and compared with, on the same
+//  machine with the same options and "runs=3" or more.
+//
+//
+//  The storage benchmark
+//  =====================
+//
+//  "mode=storage" measures, for a range of item sizes, the throughput of a fifo holding its items inline
+//  and of one holding them in a slab (see FifoStorage.h), in the same way as mode=sweep (writers pushing as
+//  fast as they can to a reader sleeping in pop()). There is one record for each item size and number of
+//  writers, giving both throughputs, how much faster (or slower) the slab was, and which storage the fifo
+//  picks for itself with the current FIFO_INLINE_MAX_BYTES - for checking that threshold on a given machine.
+//
+//
+//  The batch benchmark
+//  ===================
+//
+//  "mode=batch" measures how quickly push_batch() and pop_batch() move items of a range of sizes (16 bytes
+//  to 4KB) through a fifo - one writer pushing runs of "batch=" items as fast as it can, and one reader
+//  fetching up to that many at a time. Each item size is run with each kind of bulk copy the processor
+//  supports (see FifoCopy.h), and once with push() and pop() item by item ("unbatched") for comparison.
+//  There is one record for each item size and copy, giving megabytes and millions of items per second.
+//
+//
+//  The prefetch benchmark
+//  ======================
+//
+//  "mode=prefetch" measures what the reader's prefetching (see "Prefetching" in FifoStorage.h) saves it for
+//  big items - 256 bytes to 4KB, held by value ("item=value", in a slab) or pointed to ("item=pointer", with
+//  a FifoPrefetch hook that fetches the object pointed to). In each round the writer fills the fifo and the
+//  reader then pops every item and reads all of it, so the reader always has items ahead of it to prefetch
+//  and every one of them was last written by the writer's processor. The reader's time and processor cycles
+//  per item are reported for each prefetch distance ("distance="), along with the change in its time per
+//  item from not prefetching at all (distance 0).
+//
+//
+//  The retry loop benchmark
+//  ========================
+//
+//  "mode=retry" compares two ways for a writer to keep trying until an item that owns memory (a std::string
+//  of "size=" bytes, held in a slab) is in a small, busy fifo. With push() the writer keeps its item and
+//  passes it again each time - and each attempt that gets as far as a slab slot copies it there. With
+//  push_try() the writer moves the item in, and gets it back if the push fails - nothing is copied. There is
+//  one record for each item size and number of writers, giving the throughput and push retries of each.
+//
+//
+//  The backoff benchmark
+//  ======================
+//
+//  "mode=backoff" compares three ways for many writers ("writers=", by default 8 and 32) to deal with a busy
+//  fifo - each writer tries to push "items=" small items, busy-waiting "gap=" nanoseconds before each, and
+//  moves on to the next item whether or not the last one went in;
+//
+//  once       - one push() per item. Any failure loses the item.
+//  spin       - push() again at once, in a tight loop, while it returns FIFO_STATUS_LOCKED, up to
+//               "budget=" attempts - the retry loop callers tend to write
+//  push_retry - push_retry() with the same budget (and "budget_us=" microseconds), backing off with jitter
+//               between attempts (see "Retrying a push" in FifoLock.h)
+//
+//  The default gap keeps 32 writers' offered load (6.4 million items a second) within what the reader can
+//  pop, so that most failures are down to the writers getting in each other's way rather than to the fifo
+//  being full. Each strategy gives up at once on FIFO_STATUS_FULL and FIFO_STATUS_PREEMPTED. Items given up on
+//  as full ("lost_full", FULL or PREEMPTED) and as busy ("lost_busy", LOCKED) are reported separately, with the
+//  writers' processor cycles per item tried, and the change in both the items lost and the cycles from "spin".
+//
+//
+//  The producer handle benchmark
+//  ==============================
+//
+//  "mode=producer" compares writers pushing each item with push() against writers each pushing through a
+//  producer handle of their own (see FifoProducer.h) with chunks of 4, 16 and 64 items ("chunk="). The
+//  writers ("writers=", by default 1, 4 and 16) push their share of the items as fast as they can, retrying
+//  each push until it succeeds, and the reader pops them all, checking that each writer's items arrive in
+//  order. Throughput, the mutex acquisitions per item spent publishing, and the time from each item's first
+//  push attempt to its pop are reported - the last being what chunking costs, bounded by "flush_us=".
+//
+//
+//  The release interval benchmark
+//  ==============================
+//
+//  "mode=release" runs the same workload - writers ("writers=", by default 1, 4 and 16) pushing small items
+//  as fast as they can into a 256 item fifo, retrying each push until it succeeds, and one reader popping
+//  them - with the reader handing popped ring positions back to the writers every 1, 4, 16 and 64 pops
+//  ("release="; see "Handing positions back" in Fifo.h). It reports the hand-backs per item (each one an
+//  interlocked write to the cache line the writers test for room), the pushes per item told FULL or PREEMPTED
+//  - which a held-back position can cause - and the cycles and cross-core dirty hits (HITM) per item of all
+//  the threads together. HITM needs a programmable counter ("pmc=on", see "The PMC session" in FifoBench.h);
+//  where none can be read the hand-backs per item are the measure of the traffic saved.
+//
+//
+//  The stress test
+//  ===============
+//
+//  "mode=stress" checks that the fifo (or a baseline queue, or a fifo with another wait strategy or lock) really
+//  does behave as a fifo under concurrent assault - see FifoStress.h for what is checked and how. It runs
+//  round after round (each "ops=" pushes per writer, with the seed going up by one each round) for
+//  "duration=" seconds, or until a round fails. A failing round is reported with the options that re-run
+//  it, and is then shrunk - fewer writers, fewer operations, shorter pauses - to the smallest round that can
+//  still be seen to fail. Thread timing is never quite the same twice, so the same seed gives each thread
+//  the same pauses and calls but not necessarily the same interleaving; re-run the reported options with
+//  "repeat=1" (every round with the same seed) to make the failure come back. The exit code is 1 if a round
+//  failed. "release=" gives a fifo's reader a release interval (see "Handing positions back" in Fifo.h), so
+//  that handing popped positions back a few at a time is put under the same assault, with the checker
+//  allowing for the positions the reader may hold back. "handles=" has some of the writers push through
+//  producer handles, so that room promised to them, and the chunks they publish, are too.
+//
+//  For exhaustive exploration of the interleavings of a few small cases instead, see the model checking
+//  Console App, Fifo_ModelCheck_Win.cpp.
+//
+//
+//  Thread placement
+//  ================
+//
+//  Where the threads run makes a large difference to the figures. Two threads on the two halves of one
+//  physical core share all its caches, two cores pass cache lines to each other through a shared L3 cache,
+//  and two sockets pass them over the interconnect between the sockets. The load and compare benchmarks
+//  leave their threads to the OS unless told otherwise. "placement=" pins the reader (the consumer, for
+//  mode=compare) to one logical processor and the writers (producers) to processors that distance away from
+//  it; the other halves of its core ("smt"), other cores sharing its L3 cache ("l3"), other cores of its
+//  socket ("core") or the cores of another socket ("socket"). When there are more writers than such
+//  processors they take turns at them. For anything else "reader_cpus=" and "writer_cpus=" give lists of
+//  logical processor numbers - reader r runs on the r'th of its list and writer w on the w'th of its,
+//  going round the list again when it runs out.
+//
+//  Windows has no counterpart of Linux's "isolcpus" for keeping everything else off the chosen processors,
+//  but "priority=high" (or "realtime", given administrator rights) raises the priority class of the
+//  benchmark so that other processes are less likely to get in its way.
+//
+//  Every record reports the machine it was measured on - logical processors, cores, L3 caches, sockets and
+//  NUMA nodes, as GetLogicalProcessorInformationEx() gives them - and the priority, and the load and compare
+//  records give the placement and the processors used, so that results from different machines or
+//  placements can't be mistaken for each other.
+//
+//
+//  Command line options
+//  ====================
+//
+//  All options are "name=value" and all are optional;
+//
+//  mode=load            Benchmark to run - load, wake, compare, sweep, storage, batch, prefetch, retry, backoff,
+//                       producer, release or stress
+//
+//  For mode=load;
+//
+//  writers=2            Number of writer threads
+//  readers=1            Number of reader threads (and therefore fifos)
+//  items=100000         Push requests made by each writer
+//  rate=100000          Average push requests per second made by each writer
+//  pattern=fixed        Request timing - fixed (frequency modulated), poisson or bursty
+//  depth=0.5            pattern=fixed - modulation depth, the period swings by +/- this fraction
+//  modperiod=1000       pattern=fixed - requests per modulation cycle
+//  burst=16             pattern=bursty - requests per burst
+//  prng=mt              Pseudo-random generator - mt (Mersenne Twister) or lfsr (Shift-register PRBG)
+//  seed=1               Run seed
+//  capacity=1024        Fifo capacity - one of 5, 64, 1024 or 16384
+//  reader=poll          Reader thread uses pop_try() (poll) or pop() (block)
+//  loop=drop            Failed pushes are dropped (drop), or retried with latency from the schedule (open)
+//  series=              FIFO_INSTRUMENT_OCCUPANCY - CSV file to write the sampled population history to
+//  metrics=             File to write Prometheus metrics to, regularly and once more at the end of the run
+//  metrics_socket=      AF_UNIX socket path to serve Prometheus metrics on for the duration of the run
+//  metrics_interval=1000  metrics= - milliseconds between writes
+//  placement=none       Thread placement - none, smt, l3, core or socket (readers=1 only)
+//  reader_cpus=         Comma-separated logical processors for the reader threads, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=wake;
+//
+//  policy=all           Wait strategy - all, event, address, condvar, spin or spinpark
+//  placement=all        Thread placement - all, none, smt, l3, core or socket
+//  rounds=10000         Measured round trips (two wake-ups each)
+//  warmup=100           Unmeasured round trips first
+//  gap=50000            Nanoseconds each thread busy-waits before pushing
+//  dist=                CSV file to write the wake-up latency distributions to
+//
+//  For mode=compare;
+//
+//  queue=all            Queue - all, fifo, fifo_ttas, fifo_ticket, std_queue_mutex, condvar_queue or vyukov_mpmc
+//  size=all             Item size - all, small or large
+//  producers=1,4,16     Comma-separated numbers of producer threads
+//  items=1000000        Items passed through the queue in each case
+//  reader=poll          Consumer uses pop_try() (poll) or pop() (block)
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the consumer thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the producer threads, in place of placement=
+//
+//  For mode=sweep;
+//
+//  policy=all           Comma-separated wait strategies - all, or any of event, address, condvar, spin, spinpark
+//  capacity=8,64,1024,16384,1048576  Comma-separated fifo capacities, from those
+//  size=4,64,512,4096   Comma-separated item sizes in bytes, from those
+//  writers=1,2,4,8,16,32,64  Comma-separated numbers of writer threads
+//  items=200000         Items passed through the fifo in each case
+//  runs=1               Runs of each case - the best throughput is kept
+//  csv=                 CSV file to write every case to (the file to keep as a baseline)
+//  baseline=            CSV file of an earlier sweep to compare with
+//  tolerance=10         baseline= - percentage fall in throughput counted as a regression
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=storage;
+//
+//  size=8,16,32,64,128,256,512,1024,4096  Comma-separated item sizes in bytes, from those
+//  writers=1,4          Comma-separated numbers of writer threads
+//  items=200000         Items passed through the fifo in each case
+//  runs=1               Runs of each case - the best throughput is kept
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=batch;
+//
+//  size=16,64,256,1024,4096  Comma-separated item sizes in bytes, from those
+//  copy=all             Comma-separated copies - all, or any of unbatched, scalar, avx2, avx512
+//  batch=64             Most items pushed or popped in one call
+//  items=200000         Items passed through the fifo in each case
+//  runs=1               Runs of each case - the best throughput is kept
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Logical processor for the writer thread, in place of placement=
+//
+//  For mode=prefetch;
+//
+//  size=256,1024,4096   Comma-separated item sizes in bytes, from those
+//  item=value,pointer   Items pushed by value, by pointer, or both
+//  distance=0,1,2,4,8,16  Comma-separated prefetch distances (0 - no prefetching)
+//  items=200000         Items passed through the fifo in each case
+//  runs=1               Runs of each case - the best time per item is kept
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Logical processor for the writer thread, in place of placement=
+//
+//  For mode=retry;
+//
+//  size=16,256,4096     Comma-separated item (string) lengths in bytes
+//  writers=1,4,16       Comma-separated numbers of writer threads
+//  items=200000         Items passed through the fifo in each case
+//  runs=1               Runs of each case - the best throughput is kept
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=backoff;
+//
+//  writers=8,32         Comma-separated numbers of writer threads
+//  items=20000          Items each writer tries to push in each case
+//  gap=5000             Nanoseconds each writer busy-waits before each item
+//  budget=64            Most push attempts per item for spin and push_retry (0 - no limit)
+//  budget_us=0          Most microseconds push_retry spends on an item (0 - no limit)
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=producer;
+//
+//  chunk=4,16,64        Comma-separated producer handle chunk sizes, from those
+//  writers=1,4,16       Comma-separated numbers of writer threads
+//  items=200000         Items passed through the fifo in each case
+//  flush_us=50          Oldest an item may be before its handle's chunk is published, in microseconds
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=release;
+//
+//  release=1,4,16,64    Comma-separated numbers of pops before the reader hands their positions back
+//  full_percent=75      Population, as a percentage of the capacity, at which each pop hands back at once
+//  writers=1,4,16       Comma-separated numbers of writer threads
+//  items=200000         Items passed through the fifo in each case
+//  placement=none       Thread placement - none, smt, l3, core or socket
+//  reader_cpus=         Logical processor for the reader thread, in place of placement=
+//  writer_cpus=         Comma-separated logical processors for the writer threads, in place of placement=
+//
+//  For mode=stress;
+//
+//  queue=fifo           Queue - fifo, fifo_ttas, fifo_ticket, std_queue_mutex, condvar_queue or vyukov_mpmc
+//  policy=event         queue=fifo - wait strategy (event, address, condvar, spin or spinpark)
+//  storage=auto         queue=fifo - item storage (auto, inline or slab - see FifoStorage.h)
+//  capacity=8           Capacity - 8 or 64 (small, so that FULL is seen often)
+//  writers=4            Number of writer threads
+//  handles=0            queue=fifo... - how many of them push through producer handles (FifoProducer.h) of
+//                       their own, with chunks of 4 - inline storage only
+//  ops=20000            push() calls made by each writer in each round
+//  pause=64             Longest pseudo-random pause before each call, in YieldProcessor() iterations
+//  pop=25               Percentage of the reader's calls that are pop() rather than pop_try()
+//  release=1            queue=fifo... - popped positions the reader hands back at a time (see mode=release)
+//  full_percent=75      queue=fifo... - ...and at once whenever the fifo is at least this full
+//  duration=10          Seconds to keep running rounds for (0 - just one round)
+//  seed=                First round's seed (by default taken from the clock)
+//  repeat=0             1 - every round uses the same seed
+//  shrink=20            Attempts at each smaller round when shrinking a failure (0 - don't shrink)
+//  prng=mt              Pseudo-random generator - mt or lfsr
+//
+//  And for all modes;
+//
+//  format=text          Results as text, csv or json
+//  priority=normal      Priority class of the benchmark process - normal, high or realtime
+//  pmc=off              on - count cache misses, HITM and branch misses with an ETW session (needs
+//                       administrator rights; see "The PMC session" in FifoBench.h)
+//  pmc_cache=LLCMisses  Profile source counted as cache misses
+//  pmc_hitm=            Profile source counted as cross-core dirty hits (HITM) - none is built in
+//  pmc_branch=BranchMispredictions
+//                       Profile source counted as branch misses
+//
+//  For example "Fifo_Benchmark_Win.exe writers=4 pattern=poisson rate=250000 format=csv" or
+//  "Fifo_Benchmark_Win.exe mode=wake placement=core dist=wake.csv" or
+//  "Fifo_Benchmark_Win.exe mode=compare placement=l3 format=csv > compare.csv" or
+//  "Fifo_Benchmark_Win.exe mode=sweep runs=3 csv=tonight.csv baseline=lastnight.csv" or
+//  "Fifo_Benchmark_Win.exe mode=batch size=4096 batch=256" or
+//  "Fifo_Benchmark_Win.exe mode=prefetch item=pointer placement=socket" or
+//  "Fifo_Benchmark_Win.exe mode=backoff writers=32 budget=128" or
+//  "Fifo_Benchmark_Win.exe mode=producer writers=16 chunk=16 flush_us=20" or
+//  "Fifo_Benchmark_Win.exe mode=release writers=4 placement=socket" or
+//  "Fifo_Benchmark_Win.exe mode=stress writers=8 duration=60"
+//
+//
+//  Building the Windows Console App
+//  ================================
+//
+//  As for Software_Fifo_Exercise_Win.cpp, using this file in place of that one and adding header files
+//  FifoBench.h, FifoBaselines.h, FifoStress.h, FifoProducer.h and FifoMetricsExporter.h to the project as
+//  well as the fifo header files.
+//
+//
+
+
+#include "pch.h"		// Pre-compiled headers (pch)
+#include "FifoMetricsExporter.h"	// Includes <winsock2.h>, so must come before anything including <windows.h>
+#include <iostream>
+
+
+#include "Fifo.h"		// The software fifo template class
+#include "FifoBench.h"		// Benchmark building blocks
+#include "FifoBaselines.h"	// Other queues to compare the fifo with
+#include "FifoStress.h"		// The stress test and its checker
+#include "FifoProducer.h"	// Producer handles
+
+#include <atomic>		// For thread start and completion signalling
+#include <cstring>		// For memset()
+#include <fstream>		// For the occupancy history file and the sweep CSV files
+#include <map>			// For the sweep baseline
+#include <memory>		// For std::unique_ptr
+#include <thread>		// For the writer and reader threads
+#include <type_traits>		// For std::true_type and std::false_type
+#include <vector>
+
+
+
+using namespace std;
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  Thread placement (mode=load and mode=compare)
+//
+//--------------------------------------------------------------------------------
+
+// Where the reader and writer threads run. Each list is used round-robin; an empty list leaves those
+// threads to the OS.
+struct BenchPinning {
+	string placement;		// Placement name, or "cpus" for lists given with reader_cpus= and writer_cpus=
+	vector<unsigned> readers;	// Logical processor of each reader (consumer) thread
+	vector<unsigned> writers;	// Logical processor of each writer (producer) thread
+};
+
+
+// Works out the pinning from the placement=, reader_cpus= and writer_cpus= options - lists of processors
+// take the place of a placement. Returns false, having said why, if the options can't be met.
+bool choosePinning(const BenchOptions& options, const BenchTopology& topology, unsigned readers, unsigned writers,
+	BenchPinning* pinning) {
+
+	if (options.has("reader_cpus") || options.has("writer_cpus")) {
+
+		pinning->placement = "cpus";
+		pinning->readers = options.getUnsignedList("reader_cpus", "");
+		pinning->writers = options.getUnsignedList("writer_cpus", "");
+
+		// Only processor group 0 is used (see BenchTopology)
+		vector<unsigned> all(pinning->readers);
+		all.insert(all.end(), pinning->writers.begin(), pinning->writers.end());
+		for (size_t i = 0; i < all.size(); i++) {
+			if (all[i] >= 64) {
+				cerr << "Logical processor " << all[i] << " is out of range - use 0 to 63" << endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	pinning->placement = options.getString("placement", "none");
+	unsigned placement = benchParsePlacement(pinning->placement);
+
+	if (placement == BENCH_PLACEMENT_COUNT) {
+		cerr << "Unknown placement \"" << pinning->placement << "\" - use none, smt, l3, core or socket" << endl;
+		return false;
+	}
+	if (placement == BENCH_PLACEMENT_NONE) return true;
+
+	if (readers > 1) {
+		cerr << "placement= pins a single reader - use reader_cpus= and writer_cpus= for " << readers << " readers" << endl;
+		return false;
+	}
+
+	vector<unsigned> processors;
+	if (!topology.pickGroup(placement, writers, &processors)) {
+		cerr << "Placement \"" << pinning->placement << "\" is not available on this machine (" << topology.cores()
+			<< " cores, " << topology.l3Caches() << " L3 caches, " << topology.packages() << " sockets)" << endl;
+		return false;
+	}
+
+	pinning->readers.assign(1, processors[0]);
+	pinning->writers.assign(processors.begin() + 1, processors.end());
+	return true;
+}
+
+
+void recordPinning(BenchRecord& record, const BenchPinning& pinning) {
+
+	record.add("placement", pinning.placement);
+	record.add("reader_cpus", benchProcessorList(pinning.readers));
+	record.add("writer_cpus", benchProcessorList(pinning.writers));
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The load benchmark (mode=load)
+//
+//--------------------------------------------------------------------------------
+
+// The item type passed through the fifo by the load benchmark
+struct BenchItem {
+	unsigned long long pushTicks;	// BenchClock time at which the writer called push()
+	unsigned long long dueTicks;	// BenchClock time at which the writer's schedule said to push this item
+	unsigned writer;		// Index of the writer thread that pushed this item
+	unsigned sequence;		// Writer's request number
+};
+
+// BenchItem::writer value of the sentinel item that ends a blocking reader's run
+#define BENCH_SENTINEL_WRITER	((unsigned) 0xFFFFFFFF)
+
+
+struct LoadConfig {
+	unsigned writers;
+	unsigned readers;
+	unsigned itemsPerWriter;
+	BenchArrivalConfig arrivals;
+	BenchGenerator generator;
+	unsigned seed;
+	unsigned capacity;
+	bool blockingReader;
+	bool openLoop;			// Retry failed pushes, and measure latency from the scheduled time
+	string seriesFile;		// Where to write the occupancy history (FIFO_INSTRUMENT_OCCUPANCY only)
+	string metricsFile;		// Where to export Prometheus metrics to, if anywhere
+	string metricsSocket;
+	unsigned metricsIntervalMs;
+	BenchPinning pinning;		// Where the reader and writer threads run
+};
+
+
+struct WriterResult {
+	unsigned long long outcomes[FIFO_STATUS_COUNT];	// Number of push() calls returning each status
+	BenchSamples pushTime;				// Time taken by each push() call (the successful one, in an open loop)
+	BenchSamples sendDelay;				// Open loop - scheduled time to the successful push() returning
+};
+
+
+struct ReaderResult {
+	unsigned long long popped;			// Number of items popped (not counting the sentinel)
+	unsigned long long finishTicks;			// BenchClock time at which the last item was popped
+	BenchSamples fifoTime;				// Time each item spent in the fifo (push() call to pop return)
+	BenchSamples response;				// Open loop - scheduled push time to pop return
+};
+
+
+
+
+template <unsigned capacity>
+void writerThread(Fifo<BenchItem, capacity>* fifo, unsigned writerIndex, const LoadConfig* config,
+	const atomic<bool>* go, unsigned long long startTicks, WriterResult* result) {
+
+	BenchTopology::pin(benchProcessorFor(config->pinning.writers, writerIndex));
+
+	BenchArrivals arrivals(config->arrivals, BenchRandom(config->generator, benchThreadSeed(config->seed, writerIndex)));
+
+	// Work out the whole schedule before starting, so generating it doesn't disturb the timing
+	vector<unsigned long long> due(config->itemsPerWriter);
+	double offsetNs = 0.0;
+	for (unsigned i = 0; i < config->itemsPerWriter; i++) {
+		offsetNs += arrivals.nextGapNs();
+		due[i] = BenchClock::fromNanoseconds(offsetNs);
+	}
+
+	result->pushTime.reserve(config->itemsPerWriter);
+	if (config->openLoop) result->sendDelay.reserve(config->itemsPerWriter);
+
+	// Wait for the starting gun
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	for (unsigned i = 0; i < config->itemsPerWriter; i++) {
+
+		// Busy-wait until this request is due, giving up the processor while it's still some way off (this
+		// matters when there are more threads than processors)
+		unsigned long long dueTicks = startTicks + due[i];
+		unsigned long long nearTicks = BenchClock::fromNanoseconds(50000.0);
+		for (unsigned long long now = BenchClock::now(); now < dueTicks; now = BenchClock::now()) {
+			if (dueTicks - now > nearTicks) SwitchToThread();
+			else YieldProcessor();
+		}
+
+		BenchItem item;
+		item.writer = writerIndex;
+		item.sequence = i;
+		item.dueTicks = dueTicks;
+		item.pushTicks = BenchClock::now();
+
+		FifoStatus status = fifo->push(item);
+
+		// In an open loop the item is not dropped - the writer keeps trying until it's in. Any time this takes
+		// is charged to the item, as it would be to a real request that was due at dueTicks. If the writer
+		// falls behind its schedule the requests that follow start late, and that is charged to them too.
+		while (config->openLoop && status != FIFO_STATUS_SUCCESS) {
+			result->outcomes[(unsigned) status]++;
+			YieldProcessor();
+			item.pushTicks = BenchClock::now();
+			status = fifo->push(item);
+		}
+
+		unsigned long long pushedTicks = BenchClock::now();
+		result->pushTime.record(pushedTicks - item.pushTicks);
+		if (config->openLoop) result->sendDelay.record(pushedTicks - item.dueTicks);
+		result->outcomes[(unsigned) status]++;
+	}
+}
+
+
+template <unsigned capacity>
+void readerThread(Fifo<BenchItem, capacity>* fifo, unsigned readerIndex, const LoadConfig* config, const atomic<bool>* go,
+	const atomic<unsigned long long>* expected, ReaderResult* result) {
+
+	BenchTopology::pin(benchProcessorFor(config->pinning.readers, readerIndex));
+
+	size_t share = (size_t) config->itemsPerWriter * ((config->writers + config->readers - 1) / config->readers);
+	result->fifoTime.reserve(share);
+	if (config->openLoop) result->response.reserve(share);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	BenchItem item;
+
+	for (;;) {
+
+		if (config->blockingReader) {
+
+			fifo->pop(&item);
+			if (item.writer == BENCH_SENTINEL_WRITER) break;
+		}
+		else if (fifo->pop_try(&item) != FIFO_STATUS_SUCCESS) {
+
+			// Nothing to pop - finished if every item the writers managed to push has now been popped
+			if (result->popped == expected->load(memory_order_acquire)) break;
+			YieldProcessor();
+			continue;
+		}
+
+		unsigned long long now = BenchClock::now();
+		result->fifoTime.record(now - item.pushTicks);
+		if (config->openLoop) result->response.record(now - item.dueTicks);
+		result->finishTicks = now;
+		result->popped++;
+	}
+}
+
+
+#if FIFO_INSTRUMENT_LOCKS
+
+void addLockSide(FifoLockSideSnapshot& total, const FifoLockSideSnapshot& side) {
+
+	total.acquisitions += side.acquisitions;
+	total.contended += side.contended;
+	total.waitTicksTotal += side.waitTicksTotal;
+	total.waitTicksMax = max(total.waitTicksMax, side.waitTicksMax);
+	total.holdTicksTotal += side.holdTicksTotal;
+	total.holdTicksMax = max(total.holdTicksMax, side.holdTicksMax);
+}
+
+
+// A contended writer gives up (unless the lock makes writers wait), so its attempts are its acquisitions and its
+// contended tries together
+void recordLockSide(BenchRecord& record, const string& prefix, const FifoLockSideSnapshot& side) {
+
+	unsigned long long attempts = side.acquisitions + side.contended;
+
+	record.add(prefix + "_acquisitions", side.acquisitions);
+	record.add(prefix + "_contended", side.contended);
+	record.add(prefix + "_contended_fraction", attempts ? (double) side.contended / (double) attempts : 0.0);
+	record.add(prefix + "_wait_total_ms", BenchClock::toNanoseconds(side.waitTicksTotal) / 1.0e6);
+	record.add(prefix + "_wait_mean_ns", side.contended ? BenchClock::toNanoseconds(side.waitTicksTotal / side.contended) : 0.0);
+	record.add(prefix + "_wait_max_ns", BenchClock::toNanoseconds(side.waitTicksMax));
+	record.add(prefix + "_hold_total_ms", BenchClock::toNanoseconds(side.holdTicksTotal) / 1.0e6);
+	record.add(prefix + "_hold_mean_ns", side.acquisitions ? BenchClock::toNanoseconds(side.holdTicksTotal / side.acquisitions) : 0.0);
+	record.add(prefix + "_hold_max_ns", BenchClock::toNanoseconds(side.holdTicksMax));
+}
+
+#endif
+
+
+template <unsigned capacity>
+void runLoadBenchmark(const LoadConfig& config, BenchReport& report) {
+
+	// Fifos are allocated on the heap - with a large capacity they are too big for the stack. They are named,
+	// so that the metrics exporter can find them.
+	vector<unique_ptr<Fifo<BenchItem, capacity> > > fifos;
+	for (unsigned r = 0; r < config.readers; r++) {
+		fifos.push_back(unique_ptr<Fifo<BenchItem, capacity> >(new Fifo<BenchItem, capacity>("load" + to_string(r))));
+	}
+
+	FifoMetricsExporter exporter;
+	if (!config.metricsFile.empty() && !exporter.startFile(config.metricsFile, config.metricsIntervalMs)) {
+		cerr << "Can't write metrics file \"" << config.metricsFile << "\"" << endl;
+	}
+	else if (!config.metricsSocket.empty() && !exporter.startSocket(config.metricsSocket)) {
+		cerr << "Can't serve metrics on socket \"" << config.metricsSocket << "\"" << endl;
+	}
+
+	vector<WriterResult> writerResults(config.writers);
+	vector<ReaderResult> readerResults(config.readers);
+	vector<atomic<unsigned long long> > expected(config.readers);
+	for (unsigned r = 0; r < config.readers; r++) {
+		expected[r].store(~0ULL);
+		readerResults[r].popped = 0;
+		readerResults[r].finishTicks = 0;
+	}
+	for (unsigned w = 0; w < config.writers; w++) {
+		for (unsigned s = 0; s < FIFO_STATUS_COUNT; s++) writerResults[w].outcomes[s] = 0;
+	}
+
+	// Make sure the clock is calibrated before any thread needs it
+	BenchClock::ticksPerNanosecond();
+
+	// Start everything 10ms from now, giving the threads time to get going and work out their schedules
+	atomic<bool> go(false);
+	unsigned long long startTicks = BenchClock::now() + BenchClock::fromNanoseconds(10.0e6);
+
+	vector<thread> readers, writers;
+	for (unsigned r = 0; r < config.readers; r++) {
+		readers.push_back(thread(readerThread<capacity>, fifos[r].get(), r, &config, &go, &expected[r], &readerResults[r]));
+	}
+	for (unsigned w = 0; w < config.writers; w++) {
+		writers.push_back(thread(writerThread<capacity>, fifos[w % config.readers].get(), w, &config, &go, startTicks, &writerResults[w]));
+	}
+
+	while (BenchClock::now() < startTicks) YieldProcessor();
+	go.store(true, memory_order_release);
+
+	for (unsigned w = 0; w < config.writers; w++) writers[w].join();
+
+	// All writers are done - tell each reader how many items to expect, or send it the sentinel
+	for (unsigned r = 0; r < config.readers; r++) {
+
+		unsigned long long accepted = 0;
+		for (unsigned w = r; w < config.writers; w += config.readers) accepted += writerResults[w].outcomes[(unsigned) FIFO_STATUS_SUCCESS];
+		expected[r].store(accepted, memory_order_release);
+
+		if (config.blockingReader) {
+			BenchItem sentinel = { 0, 0, BENCH_SENTINEL_WRITER, 0 };
+			while (fifos[r]->push(sentinel) != FIFO_STATUS_SUCCESS) YieldProcessor();
+		}
+	}
+
+	for (unsigned r = 0; r < config.readers; r++) readers[r].join();
+
+	// Export the final figures while the fifos still exist
+	exporter.stop();
+
+	// Gather up the results
+	unsigned long long outcomes[FIFO_STATUS_COUNT] = {};
+	unsigned long long attempts = 0, popped = 0, finishTicks = startTicks;
+	BenchSamples pushTime, fifoTime, sendDelay, response;
+
+	for (unsigned w = 0; w < config.writers; w++) {
+		for (unsigned s = 0; s < FIFO_STATUS_COUNT; s++) outcomes[s] += writerResults[w].outcomes[s];
+		pushTime.append(writerResults[w].pushTime);
+		sendDelay.append(writerResults[w].sendDelay);
+	}
+	for (unsigned s = 0; s < FIFO_STATUS_COUNT; s++) attempts += outcomes[s];
+	for (unsigned r = 0; r < config.readers; r++) {
+		popped += readerResults[r].popped;
+		finishTicks = max(finishTicks, readerResults[r].finishTicks);
+		fifoTime.append(readerResults[r].fifoTime);
+		response.append(readerResults[r].response);
+	}
+
+	double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "load");
+	record.add("seed", config.seed);
+	record.add("prng", config.generator == BENCH_GENERATOR_MT ? "mt" : "lfsr");
+	record.add("pattern", config.arrivals.pattern == BENCH_ARRIVAL_FIXED ? "fixed" : config.arrivals.pattern == BENCH_ARRIVAL_POISSON ? "poisson" : "bursty");
+	record.add("writers", config.writers);
+	record.add("readers", config.readers);
+	record.add("capacity", capacity);
+	record.add("reader", config.blockingReader ? "block" : "poll");
+	record.add("loop", config.openLoop ? "open" : "drop");
+	record.add("items_per_writer", config.itemsPerWriter);
+	record.add("rate_per_writer", config.arrivals.ratePerSecond);
+	recordPinning(record, config.pinning);
+	record.add("attempts", attempts);
+	record.add("success", outcomes[(unsigned) FIFO_STATUS_SUCCESS]);
+	record.add("full", outcomes[(unsigned) FIFO_STATUS_FULL]);
+	record.add("locked", outcomes[(unsigned) FIFO_STATUS_LOCKED]);
+	record.add("preempted", outcomes[(unsigned) FIFO_STATUS_PREEMPTED]);
+	record.add("popped", popped);
+	record.add("duration_s", seconds);
+	record.add("throughput_items_per_s", seconds > 0.0 ? (double) popped / seconds : 0.0);
+	record.add("push_call", pushTime.percentiles());
+	record.add("fifo_time", fifoTime.percentiles());
+	if (config.openLoop) {
+		record.add("send_delay", sendDelay.percentiles());
+		record.add("response", response.percentiles());
+	}
+
+	// The fifo's own measurement of the same thing, if compiled in - summed over the fifos by taking the
+	// worst of each figure
+#if FIFO_INSTRUMENT_LATENCY
+	{
+		FifoHistogramSnapshot worst = {};
+		for (unsigned r = 0; r < config.readers; r++) {
+			FifoHistogramSnapshot snapshot = fifos[r]->getLatencySnapshot(true);
+			worst.count += snapshot.count;
+			worst.meanTicks = max(worst.meanTicks, snapshot.meanTicks);
+			worst.p50Ticks = max(worst.p50Ticks, snapshot.p50Ticks);
+			worst.p99Ticks = max(worst.p99Ticks, snapshot.p99Ticks);
+			worst.p999Ticks = max(worst.p999Ticks, snapshot.p999Ticks);
+			worst.maxTicks = max(worst.maxTicks, snapshot.maxTicks);
+		}
+		record.add("fifo_histogram", worst);
+	}
+#endif
+
+	// The fifo's own count of push() and pop results, if compiled in - these should agree with the counts
+	// made by the writer and reader threads above
+#if FIFO_INSTRUMENT_COUNTERS
+	{
+		FifoOutcomeSnapshot total = {};
+		for (unsigned r = 0; r < config.readers; r++) {
+			FifoOutcomeSnapshot snapshot = fifos[r]->getOutcomeSnapshot(true);
+			for (unsigned s = 0; s < FIFO_STATUS_COUNT; s++) total.push[s] += snapshot.push[s];
+			total.popped += snapshot.popped;
+			total.popEmpty += snapshot.popEmpty;
+		}
+		record.add("fifo_push_success", total.push[(unsigned) FIFO_STATUS_SUCCESS]);
+		record.add("fifo_push_full", total.push[(unsigned) FIFO_STATUS_FULL]);
+		record.add("fifo_push_locked", total.push[(unsigned) FIFO_STATUS_LOCKED]);
+		record.add("fifo_push_preempted", total.push[(unsigned) FIFO_STATUS_PREEMPTED]);
+		record.add("fifo_popped", total.popped);
+		record.add("fifo_pop_empty", total.popEmpty);
+	}
+#endif
+
+	// The population as seen by each fifo's reader, if compiled in - the highest high-water mark and average
+	// across the fifos, and optionally every fifo's sampled history written to a CSV file
+#if FIFO_INSTRUMENT_OCCUPANCY
+	{
+		unsigned highWaterMark = 0;
+		double average = 0.0;
+		BenchReport series;
+
+		for (unsigned r = 0; r < config.readers; r++) {
+
+			// A FifoOccupancySnapshot holds the whole sample history, so it's too big for the stack
+			unique_ptr<FifoOccupancySnapshot> snapshot(new FifoOccupancySnapshot(fifos[r]->getOccupancySnapshot(true)));
+			highWaterMark = max(highWaterMark, snapshot->highWaterMark);
+			average = max(average, snapshot->averagePopulation);
+
+			for (unsigned i = 0; i < snapshot->sampleCount; i++) {
+				BenchRecord& sample = series.newRecord();
+				sample.add("fifo", r);
+				sample.add("time_ms", BenchClock::toNanoseconds(snapshot->samples[i].ticks - startTicks) / 1.0e6);
+				sample.add("population", snapshot->samples[i].population);
+			}
+		}
+
+		record.add("fifo_occupancy_high_water_mark", highWaterMark);
+		record.add("fifo_occupancy_average", average);
+
+		if (!config.seriesFile.empty()) {
+			ofstream file(config.seriesFile.c_str());
+			series.print(file, BENCH_FORMAT_CSV);
+		}
+	}
+#endif
+
+	// The contention report, if compiled in - totals across the fifos (and the worst of the maxima)
+#if FIFO_INSTRUMENT_LOCKS
+	{
+		FifoLockSnapshot total = {};
+		for (unsigned r = 0; r < config.readers; r++) {
+			FifoLockSnapshot snapshot = fifos[r]->getLockSnapshot(true);
+			addLockSide(total.writer, snapshot.writer);
+		}
+
+		recordLockSide(record, "lock_writer", total.writer);
+	}
+#endif
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The wake-up latency benchmark (mode=wake)
+//
+//--------------------------------------------------------------------------------
+
+#define WAKE_FIFO_CAPACITY	((unsigned) 64)
+
+
+struct WakeItem {
+	unsigned long long pushTicks;	// BenchClock time just before push() was called
+	unsigned round;
+};
+
+
+struct WakeConfig {
+	unsigned rounds;		// Measured round trips
+	unsigned warmup;		// Unmeasured round trips before those
+	double gapNs;			// Busy-wait before each push, so the other thread has gone to sleep
+};
+
+
+// Busy-waits for the given time without giving up the processor
+void wakeGap(double gapNs) {
+
+	unsigned long long until = BenchClock::now() + BenchClock::fromNanoseconds(gapNs);
+	while (BenchClock::now() < until) YieldProcessor();
+}
+
+
+// One end of the ping-pong. The initiator pushes first and then waits for the reply; the other end waits
+// first and then replies. Both record the time from just before the other end's push() to their own pop()
+// returning.
+template <class WaitPolicy>
+void wakeThread(Fifo<WakeItem, WAKE_FIFO_CAPACITY, WaitPolicy>* in, Fifo<WakeItem, WAKE_FIFO_CAPACITY, WaitPolicy>* out,
+	bool initiator, unsigned processor, const WakeConfig* config, const atomic<bool>* go, BenchSamples* samples) {
+
+	BenchTopology::pin(processor);
+	samples->reserve(config->rounds);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	WakeItem item = { 0, 0 };
+
+	for (unsigned round = 0; round < config->warmup + config->rounds; round++) {
+
+		if (!initiator) {
+			in->pop(&item);
+			if (round >= config->warmup) samples->record(BenchClock::now() - item.pushTicks);
+		}
+
+		wakeGap(config->gapNs);
+
+		item.round = round;
+		item.pushTicks = BenchClock::now();
+		// The only other user of the fifo is its reader, so FIFO_STATUS_LOCKED is the only likely failure
+		while (out->push(item) != FIFO_STATUS_SUCCESS) YieldProcessor();
+
+		if (initiator) {
+			in->pop(&item);
+			if (round >= config->warmup) samples->record(BenchClock::now() - item.pushTicks);
+		}
+	}
+}
+
+
+template <class WaitPolicy>
+void runWakeBenchmark(const WakeConfig& config, unsigned placement, unsigned first, unsigned second,
+	BenchReport& report, BenchReport& distribution) {
+
+	Fifo<WakeItem, WAKE_FIFO_CAPACITY, WaitPolicy> ping, pong;
+	BenchSamples pingSamples, pongSamples;
+
+	atomic<bool> go(false);
+	thread initiator(wakeThread<WaitPolicy>, &pong, &ping, true, first, &config, &go, &pingSamples);
+	thread responder(wakeThread<WaitPolicy>, &ping, &pong, false, second, &config, &go, &pongSamples);
+
+	go.store(true, memory_order_release);
+	initiator.join();
+	responder.join();
+
+	// Both directions together
+	BenchSamples wake;
+	wake.append(pingSamples);
+	wake.append(pongSamples);
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "wake");
+	record.add("policy", WaitPolicy::name());
+	record.add("placement", benchPlacementName(placement));
+	record.add("cpu_a", first == ~0u ? string("any") : to_string(first));
+	record.add("cpu_b", second == ~0u ? string("any") : to_string(second));
+	record.add("gap_ns", config.gapNs);
+	record.add("wake", wake.percentiles());
+
+	vector<BenchBucket> buckets = wake.distribution();
+	unsigned long long cumulative = 0;
+	for (size_t b = 0; b < buckets.size(); b++) {
+		cumulative += buckets[b].count;
+		BenchRecord& row = distribution.newRecord();
+		row.add("policy", WaitPolicy::name());
+		row.add("placement", benchPlacementName(placement));
+		row.add("le_ns", buckets[b].upperNs);
+		row.add("count", buckets[b].count);
+		row.add("cumulative_fraction", (double) cumulative / (double) wake.size());
+	}
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The comparative benchmark (mode=compare)
+//
+//--------------------------------------------------------------------------------
+
+#define COMPARE_CAPACITY	((unsigned) 1024)	// A power of two, for BaselineVyukovQueue
+
+
+// A small item - 16 bytes
+struct CompareSmallItem {
+	unsigned long long pushTicks;	// BenchClock time of the producer's first attempt to push this item
+	unsigned producer;
+	unsigned sequence;
+};
+
+
+// A large item - 256 bytes
+struct CompareLargeItem {
+	unsigned long long pushTicks;
+	unsigned producer;
+	unsigned sequence;
+	char payload[240];
+};
+
+
+struct CompareConfig {
+	unsigned items;			// Items passed through the queue in each case, shared between the producers
+	bool blockingReader;		// Consumer uses pop() rather than pop_try()
+	unsigned processors;		// Logical processors on this machine - for telling oversubscribed cases apart
+	BenchPinning pinning;		// Where the consumer ("reader") and producer ("writer") threads run
+};
+
+
+// Pushes its share of the items as fast as it can, retrying each push until it succeeds, so that every
+// queue is asked to carry exactly the same items. counters[0] and counters[1] are set to the thread's
+// counters at the start and the end.
+template <class Queue, class Item>
+void compareProducer(Queue* queue, unsigned producer, unsigned count, unsigned processor, const atomic<bool>* go,
+	unsigned long long* retries, BenchCounterSnapshot* counters) {
+
+	BenchTopology::pin(processor);
+
+	Item item = {};
+	item.producer = producer;
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	counters[0] = BenchCounters::snapshot();
+
+	for (unsigned i = 0; i < count; i++) {
+		item.sequence = i;
+		item.pushTicks = BenchClock::now();
+		while (queue->push(item) != FIFO_STATUS_SUCCESS) {
+			(*retries)++;
+			YieldProcessor();
+		}
+	}
+
+	counters[1] = BenchCounters::snapshot();
+}
+
+
+template <class Queue, class Item>
+void compareConsumer(Queue* queue, unsigned long long total, bool blocking, unsigned processor, const atomic<bool>* go,
+	BenchSamples* latency, unsigned long long* finishTicks, BenchCounterSnapshot* counters) {
+
+	BenchTopology::pin(processor);
+	latency->reserve((size_t) total);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	counters[0] = BenchCounters::snapshot();
+
+	Item item;
+	for (unsigned long long popped = 0; popped < total; popped++) {
+		if (blocking) queue->pop(&item);
+		else while (queue->pop_try(&item) != FIFO_STATUS_SUCCESS) YieldProcessor();
+		latency->record(BenchClock::now() - item.pushTicks);
+	}
+	*finishTicks = BenchClock::now();
+
+	counters[1] = BenchCounters::snapshot();
+}
+
+
+template <class Queue, class Item>
+void runCompareCase(const CompareConfig& config, const char* queueName, const char* lockName, unsigned producers,
+	BenchReport& report) {
+
+	// Allocated on the heap - with large items the queues are too big for the stack
+	unique_ptr<Queue> queue(new Queue);
+
+	unsigned perProducer = max(1u, config.items / producers);
+	unsigned long long total = (unsigned long long) perProducer * producers;
+
+	vector<unsigned long long> retries(producers, 0);
+	BenchSamples latency;
+	unsigned long long finishTicks = 0;
+
+	// A start and an end snapshot for each thread - the consumer's first
+	vector<BenchCounterSnapshot> counters(2 * (producers + 1));
+
+	atomic<bool> go(false);
+	thread consumer(compareConsumer<Queue, Item>, queue.get(), total, config.blockingReader,
+		benchProcessorFor(config.pinning.readers, 0), &go, &latency, &finishTicks, &counters[0]);
+	vector<thread> threads;
+	for (unsigned p = 0; p < producers; p++) {
+		threads.push_back(thread(compareProducer<Queue, Item>, queue.get(), p, perProducer,
+			benchProcessorFor(config.pinning.writers, p), &go, &retries[p], &counters[2 * (p + 1)]));
+	}
+
+	unsigned long long startTicks = BenchClock::now();
+	go.store(true, memory_order_release);
+
+	for (unsigned p = 0; p < producers; p++) threads[p].join();
+	consumer.join();
+
+	unsigned long long totalRetries = 0;
+	for (unsigned p = 0; p < producers; p++) totalRetries += retries[p];
+
+	BenchCounterTotals counterTotals;
+	for (size_t t = 0; t < counters.size(); t += 2) counterTotals.add(counters[t], counters[t + 1]);
+
+	double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "compare");
+	record.add("queue", queueName);
+	record.add("lock", lockName);
+	record.add("item_bytes", (unsigned) sizeof(Item));
+	record.add("producers", producers);
+	record.add("consumers", 1u);
+	record.add("oversubscribed", producers + 1 > config.processors ? "yes" : "no");
+	record.add("capacity", COMPARE_CAPACITY);
+	record.add("reader", config.blockingReader ? "block" : "poll");
+	record.add("items", total);
+	recordPinning(record, config.pinning);
+	record.add("seconds", seconds);
+	record.add("items_per_second", seconds > 0.0 ? (double) total / seconds : 0.0);
+	record.add("push_retries", totalRetries);
+	record.add("latency", latency.percentiles());
+	counterTotals.describe(record, total);
+}
+
+
+// Runs every selected queue for one item type and number of producers
+template <class Item>
+void runCompareQueues(const CompareConfig& config, const string& queues, unsigned producers, BenchReport& report) {
+
+	typedef typename FifoStorageFor<Item, COMPARE_CAPACITY>::type Storage;
+
+	if (queues == "all" || queues == "fifo") {
+		runCompareCase<Fifo<Item, COMPARE_CAPACITY>, Item>(config, "fifo", FifoCriticalSectionLock::name(), producers, report);
+	}
+	if (queues == "all" || queues == "fifo_ttas") {
+		runCompareCase<Fifo<Item, COMPARE_CAPACITY, FifoEventWait, Storage, FifoTtasLock>, Item>(config, "fifo_ttas",
+			FifoTtasLock::name(), producers, report);
+	}
+	if (queues == "all" || queues == "fifo_ticket") {
+		runCompareCase<Fifo<Item, COMPARE_CAPACITY, FifoEventWait, Storage, FifoTicketLock>, Item>(config, "fifo_ticket",
+			FifoTicketLock::name(), producers, report);
+	}
+	if (queues == "all" || queues == BaselineStdQueue<Item, COMPARE_CAPACITY>::name()) {
+		runCompareCase<BaselineStdQueue<Item, COMPARE_CAPACITY>, Item>(config, BaselineStdQueue<Item, COMPARE_CAPACITY>::name(),
+			"std_mutex", producers, report);
+	}
+	if (queues == "all" || queues == BaselineCondVarQueue<Item, COMPARE_CAPACITY>::name()) {
+		runCompareCase<BaselineCondVarQueue<Item, COMPARE_CAPACITY>, Item>(config, BaselineCondVarQueue<Item, COMPARE_CAPACITY>::name(),
+			"std_mutex", producers, report);
+	}
+	if (queues == "all" || queues == BaselineVyukovQueue<Item, COMPARE_CAPACITY>::name()) {
+		runCompareCase<BaselineVyukovQueue<Item, COMPARE_CAPACITY>, Item>(config, BaselineVyukovQueue<Item, COMPARE_CAPACITY>::name(),
+			"none", producers, report);
+	}
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The throughput sweep (mode=sweep)
+//
+//--------------------------------------------------------------------------------
+
+#define SWEEP_MAX_FIFO_BYTES	(64ULL << 20)	// Bigger fifos (e.g. a million 4KB items) are skipped
+
+#define SWEEP_POLICIES		"event,address,condvar,spin,spinpark"
+#define SWEEP_CAPACITIES	"8,64,1024,16384,1048576"
+#define SWEEP_SIZES		"4,64,512,4096"
+#define SWEEP_WRITERS		"1,2,4,8,16,32,64"
+
+
+// An item of the given size - it only has to be copied, so it carries nothing in particular
+template <unsigned bytes>
+struct SweepItem {
+	unsigned char payload[bytes];
+};
+
+
+struct SweepConfig {
+	unsigned items;			// Items passed through the fifo in each case, shared between the writers
+	unsigned runs;			// Runs of each case - the best throughput is kept
+	BenchPinning pinning;		// Where the reader and writer threads run
+};
+
+
+struct SweepResult {
+	bool skipped;			// The fifo would have been bigger than SWEEP_MAX_FIFO_BYTES
+	unsigned long long items;
+	double seconds;			// The run with the best throughput...
+	double itemsPerSecond;
+	unsigned long long pushRetries;
+	BenchCounterTotals counters;
+};
+
+
+// Pushes its share of the items as fast as it can, retrying each push until it succeeds. counters[0] and
+// counters[1] are set to the thread's counters at the start and the end.
+template <class Queue, class Item>
+void sweepWriter(Queue* queue, unsigned writer, unsigned count, unsigned processor, const atomic<bool>* go,
+	unsigned long long* retries, BenchCounterSnapshot* counters) {
+
+	BenchTopology::pin(processor);
+
+	Item item;
+	memset(&item, 0, sizeof(item));
+	item.payload[0] = (unsigned char) writer;
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	counters[0] = BenchCounters::snapshot();
+
+	for (unsigned i = 0; i < count; i++) {
+		while (queue->push(item) != FIFO_STATUS_SUCCESS) {
+			(*retries)++;
+			YieldProcessor();
+		}
+	}
+
+	counters[1] = BenchCounters::snapshot();
+}
+
+
+template <class Queue, class Item>
+void sweepReader(Queue* queue, unsigned long long total, unsigned processor, const atomic<bool>* go,
+	unsigned long long* finishTicks, BenchCounterSnapshot* counters) {
+
+	BenchTopology::pin(processor);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	counters[0] = BenchCounters::snapshot();
+
+	Item item;
+	for (unsigned long long popped = 0; popped < total; popped++) queue->pop(&item);
+	*finishTicks = BenchClock::now();
+
+	counters[1] = BenchCounters::snapshot();
+}
+
+
+// A case whose fifo fits in SWEEP_MAX_FIFO_BYTES - run it config.runs times and keep the best
+template <class Queue, class Item>
+void runSweepCase(const SweepConfig& config, unsigned writers, SweepResult* result, true_type) {
+
+	unsigned perWriter = max(1u, config.items / writers);
+	unsigned long long total = (unsigned long long) perWriter * writers;
+
+	result->skipped = false;
+	result->items = total;
+	result->itemsPerSecond = -1.0;
+
+	for (unsigned run = 0; run < config.runs; run++) {
+
+		// A fresh fifo for each run, on the heap - most are too big for the stack
+		unique_ptr<Queue> queue(new Queue);
+
+		vector<unsigned long long> retries(writers, 0);
+		unsigned long long finishTicks = 0;
+
+		// A start and an end snapshot for each thread - the reader's first
+		vector<BenchCounterSnapshot> counters(2 * (writers + 1));
+
+		atomic<bool> go(false);
+		thread reader(sweepReader<Queue, Item>, queue.get(), total, benchProcessorFor(config.pinning.readers, 0),
+			&go, &finishTicks, &counters[0]);
+		vector<thread> threads;
+		for (unsigned w = 0; w < writers; w++) {
+			threads.push_back(thread(sweepWriter<Queue, Item>, queue.get(), w, perWriter,
+				benchProcessorFor(config.pinning.writers, w), &go, &retries[w], &counters[2 * (w + 1)]));
+		}
+
+		unsigned long long startTicks = BenchClock::now();
+		go.store(true, memory_order_release);
+
+		for (unsigned w = 0; w < writers; w++) threads[w].join();
+		reader.join();
+
+		double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+		double itemsPerSecond = seconds > 0.0 ? (double) total / seconds : 0.0;
+		if (itemsPerSecond <= result->itemsPerSecond) continue;
+
+		result->seconds = seconds;
+		result->itemsPerSecond = itemsPerSecond;
+		result->pushRetries = 0;
+		for (unsigned w = 0; w < writers; w++) result->pushRetries += retries[w];
+		result->counters = BenchCounterTotals();
+		for (size_t t = 0; t < counters.size(); t += 2) result->counters.add(counters[t], counters[t + 1]);
+	}
+}
+
+
+// A case whose fifo would be too big
+template <class Queue, class Item>
+void runSweepCase(const SweepConfig& config, unsigned writers, SweepResult* result, false_type) {
+
+	(void) config;
+	(void) writers;
+	result->skipped = true;
+}
+
+
+// Picks the fifo type for a capacity, and whether it is small enough to run - without instantiating the
+// fifos that aren't (some compilers refuse to, for a 32 bit build). Returns false for a capacity not in
+// SWEEP_CAPACITIES.
+template <class Item, class WaitPolicy>
+bool runSweepCapacity(const SweepConfig& config, unsigned capacity, unsigned writers, SweepResult* result) {
+
+#define SWEEP_CAPACITY_CASE(n)	case n: runSweepCase<Fifo<Item, n, WaitPolicy>, Item>(config, writers, result, \
+		integral_constant<bool, (unsigned long long) sizeof(Item) * n <= SWEEP_MAX_FIFO_BYTES>()); return true;
+
+	switch (capacity) {
+	SWEEP_CAPACITY_CASE(8)
+	SWEEP_CAPACITY_CASE(64)
+	SWEEP_CAPACITY_CASE(1024)
+	SWEEP_CAPACITY_CASE(16384)
+	SWEEP_CAPACITY_CASE(1048576)
+	}
+	return false;
+
+#undef SWEEP_CAPACITY_CASE
+}
+
+
+// Returns false for an item size not in SWEEP_SIZES
+template <class WaitPolicy>
+bool runSweepSize(const SweepConfig& config, unsigned bytes, unsigned capacity, unsigned writers, SweepResult* result) {
+
+	switch (bytes) {
+	case 4: return runSweepCapacity<SweepItem<4>, WaitPolicy>(config, capacity, writers, result);
+	case 64: return runSweepCapacity<SweepItem<64>, WaitPolicy>(config, capacity, writers, result);
+	case 512: return runSweepCapacity<SweepItem<512>, WaitPolicy>(config, capacity, writers, result);
+	case 4096: return runSweepCapacity<SweepItem<4096>, WaitPolicy>(config, capacity, writers, result);
+	}
+	return false;
+}
+
+
+// Returns false for an unknown wait strategy, capacity or item size
+bool runSweep(const SweepConfig& config, const string& policy, unsigned bytes, unsigned capacity, unsigned writers,
+	SweepResult* result) {
+
+	if (policy == FifoEventWait::name()) return runSweepSize<FifoEventWait>(config, bytes, capacity, writers, result);
+	if (policy == FifoAddressWait::name()) return runSweepSize<FifoAddressWait>(config, bytes, capacity, writers, result);
+	if (policy == FifoCondVarWait::name()) return runSweepSize<FifoCondVarWait>(config, bytes, capacity, writers, result);
+	if (policy == FifoSpinWait::name()) return runSweepSize<FifoSpinWait>(config, bytes, capacity, writers, result);
+	if (policy == FifoSpinThenParkWait::name()) return runSweepSize<FifoSpinThenParkWait>(config, bytes, capacity, writers, result);
+	return false;
+}
+
+
+// Identifies a case in a baseline
+string sweepKey(const string& policy, const string& capacity, const string& bytes, const string& writers) {
+	return policy + "/" + capacity + "/" + bytes + "/" + writers;
+}
+
+
+// The items per second of each case of a baseline sweep CSV file, by sweepKey(). Returns false if the file
+// can't be read.
+bool readSweepBaseline(const string& fileName, map<string, double>* baseline) {
+
+	ifstream file(fileName.c_str());
+	if (!file) return false;
+
+	vector<map<string, string> > records = benchReadCsv(file);
+	for (size_t r = 0; r < records.size(); r++) {
+		map<string, string>& record = records[r];
+		if (record["mode"] != "sweep" || record["items_per_second"].empty()) continue;
+		(*baseline)[sweepKey(record["policy"], record["capacity"], record["item_bytes"], record["writers"])] =
+			strtod(record["items_per_second"].c_str(), NULL);
+	}
+	return true;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The storage benchmark (mode=storage)
+//
+//--------------------------------------------------------------------------------
+
+#define STORAGE_CAPACITY	((unsigned) 1024)
+#define STORAGE_SIZES		"8,16,32,64,128,256,512,1024,4096"
+
+
+// Runs one item size with both storages
+template <unsigned bytes>
+void runStorageCase(const SweepConfig& config, unsigned writers, BenchReport& report) {
+
+	typedef SweepItem<bytes> Item;
+	typedef Fifo<Item, STORAGE_CAPACITY, FifoEventWait, FifoInlineStorage<Item, STORAGE_CAPACITY> > InlineFifo;
+	typedef Fifo<Item, STORAGE_CAPACITY, FifoEventWait, FifoSlabStorage<Item, STORAGE_CAPACITY> > SlabFifo;
+
+	SweepResult inlineResult, slabResult;
+	runSweepCase<InlineFifo, Item>(config, writers, &inlineResult, true_type());
+	runSweepCase<SlabFifo, Item>(config, writers, &slabResult, true_type());
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "storage");
+	record.add("item_bytes", bytes);
+	record.add("writers", writers);
+	record.add("capacity", STORAGE_CAPACITY);
+	record.add("items", inlineResult.items);
+	record.add("runs", config.runs);
+	recordPinning(record, config.pinning);
+	record.add("inline_mitems_per_s", inlineResult.itemsPerSecond / 1.0e6);
+	record.add("slab_mitems_per_s", slabResult.itemsPerSecond / 1.0e6);
+	record.add("slab_change_percent", inlineResult.itemsPerSecond > 0.0 ?
+		100.0 * (slabResult.itemsPerSecond - inlineResult.itemsPerSecond) / inlineResult.itemsPerSecond : 0.0);
+	record.add("default_storage", FifoStorageFor<Item, STORAGE_CAPACITY>::type::name());
+	record.add("inline_max_bytes", FIFO_INLINE_MAX_BYTES);
+}
+
+
+// Returns false for a size not in STORAGE_SIZES
+bool runStorageSize(const SweepConfig& config, unsigned bytes, unsigned writers, BenchReport& report) {
+
+	switch (bytes) {
+	case 8: runStorageCase<8>(config, writers, report); return true;
+	case 16: runStorageCase<16>(config, writers, report); return true;
+	case 32: runStorageCase<32>(config, writers, report); return true;
+	case 64: runStorageCase<64>(config, writers, report); return true;
+	case 128: runStorageCase<128>(config, writers, report); return true;
+	case 256: runStorageCase<256>(config, writers, report); return true;
+	case 512: runStorageCase<512>(config, writers, report); return true;
+	case 1024: runStorageCase<1024>(config, writers, report); return true;
+	case 4096: runStorageCase<4096>(config, writers, report); return true;
+	}
+	return false;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The batch benchmark (mode=batch)
+//
+//--------------------------------------------------------------------------------
+
+#define BATCH_CAPACITY		((unsigned) 1024)
+#define BATCH_SIZES		"16,64,256,1024,4096"
+#define BATCH_COPIES		"unbatched,scalar,avx2,avx512"
+
+
+struct BatchConfig {
+	SweepConfig sweep;		// Items, runs and thread placement, as for mode=sweep
+	unsigned batch;			// Most items pushed or popped in one call
+};
+
+
+// Pushes the items in runs of config.batch, as fast as it can, retrying until each run is all in
+template <class Queue, class Item>
+void batchWriter(Queue* queue, const BatchConfig* config, unsigned long long total, const atomic<bool>* go,
+	unsigned long long* retries) {
+
+	BenchTopology::pin(benchProcessorFor(config->sweep.pinning.writers, 0));
+
+	vector<Item> items(config->batch);
+	memset(&items[0], 0, items.size() * sizeof(Item));
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	unsigned long long pushed = 0;
+	while (pushed < total) {
+
+		unsigned count = (unsigned) min((unsigned long long) config->batch, total - pushed);
+		unsigned done = 0;
+		while (done < count) {
+			unsigned n;
+			if (queue->push_batch(&items[done], count - done, &n) != FIFO_STATUS_SUCCESS) {
+				(*retries)++;
+				YieldProcessor();
+			}
+			done += n;
+		}
+		pushed += count;
+	}
+}
+
+
+template <class Queue, class Item>
+void batchReader(Queue* queue, const BatchConfig* config, unsigned long long total, const atomic<bool>* go,
+	unsigned long long* finishTicks) {
+
+	BenchTopology::pin(benchProcessorFor(config->sweep.pinning.readers, 0));
+
+	vector<Item> items(config->batch);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	unsigned long long popped = 0;
+	while (popped < total) {
+		unsigned n;
+		queue->pop_batch(&items[0], config->batch, &n);
+		popped += n;
+	}
+	*finishTicks = BenchClock::now();
+}
+
+
+// Runs one item size with the batch functions, config.sweep.runs times, keeping the best
+template <class Queue, class Item>
+void runBatchCase(const BatchConfig& config, SweepResult* result) {
+
+	unsigned long long total = max(1u, config.sweep.items);
+
+	result->skipped = false;
+	result->items = total;
+	result->itemsPerSecond = -1.0;
+
+	for (unsigned run = 0; run < config.sweep.runs; run++) {
+
+		unique_ptr<Queue> queue(new Queue);
+
+		unsigned long long retries = 0;
+		unsigned long long finishTicks = 0;
+
+		atomic<bool> go(false);
+		thread reader(batchReader<Queue, Item>, queue.get(), &config, total, &go, &finishTicks);
+		thread writer(batchWriter<Queue, Item>, queue.get(), &config, total, &go, &retries);
+
+		unsigned long long startTicks = BenchClock::now();
+		go.store(true, memory_order_release);
+
+		writer.join();
+		reader.join();
+
+		double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+		double itemsPerSecond = seconds > 0.0 ? (double) total / seconds : 0.0;
+		if (itemsPerSecond <= result->itemsPerSecond) continue;
+
+		result->seconds = seconds;
+		result->itemsPerSecond = itemsPerSecond;
+		result->pushRetries = retries;
+	}
+}
+
+
+// Runs one item size with each of the copies asked for that the processor supports. The fifo always holds
+// its items inline - the batch functions need it to.
+template <unsigned bytes>
+void runBatchSize(const BatchConfig& config, const vector<string>& copies, BenchReport& report) {
+
+	typedef SweepItem<bytes> Item;
+	typedef Fifo<Item, BATCH_CAPACITY, FifoEventWait, FifoInlineStorage<Item, BATCH_CAPACITY> > InlineFifo;
+
+	for (size_t c = 0; c < copies.size(); c++) {
+
+		SweepResult result;
+		if (copies[c] == "unbatched") {
+			runSweepCase<InlineFifo, Item>(config.sweep, 1, &result, true_type());
+		}
+		else {
+			unsigned copyKind = 0;
+			while (copyKind < FIFO_COPY_COUNT && copies[c] != FifoCopy::name(copyKind)) copyKind++;
+			if (!FifoCopy::use(copyKind)) continue;	// Not supported by this processor
+
+			runBatchCase<InlineFifo, Item>(config, &result);
+			FifoCopy::use(FifoCopy::best());
+		}
+
+		BenchRecord& record = report.newRecord();
+		record.add("mode", "batch");
+		record.add("item_bytes", bytes);
+		record.add("copy", copies[c]);
+		record.add("batch", copies[c] == "unbatched" ? 1 : config.batch);
+		record.add("capacity", BATCH_CAPACITY);
+		record.add("items", result.items);
+		record.add("runs", config.sweep.runs);
+		recordPinning(record, config.sweep.pinning);
+		record.add("seconds", result.seconds);
+		record.add("mbytes_per_s", result.itemsPerSecond * bytes / 1.0e6);
+		record.add("mitems_per_s", result.itemsPerSecond / 1.0e6);
+		record.add("push_retries", result.pushRetries);
+	}
+}
+
+
+// Returns false for a size not in BATCH_SIZES
+bool runBatch(const BatchConfig& config, unsigned bytes, const vector<string>& copies, BenchReport& report) {
+
+	switch (bytes) {
+	case 16: runBatchSize<16>(config, copies, report); return true;
+	case 64: runBatchSize<64>(config, copies, report); return true;
+	case 256: runBatchSize<256>(config, copies, report); return true;
+	case 1024: runBatchSize<1024>(config, copies, report); return true;
+	case 4096: runBatchSize<4096>(config, copies, report); return true;
+	}
+	return false;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The prefetch benchmark (mode=prefetch)
+//
+//--------------------------------------------------------------------------------
+
+#define PREFETCH_CAPACITY	((unsigned) 1024)
+#define PREFETCH_SIZES		"256,1024,4096"
+#define PREFETCH_DISTANCES	"0,1,2,4,8,16"
+
+
+// For item=pointer - the fifo prefetches the whole of the object each item points to
+template <unsigned bytes>
+struct FifoPrefetch<SweepItem<bytes>*> {
+	static void pointee(SweepItem<bytes>* const& item) {
+		fifoPrefetchBytes(item, sizeof(SweepItem<bytes>));
+	}
+};
+
+
+struct PrefetchConfig {
+	unsigned rounds;		// Times the fifo is filled and emptied in each case
+	unsigned runs;			// Runs of each case - the best time per item is kept
+	BenchPinning pinning;		// Where the reader and writer threads run
+};
+
+
+struct PrefetchResult {
+	unsigned long long items;
+	double nsPerItem;		// The reader's time per item in the best run...
+	BenchCounterTotals counters;	// ...and its processor counters in that run
+	unsigned long long checksum;	// Keeps the reader's reads from being optimised away
+};
+
+
+// Makes the i'th item of a round - item=value fills in the item itself, item=pointer the i'th object of the
+// pool, and points the item at it
+template <unsigned bytes>
+void prefetchMake(SweepItem<bytes>* item, SweepItem<bytes>* pool, unsigned i, unsigned char value) {
+	(void) pool;
+	(void) i;
+	memset(item->payload, value, bytes);
+}
+
+
+template <unsigned bytes>
+void prefetchMake(SweepItem<bytes>** item, SweepItem<bytes>* pool, unsigned i, unsigned char value) {
+	memset(pool[i].payload, value, bytes);
+	*item = &pool[i];
+}
+
+
+// Reads all of an item, as a reader doing something with it would
+template <unsigned bytes>
+unsigned long long prefetchConsume(const SweepItem<bytes>& item) {
+
+	unsigned long long sum = 0;
+	for (unsigned b = 0; b < bytes; b += sizeof(unsigned long long)) {
+		unsigned long long word;
+		memcpy(&word, &item.payload[b], sizeof(word));
+		sum += word;
+	}
+	return sum;
+}
+
+
+template <unsigned bytes>
+unsigned long long prefetchConsume(SweepItem<bytes>* const& item) {
+	return prefetchConsume(*item);
+}
+
+
+// Fills the fifo each round, once the reader has emptied it
+template <class Queue, class Item, unsigned bytes>
+void prefetchWriter(Queue* queue, const PrefetchConfig* config, SweepItem<bytes>* pool, const atomic<unsigned>* drained,
+	atomic<unsigned>* filled) {
+
+	BenchTopology::pin(benchProcessorFor(config->pinning.writers, 0));
+
+	for (unsigned round = 0; round < config->rounds; round++) {
+
+		while (drained->load(memory_order_acquire) < round) YieldProcessor();
+
+		for (unsigned i = 0; i < PREFETCH_CAPACITY; i++) {
+			Item item;
+			prefetchMake(&item, pool, i, (unsigned char) (round + i));
+			while (queue->push(item) != FIFO_STATUS_SUCCESS) YieldProcessor();
+		}
+		filled->store(round + 1, memory_order_release);
+	}
+}
+
+
+// Empties the fifo each round, once the writer has filled it - timing only the popping and reading
+template <class Queue, class Item>
+void prefetchReader(Queue* queue, const PrefetchConfig* config, atomic<unsigned>* drained, const atomic<unsigned>* filled,
+	unsigned long long* ticks, BenchCounterTotals* counters, unsigned long long* checksum) {
+
+	BenchTopology::pin(benchProcessorFor(config->pinning.readers, 0));
+
+	for (unsigned round = 0; round < config->rounds; round++) {
+
+		while (filled->load(memory_order_acquire) < round + 1) YieldProcessor();
+
+		BenchCounterSnapshot start = BenchCounters::snapshot();
+		unsigned long long startTicks = BenchClock::now();
+
+		for (unsigned i = 0; i < PREFETCH_CAPACITY; i++) {
+			Item item;
+			queue->pop(&item);
+			*checksum += prefetchConsume(item);
+		}
+
+		*ticks += BenchClock::now() - startTicks;
+		counters->add(start, BenchCounters::snapshot());
+
+		drained->store(round + 1, memory_order_release);
+	}
+}
+
+
+template <class Queue, class Item, unsigned bytes>
+void runPrefetchCase(const PrefetchConfig& config, unsigned distance, PrefetchResult* result) {
+
+	result->items = (unsigned long long) config.rounds * PREFETCH_CAPACITY;
+	result->nsPerItem = -1.0;
+	result->checksum = 0;
+
+	// The objects pointed to by item=pointer - one for each ring position, reused each round
+	vector<SweepItem<bytes> > pool(PREFETCH_CAPACITY);
+
+	for (unsigned run = 0; run < config.runs; run++) {
+
+		// On the heap - a fifo of 4KB items is too big for the stack
+		unique_ptr<Queue> queue(new Queue);
+		queue->setPrefetchDistance(distance);
+
+		atomic<unsigned> drained(0), filled(0);
+		unsigned long long ticks = 0;
+		BenchCounterTotals counters;
+
+		thread reader(prefetchReader<Queue, Item>, queue.get(), &config, &drained, &filled, &ticks, &counters,
+			&result->checksum);
+		thread writer(prefetchWriter<Queue, Item, bytes>, queue.get(), &config, &pool[0], &drained, &filled);
+
+		writer.join();
+		reader.join();
+
+		double nsPerItem = BenchClock::toNanoseconds(ticks) / (double) result->items;
+		if (result->nsPerItem >= 0.0 && nsPerItem >= result->nsPerItem) continue;
+
+		result->nsPerItem = nsPerItem;
+		result->counters = counters;
+	}
+}
+
+
+// Runs one item size with each of the kinds of item and prefetch distances asked for
+template <unsigned bytes>
+void runPrefetchSize(const PrefetchConfig& config, const vector<string>& kinds, const vector<unsigned>& distances,
+	BenchReport& report) {
+
+	typedef SweepItem<bytes> Item;
+	typedef Fifo<Item, PREFETCH_CAPACITY> ValueFifo;
+	typedef Fifo<Item*, PREFETCH_CAPACITY> PointerFifo;
+
+	for (size_t k = 0; k < kinds.size(); k++) {
+
+		bool pointer = (kinds[k] == "pointer");
+		double unprefetchedNs = -1.0;
+
+		for (size_t d = 0; d < distances.size(); d++) {
+
+			PrefetchResult result;
+			if (pointer) runPrefetchCase<PointerFifo, Item*, bytes>(config, distances[d], &result);
+			else runPrefetchCase<ValueFifo, Item, bytes>(config, distances[d], &result);
+			if (distances[d] == 0) unprefetchedNs = result.nsPerItem;
+
+			BenchRecord& record = report.newRecord();
+			record.add("mode", "prefetch");
+			record.add("item", kinds[k]);
+			record.add("item_bytes", bytes);
+			record.add("storage", pointer ? FifoStorageFor<Item*, PREFETCH_CAPACITY>::type::name() :
+				FifoStorageFor<Item, PREFETCH_CAPACITY>::type::name());
+			record.add("distance", distances[d]);
+			record.add("capacity", PREFETCH_CAPACITY);
+			record.add("items", result.items);
+			record.add("runs", config.runs);
+			recordPinning(record, config.pinning);
+			record.add("reader_ns_per_item", result.nsPerItem);
+			if (unprefetchedNs > 0.0) {
+				record.add("reader_change_percent", 100.0 * (result.nsPerItem - unprefetchedNs) / unprefetchedNs);
+			}
+			else {
+				record.add("reader_change_percent", "n/a");
+			}
+			result.counters.describe(record, result.items);
+			record.add("checksum", result.checksum);
+		}
+	}
+}
+
+
+// Returns false for a size not in PREFETCH_SIZES
+bool runPrefetch(const PrefetchConfig& config, unsigned bytes, const vector<string>& kinds,
+	const vector<unsigned>& distances, BenchReport& report) {
+
+	switch (bytes) {
+	case 256: runPrefetchSize<256>(config, kinds, distances, report); return true;
+	case 1024: runPrefetchSize<1024>(config, kinds, distances, report); return true;
+	case 4096: runPrefetchSize<4096>(config, kinds, distances, report); return true;
+	}
+	return false;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The retry loop benchmark (mode=retry)
+//
+//--------------------------------------------------------------------------------
+
+#define RETRY_CAPACITY		((unsigned) 64)
+
+typedef Fifo<string, RETRY_CAPACITY> RetryFifo;
+
+
+// Makes each item once, then retries until it is in - passing it to push() each time, or moving it with
+// push_try() and getting it back each time that fails
+void retryWriter(RetryFifo* fifo, bool moving, unsigned bytes, unsigned count, unsigned processor, const atomic<bool>* go,
+	unsigned long long* retries) {
+
+	BenchTopology::pin(processor);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	for (unsigned i = 0; i < count; i++) {
+
+		string item(bytes, (char) ('a' + i % 26));
+
+		if (moving) {
+			while (FIFO_UNLIKELY(fifo->push_try(std::move(item)) != FIFO_STATUS_SUCCESS)) {
+				(*retries)++;
+				YieldProcessor();
+			}
+		}
+		else {
+			while (FIFO_UNLIKELY(fifo->push(item) != FIFO_STATUS_SUCCESS)) {
+				(*retries)++;
+				YieldProcessor();
+			}
+		}
+	}
+}
+
+
+// Checks the length of every item, so that an item lost in a move back would be noticed
+void retryReader(RetryFifo* fifo, unsigned long long total, unsigned bytes, unsigned processor, const atomic<bool>* go,
+	unsigned long long* finishTicks, unsigned long long* wrongLength) {
+
+	BenchTopology::pin(processor);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	string item;
+	for (unsigned long long popped = 0; popped < total; popped++) {
+		fifo->pop(&item);
+		if (item.size() != bytes) (*wrongLength)++;
+	}
+	*finishTicks = BenchClock::now();
+}
+
+
+// Runs one case config.runs times and keeps the best. Returns the number of items of the wrong length.
+unsigned long long runRetryCase(const SweepConfig& config, bool moving, unsigned bytes, unsigned writers, SweepResult* result) {
+
+	unsigned perWriter = max(1u, config.items / writers);
+	unsigned long long total = (unsigned long long) perWriter * writers;
+	unsigned long long wrongLength = 0;
+
+	result->skipped = false;
+	result->items = total;
+	result->itemsPerSecond = -1.0;
+
+	for (unsigned run = 0; run < config.runs; run++) {
+
+		unique_ptr<RetryFifo> fifo(new RetryFifo);
+
+		vector<unsigned long long> retries(writers, 0);
+		unsigned long long finishTicks = 0;
+
+		atomic<bool> go(false);
+		thread reader(retryReader, fifo.get(), total, bytes, benchProcessorFor(config.pinning.readers, 0), &go,
+			&finishTicks, &wrongLength);
+		vector<thread> threads;
+		for (unsigned w = 0; w < writers; w++) {
+			threads.push_back(thread(retryWriter, fifo.get(), moving, bytes, perWriter,
+				benchProcessorFor(config.pinning.writers, w), &go, &retries[w]));
+		}
+
+		unsigned long long startTicks = BenchClock::now();
+		go.store(true, memory_order_release);
+
+		for (unsigned w = 0; w < writers; w++) threads[w].join();
+		reader.join();
+
+		double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+		double itemsPerSecond = seconds > 0.0 ? (double) total / seconds : 0.0;
+		if (itemsPerSecond <= result->itemsPerSecond) continue;
+
+		result->seconds = seconds;
+		result->itemsPerSecond = itemsPerSecond;
+		result->pushRetries = 0;
+		for (unsigned w = 0; w < writers; w++) result->pushRetries += retries[w];
+	}
+	return wrongLength;
+}
+
+
+// Returns false if any item came out of the fifo with the wrong length
+bool runRetry(const SweepConfig& config, unsigned bytes, unsigned writers, BenchReport& report) {
+
+	SweepResult copied, moved;
+	unsigned long long wrongLength = runRetryCase(config, false, bytes, writers, &copied);
+	wrongLength += runRetryCase(config, true, bytes, writers, &moved);
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "retry");
+	record.add("item_bytes", bytes);
+	record.add("writers", writers);
+	record.add("capacity", RETRY_CAPACITY);
+	record.add("items", copied.items);
+	record.add("runs", config.runs);
+	recordPinning(record, config.pinning);
+	record.add("push_mitems_per_s", copied.itemsPerSecond / 1.0e6);
+	record.add("push_try_mitems_per_s", moved.itemsPerSecond / 1.0e6);
+	record.add("push_try_change_percent", copied.itemsPerSecond > 0.0 ?
+		100.0 * (moved.itemsPerSecond - copied.itemsPerSecond) / copied.itemsPerSecond : 0.0);
+	record.add("push_retries", copied.pushRetries);
+	record.add("push_try_retries", moved.pushRetries);
+	record.add("wrong_length", wrongLength);
+	return wrongLength == 0;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The backoff benchmark (mode=backoff)
+//
+//--------------------------------------------------------------------------------
+
+#define BACKOFF_CAPACITY	((unsigned) 256)
+
+typedef Fifo<CompareSmallItem, BACKOFF_CAPACITY> BackoffFifo;
+
+
+enum BackoffStrategy {
+	BACKOFF_ONCE,		// One attempt - any failure loses the item
+	BACKOFF_SPIN,		// Retried at once, in a tight loop, while LOCKED
+	BACKOFF_PUSH_RETRY	// push_retry()
+};
+
+
+const char* backoffStrategyName(BackoffStrategy strategy) {
+	return strategy == BACKOFF_ONCE ? "once" : strategy == BACKOFF_SPIN ? "spin" : "push_retry";
+}
+
+
+struct BackoffConfig {
+	unsigned items;			// Items each writer tries to push
+	double gapNs;			// Busy-wait before each item
+	FifoRetryBudget budget;		// For push_retry() - "spin" is held to the same number of attempts (if limited)
+	BenchPinning pinning;
+};
+
+
+struct BackoffWriterResult {
+	unsigned long long pushed;
+	unsigned long long lostFull;		// Given up on as truly full (FULL or PREEMPTED)
+	unsigned long long lostBusy;		// Given up on while LOCKED
+	unsigned long long attempts;		// push() calls, including those made by push_retry()
+	BenchCounterSnapshot counters[2];	// At the start and the end
+};
+
+
+// Tries to push each item with the given strategy, then moves on to the next whether it went in or not
+void backoffWriter(BackoffFifo* fifo, BackoffStrategy strategy, const BackoffConfig* config, unsigned writer,
+	unsigned processor, const atomic<bool>* go, atomic<unsigned>* writersLeft, BackoffWriterResult* result) {
+
+	BenchTopology::pin(processor);
+
+	CompareSmallItem item = {};
+	item.producer = writer;
+	unsigned long long gapTicks = BenchClock::fromNanoseconds(config->gapNs);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	result->counters[0] = BenchCounters::snapshot();
+
+	for (unsigned i = 0; i < config->items; i++) {
+
+		unsigned long long until = BenchClock::now() + gapTicks;
+		while (BenchClock::now() < until) YieldProcessor();
+
+		item.sequence = i;
+		FifoStatus status;
+		if (strategy == BACKOFF_PUSH_RETRY) {
+			status = fifo->push_retry(item, config->budget);
+			result->attempts++;
+		}
+		else {
+			unsigned attempts = 0;
+			do {
+				status = fifo->push(item);
+				attempts++;
+			} while (strategy == BACKOFF_SPIN && status == FIFO_STATUS_LOCKED &&
+				(config->budget.attempts == 0 || attempts < config->budget.attempts));
+			result->attempts += attempts;
+		}
+
+		if (status == FIFO_STATUS_SUCCESS) result->pushed++;
+		else if (status == FIFO_STATUS_LOCKED) result->lostBusy++;
+		else result->lostFull++;
+	}
+
+	result->counters[1] = BenchCounters::snapshot();
+	writersLeft->fetch_sub(1, memory_order_release);
+}
+
+
+// Pops until every writer has finished and the FIFO is empty
+void backoffReader(BackoffFifo* fifo, unsigned processor, const atomic<bool>* go, const atomic<unsigned>* writersLeft) {
+
+	BenchTopology::pin(processor);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	CompareSmallItem item;
+	for (;;) {
+		if (fifo->pop_try(&item) == FIFO_STATUS_SUCCESS) continue;
+		if (writersLeft->load(memory_order_acquire) == 0 && fifo->pop_try(&item) != FIFO_STATUS_SUCCESS) break;
+		YieldProcessor();
+	}
+}
+
+
+struct BackoffResult {
+	unsigned long long tried;
+	BackoffWriterResult total;		// All the writers' counts added together
+	double writerCyclesPerItem;		// The writers' processor cycles per item tried
+	double seconds;
+};
+
+
+BackoffResult runBackoffCase(const BackoffConfig& config, BackoffStrategy strategy, unsigned writers) {
+
+	unique_ptr<BackoffFifo> fifo(new BackoffFifo);
+	vector<BackoffWriterResult> results(writers);
+	memset(&results[0], 0, writers * sizeof(BackoffWriterResult));
+
+	atomic<bool> go(false);
+	atomic<unsigned> writersLeft(writers);
+	thread reader(backoffReader, fifo.get(), benchProcessorFor(config.pinning.readers, 0), &go, &writersLeft);
+	vector<thread> threads;
+	for (unsigned w = 0; w < writers; w++) {
+		threads.push_back(thread(backoffWriter, fifo.get(), strategy, &config, w, benchProcessorFor(config.pinning.writers, w),
+			&go, &writersLeft, &results[w]));
+	}
+
+	unsigned long long startTicks = BenchClock::now();
+	go.store(true, memory_order_release);
+
+	for (unsigned w = 0; w < writers; w++) threads[w].join();
+	unsigned long long finishTicks = BenchClock::now();
+	reader.join();
+
+	BackoffResult result = {};
+	unsigned long long cycles = 0;
+	for (unsigned w = 0; w < writers; w++) {
+		result.total.pushed += results[w].pushed;
+		result.total.lostFull += results[w].lostFull;
+		result.total.lostBusy += results[w].lostBusy;
+		result.total.attempts += results[w].attempts;
+		cycles += results[w].counters[1].cycles - results[w].counters[0].cycles;
+	}
+	result.tried = (unsigned long long) config.items * writers;
+	result.writerCyclesPerItem = (double) cycles / (double) result.tried;
+	result.seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+	return result;
+}
+
+
+// The percentage change from 'before' to 'after'
+double backoffChange(double before, double after) {
+	return before > 0.0 ? 100.0 * (after - before) / before : 0.0;
+}
+
+
+// Runs the three strategies with the given number of writers, one record each. Each record also gives the
+// change in items lost and in the writers' processor cycles from retrying in a tight loop ("spin").
+void runBackoff(const BackoffConfig& config, unsigned writers, BenchReport& report) {
+
+	const BackoffStrategy strategies[] = { BACKOFF_ONCE, BACKOFF_SPIN, BACKOFF_PUSH_RETRY };
+	BackoffResult results[3];
+	for (unsigned s = 0; s < 3; s++) results[s] = runBackoffCase(config, strategies[s], writers);
+
+	const BackoffResult& spin = results[1];
+	double spinLost = (double) (spin.total.lostFull + spin.total.lostBusy);
+
+	for (unsigned s = 0; s < 3; s++) {
+
+		const BackoffResult& result = results[s];
+		unsigned long long lost = result.total.lostFull + result.total.lostBusy;
+
+		BenchRecord& record = report.newRecord();
+		record.add("mode", "backoff");
+		record.add("strategy", backoffStrategyName(strategies[s]));
+		record.add("writers", writers);
+		record.add("capacity", BACKOFF_CAPACITY);
+		record.add("gap_ns", config.gapNs);
+		record.add("budget_attempts", config.budget.attempts);
+		record.add("budget_us", config.budget.microseconds);
+		recordPinning(record, config.pinning);
+		record.add("items", result.tried);
+		record.add("pushed", result.total.pushed);
+		record.add("lost_full", result.total.lostFull);
+		record.add("lost_busy", result.total.lostBusy);
+		record.add("lost_percent", 100.0 * (double) lost / (double) result.tried);
+		record.add("lost_change_vs_spin_percent", backoffChange(spinLost, (double) lost));
+		record.add("attempts_per_item", (double) result.total.attempts / (double) result.tried);
+		record.add("writer_cycles_per_item", result.writerCyclesPerItem);
+		record.add("cycles_change_vs_spin_percent", backoffChange(spin.writerCyclesPerItem, result.writerCyclesPerItem));
+		record.add("seconds", result.seconds);
+		record.add("pushed_per_second", result.seconds > 0.0 ? (double) result.total.pushed / result.seconds : 0.0);
+	}
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The producer handle benchmark (mode=producer)
+//
+//--------------------------------------------------------------------------------
+
+#define PRODUCER_CAPACITY	((unsigned) 1024)
+
+typedef Fifo<CompareSmallItem, PRODUCER_CAPACITY> ProducerFifo;
+
+
+struct ProducerConfig {
+	unsigned items;			// Items passed through the fifo in each case, shared between the writers
+	unsigned flushMicroseconds;	// Oldest an item may be before its handle's chunk is published
+	BenchPinning pinning;
+};
+
+
+struct ProducerWriterResult {
+	unsigned long long retries;		// Pushes that failed and were tried again
+	unsigned long long publishes;		// Acquisitions of the mutex to publish items
+	BenchCounterSnapshot counters[2];	// At the start and the end
+};
+
+
+// Pushes its share of the items with Fifo<>::push(), retrying each until it succeeds
+void producerPushWriter(ProducerFifo* fifo, const ProducerConfig* config, unsigned writer, unsigned count,
+	unsigned processor, const atomic<bool>* go, ProducerWriterResult* result) {
+
+	BenchTopology::pin(processor);
+
+	CompareSmallItem item = {};
+	item.producer = writer;
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	result->counters[0] = BenchCounters::snapshot();
+
+	for (unsigned i = 0; i < count; i++) {
+		item.sequence = i;
+		item.pushTicks = BenchClock::now();
+		while (FIFO_UNLIKELY(fifo->push(item) != FIFO_STATUS_SUCCESS)) {
+			result->retries++;
+			YieldProcessor();
+		}
+	}
+	result->publishes = count;
+
+	result->counters[1] = BenchCounters::snapshot();
+	(void) config;
+}
+
+
+// The same through a FifoProducer handle of its own, flushing it at the end
+template <unsigned chunkSize>
+void producerHandleWriter(ProducerFifo* fifo, const ProducerConfig* config, unsigned writer, unsigned count,
+	unsigned processor, const atomic<bool>* go, ProducerWriterResult* result) {
+
+	BenchTopology::pin(processor);
+
+	FifoProducer<ProducerFifo, chunkSize> producer(*fifo, config->flushMicroseconds);
+	CompareSmallItem item = {};
+	item.producer = writer;
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	result->counters[0] = BenchCounters::snapshot();
+
+	for (unsigned i = 0; i < count; i++) {
+		item.sequence = i;
+		item.pushTicks = BenchClock::now();
+		while (FIFO_UNLIKELY(producer.push(item) != FIFO_STATUS_SUCCESS)) {
+			result->retries++;
+			YieldProcessor();
+		}
+	}
+	producer.flush();
+	result->publishes = producer.getPublishCount();
+
+	result->counters[1] = BenchCounters::snapshot();
+}
+
+
+typedef void (*ProducerWriterFunction)(ProducerFifo* fifo, const ProducerConfig* config, unsigned writer, unsigned count,
+	unsigned processor, const atomic<bool>* go, ProducerWriterResult* result);
+
+
+// Pops every item, checking that each writer's items arrive in order
+void producerReader(ProducerFifo* fifo, unsigned long long total, unsigned writers, unsigned processor, const atomic<bool>* go,
+	BenchSamples* latency, unsigned long long* finishTicks, unsigned long long* outOfOrder) {
+
+	BenchTopology::pin(processor);
+	latency->reserve((size_t) total);
+
+	vector<unsigned> expected(writers, 0);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	CompareSmallItem item;
+	for (unsigned long long popped = 0; popped < total; popped++) {
+		while (fifo->pop_try(&item) != FIFO_STATUS_SUCCESS) YieldProcessor();
+		latency->record(BenchClock::now() - item.pushTicks);
+		if (item.producer >= writers || item.sequence != expected[item.producer]) (*outOfOrder)++;
+		else expected[item.producer]++;
+	}
+	*finishTicks = BenchClock::now();
+}
+
+
+// Runs one case and adds its record to the report. Returns the number of items that arrived out of order.
+unsigned long long runProducerCase(const ProducerConfig& config, ProducerWriterFunction writerFunction, const char* strategy,
+	unsigned chunkSize, unsigned writers, BenchReport& report) {
+
+	unique_ptr<ProducerFifo> fifo(new ProducerFifo);
+
+	unsigned perWriter = max(1u, config.items / writers);
+	unsigned long long total = (unsigned long long) perWriter * writers;
+
+	vector<ProducerWriterResult> results(writers);
+	memset(&results[0], 0, writers * sizeof(ProducerWriterResult));
+	BenchSamples latency;
+	unsigned long long finishTicks = 0;
+	unsigned long long outOfOrder = 0;
+
+	atomic<bool> go(false);
+	thread reader(producerReader, fifo.get(), total, writers, benchProcessorFor(config.pinning.readers, 0), &go,
+		&latency, &finishTicks, &outOfOrder);
+	vector<thread> threads;
+	for (unsigned w = 0; w < writers; w++) {
+		threads.push_back(thread(writerFunction, fifo.get(), &config, w, perWriter, benchProcessorFor(config.pinning.writers, w),
+			&go, &results[w]));
+	}
+
+	unsigned long long startTicks = BenchClock::now();
+	go.store(true, memory_order_release);
+
+	for (unsigned w = 0; w < writers; w++) threads[w].join();
+	reader.join();
+
+	unsigned long long retries = 0, publishes = 0;
+	BenchCounterTotals counterTotals;
+	for (unsigned w = 0; w < writers; w++) {
+		retries += results[w].retries;
+		publishes += results[w].publishes;
+		counterTotals.add(results[w].counters[0], results[w].counters[1]);
+	}
+
+	double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "producer");
+	record.add("strategy", strategy);
+	record.add("chunk", chunkSize);
+	record.add("flush_us", config.flushMicroseconds);
+	record.add("writers", writers);
+	record.add("capacity", PRODUCER_CAPACITY);
+	record.add("items", total);
+	recordPinning(record, config.pinning);
+	record.add("seconds", seconds);
+	record.add("items_per_second", seconds > 0.0 ? (double) total / seconds : 0.0);
+	record.add("push_retries", retries);
+	record.add("publishes_per_item", (double) publishes / (double) total);
+	record.add("out_of_order", outOfOrder);
+	record.add("latency", latency.percentiles());
+	counterTotals.describe(record, total);
+	return outOfOrder;
+}
+
+
+// Runs push() and each chunk size with the given number of writers. Returns false if any writer's items
+// arrived out of order.
+bool runProducer(const ProducerConfig& config, const vector<unsigned>& chunks, unsigned writers, BenchReport& report) {
+
+	unsigned long long outOfOrder = runProducerCase(config, producerPushWriter, "push", 1, writers, report);
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		switch (chunks[c]) {
+		case 4: outOfOrder += runProducerCase(config, producerHandleWriter<4>, "producer", 4, writers, report); break;
+		case 16: outOfOrder += runProducerCase(config, producerHandleWriter<16>, "producer", 16, writers, report); break;
+		case 64: outOfOrder += runProducerCase(config, producerHandleWriter<64>, "producer", 64, writers, report); break;
+		default: break;
+		}
+	}
+	return outOfOrder == 0;
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The release interval benchmark (mode=release)
+//
+//--------------------------------------------------------------------------------
+
+#define RELEASE_CAPACITY	((unsigned) 256)
+
+typedef Fifo<CompareSmallItem, RELEASE_CAPACITY> ReleaseFifo;
+
+
+struct ReleaseConfig {
+	unsigned items;			// Items passed through the fifo in each case, shared between the writers
+	unsigned fullPercent;		// Population, as a percentage of the capacity, at which the reader hands back at once
+	BenchPinning pinning;
+};
+
+
+struct ReleaseWriterResult {
+	unsigned long long full;		// Pushes told FIFO_STATUS_FULL or FIFO_STATUS_PREEMPTED, and tried again
+	unsigned long long busy;		// Pushes told FIFO_STATUS_LOCKED, and tried again
+	BenchCounterSnapshot counters[2];	// At the start and the end
+};
+
+
+// Pushes its share of the items, retrying each until it succeeds
+void releaseWriter(ReleaseFifo* fifo, unsigned writer, unsigned count, unsigned processor, const atomic<bool>* go,
+	ReleaseWriterResult* result) {
+
+	BenchTopology::pin(processor);
+
+	CompareSmallItem item = {};
+	item.producer = writer;
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	result->counters[0] = BenchCounters::snapshot();
+
+	for (unsigned i = 0; i < count; i++) {
+		item.sequence = i;
+		item.pushTicks = BenchClock::now();
+		for (;;) {
+			FifoStatus status = fifo->push(item);
+			if (FIFO_LIKELY(status == FIFO_STATUS_SUCCESS)) break;
+			if (status == FIFO_STATUS_LOCKED) result->busy++;
+			else result->full++;
+			YieldProcessor();
+		}
+	}
+
+	result->counters[1] = BenchCounters::snapshot();
+}
+
+
+// Pops every item
+void releaseReader(ReleaseFifo* fifo, unsigned long long total, unsigned processor, const atomic<bool>* go,
+	BenchSamples* latency, unsigned long long* finishTicks, BenchCounterSnapshot* counters) {
+
+	BenchTopology::pin(processor);
+	latency->reserve((size_t) total);
+
+	while (!go->load(memory_order_acquire)) YieldProcessor();
+
+	counters[0] = BenchCounters::snapshot();
+
+	CompareSmallItem item;
+	for (unsigned long long popped = 0; popped < total; popped++) {
+		while (fifo->pop_try(&item) != FIFO_STATUS_SUCCESS) YieldProcessor();
+		latency->record(BenchClock::now() - item.pushTicks);
+	}
+	*finishTicks = BenchClock::now();
+
+	counters[1] = BenchCounters::snapshot();
+}
+
+
+// Runs one case - the reader handing positions back every 'interval' pops - and adds its record to the report
+void runReleaseCase(const ReleaseConfig& config, unsigned interval, unsigned writers, BenchReport& report) {
+
+	unique_ptr<ReleaseFifo> fifo(new ReleaseFifo);
+	fifo->setReleaseInterval(interval, config.fullPercent);
+
+	unsigned perWriter = max(1u, config.items / writers);
+	unsigned long long total = (unsigned long long) perWriter * writers;
+
+	vector<ReleaseWriterResult> results(writers);
+	memset(&results[0], 0, writers * sizeof(ReleaseWriterResult));
+	BenchSamples latency;
+	unsigned long long finishTicks = 0;
+	BenchCounterSnapshot readerCounters[2];
+
+	atomic<bool> go(false);
+	thread reader(releaseReader, fifo.get(), total, benchProcessorFor(config.pinning.readers, 0), &go, &latency,
+		&finishTicks, readerCounters);
+	vector<thread> threads;
+	for (unsigned w = 0; w < writers; w++) {
+		threads.push_back(thread(releaseWriter, fifo.get(), w, perWriter, benchProcessorFor(config.pinning.writers, w), &go,
+			&results[w]));
+	}
+
+	unsigned long long startTicks = BenchClock::now();
+	go.store(true, memory_order_release);
+
+	for (unsigned w = 0; w < writers; w++) threads[w].join();
+	reader.join();
+
+	// Every thread's counts, the reader's included - the traffic saved is between the reader and the writers
+	unsigned long long full = 0, busy = 0;
+	BenchCounterTotals counterTotals;
+	counterTotals.add(readerCounters[0], readerCounters[1]);
+	for (unsigned w = 0; w < writers; w++) {
+		full += results[w].full;
+		busy += results[w].busy;
+		counterTotals.add(results[w].counters[0], results[w].counters[1]);
+	}
+
+	double seconds = BenchClock::toNanoseconds(finishTicks - startTicks) / 1.0e9;
+
+	BenchRecord& record = report.newRecord();
+	record.add("mode", "release");
+	record.add("release", interval);
+	record.add("full_percent", config.fullPercent);
+	record.add("writers", writers);
+	record.add("capacity", RELEASE_CAPACITY);
+	record.add("items", total);
+	recordPinning(record, config.pinning);
+	record.add("seconds", seconds);
+	record.add("items_per_second", seconds > 0.0 ? (double) total / seconds : 0.0);
+	record.add("releases_per_item", (double) fifo->getReleaseCount() / (double) total);
+	record.add("full_per_item", (double) full / (double) total);
+	record.add("busy_per_item", (double) busy / (double) total);
+	record.add("latency", latency.percentiles());
+	counterTotals.describe(record, total);
+}
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The stress test (mode=stress)
+//
+//--------------------------------------------------------------------------------
+
+typedef StressResult (*StressRoundFunction)(const StressConfig& config, unsigned capacity);
+
+
+// The round function for a queue - or NULL if some writers are to have producer handles and it can't have them
+template <class Queue>
+StressRoundFunction stressRoundWith(bool handles) {
+
+	return (!handles || StressHandlesFor<Queue, STRESS_HANDLE_CHUNK>::supported) ? runStressRound<Queue> : NULL;
+}
+
+
+// The round function for a fifo with the chosen wait strategy, storage ("auto" - whichever the fifo picks for
+// itself) and lock, or NULL if there's no such storage
+template <unsigned capacity, class WaitPolicy, class LockPolicy>
+StressRoundFunction stressFifoRoundFor(const string& storage, bool handles) {
+
+	typedef typename FifoStorageFor<StressItem, capacity>::type Auto;
+	typedef FifoInlineStorage<StressItem, capacity> Inline;
+	typedef FifoSlabStorage<StressItem, capacity> Slab;
+
+	if (storage == "auto") return stressRoundWith<Fifo<StressItem, capacity, WaitPolicy, Auto, LockPolicy> >(handles);
+	if (storage == Inline::name()) return stressRoundWith<Fifo<StressItem, capacity, WaitPolicy, Inline, LockPolicy> >(handles);
+	if (storage == Slab::name()) return stressRoundWith<Fifo<StressItem, capacity, WaitPolicy, Slab, LockPolicy> >(handles);
+	return NULL;
+}
+
+
+// The round function for a fifo with the chosen lock, wait strategy and storage, or NULL if there's no such
+// wait strategy or storage
+template <unsigned capacity, class LockPolicy>
+StressRoundFunction stressFifoLockRoundFor(const string& policy, const string& storage, bool handles) {
+
+	if (policy == FifoEventWait::name()) return stressFifoRoundFor<capacity, FifoEventWait, LockPolicy>(storage, handles);
+	if (policy == FifoAddressWait::name()) return stressFifoRoundFor<capacity, FifoAddressWait, LockPolicy>(storage, handles);
+	if (policy == FifoCondVarWait::name()) return stressFifoRoundFor<capacity, FifoCondVarWait, LockPolicy>(storage, handles);
+	if (policy == FifoSpinWait::name()) return stressFifoRoundFor<capacity, FifoSpinWait, LockPolicy>(storage, handles);
+	if (policy == FifoSpinThenParkWait::name()) return stressFifoRoundFor<capacity, FifoSpinThenParkWait, LockPolicy>(storage, handles);
+	return NULL;
+}
+
+
+// The round function for the chosen queue, wait strategy, storage and capacity, or NULL if there's no such
+// thing - or if writers are to have producer handles, and the queue isn't a fifo holding its items inline
+template <unsigned capacity>
+StressRoundFunction stressRoundFor(const string& queue, const string& policy, const string& storage, bool handles) {
+
+	if (queue == "fifo") return stressFifoLockRoundFor<capacity, FifoCriticalSectionLock>(policy, storage, handles);
+	if (queue == "fifo_ttas") return stressFifoLockRoundFor<capacity, FifoTtasLock>(policy, storage, handles);
+	if (queue == "fifo_ticket") return stressFifoLockRoundFor<capacity, FifoTicketLock>(policy, storage, handles);
+	if (queue == BaselineStdQueue<StressItem, capacity>::name()) return stressRoundWith<BaselineStdQueue<StressItem, capacity> >(handles);
+	if (queue == BaselineCondVarQueue<StressItem, capacity>::name()) return stressRoundWith<BaselineCondVarQueue<StressItem, capacity> >(handles);
+	if (queue == BaselineVyukovQueue<StressItem, capacity>::name()) return stressRoundWith<BaselineVyukovQueue<StressItem, capacity> >(handles);
+	return NULL;
+}
+
+
+// The options that reproduce one round
+string stressReproduce(const string& queue, const string& policy, const string& storage, unsigned capacity,
+	const StressConfig& config) {
+
+	return "mode=stress queue=" + queue + " policy=" + policy + " storage=" + storage + " capacity=" + to_string(capacity) +
+		" writers=" + to_string(config.writers) + " handles=" + to_string(config.handleWriters) + " ops=" + to_string(config.opsPerWriter) +
+		" pause=" + to_string(config.maxPause) + " pop=" + to_string(config.popPercent) +
+		" release=" + to_string(config.releaseInterval) + " full_percent=" + to_string(config.releaseFullPercent) +
+		" prng=" + (config.generator == BENCH_GENERATOR_MT ? "mt" : "lfsr") + " seed=" + to_string(config.seed) + " duration=0";
+}
+
+
+// Looks for a smaller failing round than the one given - fewer writers, fewer with producer handles, fewer
+// operations, shorter pauses, no blocking pops - trying each candidate up to 'attempts' times (thread timing varies from run to run, so
+// a round that can fail doesn't fail every time). Returns the smallest round that was seen to fail, and
+// its result.
+StressConfig shrinkStressRound(StressRoundFunction round, unsigned capacity, const StressConfig& failing, unsigned attempts,
+	StressResult* result) {
+
+	StressConfig smallest = failing;
+	bool shrunk = true;
+
+	while (shrunk) {
+
+		shrunk = false;
+
+		vector<StressConfig> candidates;
+		StressConfig candidate = smallest;
+		if (smallest.writers > 1) {
+			candidate.writers = smallest.writers - 1;
+			candidate.handleWriters = min(smallest.handleWriters, candidate.writers);
+			candidates.push_back(candidate);
+			candidate = smallest;
+		}
+		if (smallest.handleWriters > 0) { candidate.handleWriters = smallest.handleWriters - 1; candidates.push_back(candidate); candidate = smallest; }
+		if (smallest.opsPerWriter > 1) { candidate.opsPerWriter = smallest.opsPerWriter / 2; candidates.push_back(candidate); candidate = smallest; }
+		if (smallest.maxPause > 0) { candidate.maxPause = smallest.maxPause / 2; candidates.push_back(candidate); candidate = smallest; }
+		if (smallest.popPercent > 0) { candidate.popPercent = 0; candidates.push_back(candidate); }
+
+		for (size_t c = 0; c < candidates.size() && !shrunk; c++) {
+			for (unsigned a = 0; a < attempts; a++) {
+				StressResult attempt = round(candidates[c], capacity);
+				if (attempt.errorCount != 0) {
+					smallest = candidates[c];
+					*result = attempt;
+					shrunk = true;
+					break;
+				}
+			}
+		}
+	}
+	return smallest;
+}
+
+
+
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options(argc, argv);
+
+	string mode = options.getString("mode", "load");
+	BenchFormat format = benchParseFormat(options.getString("format", "text"));
+	BenchReport report;
+
+	string priority = options.getString("priority", "normal");
+	if (!BenchTopology::setPriority(priority)) {
+		cerr << "Unknown priority \"" << priority << "\" - use normal, high or realtime" << endl;
+		return 2;
+	}
+
+	// What the benchmark ran on, added to every record whatever the mode
+	BenchTopology topology;
+	BenchRecord machine;
+	topology.describe(machine);
+	machine.add("priority", priority);
+
+	// Cache misses, HITM and branch misses, if asked for and Windows allows it - otherwise they are "n/a"
+	if (options.getString("pmc", "off") == "on") {
+		BenchPmcSources sources;
+		sources.names[BENCH_PMC_CACHE_MISSES] = options.getString("pmc_cache", "LLCMisses");
+		sources.names[BENCH_PMC_HITM] = options.getString("pmc_hitm", "");
+		sources.names[BENCH_PMC_BRANCH_MISSES] = options.getString("pmc_branch", "BranchMispredictions");
+		string problem;
+		if (!BenchPmcSession::instance().start(sources, &problem)) {
+			cerr << "No PMC session - " << problem << "; cache misses, HITM and branch misses are reported as n/a" << endl;
+		}
+	}
+
+	if (mode == "load") {
+
+		LoadConfig config;
+		config.writers = max(1u, options.getUnsigned("writers", 2));
+		config.readers = max(1u, options.getUnsigned("readers", 1));
+		config.itemsPerWriter = max(1u, options.getUnsigned("items", 100000));
+		config.seed = options.getUnsigned("seed", 1);
+		config.capacity = options.getUnsigned("capacity", 1024);
+		config.blockingReader = (options.getString("reader", "poll") == "block");
+		config.openLoop = (options.getString("loop", "drop") == "open");
+		config.seriesFile = options.getString("series", "");
+		config.metricsFile = options.getString("metrics", "");
+		config.metricsSocket = options.getString("metrics_socket", "");
+		config.metricsIntervalMs = options.getUnsigned("metrics_interval", 1000);
+		config.generator = (options.getString("prng", "mt") == "lfsr") ? BENCH_GENERATOR_LFSR : BENCH_GENERATOR_MT;
+
+		string pattern = options.getString("pattern", "fixed");
+		config.arrivals.pattern = (pattern == "poisson") ? BENCH_ARRIVAL_POISSON : (pattern == "bursty") ? BENCH_ARRIVAL_BURSTY : BENCH_ARRIVAL_FIXED;
+		config.arrivals.ratePerSecond = options.getDouble("rate", 100000.0);
+		config.arrivals.modulationDepth = min(0.99, max(0.0, options.getDouble("depth", 0.5)));
+		config.arrivals.modulationPeriod = max(1u, options.getUnsigned("modperiod", 1000));
+		config.arrivals.burstLength = max(1u, options.getUnsigned("burst", 16));
+
+		if (!choosePinning(options, topology, config.readers, config.writers, &config.pinning)) return 2;
+
+		// The capacity is a template parameter, so only a fixed selection is available at run time
+		switch (config.capacity) {
+		case 5: runLoadBenchmark<5>(config, report); break;
+		case 64: runLoadBenchmark<64>(config, report); break;
+		case 1024: runLoadBenchmark<1024>(config, report); break;
+		case 16384: runLoadBenchmark<16384>(config, report); break;
+		default:
+			cerr << "Unsupported capacity " << config.capacity << " - use 5, 64, 1024 or 16384" << endl;
+			return 2;
+		}
+	}
+	else if (mode == "wake") {
+
+		WakeConfig config;
+		config.rounds = max(1u, options.getUnsigned("rounds", 10000));
+		config.warmup = options.getUnsigned("warmup", 100);
+		config.gapNs = options.getDouble("gap", 50000.0);
+
+		string policy = options.getString("policy", "all");
+		string placement = options.getString("placement", "all");
+		string distFile = options.getString("dist", "");
+
+		BenchReport distribution;
+
+		for (unsigned p = 0; p < BENCH_PLACEMENT_COUNT; p++) {
+
+			if (placement != "all" && placement != benchPlacementName(p)) continue;
+
+			unsigned first, second;
+			if (!topology.pickPair(p, &first, &second)) {
+				cerr << "Skipping placement \"" << benchPlacementName(p) << "\" - not available on this machine ("
+					<< topology.cores() << " cores, " << topology.l3Caches() << " L3 caches, " << topology.packages() << " sockets)" << endl;
+				continue;
+			}
+
+			if (policy == "all" || policy == FifoEventWait::name()) runWakeBenchmark<FifoEventWait>(config, p, first, second, report, distribution);
+			if (policy == "all" || policy == FifoAddressWait::name()) runWakeBenchmark<FifoAddressWait>(config, p, first, second, report, distribution);
+			if (policy == "all" || policy == FifoCondVarWait::name()) runWakeBenchmark<FifoCondVarWait>(config, p, first, second, report, distribution);
+			if (policy == "all" || policy == FifoSpinWait::name()) runWakeBenchmark<FifoSpinWait>(config, p, first, second, report, distribution);
+			if (policy == "all" || policy == FifoSpinThenParkWait::name()) runWakeBenchmark<FifoSpinThenParkWait>(config, p, first, second, report, distribution);
+		}
+
+		if (report.size() == 0) {
+			cerr << "Nothing to run for policy \"" << policy << "\" and placement \"" << placement << "\"" << endl;
+			return 2;
+		}
+
+		if (!distFile.empty()) {
+			ofstream file(distFile.c_str());
+			distribution.print(file, BENCH_FORMAT_CSV);
+		}
+	}
+	else if (mode == "compare") {
+
+		CompareConfig config;
+		config.items = max(1u, options.getUnsigned("items", 1000000));
+		config.blockingReader = (options.getString("reader", "poll") == "block");
+		config.processors = max(1u, topology.processors());
+
+		string queues = options.getString("queue", "all");
+		string sizes = options.getString("size", "all");
+		vector<unsigned> producerCounts = options.getUnsignedList("producers", "1,4,16");
+
+		unsigned mostProducers = 1;
+		for (size_t p = 0; p < producerCounts.size(); p++) mostProducers = max(mostProducers, producerCounts[p]);
+		if (!choosePinning(options, topology, 1, mostProducers, &config.pinning)) return 2;
+
+		for (size_t p = 0; p < producerCounts.size(); p++) {
+			unsigned producers = max(1u, producerCounts[p]);
+			if (sizes == "all" || sizes == "small") runCompareQueues<CompareSmallItem>(config, queues, producers, report);
+			if (sizes == "all" || sizes == "large") runCompareQueues<CompareLargeItem>(config, queues, producers, report);
+		}
+
+		if (report.size() == 0) {
+			cerr << "Nothing to run for queue \"" << queues << "\" and size \"" << sizes << "\"" << endl;
+			return 2;
+		}
+	}
+	else if (mode == "sweep") {
+
+		SweepConfig config;
+		config.items = max(1u, options.getUnsigned("items", 200000));
+		config.runs = max(1u, options.getUnsigned("runs", 1));
+
+		string policyList = options.getString("policy", "all");
+		vector<string> policies = benchSplitCsv(policyList == "all" ? string(SWEEP_POLICIES) : policyList);
+		vector<unsigned> capacities = options.getUnsignedList("capacity", SWEEP_CAPACITIES);
+		vector<unsigned> sizes = options.getUnsignedList("size", SWEEP_SIZES);
+		vector<unsigned> writerCounts = options.getUnsignedList("writers", SWEEP_WRITERS);
+		string csvFile = options.getString("csv", "");
+		string baselineFile = options.getString("baseline", "");
+		double tolerance = options.getDouble("tolerance", 10.0);
+
+		unsigned mostWriters = 1;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			writerCounts[w] = max(1u, writerCounts[w]);
+			mostWriters = max(mostWriters, writerCounts[w]);
+		}
+		if (!choosePinning(options, topology, 1, mostWriters, &config.pinning)) return 2;
+
+		map<string, double> baseline;
+		if (!baselineFile.empty() && !readSweepBaseline(baselineFile, &baseline)) {
+			cerr << "Can't read baseline \"" << baselineFile << "\"" << endl;
+			return 2;
+		}
+
+		BenchReport cases;
+		unsigned regressions = 0;
+
+		for (size_t p = 0; p < policies.size(); p++) {
+			for (size_t c = 0; c < capacities.size(); c++) {
+				for (size_t z = 0; z < sizes.size(); z++) {
+
+					cerr << "Sweeping policy " << policies[p] << ", capacity " << capacities[c] << ", " << sizes[z] << " byte items" << endl;
+
+					BenchRecord& row = report.newRecord();
+					row.add("policy", policies[p]);
+					row.add("capacity", capacities[c]);
+					row.add("item_bytes", sizes[z]);
+
+					string regressed;
+
+					for (size_t w = 0; w < writerCounts.size(); w++) {
+
+						SweepResult result;
+						if (!runSweep(config, policies[p], sizes[z], capacities[c], writerCounts[w], &result)) {
+							cerr << "Unknown policy \"" << policies[p] << "\", capacity " << capacities[c] << " or size " << sizes[z]
+								<< " - use " << SWEEP_POLICIES << ", " << SWEEP_CAPACITIES << " and " << SWEEP_SIZES << endl;
+							return 2;
+						}
+
+						string column = "w" + to_string(writerCounts[w]) + "_mitems_per_s";
+						if (result.skipped) {
+							row.add(column, "-");
+							continue;
+						}
+						row.add(column, result.itemsPerSecond / 1.0e6);
+
+						BenchRecord& record = cases.newRecord();
+						record.add("mode", "sweep");
+						record.add("policy", policies[p]);
+						record.add("capacity", capacities[c]);
+						record.add("item_bytes", sizes[z]);
+						record.add("writers", writerCounts[w]);
+						record.add("items", result.items);
+						record.add("runs", config.runs);
+						recordPinning(record, config.pinning);
+						record.add("seconds", result.seconds);
+						record.add("items_per_second", result.itemsPerSecond);
+						record.add("push_retries", result.pushRetries);
+						result.counters.describe(record, result.items);
+
+						if (baselineFile.empty()) continue;
+
+						// Compare with the same case in the baseline, if it has it
+						map<string, double>::const_iterator found = baseline.find(sweepKey(policies[p], to_string(capacities[c]),
+							to_string(sizes[z]), to_string(writerCounts[w])));
+						if (found == baseline.end() || found->second <= 0.0) {
+							record.add("baseline_items_per_second", "-");
+							record.add("change_percent", "-");
+							record.add("verdict", "new");
+							continue;
+						}
+
+						double change = 100.0 * (result.itemsPerSecond - found->second) / found->second;
+						const char* verdict = (change < -tolerance) ? "regressed" : (change > tolerance) ? "improved" : "same";
+						record.add("baseline_items_per_second", found->second);
+						record.add("change_percent", change);
+						record.add("verdict", verdict);
+
+						if (change < -tolerance) {
+							regressions++;
+							regressed += (regressed.empty() ? "" : ",") + to_string(writerCounts[w]);
+							cerr << "REGRESSION - policy " << policies[p] << ", capacity " << capacities[c] << ", " << sizes[z]
+								<< " byte items, " << writerCounts[w] << " writers: " << found->second << " -> "
+								<< result.itemsPerSecond << " items/s (" << change << "%)" << endl;
+						}
+					}
+
+					if (!baselineFile.empty()) row.add("regressed", regressed.empty() ? string("-") : regressed);
+				}
+			}
+		}
+
+		if (!csvFile.empty()) {
+			cases.addToEach(machine);
+			ofstream file(csvFile.c_str());
+			cases.print(file, BENCH_FORMAT_CSV);
+		}
+
+		if (!baselineFile.empty()) {
+			cerr << regressions << " regression(s) of more than " << tolerance << "% against \"" << baselineFile << "\"" << endl;
+		}
+
+		report.addToEach(machine);
+		report.print(cout, format);
+		return regressions ? 1 : 0;
+	}
+	else if (mode == "storage") {
+
+		SweepConfig config;
+		config.items = max(1u, options.getUnsigned("items", 200000));
+		config.runs = max(1u, options.getUnsigned("runs", 1));
+
+		vector<unsigned> sizes = options.getUnsignedList("size", STORAGE_SIZES);
+		vector<unsigned> writerCounts = options.getUnsignedList("writers", "1,4");
+
+		unsigned mostWriters = 1;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			writerCounts[w] = max(1u, writerCounts[w]);
+			mostWriters = max(mostWriters, writerCounts[w]);
+		}
+		if (!choosePinning(options, topology, 1, mostWriters, &config.pinning)) return 2;
+
+		for (size_t z = 0; z < sizes.size(); z++) {
+			for (size_t w = 0; w < writerCounts.size(); w++) {
+				if (!runStorageSize(config, sizes[z], writerCounts[w], report)) {
+					cerr << "Unsupported size " << sizes[z] << " - use " << STORAGE_SIZES << endl;
+					return 2;
+				}
+			}
+		}
+	}
+	else if (mode == "batch") {
+
+		BatchConfig config;
+		config.sweep.items = max(1u, options.getUnsigned("items", 200000));
+		config.sweep.runs = max(1u, options.getUnsigned("runs", 1));
+		config.batch = min(BATCH_CAPACITY, max(1u, options.getUnsigned("batch", 64)));
+		if (!choosePinning(options, topology, 1, 1, &config.sweep.pinning)) return 2;
+
+		vector<unsigned> sizes = options.getUnsignedList("size", BATCH_SIZES);
+		string copyList = options.getString("copy", "all");
+		vector<string> copies = benchSplitCsv(copyList == "all" ? string(BATCH_COPIES) : copyList);
+
+		for (size_t c = 0; c < copies.size(); c++) {
+			if (copies[c] != "unbatched" && copies[c] != "scalar" && copies[c] != "avx2" && copies[c] != "avx512") {
+				cerr << "Unsupported copy " << copies[c] << " - use all or any of " << BATCH_COPIES << endl;
+				return 2;
+			}
+		}
+
+		for (size_t z = 0; z < sizes.size(); z++) {
+			if (!runBatch(config, sizes[z], copies, report)) {
+				cerr << "Unsupported size " << sizes[z] << " - use " << BATCH_SIZES << endl;
+				return 2;
+			}
+		}
+	}
+	else if (mode == "prefetch") {
+
+		PrefetchConfig config;
+		config.rounds = max(1u, options.getUnsigned("items", 200000) / PREFETCH_CAPACITY);
+		config.runs = max(1u, options.getUnsigned("runs", 1));
+		if (!choosePinning(options, topology, 1, 1, &config.pinning)) return 2;
+
+		vector<unsigned> sizes = options.getUnsignedList("size", PREFETCH_SIZES);
+		vector<unsigned> distances = options.getUnsignedList("distance", PREFETCH_DISTANCES);
+		vector<string> kinds = benchSplitCsv(options.getString("item", "value,pointer"));
+
+		for (size_t k = 0; k < kinds.size(); k++) {
+			if (kinds[k] != "value" && kinds[k] != "pointer") {
+				cerr << "Unsupported item " << kinds[k] << " - use value, pointer or both" << endl;
+				return 2;
+			}
+		}
+
+		for (size_t z = 0; z < sizes.size(); z++) {
+			if (!runPrefetch(config, sizes[z], kinds, distances, report)) {
+				cerr << "Unsupported size " << sizes[z] << " - use " << PREFETCH_SIZES << endl;
+				return 2;
+			}
+		}
+	}
+	else if (mode == "retry") {
+
+		SweepConfig config;
+		config.items = max(1u, options.getUnsigned("items", 200000));
+		config.runs = max(1u, options.getUnsigned("runs", 1));
+
+		vector<unsigned> sizes = options.getUnsignedList("size", "16,256,4096");
+		vector<unsigned> writerCounts = options.getUnsignedList("writers", "1,4,16");
+
+		unsigned mostWriters = 1;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			writerCounts[w] = max(1u, writerCounts[w]);
+			mostWriters = max(mostWriters, writerCounts[w]);
+		}
+		if (!choosePinning(options, topology, 1, mostWriters, &config.pinning)) return 2;
+
+		bool lost = false;
+		for (size_t z = 0; z < sizes.size(); z++) {
+			for (size_t w = 0; w < writerCounts.size(); w++) {
+				if (!runRetry(config, sizes[z], writerCounts[w], report)) lost = true;
+			}
+		}
+
+		report.addToEach(machine);
+		report.print(cout, format);
+		return lost ? 1 : 0;
+	}
+	else if (mode == "backoff") {
+
+		BackoffConfig config;
+		config.items = max(1u, options.getUnsigned("items", 20000));
+		config.gapNs = options.getDouble("gap", 5000.0);
+		config.budget.attempts = options.getUnsigned("budget", 64);
+		config.budget.microseconds = options.getUnsigned("budget_us", 0);
+
+		vector<unsigned> writerCounts = options.getUnsignedList("writers", "8,32");
+
+		unsigned mostWriters = 1;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			writerCounts[w] = max(1u, writerCounts[w]);
+			mostWriters = max(mostWriters, writerCounts[w]);
+		}
+		if (!choosePinning(options, topology, 1, mostWriters, &config.pinning)) return 2;
+
+		for (size_t w = 0; w < writerCounts.size(); w++) runBackoff(config, writerCounts[w], report);
+	}
+	else if (mode == "producer") {
+
+		ProducerConfig config;
+		config.items = max(1u, options.getUnsigned("items", 200000));
+		config.flushMicroseconds = options.getUnsigned("flush_us", 50);
+
+		vector<unsigned> chunks = options.getUnsignedList("chunk", "4,16,64");
+		vector<unsigned> writerCounts = options.getUnsignedList("writers", "1,4,16");
+
+		for (size_t c = 0; c < chunks.size(); c++) {
+			if (chunks[c] != 4 && chunks[c] != 16 && chunks[c] != 64) {
+				cerr << "Unsupported chunk size " << chunks[c] << " - use 4, 16 or 64" << endl;
+				return 2;
+			}
+		}
+
+		unsigned mostWriters = 1;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			writerCounts[w] = max(1u, writerCounts[w]);
+			mostWriters = max(mostWriters, writerCounts[w]);
+		}
+		if (!choosePinning(options, topology, 1, mostWriters, &config.pinning)) return 2;
+
+		bool inOrder = true;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			if (!runProducer(config, chunks, writerCounts[w], report)) inOrder = false;
+		}
+
+		report.addToEach(machine);
+		report.print(cout, format);
+		return inOrder ? 0 : 1;
+	}
+	else if (mode == "release") {
+
+		ReleaseConfig config;
+		config.items = max(1u, options.getUnsigned("items", 200000));
+		config.fullPercent = min(100u, options.getUnsigned("full_percent", FIFO_RELEASE_FULL_PERCENT));
+
+		vector<unsigned> intervals = options.getUnsignedList("release", "1,4,16,64");
+		vector<unsigned> writerCounts = options.getUnsignedList("writers", "1,4,16");
+
+		unsigned mostWriters = 1;
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			writerCounts[w] = max(1u, writerCounts[w]);
+			mostWriters = max(mostWriters, writerCounts[w]);
+		}
+		if (!choosePinning(options, topology, 1, mostWriters, &config.pinning)) return 2;
+
+		for (size_t w = 0; w < writerCounts.size(); w++) {
+			for (size_t i = 0; i < intervals.size(); i++) runReleaseCase(config, max(1u, intervals[i]), writerCounts[w], report);
+		}
+	}
+	else if (mode == "stress") {
+
+		StressConfig config;
+		config.writers = max(1u, options.getUnsigned("writers", 4));
+		config.handleWriters = min(config.writers, options.getUnsigned("handles", 0));
+		config.opsPerWriter = max(1u, options.getUnsigned("ops", 20000));
+		config.maxPause = options.getUnsigned("pause", 64);
+		config.popPercent = min(100u, options.getUnsigned("pop", 25));
+		config.releaseInterval = max(1u, options.getUnsigned("release", 1));
+		config.releaseFullPercent = min(100u, options.getUnsigned("full_percent", FIFO_RELEASE_FULL_PERCENT));
+		config.generator = (options.getString("prng", "mt") == "lfsr") ? BENCH_GENERATOR_LFSR : BENCH_GENERATOR_MT;
+		// Without a seed every run explores different schedules - the seed is reported either way
+		config.seed = options.has("seed") ? options.getUnsigned("seed", 1) : (unsigned) BenchClock::now();
+
+		double durationS = options.getDouble("duration", 10.0);
+		bool repeat = options.getUnsigned("repeat", 0) != 0;
+		unsigned shrinkAttempts = options.getUnsigned("shrink", 20);
+		unsigned capacity = options.getUnsigned("capacity", 8);
+		string queue = options.getString("queue", "fifo");
+		string policy = options.getString("policy", FifoEventWait::name());
+		string storage = options.getString("storage", "auto");
+
+		StressRoundFunction round = NULL;
+		switch (capacity) {
+		case 8: round = stressRoundFor<8>(queue, policy, storage, config.handleWriters != 0); break;
+		case 64: round = stressRoundFor<64>(queue, policy, storage, config.handleWriters != 0); break;
+		default:
+			cerr << "Unsupported capacity " << capacity << " - use 8 or 64" << endl;
+			return 2;
+		}
+		if (round == NULL) {
+			cerr << "Unknown queue \"" << queue << "\", policy \"" << policy << "\" or storage \"" << storage << "\"";
+			if (config.handleWriters != 0) cerr << " - or one that can't have producer handles (a fifo with inline storage only)";
+			cerr << endl;
+			return 2;
+		}
+		bool isFifo = (queue.compare(0, 4, "fifo") == 0);
+		if (!isFifo && config.releaseInterval > 1) {
+			cerr << "Only a fifo has a release interval - \"" << queue << "\" hands every position back at once" << endl;
+			return 2;
+		}
+
+		// Rounds, each with the next seed (or all with the same one), until the time is up or one fails
+		StressResult total = {};
+		StressResult failure = {};
+		StressConfig failing = config;
+		unsigned rounds = 0;
+		unsigned long long endTicks = BenchClock::now() + BenchClock::fromNanoseconds(durationS * 1.0e9);
+
+		do {
+			StressConfig roundConfig = config;
+			if (!repeat) roundConfig.seed = config.seed + rounds;
+
+			StressResult result = round(roundConfig, capacity);
+			rounds++;
+			total.pushes += result.pushes;
+			total.pops += result.pops;
+			total.full += result.full;
+			total.empty += result.empty;
+
+			if (result.errorCount != 0) {
+				failure = result;
+				failing = roundConfig;
+				break;
+			}
+		} while (BenchClock::now() < endTicks);
+
+		bool failed = (failure.errorCount != 0);
+		string reproduce = failed ? stressReproduce(queue, policy, storage, capacity, failing) : string("");
+		string shrunk = reproduce;
+
+		if (failed) {
+			cerr << "FAILED - " << failure.errorCount << " error(s) in round " << rounds << ";" << endl;
+			for (size_t e = 0; e < failure.errors.size(); e++) cerr << "  " << failure.errors[e] << endl;
+			cerr << "Reproduce with: " << reproduce << endl;
+
+			if (shrinkAttempts != 0) {
+				StressResult smallestResult = failure;
+				StressConfig smallest = shrinkStressRound(round, capacity, failing, shrinkAttempts, &smallestResult);
+				shrunk = stressReproduce(queue, policy, storage, capacity, smallest);
+				cerr << "Smallest failing round found (" << smallestResult.errorCount << " error(s), first: "
+					<< (smallestResult.errors.empty() ? string("?") : smallestResult.errors[0]) << ");" << endl;
+				cerr << "  " << shrunk << " repeat=1" << endl;
+			}
+		}
+
+		BenchRecord& record = report.newRecord();
+		record.add("mode", "stress");
+		record.add("queue", queue);
+		record.add("policy", isFifo ? policy : string("-"));
+		record.add("storage", isFifo ? storage : string("-"));
+		record.add("capacity", capacity);
+		record.add("writers", config.writers);
+		record.add("handle_writers", config.handleWriters);
+		record.add("ops_per_writer", config.opsPerWriter);
+		record.add("release_interval", isFifo ? to_string(config.releaseInterval) : string("-"));
+		record.add("seed", config.seed);
+		record.add("rounds", rounds);
+		record.add("pushes", total.pushes);
+		record.add("pops", total.pops);
+		record.add("full_checked", total.full);
+		record.add("empty_checked", total.empty);
+		record.add("errors", failure.errorCount);
+		record.add("result", failed ? "fail" : "pass");
+		record.add("reproduce", shrunk);
+
+		report.addToEach(machine);
+		report.print(cout, format);
+		return failed ? 1 : 0;
+	}
+	else {
+		cerr << "Unknown mode \"" << mode << "\"" << endl;
+		return 2;
+	}
+
+	report.addToEach(machine);
+	report.print(cout, format);
+	return 0;
+}
@@ -0,0 +1,783 @@
+﻿//
+//--------------------------------------------------------------------------------
+//
+//	MIT License
+//
+//	Copyright (c) 2019 Calmholm
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a copy
+//	of this software and associated documentation files(the "Software"), to deal
+//	in the Software without restriction, including without limitation the rights
+//	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//	copies of the Software, and to permit persons to whom the Software is
+//	furnished to do so, subject to the following conditions :
+//
+//	The above copyright notice and this permission notice shall be included in all
+//	copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//	SOFTWARE.
+//
+//--------------------------------------------------------------------------------
+//
+//
+//
+//
+//  Systematic schedule exploration (model checking) of the software fifo template class.
+//
+//
+//  About this file
+//  ===============
+//
+//  This file contains a main() function which has been developed for the purpose of implementing a Windows
+//  Console App that explores the ways in which the push(), pop_try() and pop() calls of a few threads can
+//  interleave inside the software fifo (Fifo.h), its reader wait strategies (FifoWait.h), item storage
+//  (FifoStorage.h) and locks (FifoLock.h), and checks every one of them. It is built with FIFO_MODEL_CHECK
+//  defined as 1, which hands the scheduling of the threads to FifoModelScheduler (see FifoModel.h).
+//
+//  Ordinary multi-threaded testing, such as the stress test in Fifo_Benchmark_Win.cpp, only sees the
+//  interleavings that the operating system happens to produce - the FIFO_STATUS_PREEMPTED race in push() is
+//  "a rare occurrence", and a lost wake-up might take days to show. Here every interleaving with up to
+//  "bound=" preemptions is run, so a rare one is found as surely as a common one. Use it to gain confidence
+//  in a new wait strategy before deploying it.
+//
+//
+//  How the model check works
+//  =========================
+//
+//  Each case is one fifo (of a given wait strategy, capacity, item storage and lock), a reader thread and a
+//  number of writer threads. Each writer pushes a number of items - with push(), push_batch() or a producer
+//  handle - trying again (with YieldProcessor()) when a push fails. The reader pops them all - with pop(),
+//  with pop_try() or pop_try_batch() (again trying again when EMPTY), or alternately with pop_try() and pop().
+//  Every call is recorded with the scheduler's step count before and after it; a batch call as one call for
+//  each item it moved, all with its step counts. An execution of the case fails if;
+//
+//  - it deadlocks - for example the reader asleep in pop() while an item waits in the FIFO (a lost wake-up)
+//  - it livelocks - the threads spin without ever finishing
+//  - the StressChecker (FifoStress.h) finds the results wrong - items lost, duplicated or out of order, or a
+//    FULL, PREEMPTED or EMPTY status that the fifo couldn't have been in at the time
+//
+//  A failure is reported with a trace of every step of the failing execution, and the options - including
+//  "schedule=" - that replay exactly that execution. The first failure ends the case.
+//
+//  "policy=naive" is a wait strategy with the classic lost wake-up (the reader tests the population before
+//  saying that it's going to sleep), included to show what the checker reports when it finds one.
+//
+//
+//  Command line options
+//  ====================
+//
+//  Options are given as name=value. Those marked "list" take a comma-separated list, and every combination
+//  of the values given is checked.
+//
+//  policy=event,address,condvar,spin,spinpark
+//                       Wait strategies (list) - or naive, see above
+//  capacity=1,2         FIFO capacities (list) - 1, 2, 3 or 4
+//  storage=inline       Item storage (list) - inline or slab (see FifoStorage.h). The slab has one spare slot,
+//                       so that writers can find it full.
+//  lock=critical_section
+//                       Writers' lock (list) - critical_section, ttas or ticket (see FifoLock.h)
+//  writers=1,2          Numbers of writer threads (list), up to 4
+//  writer=push          How the writers without producer handles push (list) - push(), or push_batch() of all
+//                       the items they have left (up to 4) - inline storage only
+//  items=2              Items pushed by each writer
+//  reader=pop,poll,mix  How the reader pops (list) - pop(), pop_try(), alternately each, or batch -
+//                       pop_try_batch() of up to 4 items (inline storage only)
+//  release=1            Pops before the reader hands their ring positions back (list - see "Handing positions
+//                       back" in Fifo.h). A FULL is then only wrong if more than this less one positions were
+//                       free.
+//  full_percent=100     Population, as a percentage of the capacity, at which the reader hands positions back
+//                       at once whatever the release interval (list)
+//  handles=0            How many of the writers push through producer handles (FifoProducer.h) of their own,
+//                       with chunks of 3 (list) - capacity 3 or 4 only
+//  search=dfs           dfs - every execution within the preemption bound; random - pseudo-random ones
+//  bound=2              Most preemptions in one execution
+//  executions=1000000   Most executions of each case (search=random - 10000)
+//  seed=1               search=random - seed for the choices
+//  schedule=            Replay one execution - the choices reported with a failure
+//  format=text          Report format - text, csv or json
+//
+//  For example "Fifo_ModelCheck_Win.exe policy=address writers=3 bound=3" or
+//  "Fifo_ModelCheck_Win.exe capacity=2,3 release=2" or
+//  "Fifo_ModelCheck_Win.exe policy=naive capacity=1 writers=1 reader=pop"
+//
+//  Without any of the options marked "list" the default cases are run;
+//
+//  - every wait strategy with the values shown above
+//  - the hand-back cases - capacity 4, a release interval of 2 and fullness thresholds of 75 and 100
+//    percent, so that the reader both holds positions back and hands them back because the FIFO is full
+//  - the producer handle cases - capacities 3 and 4, two writers of which one or both have handles, and a
+//    release interval of 2 with a threshold of 75 percent, so that room promised to a handle is counted both
+//    by the other writer and by the reader's release test
+//  - the slab cases - capacities 1 and 2 and two writers, so that a writer finds every slot taken
+//  - the batch cases - capacities 2 and 3, push_batch() and pop_try_batch() against push() and pop_try(),
+//    with release intervals of 1 and 2
+//  - the spinlock cases - ttas and ticket, with capacities 1 and 2 and two writers
+//
+//  Given any of the options marked "list", just the combinations of the values given (and the defaults above
+//  for the rest) are run. The exit code is 1 if any case failed. The default cases - some 120, exploring up
+//  to tens of thousands of executions each - take a few minutes.
+//
+//  A handle publishes its chunk only when the chunk is full or flushed (each writer flushes its handle when
+//  it has pushed its items), never because an item has waited too long - an execution must replay exactly,
+//  whatever the time.
+//
+//
+//  Building the Windows Console App
+//  ================================
+//
+//  As for Software_Fifo_Exercise_Win.cpp, using this file in place of that one and adding header files
+//  FifoModel.h, FifoBench.h, FifoStress.h and FifoProducer.h to the project as well as the fifo header files.
+//  FIFO_MODEL_CHECK is defined below, before anything is included, so no project settings need to change.
+//
+//
+
+
+#define FIFO_MODEL_CHECK	1	// Redirect the fifo's synchronisation calls to FifoModel.h
+#define FIFO_SPIN_LIMIT		((unsigned) 2)	// FifoSpinThenParkWait - spin briefly, so that parking is explored too
+#define FIFO_SLAB_SPARE_SLOTS	((unsigned) 1)	// FifoSlabStorage - so that running out of slots is explored too
+
+#include "pch.h"		// Pre-compiled headers (pch)
+#include <iostream>
+
+
+#include "Fifo.h"		// The software fifo template class
+#include "FifoBench.h"		// For the options and the report
+#include "FifoStress.h"		// For the history checker
+
+#include <memory>		// For std::unique_ptr
+#include <vector>
+
+
+
+using namespace std;
+
+
+
+
+#define MODEL_READER_POP	((unsigned) 0)	// pop() only
+#define MODEL_READER_POLL	((unsigned) 1)	// pop_try() only
+#define MODEL_READER_MIX	((unsigned) 2)	// pop_try() and pop() alternately
+#define MODEL_READER_BATCH	((unsigned) 3)	// pop_try_batch() only
+
+#define MODEL_WRITER_PUSH	((unsigned) 0)	// push()
+#define MODEL_WRITER_BATCH	((unsigned) 1)	// push_batch()
+
+#define MODEL_BATCH_MOST	((unsigned) 4)	// Most items in one push_batch() or pop_try_batch()
+
+#define MODEL_MAX_WRITERS	((unsigned) 4)
+
+#define MODEL_HANDLE_CHUNK	((unsigned) 3)	// Chunk size of the writers' producer handles
+#define MODEL_HANDLE_FLUSH_US	((unsigned) 0xFFFFFFFF)	// Oldest an item may wait in a chunk - over an hour, so never
+
+#define MODEL_TRACE_HEAD	((size_t) 150)	// Steps of a failing execution shown from the start...
+#define MODEL_TRACE_TAIL	((size_t) 50)	// ...and from the end, if it has more than both together
+
+
+struct ModelConfig {
+	unsigned writers;
+	unsigned handleWriters;		// Of those, how many push through a producer handle of their own
+	unsigned writer;		// MODEL_WRITER_... - how the rest push
+	unsigned itemsPerWriter;
+	unsigned reader;		// MODEL_READER_...
+	unsigned releaseInterval;	// Pops before the reader hands their positions back
+	unsigned releaseFullPercent;	// ...or the population at which it hands them back at once
+	unsigned search;		// FIFO_MODEL_SEARCH_...
+	unsigned bound;			// Most preemptions in one execution
+	unsigned seed;
+	unsigned long long maxExecutions;
+	vector<unsigned> replay;	// Choices to replay, if any
+};
+
+
+struct ModelResult {
+	unsigned long long executions;
+	unsigned long long mostSteps;	// In any one execution
+	unsigned long long preempted;	// Executions in which a push() returned FIFO_STATUS_PREEMPTED
+	bool complete;			// Every execution within the bound was explored
+	string failure;			// Empty if every execution passed
+	vector<string> errors;		// Found by the StressChecker
+	vector<unsigned> schedule;	// Of the failing execution
+	vector<FifoModelStep> trace;	// Of the failing execution
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  A wait strategy with a lost wake-up
+//
+//--------------------------------------------------------------------------------
+
+// The reader tests the population and only then announces that it's going to sleep, so a writer that pushes
+// in between sees no sleeper, doesn't signal - and the reader sleeps with an item in the FIFO. Compare the
+// order of steps in FifoAddressWait (see "Lost wake-ups" in FifoWait.h).
+class ModelNaiveWait {
+
+	HANDLE dataAvailable;		// Auto-reset Event
+	std::atomic<unsigned> sleeping;
+
+public:
+
+	ModelNaiveWait() : sleeping(0) {
+		dataAvailable = CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+
+	~ModelNaiveWait() {
+		CloseHandle(dataAvailable);
+	}
+
+
+	void park(volatile unsigned* population) {
+
+		FIFO_SCHEDULE_POINT("naive park: population test");
+		if (*population != 0) return;
+
+		FIFO_SCHEDULE_POINT("naive park: set sleeping");
+		sleeping.store(1);
+		WaitForSingleObject(dataAvailable, INFINITE);
+
+		FIFO_SCHEDULE_POINT("naive park: clear sleeping");
+		sleeping.store(0);
+	}
+
+
+	void wake(volatile unsigned* population) {
+
+		(void) population;
+		FIFO_SCHEDULE_POINT("naive wake: sleeping test");
+		if (sleeping.load()) SetEvent(dataAvailable);
+	}
+
+
+	void drained(void) {}
+
+
+	static const char* name(void) {
+		return "naive";
+	}
+};
+
+
+
+
+//--------------------------------------------------------------------------------
+//
+//  The threads of a case
+//
+//--------------------------------------------------------------------------------
+
+// Whether a queue has push_batch() and pop_try_batch() - a Fifo that holds its items inline
+template <class Queue>
+struct ModelBatchedFor {
+	static const bool value = false;
+};
+
+
+template <class T, unsigned capacity, class WaitPolicy, class Storage, class LockPolicy>
+struct ModelBatchedFor<Fifo<T, capacity, WaitPolicy, Storage, LockPolicy> > {
+	static const bool value = Storage::batched;
+};
+
+
+// push_batch() and pop_try_batch(), for the writers and reader that use them. Only a queue that has them is
+// given such writers or such a reader (see modelCaseFor() below) - for any other these do nothing.
+template <class Queue, bool batched = ModelBatchedFor<Queue>::value>
+struct ModelBatch {
+
+	static FifoStatus push(Queue*, unsigned, unsigned, unsigned, unsigned* pushedPtr) {
+		*pushedPtr = 0;
+		return FIFO_STATUS_LOCKED;
+	}
+
+
+	static FifoStatus pop_try(Queue*, StressItem*, unsigned, unsigned* poppedPtr) {
+		*poppedPtr = 0;
+		return FIFO_STATUS_EMPTY;
+	}
+};
+
+
+template <class Queue>
+struct ModelBatch<Queue, true> {
+
+	// Pushes up to 'count' of the writer's items, numbered from 'first'
+	static FifoStatus push(Queue* queue, unsigned writer, unsigned first, unsigned count, unsigned* pushedPtr) {
+
+		StressItem items[MODEL_BATCH_MOST];
+		if (count > MODEL_BATCH_MOST) count = MODEL_BATCH_MOST;
+		for (unsigned i = 0; i < count; i++) {
+			items[i].writer = writer;
+			items[i].sequence = first + i;
+		}
+		return queue->push_batch(items, count, pushedPtr);
+	}
+
+
+	static FifoStatus pop_try(Queue* queue, StressItem* items, unsigned maxCount, unsigned* poppedPtr) {
+		return queue->pop_try_batch(items, maxCount, poppedPtr);
+	}
+};
+
+
+template <class Queue>
+void modelWriter(Queue* queue, unsigned writer, const ModelConfig& config, StressHistory* history) {
+
+	FifoModelScheduler& model = FifoModelScheduler::instance();
+
+	for (unsigned sequence = 0; sequence < config.itemsPerWriter; ) {
+
+		StressEvent event;
+		event.op = STRESS_OP_PUSH;
+		event.item.writer = writer;
+		event.item.sequence = sequence;
+		unsigned pushed = 0;
+		event.startTicks = model.now();
+		if (config.writer == MODEL_WRITER_BATCH) {
+			event.status = ModelBatch<Queue>::push(queue, writer, sequence, config.itemsPerWriter - sequence, &pushed);
+		}
+		else {
+			event.status = queue->push(event.item);
+			if (event.status == FIFO_STATUS_SUCCESS) pushed = 1;
+		}
+		event.endTicks = model.now();
+		event.published = (event.status == FIFO_STATUS_SUCCESS) ? 1 : 0;
+		event.roomMost = event.roomAfter = 0;
+
+		// A push_batch() is recorded as a push() of each item it pushed
+		history->push_back(event);
+		for (unsigned i = 1; i < pushed; i++) {
+			event.item.sequence++;
+			history->push_back(event);
+		}
+
+		sequence += pushed;
+		if (event.status != FIFO_STATUS_SUCCESS) YieldProcessor();
+	}
+}
+
+
+// A writer that pushes through a producer handle of its own, as modelWriter() does straight into the queue,
+// and then flushes it. Only a queue that can have one is given such writers (see modelCaseFor() below) - for
+// any other this does nothing.
+template <class Queue, bool supported = StressHandlesFor<Queue, MODEL_HANDLE_CHUNK>::supported>
+struct ModelHandleWriter {
+	static void run(Queue*, unsigned, const ModelConfig&, StressHistory*) {}
+};
+
+
+template <class Queue>
+struct ModelHandleWriter<Queue, true> {
+
+	static void run(Queue* queue, unsigned writer, const ModelConfig& config, StressHistory* history) {
+
+		FifoModelScheduler& model = FifoModelScheduler::instance();
+		FifoProducer<Queue, MODEL_HANDLE_CHUNK> producer(*queue, MODEL_HANDLE_FLUSH_US);
+
+		for (unsigned sequence = 0; sequence < config.itemsPerWriter; sequence++) {
+			for (;;) {
+				StressEvent event;
+				event.op = STRESS_OP_PUSH;
+				event.item.writer = writer;
+				event.item.sequence = sequence;
+				event.startTicks = model.now();
+				stressHandlePush(producer, &event);
+				event.endTicks = model.now();
+				history->push_back(event);
+
+				if (event.status == FIFO_STATUS_SUCCESS) break;
+				YieldProcessor();
+			}
+		}
+
+		StressEvent event;
+		event.op = STRESS_OP_FLUSH;
+		event.item.writer = writer;
+		event.item.sequence = config.itemsPerWriter;
+		event.startTicks = model.now();
+		stressHandleFlush(producer, &event);
+		event.endTicks = model.now();
+		history->push_back(event);
+	}
+};
+
+
+template <class Queue>
+void modelReader(Queue* queue, const ModelConfig& config, StressHistory* history) {
+
+	FifoModelScheduler& model = FifoModelScheduler::instance();
+	unsigned items = config.writers * config.itemsPerWriter;
+
+	for (unsigned i = 0; i < items; ) {
+
+		bool blocking = (config.reader == MODEL_READER_POP) || (config.reader == MODEL_READER_MIX && (i & 1) != 0);
+
+		StressEvent event;
+		event.item.writer = event.item.sequence = ~0u;
+		event.published = event.roomMost = event.roomAfter = 0;
+		event.op = blocking ? STRESS_OP_POP : STRESS_OP_POP_TRY;
+		StressItem batch[MODEL_BATCH_MOST];
+		unsigned popped = 0;
+		event.startTicks = model.now();
+		if (blocking) {
+			queue->pop(&event.item);
+			event.status = FIFO_STATUS_SUCCESS;
+			popped = 1;
+		}
+		else if (config.reader == MODEL_READER_BATCH) {
+			event.status = ModelBatch<Queue>::pop_try(queue, batch, min(items - i, MODEL_BATCH_MOST), &popped);
+		}
+		else {
+			event.status = queue->pop_try(&event.item);
+			if (event.status == FIFO_STATUS_SUCCESS) popped = 1;
+		}
+		event.endTicks = model.now();
+
+		// A pop_try_batch() is recorded as a pop_try() of each item it popped
+		if (config.reader == MODEL_READER_BATCH && popped != 0) {
+			for (unsigned p = 0; p < popped; p++) {
+				event.item = batch[p];
+				history->push_back(event);
+			}
+		}
+		else history->push_back(event);
+
+		i += popped;
+		if (popped == 0) YieldProcessor();
+	}
+}
+
+
+
+
+
+bool modelSawStatus(const vector<StressHistory>& histories, FifoStatus status) {
+
+	for (size_t h = 0; h < histories.size(); h++) {
+		for (size_t e = 0; e < histories[h].size(); e++) if (histories[h][e].status == status) return true;
+	}
+	return false;
+}
+
+
+// Thread 0 is the reader, threads 1 to config.writers the writers
+template <class Queue>
+ModelResult exploreCase(const ModelConfig& config, unsigned capacity) {
+
+	FifoModelScheduler& model = FifoModelScheduler::instance();
+	model.startSearch(config.search, config.bound, config.seed, config.replay);
+
+	ModelResult result = {};
+
+	for (;;) {
+
+		// A new fifo for each execution - allocated on the heap, as in the other Console Apps
+		unique_ptr<Queue> queue(new Queue);
+		queue->setReleaseInterval(config.releaseInterval, config.releaseFullPercent);
+		vector<StressHistory> writerHistories(config.writers);
+		StressHistory readerHistory;
+
+		bool finished = model.execute(config.writers + 1, [&](unsigned thread) {
+			if (thread == 0) modelReader(queue.get(), config, &readerHistory);
+			else if (thread - 1 < config.handleWriters) ModelHandleWriter<Queue>::run(queue.get(), thread - 1, config, &writerHistories[thread - 1]);
+			else modelWriter(queue.get(), thread - 1, config, &writerHistories[thread - 1]);
+		});
+
+		result.executions++;
+		result.mostSteps = max(result.mostSteps, model.now());
+
+		if (!finished) {
+			result.failure = model.getFailure();
+		}
+		else {
+			if (modelSawStatus(writerHistories, FIFO_STATUS_PREEMPTED)) result.preempted++;
+
+			StressResult checked = StressChecker(capacity, config.releaseInterval - 1).check(writerHistories, readerHistory);
+			if (checked.errorCount != 0) {
+				result.failure = "wrong result - " + to_string(checked.errorCount) + " error(s)";
+				result.errors = checked.errors;
+			}
+		}
+
+		if (!result.failure.empty()) {
+			result.schedule = model.schedule();
+			result.trace = model.getTrace();
+			return result;
+		}
+
+		if (result.executions >= config.maxExecutions) return result;
+		if (!model.nextExecution()) {
+			result.complete = true;
+			return result;
+		}
+	}
+}
+
+
+typedef ModelResult (*ModelCaseFunction)(const ModelConfig& config, unsigned capacity);
+
+
+// The case function for a fifo, or NULL if the case needs batch functions - push_batch(), pop_try_batch() or
+// producer handles - that its storage hasn't got, or producer handles and it has less room than a chunk
+template <class Queue>
+ModelCaseFunction modelCaseWith(bool batched, bool handles) {
+
+	if (batched && !ModelBatchedFor<Queue>::value) return NULL;
+	if (handles && !StressHandlesFor<Queue, MODEL_HANDLE_CHUNK>::supported) return NULL;
+	return exploreCase<Queue>;
+}
+
+
+template <unsigned capacity, class WaitPolicy, class Storage>
+ModelCaseFunction modelCaseFor(const string& lock, bool batched, bool handles) {
+
+	if (lock == FifoCriticalSectionLock::name()) {
+		return modelCaseWith<Fifo<StressItem, capacity, WaitPolicy, Storage, FifoCriticalSectionLock> >(batched, handles);
+	}
+	if (lock == FifoTtasLock::name()) return modelCaseWith<Fifo<StressItem, capacity, WaitPolicy, Storage, FifoTtasLock> >(batched, handles);
+	if (lock == FifoTicketLock::name()) return modelCaseWith<Fifo<StressItem, capacity, WaitPolicy, Storage, FifoTicketLock> >(batched, handles);
+	return NULL;
+}
+
+
+template <unsigned capacity, class WaitPolicy>
+ModelCaseFunction modelCaseFor(const string& storage, const string& lock, bool batched, bool handles) {
+
+	typedef FifoInlineStorage<StressItem, capacity> Inline;
+	typedef FifoSlabStorage<StressItem, capacity> Slab;
+
+	if (storage == Inline::name()) return modelCaseFor<capacity, WaitPolicy, Inline>(lock, batched, handles);
+	if (storage == Slab::name()) return modelCaseFor<capacity, WaitPolicy, Slab>(lock, batched, handles);
+	return NULL;
+}
+
+
+template <unsigned capacity>
+ModelCaseFunction modelCaseFor(const string& policy, const string& storage, const string& lock, bool batched, bool handles) {
+
+	if (policy == FifoEventWait::name()) return modelCaseFor<capacity, FifoEventWait>(storage, lock, batched, handles);
+	if (policy == FifoAddressWait::name()) return modelCaseFor<capacity, FifoAddressWait>(storage, lock, batched, handles);
+	if (policy == FifoCondVarWait::name()) return modelCaseFor<capacity, FifoCondVarWait>(storage, lock, batched, handles);
+	if (policy == FifoSpinWait::name()) return modelCaseFor<capacity, FifoSpinWait>(storage, lock, batched, handles);
+	if (policy == FifoSpinThenParkWait::name()) return modelCaseFor<capacity, FifoSpinThenParkWait>(storage, lock, batched, handles);
+	if (policy == ModelNaiveWait::name()) return modelCaseFor<capacity, ModelNaiveWait>(storage, lock, batched, handles);
+	return NULL;
+}
+
+
+// The case function for a wait strategy, capacity, storage and lock, or NULL if there's no such thing - or if
+// the case needs what that fifo can't do (see modelCaseWith() above)
+ModelCaseFunction modelCaseFor(const string& policy, unsigned capacity, const string& storage, const string& lock, bool batched,
+	bool handles) {
+
+	switch (capacity) {
+	case 1: return modelCaseFor<1>(policy, storage, lock, batched, handles);
+	case 2: return modelCaseFor<2>(policy, storage, lock, batched, handles);
+	case 3: return modelCaseFor<3>(policy, storage, lock, batched, handles);
+	case 4: return modelCaseFor<4>(policy, storage, lock, batched, handles);
+	default: return NULL;
+	}
+}
+
+
+string modelList(const vector<unsigned>& values) {
+
+	string text;
+	for (size_t i = 0; i < values.size(); i++) text += (i ? "," : "") + to_string(values[i]);
+	return text;
+}
+
+
+// One case - a combination of the values of the options marked "list"
+struct ModelCase {
+	string policy;
+	unsigned capacity;
+	string storage;
+	string lock;
+	unsigned writers;
+	string writer;
+	string reader;
+	unsigned releaseInterval;
+	unsigned releaseFullPercent;
+	unsigned handleWriters;
+};
+
+
+// The values of the list options for a group of cases, as comma-separated lists
+struct ModelCaseLists {
+	const char* policies;
+	const char* capacities;
+	const char* storages;
+	const char* locks;
+	const char* writers;
+	const char* writerKinds;
+	const char* readers;
+	const char* releases;
+	const char* fullPercents;
+	const char* handleWriters;
+};
+
+
+// The default cases (see "Command line options" above). The first group's lists are also the defaults for any
+// list option not given when others are.
+static const ModelCaseLists modelDefaultCases[] = {
+	{ "event,address,condvar,spin,spinpark", "1,2", "inline", "critical_section", "1,2", "push", "pop,poll,mix", "1", "100", "0" },
+	{ "event", "4", "inline", "critical_section", "1,2", "push", "pop,poll,mix", "2", "75,100", "0" },	// Hand-back
+	{ "event", "3,4", "inline", "critical_section", "2", "push", "pop,poll,mix", "2", "75", "1,2" },	// Producer handles
+	{ "event", "1,2", "slab", "critical_section", "2", "push", "pop,poll,mix", "1", "100", "0" },		// Slab
+	{ "event", "2,3", "inline", "critical_section", "1,2", "push,batch", "poll,batch", "1,2", "100", "0" },	// Batches
+	{ "event", "1,2", "inline", "ttas,ticket", "2", "push", "pop,poll,mix", "1", "100", "0" }		// Spinlocks
+};
+
+
+// Adds every combination of the lists' values - or of the options given on the command line, in their place
+void modelAddCases(vector<ModelCase>& cases, const BenchOptions& options, const ModelCaseLists& lists) {
+
+	vector<string> policies = options.getStringList("policy", lists.policies);
+	vector<unsigned> capacities = options.getUnsignedList("capacity", lists.capacities);
+	vector<string> storages = options.getStringList("storage", lists.storages);
+	vector<string> locks = options.getStringList("lock", lists.locks);
+	vector<unsigned> writerCounts = options.getUnsignedList("writers", lists.writers);
+	vector<string> writerKinds = options.getStringList("writer", lists.writerKinds);
+	vector<string> readers = options.getStringList("reader", lists.readers);
+	vector<unsigned> releases = options.getUnsignedList("release", lists.releases);
+	vector<unsigned> fullPercents = options.getUnsignedList("full_percent", lists.fullPercents);
+	vector<unsigned> handleCounts = options.getUnsignedList("handles", lists.handleWriters);
+
+	// Every combination, one index per list - the last list's index moving fastest
+	size_t sizes[] = { policies.size(), capacities.size(), storages.size(), locks.size(), writerCounts.size(), writerKinds.size(),
+		readers.size(), releases.size(), fullPercents.size(), handleCounts.size() };
+	const size_t listCount = sizeof(sizes) / sizeof(sizes[0]);
+	size_t at[listCount] = {};
+
+	for (size_t l = 0; l < listCount; l++) if (sizes[l] == 0) return;
+
+	for (;;) {
+		ModelCase entry = { policies[at[0]], capacities[at[1]], storages[at[2]], locks[at[3]], writerCounts[at[4]], writerKinds[at[5]],
+			readers[at[6]], max(1u, releases[at[7]]), min(100u, fullPercents[at[8]]), handleCounts[at[9]] };
+		cases.push_back(entry);
+
+		size_t l = listCount;
+		while (l > 0 && ++at[l - 1] == sizes[l - 1]) at[--l] = 0;
+		if (l == 0) return;
+	}
+}
+
+
+
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options(argc, argv);
+	BenchFormat format = benchParseFormat(options.getString("format", "text"));
+	BenchReport report;
+
+	static const char* caseOptions[] = { "policy", "capacity", "storage", "lock", "writers", "writer", "reader", "release", "full_percent",
+		"handles" };
+	bool anyCaseOption = false;
+	for (size_t o = 0; o < sizeof(caseOptions) / sizeof(caseOptions[0]); o++) anyCaseOption = anyCaseOption || options.has(caseOptions[o]);
+
+	vector<ModelCase> cases;
+	if (anyCaseOption) modelAddCases(cases, options, modelDefaultCases[0]);
+	else {
+		for (size_t g = 0; g < sizeof(modelDefaultCases) / sizeof(modelDefaultCases[0]); g++) modelAddCases(cases, options, modelDefaultCases[g]);
+	}
+
+	ModelConfig config;
+	config.itemsPerWriter = max(1u, options.getUnsigned("items", 2));
+	config.search = (options.getString("search", "dfs") == "random") ? FIFO_MODEL_SEARCH_RANDOM : FIFO_MODEL_SEARCH_DFS;
+	config.bound = options.getUnsigned("bound", 2);
+	config.seed = options.getUnsigned("seed", 1);
+	config.maxExecutions = options.getUnsigned("executions", config.search == FIFO_MODEL_SEARCH_RANDOM ? 10000 : 1000000);
+	config.replay = options.getUnsignedList("schedule", "");
+	if (options.has("schedule")) config.maxExecutions = 1;
+
+	bool anyFailed = false;
+
+	for (size_t c = 0; c < cases.size(); c++) {
+
+		const ModelCase& entry = cases[c];
+
+		bool batched = (entry.writer == "batch" || entry.reader == "batch");
+		ModelCaseFunction explore = modelCaseFor(entry.policy, entry.capacity, entry.storage, entry.lock, batched, entry.handleWriters != 0);
+		if (explore == NULL) {
+			cerr << "Unknown policy \"" << entry.policy << "\", storage \"" << entry.storage << "\" or lock \"" << entry.lock <<
+				"\", or unsupported capacity " << entry.capacity;
+			if (batched) cerr << " - batches need inline storage";
+			if (entry.handleWriters != 0) cerr << " - producer handles need inline storage and a capacity of at least " << MODEL_HANDLE_CHUNK;
+			cerr << endl;
+			return 2;
+		}
+		config.writers = entry.writers;
+		if (config.writers < 1 || config.writers > MODEL_MAX_WRITERS) {
+			cerr << "Unsupported number of writers " << config.writers << " - use 1 to " << MODEL_MAX_WRITERS << endl;
+			return 2;
+		}
+		config.handleWriters = entry.handleWriters;
+		if (config.handleWriters > config.writers) {
+			cerr << "More writers with producer handles (" << config.handleWriters << ") than writers (" << config.writers << ")" << endl;
+			return 2;
+		}
+		config.writer = (entry.writer == "batch") ? MODEL_WRITER_BATCH : MODEL_WRITER_PUSH;
+		config.reader = (entry.reader == "poll") ? MODEL_READER_POLL : (entry.reader == "mix") ? MODEL_READER_MIX :
+			(entry.reader == "batch") ? MODEL_READER_BATCH : MODEL_READER_POP;
+		config.releaseInterval = entry.releaseInterval;
+		config.releaseFullPercent = entry.releaseFullPercent;
+
+		ModelResult result = explore(config, entry.capacity);
+		bool failed = !result.failure.empty();
+
+		string replay = "policy=" + entry.policy + " capacity=" + to_string(entry.capacity) + " storage=" + entry.storage +
+			" lock=" + entry.lock + " writers=" + to_string(config.writers) + " writer=" + entry.writer + " handles=" + to_string(config.handleWriters) + " items=" + to_string(config.itemsPerWriter) +
+			" reader=" + entry.reader +
+			" release=" + to_string(config.releaseInterval) + " full_percent=" + to_string(config.releaseFullPercent) +
+			" bound=" + to_string(config.bound) + " schedule=" + modelList(result.schedule);
+
+		if (failed) {
+			anyFailed = true;
+			cerr << "FAILED - " << replay << endl;
+			cerr << "  " << result.failure << endl;
+			for (size_t e = 0; e < result.errors.size(); e++) cerr << "  " << result.errors[e] << endl;
+			cerr << "  Trace (thread 0 is the reader, thread w + 1 writer w);" << endl;
+			size_t steps = result.trace.size();
+			for (size_t s = 0; s < steps; s++) {
+				if (steps > MODEL_TRACE_HEAD + MODEL_TRACE_TAIL && s == MODEL_TRACE_HEAD) {
+					cerr << "    ... " << (steps - MODEL_TRACE_HEAD - MODEL_TRACE_TAIL) << " steps not shown" << endl;
+					s = steps - MODEL_TRACE_TAIL;
+				}
+				cerr << "    " << s << "\tthread " << result.trace[s].thread << "\t" << result.trace[s].label << endl;
+			}
+		}
+
+		BenchRecord& record = report.newRecord();
+		record.add("policy", entry.policy);
+		record.add("capacity", entry.capacity);
+		record.add("storage", entry.storage);
+		record.add("lock", entry.lock);
+		record.add("writers", config.writers);
+		record.add("writer", entry.writer);
+		record.add("handles", config.handleWriters);
+		record.add("items", config.itemsPerWriter);
+		record.add("reader", entry.reader);
+		record.add("release", config.releaseInterval);
+		record.add("full_percent", config.releaseFullPercent);
+		record.add("search", config.search == FIFO_MODEL_SEARCH_RANDOM ? "random" : "dfs");
+		record.add("bound", config.bound);
+		record.add("executions", result.executions);
+		record.add("most_steps", result.mostSteps);
+		record.add("preempted", result.preempted);
+		record.add("complete", result.complete ? "yes" : "no");
+		record.add("result", failed ? "fail" : "pass");
+		record.add("replay", failed ? replay : string(""));
+	}
+
+	report.print(cout, format);
+	return anyFailed ? 1 : 0;
+}
@@ -33,8 +33,9 @@
 //  About this file
 //  ===============
 //
-//  This file contains experimental C++ code which has been developed for the purpose of implementing
-//  a thread-safe software fifo template class.
+//  This file, together with header file Fifo.h, contains experimental C++ code which has been developed
+//  for the purpose of implementing a thread-safe software fifo template class. The template class itself
+//  lives in Fifo.h so that it can be shared with the benchmark harness (Fifo_Benchmark_Win.cpp).
 //  This file also contains a main() function which has been developed for the purpose of implementing
 //  a Windows Console App that performs rudimentary testing of an instantiation of the software fifo
 //  template class.
@@ -125,8 +126,14 @@
 //  FIFO_EXAMPLE_MAX_CAPACITY.
 //  It has two associated indices, notably a data insertion index and a data extraction index.
 //  It also has a (volatile) population counter that tracks item insertions (pushes) and extractions (pops).
-//  Accesses are protected from corruption through multi-thread assault by a CRITICAL_SECTION (a mutex).
-//  Inter-thread signalling uses a Windows Event.
+//  Accesses are protected from corruption through multi-thread assault by a CRITICAL_SECTION (a mutex) by
+//  default - see FifoLock.h for the spinlocks that can take its place. Only the writer threads take it; the
+//  reader thread relies on the population alone (see "The reader and the mutex" in Fifo.h).
+//  Inter-thread signalling uses a Windows Event (by default - see FifoWait.h for the alternatives).
+//  Items bigger than FIFO_INLINE_MAX_BYTES (or with their own copy constructors) are held in a side array
+//  ("slab") instead, with the circular buffer holding slab slot numbers, so that they are copied in and out
+//  without holding the mutex (see FifoStorage.h).
+//  Runs of items held inline can be pushed and popped in one go, with a bulk copy (see FifoCopy.h).
 //
 //
 //  Thread priorities
@@ -143,6 +150,9 @@
 //
 //  The data type "T" in the fifo template class may be a simple type or it can be a pointer to something.
 //  Pointers will be appropriate for "large work items (e.g. a struct or vector)" as per the design brief.
+//  A large struct can equally be pushed by value - the fifo then holds it in a slab (see FifoStorage.h), so
+//  the mutex is held no longer than for a pointer - leaving only its lifetime to think about, not two code
+//  paths.
 //
 //  The Windows Console App main() code here uses ints ("Fifo<int> int_test_fifo") for testing, but we could
 //  equally have for example;
@@ -169,6 +179,9 @@
 //  FIFO_STATUS_PREEMPTED - returned by function push(). This "writer" thread failed to push a new item because
 //                          it was pre-empted by another and the FIFO is in fact now stuffed (FIFO_STATUS_FULL).
 //
+//  They are values of a one byte enum class, FifoStatus, and fifoStatusName() gives the name of one for
+//  logging (see Fifo.h).
+//
 //
 //  Building the Windows Console App
 //  ================================
@@ -181,8 +194,17 @@
 //  4. Click on 'OK' (in the bottom-right of the dialog)
 //  5. Copy this entire file (CTRL+A, CTRL+C)
 //  6. In VS2017 replace the contents of file "<project_name>.cpp" with the text copied from this file (CTRL+A, CTRL+V)
-//  7. Select from the Menu bar: Build Tab->Build Solution
-//  8. If there are no build errors, run the Console App from within VS2017 using Debug->Start [Without] Debugging
+//  7. Copy the fifo header files (Fifo.h, FifoStats.h, FifoTrace.h, FifoMetrics.h, FifoWait.h, FifoStorage.h,
+//     FifoCopy.h, FifoCacheLine.h and FifoLock.h) into the project folder and add them to the project using
+//     Project->Add Existing Item
+//  8. Select from the Menu bar: Build Tab->Build Solution
+//  9. If there are no build errors, run the Console App from within VS2017 using Debug->Start [Without] Debugging
+//
+//  The benchmark harness Console App is built in the same way, using Fifo_Benchmark_Win.cpp in place of this
+//  file in step 5 (and adding FifoBench.h, FifoBaselines.h, FifoStress.h, FifoProducer.h and
+//  FifoMetricsExporter.h as well as the fifo header files in step 7). See Fifo_Benchmark_Win.cpp for its
+//  command line options. So is the model checking Console App, using Fifo_ModelCheck_Win.cpp and adding
+//  FifoModel.h, FifoBench.h, FifoStress.h and FifoProducer.h.
 //
 //
 //  Suggestions for more comprehensive multi-threaded testing
@@ -199,6 +221,18 @@
 //  C++11), or other PRNG, and should give generally reproducible results but with some variability caused
 //  by vacillations in the OS.
 //
+//  This is what the benchmark harness Console App (Fifo_Benchmark_Win.cpp) now does - it runs configurable
+//  numbers of writer and reader threads whose request timing is driven by a seeded Mersenne Twister or
+//  Shift-register PRBG, and reports push outcome counts, throughput and latency percentiles. Its
+//  "mode=stress" goes further and checks the results - every item popped exactly once and in each writer's
+//  order, and every FULL, PREEMPTED and EMPTY status one that the fifo could really have been in - and
+//  reports the seed and options that reproduce any failure.
+//
+//  Timing can only make a rare interleaving more likely, never certain. The model checking Console App
+//  (Fifo_ModelCheck_Win.cpp) takes the scheduling of the threads over entirely (see FifoModel.h) and runs
+//  every interleaving of a few small cases, up to a bound on the number of preemptions, so that the
+//  FIFO_STATUS_PREEMPTED race and the reader's sleeping and waking are all exercised deterministically.
+//
 //
 
 
@@ -206,7 +240,7 @@
 #include <iostream>
 
 
-#include <windows.h>		// For the Windows Event
+#include "Fifo.h"		// The software fifo template class
 #include <string>		// For the string class
 
 
@@ -215,198 +249,6 @@ using namespace std;
 
 
 
-#define FIFO_EXAMPLE_MAX_CAPACITY	((unsigned) 5)
-
-#define FIFO_STATUS_SUCCESS		((unsigned) 0)
-#define FIFO_STATUS_FULL		((unsigned) 1)
-#define FIFO_STATUS_EMPTY		((unsigned) 2)
-#define FIFO_STATUS_LOCKED		((unsigned) 3)
-#define FIFO_STATUS_PREEMPTED		((unsigned) 4)
-
-
-string status_Strings[]{
-	"FIFO_STATUS_SUCCESS",
-	"FIFO_STATUS_FULL",
-	"FIFO_STATUS_EMPTY",
-	"FIFO_STATUS_LOCKED",
-	"FIFO_STATUS_PREEMPTED"
-};
-
-
-
-
-template <class T, unsigned capacity = FIFO_EXAMPLE_MAX_CAPACITY>
-class Fifo {
-
-	HANDLE DataAvailableEvent;  // At least one array slot in items[] contains data
-	CRITICAL_SECTION mutex;	    // Critical Section "mutex" protects items[] AND ITS INDEXES from simultaneous multithread assault
-
-private:
-
-	T items[capacity];	    // The FIFO is implemented as a basic array of T - this basic array is called "items"
-
-	unsigned InsertionIndex, ExtractionIndex;  // Array insertion and extraction indices
-
-	volatile unsigned population;  // Current population of items[] array
-
-
-public:
-
-	Fifo() : InsertionIndex(0), ExtractionIndex(0), population(0) {
-
-		// CreateEvent(Security attributes (Null=default), Is a manual-reset event?, Initial state is Signaled?, Name)
-		DataAvailableEvent = CreateEvent(NULL, TRUE, FALSE, TEXT("DataAvailableEvent"));
-
-		InitializeCriticalSection(&mutex);
-	}
-
-
-	~Fifo() {
-
-		CloseHandle(DataAvailableEvent);
-		DeleteCriticalSection(&mutex);
-	}
-
-
-	unsigned push(T item) {
-
-		//	- push
-		//	A "writer thread" calls this function to push an item into the queue.
-		//	If there is no room in the queue for the item, this function should return immediately indicating
-		//	to the calling thread that the item was not pushed to the queue.
-		//
-		//	This function may be called from multiple threads ("writer threads")
-		//
-
-		// If there's no space in the FIFO then return appropriate status code immediately
-		if (population >= capacity) return FIFO_STATUS_FULL;
-
-		// One thread at a time now...
-		// Attempt to acquire the mutex (this thread will continue if it's acquired) or alternatively return
-		// appropriate status code if another thread has it
-		if (TryEnterCriticalSection(&mutex) == 0) return FIFO_STATUS_LOCKED;
-
-		// NOTE - Depending on how the OS does its thread scheduling this will likely be a rare occurrence, but...
-		//
-		// The mutex has been acquired - test again - if another writer thread previously here bumped the poulation to
-		// maximum and thereafter released the mutex so that this thread could then acquire it, did that
-		// writer thread bump the population to maximum AFTER this thread passed the not-full-capacity test above
-		// but BEFORE it could test and acquire the mutex?
-		if (population >= capacity) {
-
-			// Yes it did - the FIFO is in fact full - release the mutex
-			LeaveCriticalSection(&mutex);
-
-			// No space in the FIFO so return appropriate status code immediately
-			return FIFO_STATUS_PREEMPTED;
-		}
-
-		// There's space in the FIFO...
-		// Store the item in the FIFO at the current insertion position
-		items[InsertionIndex] = item;
-		// Bump insertion position and FIFO population
-		InsertionIndex = (InsertionIndex + 1) % capacity;
-		population++;
-
-		// Release the mutex
-		LeaveCriticalSection(&mutex);
-
-		// Set the 'Data Available' Event. This action might release the reader thread if that thread is waiting on it
-		SetEvent(DataAvailableEvent);
-
-		// Return success
-		return FIFO_STATUS_SUCCESS;
-	}
-
-
-	unsigned pop_try(T* itemPtr) {
-
-		//	- pop_try
-		//	The "reader thread" calls this function to fetch the next available item.
-		//	If no items are available the function should return immediately indicating this condition to the
-		//	calling thread.
-		//
-		//	This function is only ever called from a single thread (the "reader thread")
-		//
-
-		// If no items in the FIFO return appropriate status code immediately
-		if (population == 0) return FIFO_STATUS_EMPTY;
-
-		// Data items are available in the FIFO...
-
-		// One thread at a time now...
-		// Wait if necessary until a writer thread has released the mutex
-		EnterCriticalSection(&mutex);
-
-		// Obtain the item at the current extraction position
-		*itemPtr = items[ExtractionIndex];
-		// Bump extraction position and decrement FIFO population
-		ExtractionIndex = (ExtractionIndex + 1) % capacity;
-		population--;
-
-		// Has the action of popping this item rendered the FIFO empty?
-		if (population == 0) {
-
-			// Yes it has - item is no longer available so reset the Event flag
-			ResetEvent(DataAvailableEvent);
-		}
-
-		// Release the mutex
-		LeaveCriticalSection(&mutex);
-
-		// Return success
-		return FIFO_STATUS_SUCCESS;
-	}
-
-
-	void pop(T* itemPtr) {
-
-		//	- pop
-		//	The "reader thread" calls this function to fetch the next available item.
-		//	If no items are available this thread is put to sleep until an item becomes available.
-		//
-		//	This function is only ever called from a single thread (the "reader thread")
-		//
-
-		// If no items are available put this (single reader) thread to sleep until item is available,
-		// i.e, until the DataAvailableEvent is set by a writer thread calling Fifo<T>::push()
-		if (population == 0) WaitForSingleObject(DataAvailableEvent, INFINITE); // indefinite wait
-
-		// If we're here this thread either hasn't waited or alternatively "the sleeper has awakened".
-		// Back to reality, we know that data items are now available in the FIFO...
-
-		// One thread at a time now...
-		// Wait if necessary until a writer thread has released the mutex
-		EnterCriticalSection(&mutex);
-
-		// Obtain the item at the current extraction position
-		*itemPtr = items[ExtractionIndex];
-		// Bump extraction position and decrement FIFO population
-		ExtractionIndex = (ExtractionIndex + 1) % capacity;
-		population--;
-
-		// Has the action of popping this item rendered the FIFO empty?
-		if (population == 0) {
-
-			// Yes it has - item is no longer available so reset the Event flag
-			ResetEvent(DataAvailableEvent);
-		}
-
-		// Release the mutex
-		LeaveCriticalSection(&mutex);
-	}
-
-
-	// This function is only here for testing by main() below - it can be deleted or commented-out
-	// when no longer needed
-	unsigned getPopulation(void) {
-		return population;
-	}
-
-};
-
-
-
 
 int main()
 {
@@ -417,7 +259,7 @@ int main()
 
 	Fifo<int> int_test_fifo;
 	int value = -1;
-	unsigned status;
+	FifoStatus status;
 	unsigned currentPop;
 	unsigned testNum = 0;
 
@@ -433,7 +275,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Trying to pop a value from fifo" << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -445,7 +287,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -457,7 +299,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -470,7 +312,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -482,7 +324,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -494,7 +336,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -506,7 +348,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -518,7 +360,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -530,7 +372,7 @@ int main()
 	cout << endl << "** Test " << testNum << " ** Pushing the value " << value << " onto fifo" << endl;
 	status = int_test_fifo.push(value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -543,7 +385,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -557,7 +399,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -570,7 +412,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -583,7 +425,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -596,7 +438,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 
@@ -609,7 +451,7 @@ int main()
 	cout << "Current value (may be overwritten by forthcoming pop_try) is " << value << endl;
 	status = int_test_fifo.pop_try(&value);
 	// display the status resulting from the operation
-	cout << "Status result of operation was " << status_Strings[status] << endl;
+	cout << "Status result of operation was " << fifoStatusName(status) << endl;
 	cout << "Fifo population after test is " << int_test_fifo.getPopulation() << endl;
 	cout << "Current value is " << value << endl;
 